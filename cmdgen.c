@@ -147,6 +147,8 @@ void help(void)
            "        specify device to read entropy from (e.g. /dev/urandom)\n"
            "  --primes <type>      select prime-generation method:\n"
            "        probable       conventional probabilistic prime finding\n"
+           "        probable-parallel\n"
+           "                       the same, using all available CPUs\n"
            "        proven         numbers that have been proven to be prime\n"
            "        proven-even    also try harder for an even distribution\n"
            "  --strong-rsa         use \"strong\" primes as RSA key factors\n"
@@ -365,6 +367,9 @@ int main(int argc, char **argv)
                         } else if (!strcmp(val, "probable") ||
                                    !strcmp(val, "probabilistic")) {
                             primegen = &primegen_probabilistic;
+                        } else if (!strcmp(val, "probable-parallel") ||
+                                   !strcmp(val, "parallel")) {
+                            primegen = &primegen_probabilistic_parallel;
                         } else if (!strcmp(val, "provable") ||
                                    !strcmp(val, "proven") ||
                                    !strcmp(val, "simple") ||
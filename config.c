@@ -2593,6 +2593,10 @@ void setup_config_box(struct controlbox *b, bool midsession,
                           HELPCTX(ssh_compress),
                           conf_checkbox_handler,
                           I(CONF_compression));
+            ctrl_editbox(s, "Compression level (1-9)", 'l', 20,
+                         HELPCTX(ssh_compress),
+                         conf_editbox_handler,
+                         I(CONF_compression_level), I(-1));
         }
 
         if (!midsession) {
@@ -69,6 +69,7 @@ typedef struct strbuf strbuf;
 typedef struct LoadedFile LoadedFile;
 
 typedef struct RSAKey RSAKey;
+typedef struct RSACrtCache RSACrtCache;
 
 typedef struct BinarySink BinarySink;
 typedef struct BinarySource BinarySource;
@@ -105,10 +106,12 @@ typedef struct MontyContext MontyContext;
 
 typedef struct WeierstrassCurve WeierstrassCurve;
 typedef struct WeierstrassPoint WeierstrassPoint;
+typedef struct WeierstrassComb WeierstrassComb;
 typedef struct MontgomeryCurve MontgomeryCurve;
 typedef struct MontgomeryPoint MontgomeryPoint;
 typedef struct EdwardsCurve EdwardsCurve;
 typedef struct EdwardsPoint EdwardsPoint;
+typedef struct EdwardsComb EdwardsComb;
 
 typedef struct SshServerConfig SshServerConfig;
 typedef struct SftpServer SftpServer;
@@ -144,6 +147,7 @@ typedef struct ssh_cipher ssh_cipher;
 typedef struct ssh2_ciphers ssh2_ciphers;
 typedef struct dh_ctx dh_ctx;
 typedef struct ecdh_key ecdh_key;
+typedef struct WorkerPool WorkerPool;
 
 typedef struct dlgparam dlgparam;
 
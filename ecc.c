@@ -4,6 +4,314 @@
 #include "mpint.h"
 #include "ecc.h"
 
+/*
+ * Fixed-base comb tables (see ecc.h) all have the same number of
+ * teeth. A comb with t teeth keeps a table of 2^t points, and turns
+ * a multiplication by an n-bit integer into n/t doublings and n/t
+ * additions, each preceded by a constant-time scan of the table.
+ */
+#define COMB_TEETH 5
+#define COMB_SIZE (1 << COMB_TEETH)
+
+/*
+ * Extract the comb table index for column 'col' of the integer n,
+ * i.e. the bits at positions col, col+spacing, col+2*spacing, ...
+ */
+static inline unsigned comb_index(mp_int *n, size_t col, size_t spacing)
+{
+    unsigned index = 0;
+    for (unsigned i = 0; i < COMB_TEETH; i++)
+        index |= mp_get_bit(n, col + i * spacing) << i;
+    return index;
+}
+
+/* Return 1 if a == b, else 0, without any data-dependent branching */
+static inline unsigned comb_index_eq(unsigned a, unsigned b)
+{
+    return (unsigned)(((uint64_t)(a ^ b) - 1) >> 63);
+}
+
+/* ----------------------------------------------------------------------
+ * Specialised arithmetic in the field of integers mod 2^255-19, which
+ * is used by both Curve25519 and Ed25519.
+ *
+ * The general-purpose curve code below does all its arithmetic with
+ * mp_ints in Montgomery representation, which has to cope with any
+ * modulus at all. For this one, we can instead represent a field
+ * element as five 51-bit limbs, in which case reduction mod p is
+ * almost free: anything carried out of the top limb is worth 2^255,
+ * which is congruent to 19, so it just gets multiplied by 19 and
+ * added back in at the bottom.
+ *
+ * Limbs are allowed to be a little larger than 2^51 between
+ * operations, so that we only have to propagate carries once per
+ * operation, and only have to reduce fully when converting back to
+ * an mp_int. Every function here is straight-line code with no
+ * data-dependent branches or memory accesses.
+ *
+ * This needs a 64x64->128 bit multiplication, so we only enable it
+ * if the compiler provides a 128-bit integer type. Otherwise the
+ * curves just use the general code.
+ */
+
+typedef struct fe25519 { uint64_t v[5]; } fe25519;
+
+/* An Edwards point in extended coordinates (see EdwardsPoint below) */
+typedef struct ge25519 { fe25519 X, Y, Z, T; } ge25519;
+
+#if defined __SIZEOF_INT128__
+#define HAVE_FE25519 1
+
+#define FE25519_MASK (((uint64_t)1 << 51) - 1)
+
+static inline void fe25519_carry(fe25519 *h)
+{
+    uint64_t c;
+    c = h->v[0] >> 51; h->v[0] &= FE25519_MASK; h->v[1] += c;
+    c = h->v[1] >> 51; h->v[1] &= FE25519_MASK; h->v[2] += c;
+    c = h->v[2] >> 51; h->v[2] &= FE25519_MASK; h->v[3] += c;
+    c = h->v[3] >> 51; h->v[3] &= FE25519_MASK; h->v[4] += c;
+    c = h->v[4] >> 51; h->v[4] &= FE25519_MASK; h->v[0] += 19 * c;
+}
+
+static inline void fe25519_add(fe25519 *h, const fe25519 *f, const fe25519 *g)
+{
+    for (unsigned i = 0; i < 5; i++)
+        h->v[i] = f->v[i] + g->v[i];
+    fe25519_carry(h);
+}
+
+static inline void fe25519_sub(fe25519 *h, const fe25519 *f, const fe25519 *g)
+{
+    /* Add 4p before subtracting, to make sure no limb goes negative */
+    h->v[0] = f->v[0] + 0x1FFFFFFFFFFFB4 - g->v[0];
+    for (unsigned i = 1; i < 5; i++)
+        h->v[i] = f->v[i] + 0x1FFFFFFFFFFFFC - g->v[i];
+    fe25519_carry(h);
+}
+
+/* Propagate the carries out of a five-limb product. */
+static inline void fe25519_carry_wide(fe25519 *h, __uint128_t r0,
+                                      __uint128_t r1, __uint128_t r2,
+                                      __uint128_t r3, __uint128_t r4)
+{
+    r1 += (uint64_t)(r0 >> 51);
+    r2 += (uint64_t)(r1 >> 51);
+    r3 += (uint64_t)(r2 >> 51);
+    r4 += (uint64_t)(r3 >> 51);
+    r0 = ((uint64_t)r0 & FE25519_MASK) + (r4 >> 51) * 19;
+    h->v[0] = (uint64_t)r0 & FE25519_MASK;
+    h->v[1] = ((uint64_t)r1 & FE25519_MASK) + (uint64_t)(r0 >> 51);
+    h->v[2] = (uint64_t)r2 & FE25519_MASK;
+    h->v[3] = (uint64_t)r3 & FE25519_MASK;
+    h->v[4] = (uint64_t)r4 & FE25519_MASK;
+}
+
+static inline void fe25519_mul(fe25519 *h, const fe25519 *f, const fe25519 *g)
+{
+    uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2];
+    uint64_t f3 = f->v[3], f4 = f->v[4];
+    uint64_t g0 = g->v[0], g1 = g->v[1], g2 = g->v[2];
+    uint64_t g3 = g->v[3], g4 = g->v[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2;
+    uint64_t g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+    #define M(a, b) ((__uint128_t)(a) * (b))
+    __uint128_t r0 = M(f0, g0) + M(f1, g4_19) + M(f2, g3_19) +
+        M(f3, g2_19) + M(f4, g1_19);
+    __uint128_t r1 = M(f0, g1) + M(f1, g0) + M(f2, g4_19) +
+        M(f3, g3_19) + M(f4, g2_19);
+    __uint128_t r2 = M(f0, g2) + M(f1, g1) + M(f2, g0) +
+        M(f3, g4_19) + M(f4, g3_19);
+    __uint128_t r3 = M(f0, g3) + M(f1, g2) + M(f2, g1) +
+        M(f3, g0) + M(f4, g4_19);
+    __uint128_t r4 = M(f0, g4) + M(f1, g3) + M(f2, g2) +
+        M(f3, g1) + M(f4, g0);
+    #undef M
+
+    fe25519_carry_wide(h, r0, r1, r2, r3, r4);
+}
+
+static inline void fe25519_sqr(fe25519 *h, const fe25519 *f)
+{
+    /* As fe25519_mul, but collecting the symmetric pairs of terms */
+    uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2];
+    uint64_t f3 = f->v[3], f4 = f->v[4];
+    uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+    uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+    uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+    #define M(a, b) ((__uint128_t)(a) * (b))
+    __uint128_t r0 = M(f0, f0) + M(f1_38, f4) + M(f2_38, f3);
+    __uint128_t r1 = M(f0_2, f1) + M(f2_38, f4) + M(f3_19, f3);
+    __uint128_t r2 = M(f0_2, f2) + M(f1, f1) + M(f3_38, f4);
+    __uint128_t r3 = M(f0_2, f3) + M(f1_2, f2) + M(f4_19, f4);
+    __uint128_t r4 = M(f0_2, f4) + M(f1_2, f3) + M(f2, f2);
+    #undef M
+
+    fe25519_carry_wide(h, r0, r1, r2, r3, r4);
+}
+
+static inline void fe25519_cond_swap(fe25519 *f, fe25519 *g, unsigned swap)
+{
+    uint64_t mask = -(uint64_t)(swap & 1);
+    for (unsigned i = 0; i < 5; i++) {
+        uint64_t t = mask & (f->v[i] ^ g->v[i]);
+        f->v[i] ^= t;
+        g->v[i] ^= t;
+    }
+}
+
+static inline void fe25519_select_into(
+    fe25519 *dest, const fe25519 *src0, const fe25519 *src1, unsigned choose)
+{
+    uint64_t mask = -(uint64_t)(choose & 1);
+    for (unsigned i = 0; i < 5; i++)
+        dest->v[i] = src0->v[i] ^ (mask & (src0->v[i] ^ src1->v[i]));
+}
+
+static void fe25519_from_mp(fe25519 *h, mp_int *x)
+{
+    uint64_t w[4];
+    for (unsigned i = 0; i < 4; i++) {
+        w[i] = 0;
+        for (unsigned j = 0; j < 8; j++)
+            w[i] |= (uint64_t)mp_get_byte(x, 8*i + j) << (8*j);
+    }
+    h->v[0] = w[0] & FE25519_MASK;
+    h->v[1] = ((w[0] >> 51) | (w[1] << 13)) & FE25519_MASK;
+    h->v[2] = ((w[1] >> 38) | (w[2] << 26)) & FE25519_MASK;
+    h->v[3] = ((w[2] >> 25) | (w[3] << 39)) & FE25519_MASK;
+    h->v[4] = (w[3] >> 12) & FE25519_MASK;
+}
+
+static void fe25519_freeze(fe25519 *h)
+{
+    /*
+     * Reduce fully to the range [0,p). After two rounds of carrying,
+     * the value is less than 2p, so we subtract p (by adding 19 and
+     * discarding bit 255) if and only if adding 19 would carry out
+     * of the top limb.
+     */
+    fe25519_carry(h);
+    fe25519_carry(h);
+
+    uint64_t q = (h->v[0] + 19) >> 51;
+    for (unsigned i = 1; i < 5; i++)
+        q = (h->v[i] + q) >> 51;
+    h->v[0] += 19 * q;
+    for (unsigned i = 0; i < 4; i++) {
+        h->v[i+1] += h->v[i] >> 51;
+        h->v[i] &= FE25519_MASK;
+    }
+    h->v[4] &= FE25519_MASK;
+}
+
+static unsigned fe25519_eq(const fe25519 *f, const fe25519 *g)
+{
+    fe25519 ff = *f, gg = *g;
+    fe25519_freeze(&ff);
+    fe25519_freeze(&gg);
+    uint64_t diff = 0;
+    for (unsigned i = 0; i < 5; i++)
+        diff |= ff.v[i] ^ gg.v[i];
+    return 1 & ((diff - 1) >> 63);
+}
+
+static void fe25519_sqr_n(fe25519 *h, const fe25519 *f, unsigned n)
+{
+    fe25519_sqr(h, f);
+    while (--n > 0)
+        fe25519_sqr(h, h);
+}
+
+/* Raise to the power (p-5)/8 = 2^252-3, as needed for square roots */
+static void fe25519_pow22523(fe25519 *h, const fe25519 *z)
+{
+    fe25519 t0, t1, t2;
+
+    fe25519_sqr(&t0, z);                       /* 2 */
+    fe25519_sqr_n(&t1, &t0, 2);                /* 8 */
+    fe25519_mul(&t1, z, &t1);                  /* 9 */
+    fe25519_mul(&t0, &t0, &t1);                /* 11 */
+    fe25519_sqr(&t0, &t0);                     /* 22 */
+    fe25519_mul(&t0, &t1, &t0);                /* 2^5 - 1 */
+    fe25519_sqr_n(&t1, &t0, 5);
+    fe25519_mul(&t0, &t1, &t0);                /* 2^10 - 1 */
+    fe25519_sqr_n(&t1, &t0, 10);
+    fe25519_mul(&t1, &t1, &t0);                /* 2^20 - 1 */
+    fe25519_sqr_n(&t2, &t1, 20);
+    fe25519_mul(&t1, &t2, &t1);                /* 2^40 - 1 */
+    fe25519_sqr_n(&t1, &t1, 10);
+    fe25519_mul(&t0, &t1, &t0);                /* 2^50 - 1 */
+    fe25519_sqr_n(&t1, &t0, 50);
+    fe25519_mul(&t1, &t1, &t0);                /* 2^100 - 1 */
+    fe25519_sqr_n(&t2, &t1, 100);
+    fe25519_mul(&t1, &t2, &t1);                /* 2^200 - 1 */
+    fe25519_sqr_n(&t1, &t1, 50);
+    fe25519_mul(&t0, &t1, &t0);                /* 2^250 - 1 */
+    fe25519_sqr_n(&t0, &t0, 2);                /* 2^252 - 4 */
+    fe25519_mul(h, &t0, z);                    /* 2^252 - 3 */
+}
+
+static mp_int *fe25519_to_mp(const fe25519 *f)
+{
+    fe25519 h = *f;
+    fe25519_freeze(&h);
+
+    uint64_t w[4];
+    w[0] = h.v[0] | (h.v[1] << 51);
+    w[1] = (h.v[1] >> 13) | (h.v[2] << 38);
+    w[2] = (h.v[2] >> 26) | (h.v[3] << 25);
+    w[3] = (h.v[3] >> 39) | (h.v[4] << 12);
+
+    unsigned char bytes[32];
+    for (unsigned i = 0; i < 4; i++)
+        PUT_64BIT_LSB_FIRST(bytes + 8*i, w[i]);
+    mp_int *x = mp_from_bytes_le(make_ptrlen(bytes, 32));
+    smemclr(bytes, sizeof(bytes));
+    smemclr(w, sizeof(w));
+    smemclr(&h, sizeof(h));
+    return x;
+}
+
+/* Convert between fe25519 and the Montgomery representation used by
+ * the rest of this file. */
+static void fe25519_from_monty(fe25519 *h, MontyContext *mc, mp_int *x)
+{
+    mp_int *tmp = monty_export(mc, x);
+    fe25519_from_mp(h, tmp);
+    mp_free(tmp);
+}
+
+static mp_int *fe25519_to_monty(MontyContext *mc, const fe25519 *f)
+{
+    mp_int *tmp = fe25519_to_mp(f);
+    mp_int *x = monty_import(mc, tmp);
+    mp_free(tmp);
+    return x;
+}
+
+#endif /* __SIZEOF_INT128__ */
+
+/* Functions that are only called if use_fe25519 is set in a curve,
+ * which never happens if we don't have HAVE_FE25519 */
+#define STUB_BODY { unreachable("Should never be called"); }
+
+/* Check whether a field modulus is 2^255-19. */
+static bool is_p25519(mp_int *p)
+{
+#ifdef HAVE_FE25519
+    mp_int *p25519 = MP_LITERAL(
+        0x7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed);
+    bool toret = mp_cmp_eq(p, p25519);
+    mp_free(p25519);
+    return toret;
+#else
+    return false;
+#endif
+}
+
 /* ----------------------------------------------------------------------
  * Weierstrass curves.
  */
@@ -468,6 +776,96 @@ WeierstrassPoint *ecc_weierstrass_multiply(WeierstrassPoint *B, mp_int *n)
     return k_B;
 }
 
+struct WeierstrassComb {
+    WeierstrassCurve *wc;
+
+    /* table[j] is the sum of (2^(i*spacing)) B over all the bits i
+     * that are set in j. */
+    size_t spacing;
+    WeierstrassPoint *table[COMB_SIZE];
+};
+
+WeierstrassComb *ecc_weierstrass_comb_new(WeierstrassPoint *B, size_t bits)
+{
+    WeierstrassComb *comb = snew(WeierstrassComb);
+    comb->wc = B->wc;
+    comb->spacing = (bits + COMB_TEETH - 1) / COMB_TEETH;
+
+    /*
+     * Nothing here depends on secret data, so we can build the table
+     * with as little care as we like. But we still use add_general,
+     * because there's no guarantee that two of the sums won't turn
+     * out to be equal or inverse if B has small order.
+     */
+    WeierstrassPoint *teeth[COMB_TEETH];
+    teeth[0] = ecc_weierstrass_point_copy(B);
+    for (unsigned i = 1; i < COMB_TEETH; i++) {
+        teeth[i] = ecc_weierstrass_point_copy(teeth[i-1]);
+        for (size_t k = 0; k < comb->spacing; k++) {
+            WeierstrassPoint *dbl = ecc_weierstrass_double(teeth[i]);
+            ecc_weierstrass_point_free(teeth[i]);
+            teeth[i] = dbl;
+        }
+    }
+
+    comb->table[0] = ecc_weierstrass_point_new_identity(comb->wc);
+    for (unsigned j = 1; j < COMB_SIZE; j++) {
+        unsigned i = 0;
+        while (!(j & (1 << i)))
+            i++;
+        comb->table[j] = ecc_weierstrass_add_general(
+            comb->table[j & ~(1 << i)], teeth[i]);
+    }
+
+    for (unsigned i = 0; i < COMB_TEETH; i++)
+        ecc_weierstrass_point_free(teeth[i]);
+
+    return comb;
+}
+
+void ecc_weierstrass_comb_free(WeierstrassComb *comb)
+{
+    for (unsigned j = 0; j < COMB_SIZE; j++)
+        ecc_weierstrass_point_free(comb->table[j]);
+    smemclr(comb, sizeof(*comb));
+    sfree(comb);
+}
+
+WeierstrassPoint *ecc_weierstrass_comb_multiply(
+    WeierstrassComb *comb, mp_int *n)
+{
+    /* Bits of n above the top of the table would be silently ignored */
+    assert(mp_get_nbits(n) <= comb->spacing * COMB_TEETH);
+
+    WeierstrassPoint *acc = ecc_weierstrass_point_new_identity(comb->wc);
+    WeierstrassPoint *sel = ecc_weierstrass_point_new_identity(comb->wc);
+
+    /*
+     * Work along the columns of n from the top, doubling the
+     * accumulator and adding in whichever table entry corresponds to
+     * the bits in this column. Every entry of the table is read each
+     * time, so that the memory access pattern doesn't give away
+     * which one we wanted; and the addition has to be add_general,
+     * because the accumulator and the table entry are both allowed
+     * to be the identity.
+     */
+    for (size_t col = comb->spacing; col-- > 0 ;) {
+        WeierstrassPoint *dbl = ecc_weierstrass_double(acc);
+        ecc_weierstrass_point_free(acc);
+
+        unsigned index = comb_index(n, col, comb->spacing);
+        for (unsigned j = 0; j < COMB_SIZE; j++)
+            ecc_weierstrass_cond_overwrite(sel, comb->table[j],
+                                           comb_index_eq(j, index));
+
+        acc = ecc_weierstrass_add_general(dbl, sel);
+        ecc_weierstrass_point_free(dbl);
+    }
+
+    ecc_weierstrass_point_free(sel);
+    return acc;
+}
+
 unsigned ecc_weierstrass_is_identity(WeierstrassPoint *wp)
 {
     return mp_eq_integer(wp->Z, 0);
@@ -567,6 +965,11 @@ struct MontgomeryCurve {
 
     /* (a+2)/4, also in Montgomery-multiplication form. */
     mp_int *aplus2over4;
+
+    /* Set if p = 2^255-19, so we can use the fe25519 functions, in
+     * which case we also keep (a+2)/4 in that representation. */
+    bool use_fe25519;
+    fe25519 fe_aplus2over4;
 };
 
 MontgomeryCurve *ecc_montgomery_curve(
@@ -584,6 +987,13 @@ MontgomeryCurve *ecc_montgomery_curve(
     mp_add_integer_into(aplus2, aplus2, 2);
     mp_int *aplus2over4 = mp_modmul(aplus2, fourinverse, mc->p);
     mc->aplus2over4 = monty_import(mc->mc, aplus2over4);
+
+    mc->use_fe25519 = is_p25519(p);
+#ifdef HAVE_FE25519
+    if (mc->use_fe25519)
+        fe25519_from_mp(&mc->fe_aplus2over4, aplus2over4);
+#endif
+
     mp_free(four);
     mp_free(fourinverse);
     mp_free(aplus2);
@@ -763,8 +1173,98 @@ static void ecc_montgomery_normalise(MontgomeryPoint *mp)
     mp_free(zinv);
 }
 
+#ifdef HAVE_FE25519
+
+/*
+ * Version of ecc_montgomery_multiply using fe25519 arithmetic. The
+ * ladder is the same as below, using the same formulae as
+ * ecc_montgomery_diff_add and ecc_montgomery_double, except that here
+ * we start from the identity (X:Z) = (1:0) and B, so there's no need
+ * for special handling of leading zero bits in n.
+ */
+static MontgomeryPoint *ecc_montgomery_multiply_fe25519(
+    MontgomeryPoint *B, mp_int *n)
+{
+    MontgomeryCurve *mc = B->mc;
+    fe25519 xb, zb, x2, z2, x3, z3;
+    fe25519 a, aa, b, bb, e, c, d, da, cb, t;
+
+    fe25519_from_monty(&xb, mc->mc, B->X);
+    fe25519_from_monty(&zb, mc->mc, B->Z);
+    memset(&x2, 0, sizeof(x2));
+    x2.v[0] = 1;
+    memset(&z2, 0, sizeof(z2));
+    x3 = xb;
+    z3 = zb;
+
+    unsigned swap = 0;
+    for (size_t bitindex = mp_max_bits(n); bitindex-- > 0 ;) {
+        unsigned nbit = mp_get_bit(n, bitindex);
+        swap ^= nbit;
+        fe25519_cond_swap(&x2, &x3, swap);
+        fe25519_cond_swap(&z2, &z3, swap);
+        swap = nbit;
+
+        fe25519_add(&a, &x2, &z2);
+        fe25519_sqr(&aa, &a);
+        fe25519_sub(&b, &x2, &z2);
+        fe25519_sqr(&bb, &b);
+        fe25519_sub(&e, &aa, &bb);             /* e = 4 x2 z2 */
+        fe25519_add(&c, &x3, &z3);
+        fe25519_sub(&d, &x3, &z3);
+        fe25519_mul(&da, &d, &a);
+        fe25519_mul(&cb, &c, &b);
+
+        /* (x3:z3) = diff_add((x2:z2), (x3:z3), B) */
+        fe25519_add(&t, &da, &cb);
+        fe25519_sqr(&t, &t);
+        fe25519_mul(&x3, &t, &zb);
+        fe25519_sub(&t, &da, &cb);
+        fe25519_sqr(&t, &t);
+        fe25519_mul(&z3, &t, &xb);
+
+        /* (x2:z2) = double((x2:z2)) */
+        fe25519_mul(&x2, &aa, &bb);
+        fe25519_mul(&t, &e, &mc->fe_aplus2over4);
+        fe25519_add(&t, &t, &bb);
+        fe25519_mul(&z2, &e, &t);
+    }
+    fe25519_cond_swap(&x2, &x3, swap);
+    fe25519_cond_swap(&z2, &z3, swap);
+
+    MontgomeryPoint *toret = ecc_montgomery_point_new_empty(mc);
+    toret->X = fe25519_to_monty(mc->mc, &x2);
+    toret->Z = fe25519_to_monty(mc->mc, &z2);
+
+    smemclr(&x2, sizeof(x2));
+    smemclr(&z2, sizeof(z2));
+    smemclr(&x3, sizeof(x3));
+    smemclr(&z3, sizeof(z3));
+    smemclr(&a, sizeof(a));
+    smemclr(&aa, sizeof(aa));
+    smemclr(&b, sizeof(b));
+    smemclr(&bb, sizeof(bb));
+    smemclr(&e, sizeof(e));
+    smemclr(&c, sizeof(c));
+    smemclr(&d, sizeof(d));
+    smemclr(&da, sizeof(da));
+    smemclr(&cb, sizeof(cb));
+    smemclr(&t, sizeof(t));
+    return toret;
+}
+
+#else
+
+static MontgomeryPoint *ecc_montgomery_multiply_fe25519(
+    MontgomeryPoint *B, mp_int *n) STUB_BODY
+
+#endif
+
 MontgomeryPoint *ecc_montgomery_multiply(MontgomeryPoint *B, mp_int *n)
 {
+    if (B->mc->use_fe25519)
+        return ecc_montgomery_multiply_fe25519(B, n);
+
     /*
      * 'Montgomery ladder' technique, to compute an arbitrary integer
      * multiple of B under the constraint that you can only add two
@@ -868,6 +1368,12 @@ struct EdwardsCurve {
     /* Parameters of the curve, in Montgomery-multiplication
      * transformed form. */
     mp_int *d, *a;
+
+    /* Set if p = 2^255-19 and a = -1, so we can use the fe25519
+     * functions, in which case we also keep 2d in that form. */
+    bool use_fe25519;
+    fe25519 fe_2d;
+    fe25519 fe_d;
 };
 
 EdwardsCurve *ecc_edwards_curve(mp_int *p, mp_int *d, mp_int *a,
@@ -879,6 +1385,22 @@ EdwardsCurve *ecc_edwards_curve(mp_int *p, mp_int *d, mp_int *a,
     ec->d = monty_import(ec->mc, d);
     ec->a = monty_import(ec->mc, a);
 
+    ec->use_fe25519 = false;
+    if (is_p25519(p)) {
+        mp_int *minus1 = mp_copy(p);
+        mp_sub_integer_into(minus1, minus1, 1);
+        ec->use_fe25519 = mp_cmp_eq(a, minus1);
+        mp_free(minus1);
+    }
+#ifdef HAVE_FE25519
+    if (ec->use_fe25519) {
+        mp_int *twod = mp_modadd(d, d, p);
+        fe25519_from_mp(&ec->fe_2d, twod);
+        mp_free(twod);
+        fe25519_from_mp(&ec->fe_d, d);
+    }
+#endif
+
     if (nonsquare_mod_p)
         ec->sc = modsqrt_new(p, nonsquare_mod_p);
     else
@@ -952,11 +1474,74 @@ void ecc_edwards_point_free(EdwardsPoint *ep)
     sfree(ep);
 }
 
+#ifdef HAVE_FE25519
+/*
+ * Version of ecc_edwards_point_new_from_y using fe25519 arithmetic.
+ * Since p = 5 mod 8, we can find the square root of u/v directly
+ * without a separate inversion, as described in RFC 8032 section
+ * 5.1.3: the candidate x = u v^3 (u v^7)^((p-5)/8) satisfies either
+ * v x^2 = u, or v x^2 = -u in which case x sqrt(-1) is the answer.
+ */
+static EdwardsPoint *ecc_edwards_point_new_from_y_fe25519(
+    EdwardsCurve *ec, mp_int *yorig, unsigned desired_x_parity)
+{
+    static const fe25519 zero = {{ 0 }}, one = {{ 1 }};
+    static const fe25519 sqrtm1 = {{
+        0x61b274a0ea0b0, 0xd5a5fc8f189d, 0x7ef5e9cbd0c60,
+        0x78595a6804c9e, 0x2b8324804fc1d }};
+    fe25519 y, u, v, v3, x, t;
+
+    fe25519_from_mp(&y, yorig);
+    fe25519_sqr(&u, &y);
+    fe25519_mul(&v, &u, &ec->fe_d);
+    fe25519_sub(&u, &u, &one);                 /* u = y^2 - 1 */
+    fe25519_add(&v, &v, &one);                 /* v = d y^2 - a */
+
+    fe25519_sqr(&v3, &v);
+    fe25519_mul(&v3, &v3, &v);
+    fe25519_sqr(&x, &v3);
+    fe25519_mul(&x, &x, &v);
+    fe25519_mul(&x, &x, &u);
+    fe25519_pow22523(&x, &x);
+    fe25519_mul(&x, &x, &v3);
+    fe25519_mul(&x, &x, &u);
+
+    fe25519_sqr(&t, &x);
+    fe25519_mul(&t, &t, &v);
+    unsigned root = fe25519_eq(&t, &u);
+    fe25519_sub(&u, &zero, &u);
+    unsigned root_of_minus = fe25519_eq(&t, &u);
+
+    if (!(root | root_of_minus)) {
+        /* As in the generic version, no need to be time-constant */
+        return NULL;
+    }
+
+    fe25519_mul(&t, &x, &sqrtm1);
+    fe25519_select_into(&x, &x, &t, root_of_minus);
+
+    fe25519_freeze(&x);
+    unsigned flip = (x.v[0] ^ desired_x_parity) & 1;
+    fe25519_sub(&t, &zero, &x);
+    fe25519_select_into(&x, &x, &t, flip);
+
+    return ecc_edwards_point_new_imported(
+        ec, fe25519_to_monty(ec->mc, &x), monty_import(ec->mc, yorig));
+}
+#else
+static EdwardsPoint *ecc_edwards_point_new_from_y_fe25519(
+    EdwardsCurve *ec, mp_int *yorig, unsigned desired_x_parity) STUB_BODY
+#endif
+
 EdwardsPoint *ecc_edwards_point_new_from_y(
     EdwardsCurve *ec, mp_int *yorig, unsigned desired_x_parity)
 {
     assert(ec->sc);
 
+    if (ec->use_fe25519)
+        return ecc_edwards_point_new_from_y_fe25519(
+            ec, yorig, desired_x_parity);
+
     /*
      * The curve equation is ax^2 + y^2 = 1 + dx^2y^2, which
      * rearranges to x^2(dy^2-a) = y^2-1. So we compute
@@ -1093,8 +1678,130 @@ static void ecc_edwards_normalise(EdwardsPoint *ep)
     monty_mul_into(ec->mc, ep->T, ep->X, ep->Y);
 }
 
+#ifdef HAVE_FE25519
+
+static void ge25519_from_point(ge25519 *r, EdwardsPoint *P)
+{
+    MontyContext *mc = P->ec->mc;
+    fe25519_from_monty(&r->X, mc, P->X);
+    fe25519_from_monty(&r->Y, mc, P->Y);
+    fe25519_from_monty(&r->Z, mc, P->Z);
+    fe25519_from_monty(&r->T, mc, P->T);
+}
+
+static EdwardsPoint *ge25519_to_point(EdwardsCurve *ec, const ge25519 *r)
+{
+    EdwardsPoint *P = ecc_edwards_point_new_empty(ec);
+    P->X = fe25519_to_monty(ec->mc, &r->X);
+    P->Y = fe25519_to_monty(ec->mc, &r->Y);
+    P->Z = fe25519_to_monty(ec->mc, &r->Z);
+    P->T = fe25519_to_monty(ec->mc, &r->T);
+    return P;
+}
+
+static void ge25519_identity(ge25519 *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->Y.v[0] = r->Z.v[0] = 1;
+}
+
+static void ge25519_select_into(ge25519 *dest, const ge25519 *src0,
+                                const ge25519 *src1, unsigned choose)
+{
+    fe25519_select_into(&dest->X, &src0->X, &src1->X, choose);
+    fe25519_select_into(&dest->Y, &src0->Y, &src1->Y, choose);
+    fe25519_select_into(&dest->Z, &src0->Z, &src1->Z, choose);
+    fe25519_select_into(&dest->T, &src0->T, &src1->T, choose);
+}
+
+/*
+ * Addition and doubling for a = -1, listed as 'add-2008-hwcd-3' and
+ * 'dbl-2008-hwcd' in
+ * https://hyperelliptic.org/EFD/g1p/auto-twisted-extended-1.html
+ *
+ * The addition formula is complete, as is the one in ecc_edwards_add
+ * (which it agrees with up to projective scaling).
+ */
+static void ge25519_add(ge25519 *r, const ge25519 *P, const ge25519 *Q,
+                        const fe25519 *twod)
+{
+    fe25519 a, b, c, d, e, f, g, h, t;
+
+    fe25519_sub(&a, &P->Y, &P->X);
+    fe25519_sub(&t, &Q->Y, &Q->X);
+    fe25519_mul(&a, &a, &t);
+    fe25519_add(&b, &P->Y, &P->X);
+    fe25519_add(&t, &Q->Y, &Q->X);
+    fe25519_mul(&b, &b, &t);
+    fe25519_mul(&c, &P->T, &Q->T);
+    fe25519_mul(&c, &c, twod);
+    fe25519_mul(&d, &P->Z, &Q->Z);
+    fe25519_add(&d, &d, &d);
+    fe25519_sub(&e, &b, &a);
+    fe25519_sub(&f, &d, &c);
+    fe25519_add(&g, &d, &c);
+    fe25519_add(&h, &b, &a);
+    fe25519_mul(&r->X, &e, &f);
+    fe25519_mul(&r->Y, &g, &h);
+    fe25519_mul(&r->T, &e, &h);
+    fe25519_mul(&r->Z, &f, &g);
+}
+
+static void ge25519_double(ge25519 *r, const ge25519 *P)
+{
+    fe25519 a, b, c, e, f, g, h;
+
+    fe25519_sqr(&a, &P->X);
+    fe25519_sqr(&b, &P->Y);
+    fe25519_sqr(&c, &P->Z);
+    fe25519_add(&c, &c, &c);
+    fe25519_add(&h, &a, &b);
+    fe25519_add(&e, &P->X, &P->Y);
+    fe25519_sqr(&e, &e);
+    fe25519_sub(&e, &h, &e);
+    fe25519_sub(&g, &a, &b);
+    fe25519_add(&f, &c, &g);
+    fe25519_mul(&r->X, &e, &f);
+    fe25519_mul(&r->Y, &g, &h);
+    fe25519_mul(&r->T, &e, &h);
+    fe25519_mul(&r->Z, &f, &g);
+}
+
+/* Version of ecc_edwards_multiply using fe25519 arithmetic. */
+static EdwardsPoint *ecc_edwards_multiply_fe25519(EdwardsPoint *B, mp_int *n)
+{
+    EdwardsCurve *ec = B->ec;
+    ge25519 b, acc, sum;
+
+    ge25519_from_point(&b, B);
+    ge25519_identity(&acc);
+
+    /* Double and always add, keeping the sum only if the bit is set */
+    for (size_t bitindex = mp_max_bits(n); bitindex-- > 0 ;) {
+        ge25519_double(&acc, &acc);
+        ge25519_add(&sum, &acc, &b, &ec->fe_2d);
+        ge25519_select_into(&acc, &acc, &sum, mp_get_bit(n, bitindex));
+    }
+
+    EdwardsPoint *toret = ge25519_to_point(ec, &acc);
+    smemclr(&acc, sizeof(acc));
+    smemclr(&sum, sizeof(sum));
+    return toret;
+}
+
+#else
+
+static void ge25519_from_point(ge25519 *r, EdwardsPoint *P) STUB_BODY
+static EdwardsPoint *ecc_edwards_multiply_fe25519(
+    EdwardsPoint *B, mp_int *n) STUB_BODY
+
+#endif
+
 EdwardsPoint *ecc_edwards_multiply(EdwardsPoint *B, mp_int *n)
 {
+    if (B->ec->use_fe25519)
+        return ecc_edwards_multiply_fe25519(B, n);
+
     EdwardsPoint *two_B = ecc_edwards_add(B, B);
     EdwardsPoint *k_B = ecc_edwards_point_copy(B);
     EdwardsPoint *kplus1_B = ecc_edwards_point_copy(two_B);
@@ -1129,6 +1836,255 @@ EdwardsPoint *ecc_edwards_multiply(EdwardsPoint *B, mp_int *n)
     return k_B;
 }
 
+static EdwardsPoint *ecc_edwards_point_new_identity(EdwardsCurve *ec)
+{
+    EdwardsPoint *ep = ecc_edwards_point_new_empty(ec);
+    size_t bits = mp_max_bits(ec->p);
+    ep->X = mp_new(bits);
+    ep->Y = mp_copy(monty_identity(ec->mc));
+    ep->Z = mp_copy(monty_identity(ec->mc));
+    ep->T = mp_new(bits);
+    return ep;
+}
+
+struct EdwardsComb {
+    EdwardsCurve *ec;
+
+    /* Same layout as WeierstrassComb */
+    size_t spacing;
+    EdwardsPoint *table[COMB_SIZE];
+
+    /* If the curve uses fe25519, a copy of the table in that form */
+    ge25519 *fe_table;
+};
+
+EdwardsComb *ecc_edwards_comb_new(EdwardsPoint *B, size_t bits)
+{
+    EdwardsComb *comb = snew(EdwardsComb);
+    comb->ec = B->ec;
+    comb->spacing = (bits + COMB_TEETH - 1) / COMB_TEETH;
+
+    EdwardsPoint *teeth[COMB_TEETH];
+    teeth[0] = ecc_edwards_point_copy(B);
+    for (unsigned i = 1; i < COMB_TEETH; i++) {
+        teeth[i] = ecc_edwards_point_copy(teeth[i-1]);
+        for (size_t k = 0; k < comb->spacing; k++) {
+            EdwardsPoint *dbl = ecc_edwards_add(teeth[i], teeth[i]);
+            ecc_edwards_point_free(teeth[i]);
+            teeth[i] = dbl;
+        }
+    }
+
+    comb->table[0] = ecc_edwards_point_new_identity(comb->ec);
+    for (unsigned j = 1; j < COMB_SIZE; j++) {
+        unsigned i = 0;
+        while (!(j & (1 << i)))
+            i++;
+        comb->table[j] = ecc_edwards_add(comb->table[j & ~(1 << i)],
+                                         teeth[i]);
+    }
+
+    for (unsigned i = 0; i < COMB_TEETH; i++)
+        ecc_edwards_point_free(teeth[i]);
+
+    comb->fe_table = NULL;
+    if (comb->ec->use_fe25519) {
+        comb->fe_table = snewn(COMB_SIZE, ge25519);
+        for (unsigned j = 0; j < COMB_SIZE; j++)
+            ge25519_from_point(&comb->fe_table[j], comb->table[j]);
+    }
+
+    return comb;
+}
+
+void ecc_edwards_comb_free(EdwardsComb *comb)
+{
+    for (unsigned j = 0; j < COMB_SIZE; j++)
+        ecc_edwards_point_free(comb->table[j]);
+    if (comb->fe_table) {
+        smemclr(comb->fe_table, COMB_SIZE * sizeof(*comb->fe_table));
+        sfree(comb->fe_table);
+    }
+    smemclr(comb, sizeof(*comb));
+    sfree(comb);
+}
+
+#ifdef HAVE_FE25519
+static EdwardsPoint *ecc_edwards_comb_multiply_fe25519(
+    EdwardsComb *comb, mp_int *n)
+{
+    ge25519 acc, sel;
+    ge25519_identity(&acc);
+    ge25519_identity(&sel);
+
+    for (size_t col = comb->spacing; col-- > 0 ;) {
+        ge25519_double(&acc, &acc);
+
+        unsigned index = comb_index(n, col, comb->spacing);
+        for (unsigned j = 0; j < COMB_SIZE; j++)
+            ge25519_select_into(&sel, &sel, &comb->fe_table[j],
+                                comb_index_eq(j, index));
+
+        ge25519_add(&acc, &acc, &sel, &comb->ec->fe_2d);
+    }
+
+    EdwardsPoint *toret = ge25519_to_point(comb->ec, &acc);
+    smemclr(&acc, sizeof(acc));
+    smemclr(&sel, sizeof(sel));
+    return toret;
+}
+#else
+static EdwardsPoint *ecc_edwards_comb_multiply_fe25519(
+    EdwardsComb *comb, mp_int *n) STUB_BODY
+#endif
+
+EdwardsPoint *ecc_edwards_comb_multiply(EdwardsComb *comb, mp_int *n)
+{
+    /* Bits of n above the top of the table would be silently ignored */
+    assert(mp_get_nbits(n) <= comb->spacing * COMB_TEETH);
+
+    if (comb->fe_table)
+        return ecc_edwards_comb_multiply_fe25519(comb, n);
+
+    EdwardsPoint *acc = ecc_edwards_point_new_identity(comb->ec);
+    EdwardsPoint *sel = ecc_edwards_point_new_identity(comb->ec);
+
+    /* As in ecc_weierstrass_comb_multiply, except that the Edwards
+     * addition law copes with the identity without special help. */
+    for (size_t col = comb->spacing; col-- > 0 ;) {
+        EdwardsPoint *dbl = ecc_edwards_add(acc, acc);
+        ecc_edwards_point_free(acc);
+
+        unsigned index = comb_index(n, col, comb->spacing);
+        for (unsigned j = 0; j < COMB_SIZE; j++)
+            ecc_edwards_cond_overwrite(sel, comb->table[j],
+                                       comb_index_eq(j, index));
+
+        acc = ecc_edwards_add(dbl, sel);
+        ecc_edwards_point_free(dbl);
+    }
+
+    ecc_edwards_point_free(sel);
+    return acc;
+}
+
+/*
+ * Multi-scalar multiplication, by the interleaved fixed-window
+ * method: each point gets a table of its first few multiples, and
+ * then a single run of doublings serves all the terms at once, with
+ * one table lookup and addition per term per window.
+ *
+ * This is the one piece of this module that is NOT constant-time:
+ * both the number of windows and the table lookups depend on the
+ * scalars. It's only intended for signature verification, where
+ * every input is public.
+ */
+#define MULTISCALAR_WINDOW 4
+#define MULTISCALAR_SIZE (1 << MULTISCALAR_WINDOW)
+
+static size_t multiscalar_nwindows(mp_int **scalars, size_t n)
+{
+    size_t nwindows = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t w = ((mp_get_nbits(scalars[i]) + MULTISCALAR_WINDOW - 1) /
+                    MULTISCALAR_WINDOW);
+        if (nwindows < w)
+            nwindows = w;
+    }
+    return nwindows;
+}
+
+static unsigned multiscalar_digit(mp_int *x, size_t window)
+{
+    unsigned digit = 0;
+    for (unsigned b = MULTISCALAR_WINDOW; b-- > 0 ;)
+        digit = (digit << 1) | mp_get_bit(x, window * MULTISCALAR_WINDOW + b);
+    return digit;
+}
+
+#ifdef HAVE_FE25519
+static EdwardsPoint *ecc_edwards_multiscalar_fe25519(
+    EdwardsPoint **points, mp_int **scalars, size_t n)
+{
+    EdwardsCurve *ec = points[0]->ec;
+    ge25519 *table = snewn(n * MULTISCALAR_SIZE, ge25519);
+
+    for (size_t i = 0; i < n; i++) {
+        ge25519 *t = table + i * MULTISCALAR_SIZE;
+        ge25519_identity(&t[0]);
+        ge25519_from_point(&t[1], points[i]);
+        for (unsigned k = 2; k < MULTISCALAR_SIZE; k++)
+            ge25519_add(&t[k], &t[k-1], &t[1], &ec->fe_2d);
+    }
+
+    ge25519 acc;
+    ge25519_identity(&acc);
+    for (size_t w = multiscalar_nwindows(scalars, n); w-- > 0 ;) {
+        for (unsigned b = 0; b < MULTISCALAR_WINDOW; b++)
+            ge25519_double(&acc, &acc);
+        for (size_t i = 0; i < n; i++) {
+            unsigned digit = multiscalar_digit(scalars[i], w);
+            if (digit)
+                ge25519_add(&acc, &acc, &table[i * MULTISCALAR_SIZE + digit],
+                            &ec->fe_2d);
+        }
+    }
+
+    sfree(table);
+    return ge25519_to_point(ec, &acc);
+}
+#else
+static EdwardsPoint *ecc_edwards_multiscalar_fe25519(
+    EdwardsPoint **points, mp_int **scalars, size_t n) STUB_BODY
+#endif
+
+EdwardsPoint *ecc_edwards_multiscalar(
+    EdwardsPoint **points, mp_int **scalars, size_t n)
+{
+    assert(n > 0);
+    EdwardsCurve *ec = points[0]->ec;
+    for (size_t i = 1; i < n; i++)
+        assert(points[i]->ec == ec);
+
+    if (ec->use_fe25519)
+        return ecc_edwards_multiscalar_fe25519(points, scalars, n);
+
+    /* Entry 0 of each point's table is never looked at, because a
+     * zero digit just skips the addition. */
+    EdwardsPoint **table = snewn(n * MULTISCALAR_SIZE, EdwardsPoint *);
+    for (size_t i = 0; i < n; i++) {
+        EdwardsPoint **t = table + i * MULTISCALAR_SIZE;
+        t[0] = NULL;
+        t[1] = ecc_edwards_point_copy(points[i]);
+        for (unsigned k = 2; k < MULTISCALAR_SIZE; k++)
+            t[k] = ecc_edwards_add(t[k-1], t[1]);
+    }
+
+    EdwardsPoint *acc = ecc_edwards_point_new_identity(ec);
+    for (size_t w = multiscalar_nwindows(scalars, n); w-- > 0 ;) {
+        for (unsigned b = 0; b < MULTISCALAR_WINDOW; b++) {
+            EdwardsPoint *dbl = ecc_edwards_add(acc, acc);
+            ecc_edwards_point_free(acc);
+            acc = dbl;
+        }
+        for (size_t i = 0; i < n; i++) {
+            unsigned digit = multiscalar_digit(scalars[i], w);
+            if (digit) {
+                EdwardsPoint *sum = ecc_edwards_add(
+                    acc, table[i * MULTISCALAR_SIZE + digit]);
+                ecc_edwards_point_free(acc);
+                acc = sum;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+        for (unsigned k = 1; k < MULTISCALAR_SIZE; k++)
+            ecc_edwards_point_free(table[i * MULTISCALAR_SIZE + k]);
+    sfree(table);
+    return acc;
+}
+
 /*
  * Helper routine to determine whether two values each given as a pair
  * of projective coordinates represent the same affine value.
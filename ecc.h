@@ -96,6 +96,21 @@ WeierstrassPoint *ecc_weierstrass_double(WeierstrassPoint *);
  */
 WeierstrassPoint *ecc_weierstrass_multiply(WeierstrassPoint *, mp_int *);
 
+/*
+ * Precomputed 'comb' table for multiplying one fixed point (typically
+ * a curve's base point) by many different integers, which is much
+ * faster than ecc_weierstrass_multiply. 'bits' is the size of the
+ * largest integer the table will be asked to multiply by; passing
+ * comb_multiply a wider integer than that is an assertion failure.
+ *
+ * Unlike ecc_weierstrass_multiply, comb_multiply copes with the
+ * identity turning up along the way, so the integer doesn't have to
+ * be less than the order of the point.
+ */
+WeierstrassComb *ecc_weierstrass_comb_new(WeierstrassPoint *, size_t bits);
+void ecc_weierstrass_comb_free(WeierstrassComb *);
+WeierstrassPoint *ecc_weierstrass_comb_multiply(WeierstrassComb *, mp_int *);
+
 /*
  * Query functions to get the value of a point back out. is_identity
  * tells you whether the point is the identity; if it isn't, then
@@ -233,6 +248,21 @@ void ecc_edwards_point_free(EdwardsPoint *point);
 EdwardsPoint *ecc_edwards_add(EdwardsPoint *, EdwardsPoint *);
 EdwardsPoint *ecc_edwards_multiply(EdwardsPoint *, mp_int *);
 
+/* Fixed-base comb tables, as for Weierstrass curves. */
+EdwardsComb *ecc_edwards_comb_new(EdwardsPoint *, size_t bits);
+void ecc_edwards_comb_free(EdwardsComb *);
+EdwardsPoint *ecc_edwards_comb_multiply(EdwardsComb *, mp_int *);
+
+/*
+ * Multi-scalar multiplication: return the sum of scalars[i] *
+ * points[i] over 0 <= i < n, which must be at least 1. This is much
+ * faster than doing the multiplications one by one, but it is NOT
+ * constant-time, so it must only be used on public data (e.g. for
+ * verifying signatures).
+ */
+EdwardsPoint *ecc_edwards_multiscalar(
+    EdwardsPoint **points, mp_int **scalars, size_t n);
+
 /*
  * Query functions: compare two points for equality, and return the
  * affine coordinates of a point.
@@ -175,12 +175,27 @@ static struct mr_result miller_rabin_test_inner(MillerRabin *mr, mp_int *w)
     return result;
 }
 
+mp_int *miller_rabin_random_witness(MillerRabin *mr)
+{
+    /*
+     * We use the random number directly as the Montgomery
+     * representation of the witness, which saves an import and is
+     * just as random.
+     */
+    return mp_random_in_range(mr->two, mr->pm1);
+}
+
+bool miller_rabin_test_witness(MillerRabin *mr, mp_int *mw)
+{
+    return miller_rabin_test_inner(mr, mw).passed;
+}
+
 bool miller_rabin_test_random(MillerRabin *mr)
 {
-    mp_int *mw = mp_random_in_range(mr->two, mr->pm1);
-    struct mr_result result = miller_rabin_test_inner(mr, mw);
+    mp_int *mw = miller_rabin_random_witness(mr);
+    bool passed = miller_rabin_test_witness(mr, mw);
     mp_free(mw);
-    return result.passed;
+    return passed;
 }
 
 mp_int *miller_rabin_find_potential_primitive_root(MillerRabin *mr)
@@ -1431,6 +1431,10 @@ if (defined $makefiles{'gtk'}) {
                  " -D _FILE_OFFSET_BITS=64\n".
     "XLDFLAGS = \$(LDFLAGS) \$(shell \$(GTK_CONFIG) --libs)\n".
     "ULDFLAGS = \$(LDFLAGS)\n".
+    "ifeq (,\$(findstring NO_THREADS,\$(COMPAT)))\n".
+    "XLDFLAGS+= -lpthread\n".
+    "ULDFLAGS+= -lpthread\n".
+    "endif\n".
     "ifeq (,\$(findstring NO_GSSAPI,\$(COMPAT)))\n".
     "ifeq (,\$(findstring STATIC_GSSAPI,\$(COMPAT)))\n".
     "XLDFLAGS+= -ldl\n".
@@ -1510,6 +1514,9 @@ if (defined $makefiles{'unix'}) {
                (join " ", map {"-I$dirpfx$_"} @srcdirs)).
                  " -D _FILE_OFFSET_BITS=64\n".
     "ULDFLAGS = \$(LDFLAGS)\n".
+    "ifeq (,\$(findstring NO_THREADS,\$(COMPAT)))\n".
+    "ULDFLAGS+= -lpthread\n".
+    "endif\n".
     "INSTALL=install\n".
     "INSTALL_PROGRAM=\$(INSTALL)\n".
     "INSTALL_DATA=\$(INSTALL)\n".
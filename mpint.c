@@ -957,8 +957,59 @@ static void mp_mul_add_simple(mp_int *r, mp_int *a, mp_int *b)
     }
 }
 
+/*
+ * Internal routine: square in the trivial O(N^2) way, but computing
+ * each cross term a_i a_j only once and doubling them all at the end,
+ * which saves nearly half the multiplications. Unlike
+ * mp_mul_add_simple, this expects r to be zero on entry, and sets
+ * r <- a^2.
+ */
+static void mp_sqr_simple(mp_int *r, mp_int *a)
+{
+    size_t an = a->nw, rn = r->nw;
+
+    /*
+     * Cross terms. Row i adds a_i * a_j (j > i) at position i+j, and
+     * its final carry goes at position i+an, which no earlier row
+     * has reached yet, so it can be stored rather than added.
+     */
+    for (size_t i = 0; i < an && 2*i+1 < rn; i++) {
+        BignumInt adata = a->w[i], carry = 0;
+        size_t k = 2*i+1;
+        for (size_t j = i+1; j < an && k < rn; j++, k++)
+            BignumMULADD2(carry, r->w[k], adata, a->w[j], r->w[k], carry);
+        if (k < rn)
+            r->w[k] = carry;
+    }
+
+    /* Double them */
+    BignumInt carry = 0;
+    for (size_t k = 0; k < rn; k++) {
+        BignumInt word = r->w[k];
+        r->w[k] = (word << 1) | carry;
+        carry = word >> (BIGNUM_INT_BITS - 1);
+    }
+
+    /* Add the diagonal terms a_i^2 at position 2i */
+    carry = 0;
+    for (size_t i = 0; i < an && 2*i < rn; i++) {
+        BignumInt hi;
+        BignumMULADD2(hi, r->w[2*i], a->w[i], a->w[i], r->w[2*i], carry);
+        if (2*i+1 < rn)
+            BignumADC(r->w[2*i+1], carry, r->w[2*i+1], hi, 0);
+    }
+}
+
+/*
+ * Sizes (in words) below which we don't bother with Karatsuba, for
+ * multiplication and squaring respectively. test/cryptbench.py can
+ * measure the effect of changing these.
+ */
 #ifndef KARATSUBA_THRESHOLD      /* allow redefinition via -D for testing */
-#define KARATSUBA_THRESHOLD 24
+#define KARATSUBA_THRESHOLD 48
+#endif
+#ifndef KARATSUBA_SQR_THRESHOLD
+#define KARATSUBA_SQR_THRESHOLD 64
 #endif
 
 static inline size_t mp_mul_scratchspace_unary(size_t n)
@@ -997,11 +1048,19 @@ static size_t mp_mul_scratchspace(size_t rw, size_t aw, size_t bw)
     return mp_mul_scratchspace_unary(inlen);
 }
 
+static void mp_sqr_internal(mp_int *r, mp_int *a, mp_int scratch);
+
 static void mp_mul_internal(mp_int *r, mp_int *a, mp_int *b, mp_int scratch)
 {
     size_t inlen = size_t_min(r->nw, size_t_max(a->nw, b->nw));
     assert(scratch.nw >= mp_mul_scratchspace_unary(inlen));
 
+    if (a->w == b->w && a->nw == b->nw) {
+        /* Multiplying a number by itself, which we can do faster. */
+        mp_sqr_internal(r, a, scratch);
+        return;
+    }
+
     mp_clear(r);
 
     if (inlen < KARATSUBA_THRESHOLD || a->nw == 0 || b->nw == 0) {
@@ -1101,6 +1160,63 @@ static void mp_mul_internal(mp_int *r, mp_int *a, mp_int *b, mp_int scratch)
     mp_add_into(&r1, &r1, &product);
 }
 
+/*
+ * Squaring version of mp_mul_internal: the same Karatsuba recursion,
+ * except that all three half-size products are themselves squares.
+ */
+static void mp_sqr_internal(mp_int *r, mp_int *a, mp_int scratch)
+{
+    size_t inlen = size_t_min(r->nw, a->nw);
+    assert(scratch.nw >= mp_mul_scratchspace_unary(inlen));
+
+    mp_clear(r);
+
+    if (inlen < KARATSUBA_SQR_THRESHOLD || a->nw == 0) {
+        mp_sqr_simple(r, a);
+        return;
+    }
+
+    /*
+     * With a = a_1 D + a_0, we have
+     *
+     *   a^2 = a_1^2 D^2 + ((a_1 + a_0)^2 - a_1^2 - a_0^2) D + a_0^2
+     */
+    size_t toplen = inlen / 2;
+    size_t botlen = inlen - toplen;
+
+    mp_int a0 = mp_make_alias(a, 0, botlen);
+    mp_int a1 = mp_make_alias(a, botlen, toplen);
+    mp_int r0 = mp_make_alias(r, 0, botlen*2);
+    mp_int r1 = mp_make_alias(r, botlen, r->nw);
+    mp_int r2 = mp_make_alias(r, botlen*2, r->nw);
+
+    mp_sqr_internal(&r0, &a0, scratch);
+    mp_sqr_internal(&r2, &a1, scratch);
+
+    if (r->nw < inlen*2) {
+        /* Truncated output: as in mp_mul_internal, just add in the
+         * cross term a_0 a_1 twice. */
+        mp_int s = mp_alloc_from_scratch(
+            &scratch, size_t_min(botlen+toplen, r1.nw));
+
+        mp_mul_internal(&s, &a0, &a1, scratch);
+        mp_add_into(&r1, &r1, &s);
+        mp_add_into(&r1, &r1, &s);
+        return;
+    }
+
+    mp_int asum = mp_alloc_from_scratch(&scratch, botlen+1);
+    mp_add_into(&asum, &a0, &a1);
+
+    mp_int product = mp_alloc_from_scratch(&scratch, botlen*2+1);
+    mp_sqr_internal(&product, &asum, scratch);
+
+    mp_sub_into(&product, &product, &r0);
+    mp_sub_into(&product, &product, &r2);
+
+    mp_add_into(&r1, &r1, &product);
+}
+
 void mp_mul_into(mp_int *r, mp_int *a, mp_int *b)
 {
     mp_int *scratch = mp_make_sized(mp_mul_scratchspace(r->nw, a->nw, b->nw));
@@ -1466,7 +1582,7 @@ void monty_mul_into(MontyContext *mc, mp_int *r, mp_int *x, mp_int *y)
 
     mp_int scratch = *mc->scratch;
     mp_int tmp = mp_alloc_from_scratch(&scratch, 2*mc->rw);
-    mp_mul_into(&tmp, x, y);
+    mp_mul_internal(&tmp, x, y, scratch);
     mp_int reduced = monty_reduce_internal(mc, &tmp, scratch);
     mp_copy_into(r, &reduced);
     mp_clear(mc->scratch);
@@ -1535,42 +1651,73 @@ mp_int *monty_export(MontyContext *mc, mp_int *x)
     return toret;
 }
 
-static void monty_reduce(MontyContext *mc, mp_int *x)
+/*
+ * Choose the window size for monty_pow, given the size of the
+ * exponent. Each window costs a multiplication and a scan of the
+ * table, and the table costs 2^w multiplications to set up, so we
+ * want the w minimising (bits/w + 2^w).
+ */
+#define MONTY_POW_MAX_WINDOW 7
+static unsigned monty_pow_window(size_t bits)
 {
-    mp_int reduced = monty_reduce_internal(mc, x, *mc->scratch);
-    mp_copy_into(x, &reduced);
-    mp_clear(mc->scratch);
+    unsigned w = 1;
+    while (w < MONTY_POW_MAX_WINDOW &&
+           bits / (w+1) + ((size_t)2 << w) < bits / w + ((size_t)1 << w))
+        w++;
+    return w;
 }
 
 mp_int *monty_pow(MontyContext *mc, mp_int *base, mp_int *exponent)
 {
-    /* square builds up powers of the form base^{2^i}. */
-    mp_int *square = mp_copy(base);
-    size_t i = 0;
+    /*
+     * Fixed-window exponentiation. We precompute base^k for all
+     * 0 <= k < 2^w, and then go through the exponent w bits at a
+     * time from the top, squaring w times and then multiplying in
+     * the table entry indexed by the next w bits.
+     *
+     * To avoid leaking the exponent, every window is processed in
+     * exactly the same way (even a window of all zero bits still
+     * multiplies by table[0] = 1), and the table entry is retrieved
+     * by scanning the whole table and using mp_select_into to keep
+     * only the one we want.
+     */
+    size_t bits = exponent->nw * BIGNUM_INT_BITS;
+    unsigned w = monty_pow_window(bits);
+    size_t tablesize = (size_t)1 << w;
+
+    mp_int **table = snewn(tablesize, mp_int *);
+    table[0] = mp_copy(mc->powers_of_r_mod_m[0]);
+    table[1] = mp_make_sized(mc->rw);
+    mp_copy_into(table[1], base);
+    for (size_t k = 2; k < tablesize; k++)
+        table[k] = monty_mul(mc, table[k-1], table[1]);
 
     /* out accumulates the output value. Starts at 1 (in Montgomery
-     * representation) and we multiply in each base^{2^i}. */
+     * representation). */
     mp_int *out = mp_copy(mc->powers_of_r_mod_m[0]);
 
-    /* tmp holds each product we compute and reduce. */
-    mp_int *tmp = mp_make_sized(mc->rw * 2);
+    /* sel holds the table entry chosen for each window. */
+    mp_int *sel = mp_make_sized(mc->rw);
 
-    while (true) {
-        mp_mul_into(tmp, out, square);
-        monty_reduce(mc, tmp);
-        mp_select_into(out, out, tmp, mp_get_bit(exponent, i));
+    for (size_t window = (bits + w - 1) / w; window-- > 0 ;) {
+        for (unsigned i = 0; i < w; i++)
+            monty_mul_into(mc, out, out, out);
 
-        if (++i >= exponent->nw * BIGNUM_INT_BITS)
-            break;
+        size_t index = 0;
+        for (unsigned i = w; i-- > 0 ;)
+            index = (index << 1) | mp_get_bit(exponent, window * w + i);
+
+        for (size_t k = 0; k < tablesize; k++)
+            mp_select_into(sel, sel, table[k],
+                           1 ^ normalise_to_1(k ^ index));
 
-        mp_mul_into(tmp, square, square);
-        monty_reduce(mc, tmp);
-        mp_copy_into(square, tmp);
+        monty_mul_into(mc, out, out, sel);
     }
 
-    mp_free(square);
-    mp_free(tmp);
-    mp_clear(mc->scratch);
+    for (size_t k = 0; k < tablesize; k++)
+        mp_free(table[k]);
+    sfree(table);
+    mp_free(sel);
     return out;
 }
 
@@ -0,0 +1,29 @@
+/*
+ * Stub implementation of worker thread pools, for applications that
+ * must not use threads (such as testsc, which traces the execution
+ * of a single thread), or platforms that don't have them. Callers
+ * fall back to doing all the work in sequence on their own thread.
+ */
+
+#include "putty.h"
+#include "ssh.h"
+
+WorkerPool *worker_pool_new(size_t nworkers, worker_fn_t fn, void *ctx)
+{
+    return NULL;
+}
+
+void worker_pool_run(WorkerPool *pool)
+{
+    unreachable("worker_pool_new never returns a pool to run");
+}
+
+void worker_pool_free(WorkerPool *pool)
+{
+    unreachable("worker_pool_new never returns a pool to free");
+}
+
+size_t worker_pool_ncpus(void)
+{
+    return 1;
+}
@@ -365,6 +365,37 @@ void pcs_ready(PrimeCandidateSource *s)
     s->ready = true;
 }
 
+mp_int *pcs_draw(PrimeCandidateSource *s)
+{
+    assert(s->ready);
+    return mp_random_upto(s->limit);
+}
+
+mp_int *pcs_sieve(PrimeCandidateSource *s, mp_int *x)
+{
+    int64_t x_res = 0, last_mod = 0;
+
+    for (size_t i = 0; i < s->navoids; i++) {
+        int64_t mod = s->avoids[i].mod, avoid_res = s->avoids[i].res;
+
+        if (mod != last_mod) {
+            last_mod = mod;
+            x_res = mp_unsafe_mod_integer(x, mod);
+        }
+
+        if (x_res == avoid_res)
+            return NULL;
+    }
+
+    /*
+     * We've found a viable x. Make the final output value.
+     */
+    mp_int *toret = mp_new(s->bits);
+    mp_mul_into(toret, x, s->factor);
+    mp_add_into(toret, toret, s->addend);
+    return toret;
+}
+
 mp_int *pcs_generate(PrimeCandidateSource *s)
 {
     assert(s->ready);
@@ -375,38 +406,12 @@ mp_int *pcs_generate(PrimeCandidateSource *s)
     }
 
     while (true) {
-        mp_int *x = mp_random_upto(s->limit);
-
-        int64_t x_res = 0, last_mod = 0;
-        bool ok = true;
-
-        for (size_t i = 0; i < s->navoids; i++) {
-            int64_t mod = s->avoids[i].mod, avoid_res = s->avoids[i].res;
-
-            if (mod != last_mod) {
-                last_mod = mod;
-                x_res = mp_unsafe_mod_integer(x, mod);
-            }
-
-            if (x_res == avoid_res) {
-                ok = false;
-                break;
-            }
-        }
-
-        if (!ok) {
-            mp_free(x);
-            continue; /* try a new x */
-        }
-
-        /*
-         * We've found a viable x. Make the final output value.
-         */
-        mp_int *toret = mp_new(s->bits);
-        mp_mul_into(toret, x, s->factor);
-        mp_add_into(toret, toret, s->addend);
+        mp_int *x = pcs_draw(s);
+        mp_int *toret = pcs_sieve(s, x);
         mp_free(x);
-        return toret;
+        if (toret)
+            return toret;
+        /* otherwise, try a new x */
     }
 }
 
@@ -423,6 +428,11 @@ unsigned pcs_get_bits(PrimeCandidateSource *pcs)
     return pcs->bits;
 }
 
+bool pcs_is_oneshot(PrimeCandidateSource *pcs)
+{
+    return pcs->one_shot;
+}
+
 unsigned pcs_get_bits_remaining(PrimeCandidateSource *pcs)
 {
     return mp_get_nbits(pcs->limit);
@@ -1402,6 +1402,7 @@ NORETURN void cleanup_exit(int);
     X(STR, NONE, remote_cmd2) /* fallback if remote_cmd fails; never loaded or saved */ \
     X(BOOL, NONE, nopty) \
     X(BOOL, NONE, compression) \
+    X(INT, NONE, compression_level) /* 1 (fastest) to 9 (smallest) */ \
     X(INT, INT, ssh_kexlist) \
     X(INT, INT, ssh_hklist) \
     X(BOOL, NONE, ssh_prefer_known_hostkeys) \
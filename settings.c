@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "putty.h"
+#include "ssh.h"
 #include "storage.h"
 #ifndef NO_GSSAPI
 #include "sshgssc.h"
@@ -593,6 +594,7 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
     write_setting_s(sesskey, "LocalUserName", conf_get_str(conf, CONF_localusername));
     write_setting_b(sesskey, "NoPTY", conf_get_bool(conf, CONF_nopty));
     write_setting_b(sesskey, "Compression", conf_get_bool(conf, CONF_compression));
+    write_setting_i(sesskey, "CompressionLevel", conf_get_int(conf, CONF_compression_level));
     write_setting_b(sesskey, "TryAgent", conf_get_bool(conf, CONF_tryagent));
     write_setting_b(sesskey, "AgentFwd", conf_get_bool(conf, CONF_agentfwd));
 #ifndef NO_GSSAPI
@@ -951,6 +953,8 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
     gpps(sesskey, "LocalUserName", "", conf, CONF_localusername);
     gppb(sesskey, "NoPTY", false, conf, CONF_nopty);
     gppb(sesskey, "Compression", false, conf, CONF_compression);
+    gppi(sesskey, "CompressionLevel", COMPRESSION_LEVEL_DEFAULT,
+         conf, CONF_compression_level);
     gppb(sesskey, "TryAgent", true, conf, CONF_tryagent);
     gppb(sesskey, "AgentFwd", false, conf, CONF_agentfwd);
     gppb(sesskey, "ChangeUsername", false, conf, CONF_change_username);
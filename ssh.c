@@ -406,6 +406,20 @@ static void ssh_shutdown_internal(Ssh *ssh)
         ssh->pinger = NULL;
     }
 
+    if (ssh->base_layer) {
+        /* Report on packet buffer recycling. The pool is shared by
+         * every connection in the process, so these are totals for
+         * the whole process, not just this connection. */
+        PacketPoolStats pps;
+        ssh_packet_pool_stats(&pps);
+        if (pps.allocs)
+            ssh_logevent(("Packet buffers (all connections in this process): "
+                          "%lu allocated, %lu reused (%lu%%), "
+                          "%lu too big to reuse", pps.allocs, pps.reused,
+                          (unsigned long)(100.0 * pps.reused / pps.allocs),
+                          pps.oversize));
+    }
+
     /*
      * We only need to free the base PPL, which will free the others
      * (if any) transitively.
@@ -164,6 +164,25 @@ int ssh2_censor_packet(
 PktOut *ssh_new_packet(void);
 void ssh_free_pktout(PktOut *pkt);
 
+/*
+ * Allocate a PktIn with datalen bytes of space following it (found
+ * with snew_plus_get_aux), and free one immediately rather than via
+ * the free queue. Storage for these, and for PktOut and its data,
+ * comes from a pool of recycled buffers in sshpktbuf.c, so that a
+ * bulk data transfer doesn't need a malloc and free per packet.
+ */
+PktIn *ssh_new_pktin(size_t datalen);
+void ssh_free_pktin(PktIn *pktin);
+
+/* Counters for the pool, which is shared by every connection in the
+ * process, so they're process-wide totals since startup. */
+typedef struct PacketPoolStats {
+    unsigned long allocs;   /* buffers handed out by the pool */
+    unsigned long reused;   /* ... of which came from a free list */
+    unsigned long oversize; /* ... of which were too big to recycle */
+} PacketPoolStats;
+void ssh_packet_pool_stats(PacketPoolStats *stats);
+
 Socket *ssh_connection_sharing_init(
     const char *host, int port, Conf *conf, LogContext *logctx,
     Plug *sshplug, ssh_sharing_state **state);
@@ -443,6 +462,12 @@ struct RSAKey {
     mp_int *q;
     mp_int *iqmp;
     char *comment;
+
+    /* Values derived from the private key that every CRT
+     * decryption would otherwise recompute. Set up by rsa_verify,
+     * or else on first use; NULL until then. */
+    RSACrtCache *crt;
+
     ssh_key sshk;
 };
 
@@ -459,6 +484,9 @@ struct ec_wcurve
     WeierstrassCurve *wc;
     WeierstrassPoint *G;
     mp_int *G_order;
+
+    /* Precomputed multiples of G, set up the first time they're used */
+    WeierstrassComb *G_comb;
 };
 
 /* Montgomery form curve */
@@ -467,6 +495,11 @@ struct ec_mcurve
     MontgomeryCurve *mc;
     MontgomeryPoint *G;
     unsigned log2_cofactor;
+
+    /* Twisted Edwards curve birationally equivalent to this one, via
+     * u = (1+y)/(1-y), with G corresponding to its base point. NULL
+     * if we don't know of one. */
+    struct ec_curve *(*ecurve)(void);
 };
 
 /* Edwards form curve */
@@ -476,6 +509,9 @@ struct ec_ecurve
     EdwardsPoint *G;
     mp_int *G_order;
     unsigned log2_cofactor;
+
+    /* Precomputed multiples of G, set up the first time they're used */
+    EdwardsComb *G_comb;
 };
 
 typedef enum EllipticCurveType {
@@ -574,11 +610,15 @@ int rsa_ssh1_public_blob_len(ptrlen data);
 void rsa_ssh1_private_blob_agent(BinarySink *bs, RSAKey *key);
 void freersapriv(RSAKey *key);
 void freersakey(RSAKey *key);
+void rsa_set_crt_threads(RSAKey *key, bool enabled);
 key_components *rsa_components(RSAKey *key);
 
 uint32_t crc32_rfc1662(ptrlen data);
 uint32_t crc32_ssh1(ptrlen data);
 uint32_t crc32_update(uint32_t crc_input, ptrlen data);
+uint32_t crc32_update_sw(uint32_t crc_input, ptrlen data);
+uint32_t crc32_update_hw(uint32_t crc_input, ptrlen data);
+bool crc32_hw_available(void);
 
 /* SSH CRC compensation attack detector */
 struct crcda_ctx;
@@ -634,6 +674,8 @@ struct ssh_cipheralg {
                            unsigned long seq);
     void (*decrypt_length)(ssh_cipher *, void *blk, int len,
                            unsigned long seq);
+    /* Ignored unless SSH_CIPHER_NEXT_MESSAGE flag set */
+    void (*next_message)(ssh_cipher *);
     const char *ssh2_id;
     int blksize;
     /* real_keybits is the number of bits of entropy genuinely used by
@@ -652,6 +694,7 @@ struct ssh_cipheralg {
     unsigned int flags;
 #define SSH_CIPHER_IS_CBC       1
 #define SSH_CIPHER_SEPARATE_LENGTH      2
+#define SSH_CIPHER_NEXT_MESSAGE         4
     const char *text_name;
     /* If set, this takes priority over other MAC. */
     const ssh2_macalg *required_mac;
@@ -678,6 +721,8 @@ static inline void ssh_cipher_encrypt_length(
 static inline void ssh_cipher_decrypt_length(
     ssh_cipher *c, void *blk, int len, unsigned long seq)
 { c->vt->decrypt_length(c, blk, len, seq); }
+static inline void ssh_cipher_next_message(ssh_cipher *c)
+{ c->vt->next_message(c); }
 static inline const struct ssh_cipheralg *ssh_cipher_alg(ssh_cipher *c)
 { return c->vt; }
 
@@ -828,6 +873,14 @@ struct ssh_keyalg {
     /* 'Class methods' that don't deal with an ssh_key at all */
     int (*pubkey_bits) (const ssh_keyalg *self, ptrlen blob);
 
+    /* Optional faster way to check that a whole batch of signatures
+     * are all valid, each made by a key of this algorithm. Callers
+     * should go through ssh_key_verify_batch, which falls back to
+     * one at a time if this is NULL. This may be slightly more
+     * lenient than verify: see ssh_key_verify_batch. */
+    bool (*verify_batch) (const ssh_keyalg *self, ssh_key *const *keys,
+                          const ptrlen *sigs, const ptrlen *data, size_t n);
+
     /* Constant data fields giving information about the key type */
     const char *ssh_id;    /* string identifier in the SSH protocol */
     const char *cache_id;  /* identifier used in PuTTY's host key cache */
@@ -864,6 +917,22 @@ static inline key_components *ssh_key_components(ssh_key *key)
 { return key->vt->components(key); }
 static inline int ssh_key_public_bits(const ssh_keyalg *self, ptrlen blob)
 { return self->pubkey_bits(self, blob); }
+
+/*
+ * Return true if sigs[i] is a valid signature of data[i] by keys[i],
+ * for every i < n. All the keys must be of algorithm 'alg'. If this
+ * returns false, the caller will have to use ssh_key_verify to find
+ * out which ones were bad.
+ *
+ * 'Valid' is not quite the same as what ssh_key_verify checks. The
+ * EdDSA batch check uses the cofactored verification equation, so it
+ * can accept a deliberately malformed signature (one with a
+ * small-order component) that ssh_key_verify would reject. Don't use
+ * this where that difference matters.
+ */
+bool ssh_key_verify_batch(const ssh_keyalg *alg, ssh_key *const *keys,
+                          const ptrlen *sigs, const ptrlen *data, size_t n);
+
 static inline const ssh_keyalg *ssh_key_alg(ssh_key *key)
 { return key->vt; }
 static inline const char *ssh_key_ssh_id(ssh_key *key)
@@ -877,6 +946,9 @@ static inline const char *ssh_key_cache_id(ssh_key *key)
 #define SSH_AGENT_RSA_SHA2_256 2
 #define SSH_AGENT_RSA_SHA2_512 4
 
+/* Compression level used when the configuration doesn't choose one */
+#define COMPRESSION_LEVEL_DEFAULT 6
+
 struct ssh_compressor {
     const ssh_compression_alg *vt;
 };
@@ -889,7 +961,8 @@ struct ssh_compression_alg {
     /* For zlib@openssh.com: if non-NULL, this name will be considered once
      * userauth has completed successfully. */
     const char *delayed_name;
-    ssh_compressor *(*compress_new)(void);
+    /* Levels run from 1 (fastest) to 9 (most thorough), as in zlib */
+    ssh_compressor *(*compress_new)(int level);
     void (*compress_free)(ssh_compressor *);
     void (*compress)(ssh_compressor *, const unsigned char *block, int len,
                      unsigned char **outblock, int *outlen,
@@ -902,8 +975,8 @@ struct ssh_compression_alg {
 };
 
 static inline ssh_compressor *ssh_compressor_new(
-    const ssh_compression_alg *alg)
-{ return alg->compress_new(); }
+    const ssh_compression_alg *alg, int level)
+{ return alg->compress_new(level); }
 static inline ssh_decompressor *ssh_decompressor_new(
     const ssh_compression_alg *alg)
 { return alg->decompress_new(); }
@@ -942,6 +1015,15 @@ void argon2_choose_passes(
     strbuf *out);
 /* The H' hash defined in Argon2, exposed just for testcrypt */
 strbuf *argon2_long_hash(unsigned length, ptrlen data);
+/* For testing: force a particular implementation of Argon2's
+ * compression function ("sw", "sse2" or "avx2"), or go back to
+ * automatic selection if name is NULL. Returns false if the
+ * implementation isn't available on this CPU. */
+bool argon2_force_impl(const char *name);
+/* For testing: divide Argon2's lanes between this many worker
+ * threads (where threads are available), or go back to one per CPU if
+ * nworkers is 0. */
+void argon2_force_workers(size_t nworkers);
 
 /* The maximum length of any hash algorithm. (bytes) */
 #define MAX_HASH_LEN (114) /* longest is SHAKE256 with 114-byte output */
@@ -970,11 +1052,20 @@ extern const ssh_cipheralg ssh_aes128_sdctr_sw;
 extern const ssh_cipheralg ssh_aes128_cbc;
 extern const ssh_cipheralg ssh_aes128_cbc_hw;
 extern const ssh_cipheralg ssh_aes128_cbc_sw;
+extern const ssh_cipheralg ssh_aes256_gcm;
+extern const ssh_cipheralg ssh_aes256_gcm_hw;
+extern const ssh_cipheralg ssh_aes256_gcm_sw;
+extern const ssh_cipheralg ssh_aes128_gcm;
+extern const ssh_cipheralg ssh_aes128_gcm_hw;
+extern const ssh_cipheralg ssh_aes128_gcm_sw;
 extern const ssh_cipheralg ssh_blowfish_ssh2_ctr;
 extern const ssh_cipheralg ssh_blowfish_ssh2;
 extern const ssh_cipheralg ssh_arcfour256_ssh2;
 extern const ssh_cipheralg ssh_arcfour128_ssh2;
 extern const ssh_cipheralg ssh2_chacha20_poly1305;
+extern const ssh_cipheralg ssh2_chacha20_poly1305_sw;
+extern const ssh_cipheralg ssh2_chacha20_poly1305_sse2;
+extern const ssh_cipheralg ssh2_chacha20_poly1305_avx2;
 extern const ssh2_ciphers ssh2_3des;
 extern const ssh2_ciphers ssh2_des;
 extern const ssh2_ciphers ssh2_aes;
@@ -1026,9 +1117,41 @@ extern const ssh2_macalg ssh_hmac_sha1_buggy;
 extern const ssh2_macalg ssh_hmac_sha1_96;
 extern const ssh2_macalg ssh_hmac_sha1_96_buggy;
 extern const ssh2_macalg ssh_hmac_sha256;
+extern const ssh2_macalg ssh_umac_64;
+extern const ssh2_macalg ssh_umac_128;
 extern const ssh2_macalg ssh2_poly1305;
+extern const ssh2_macalg ssh2_aesgcm_mac;
+extern const ssh2_macalg ssh2_aesgcm_mac_hw;
+extern const ssh2_macalg ssh2_aesgcm_mac_sw;
 extern const ssh_compression_alg ssh_zlib;
 
+/*
+ * The GHASH authenticator half of AES-GCM (in sshaesgcm.c) needs two
+ * values that only the AES half (in sshaes.c) can compute: the hash
+ * key E_K(0^128), and the mask E_K(J0) for the current message, which
+ * is XORed into the final GHASH value to make the tag.
+ */
+void aesgcm_cipher_crypt_hashkey(ssh_cipher *cipher, void *out);
+void aesgcm_cipher_crypt_mask(ssh_cipher *cipher, void *out);
+
+/*
+ * By default, the AES-GCM MAC expects to be fed the SSH-2 packet
+ * sequence number (which it ignores), then the 4-byte packet length
+ * field (authenticated as additional data), then the ciphertext.
+ * This function reconfigures those prefix lengths, which is only
+ * useful for testing against standard GCM test vectors.
+ */
+void aesgcm_set_prefix_lengths(ssh2_mac *mac, size_t skip, size_t aad);
+
+/*
+ * UMAC needs a 64-bit nonce per message. By default it takes the
+ * SSH-2 sequence number, i.e. the first 4 bytes it's fed after
+ * ssh2_mac_start, and treats the rest as the message. This function
+ * sets an explicit nonce instead, which again is only useful for
+ * testing against the RFC 4418 test vectors.
+ */
+void umac_set_nonce(ssh2_mac *mac, ptrlen nonce);
+
 /* Special constructor: BLAKE2b can be instantiated with any hash
  * length up to 128 bytes */
 ssh_hash *blake2b_new_general(unsigned hashlen);
@@ -1044,6 +1167,30 @@ bool platform_sha256_hw_available(void);
 bool platform_sha1_hw_available(void);
 bool platform_sha512_hw_available(void);
 
+/*
+ * A pool of worker threads, for dividing up CPU-intensive work that
+ * can be done in parallel (such as the lanes of Argon2).
+ *
+ * worker_pool_new(n, fn, ctx) makes a pool of n workers, numbered 0
+ * to n-1. Each call to worker_pool_run calls fn(ctx, index) once for
+ * every worker, all concurrently, and returns when every one of them
+ * has returned; so successive calls are separated by a barrier.
+ * Worker 0 runs on the thread that called worker_pool_run.
+ *
+ * worker_pool_new returns NULL if threads aren't available (either
+ * because the platform can't provide them, or because this build or
+ * application has been configured without them), in which case the
+ * caller should simply do all the work itself, in sequence.
+ *
+ * worker_pool_ncpus returns the number of processors that it's worth
+ * dividing work between.
+ */
+typedef void (*worker_fn_t)(void *ctx, size_t index);
+WorkerPool *worker_pool_new(size_t nworkers, worker_fn_t fn, void *ctx);
+void worker_pool_run(WorkerPool *pool);
+void worker_pool_free(WorkerPool *pool);
+size_t worker_pool_ncpus(void);
+
 /*
  * PuTTY version number formatted as an SSH version string.
  */
@@ -1073,6 +1220,7 @@ void prng_free(prng *p);
 void prng_seed_begin(prng *p);
 void prng_seed_finish(prng *p);
 void prng_read(prng *p, void *vout, size_t size);
+void prng_read_buffered(prng *p, void *vout, size_t size);
 void prng_add_entropy(prng *p, unsigned source_id, ptrlen data);
 size_t prng_seed_bits(prng *p);
 
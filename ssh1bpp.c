@@ -68,7 +68,8 @@ static void ssh1_bpp_free(BinaryPacketProtocol *bpp)
         ssh_decompressor_free(s->decompctx);
     if (s->crcda_ctx)
         crcda_free_context(s->crcda_ctx);
-    sfree(s->pktin);
+    if (s->pktin)
+        ssh_free_pktin(s->pktin);
     sfree(s);
 }
 
@@ -111,7 +112,7 @@ void ssh1_bpp_start_compression(BinaryPacketProtocol *bpp)
     assert(!s->compctx);
     assert(!s->decompctx);
 
-    s->compctx = ssh_compressor_new(&ssh_zlib);
+    s->compctx = ssh_compressor_new(&ssh_zlib, COMPRESSION_LEVEL_DEFAULT);
     s->decompctx = ssh_decompressor_new(&ssh_zlib);
 
     bpp_logevent("Started zlib (RFC1950) compression");
@@ -158,10 +159,7 @@ static void ssh1_bpp_handle_input(BinaryPacketProtocol *bpp)
         /*
          * Allocate the packet to return, now we know its length.
          */
-        s->pktin = snew_plus(PktIn, s->biglen);
-        s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-        s->pktin->qnode.on_free_queue = false;
-        s->pktin->type = 0;
+        s->pktin = ssh_new_pktin(s->biglen);
 
         s->maxlen = s->biglen;
         s->data = snew_plus_get_aux(s->pktin);
@@ -204,12 +202,12 @@ static void ssh1_bpp_handle_input(BinaryPacketProtocol *bpp)
                 PktIn *old_pktin = s->pktin;
 
                 s->maxlen = s->pad + decomplen;
-                s->pktin = snew_plus(PktIn, s->maxlen);
+                s->pktin = ssh_new_pktin(s->maxlen);
                 *s->pktin = *old_pktin; /* structure copy */
                 s->data = snew_plus_get_aux(s->pktin);
 
                 smemclr(old_pktin, s->biglen);
-                sfree(old_pktin);
+                ssh_free_pktin(old_pktin);
             }
 
             memcpy(s->data + s->pad, decompblk, decomplen);
@@ -50,7 +50,8 @@ static void ssh2_bare_bpp_free(BinaryPacketProtocol *bpp)
 {
     struct ssh2_bare_bpp_state *s =
         container_of(bpp, struct ssh2_bare_bpp_state, bpp);
-    sfree(s->pktin);
+    if (s->pktin)
+        ssh_free_pktin(s->pktin);
     sfree(s);
 }
 
@@ -88,9 +89,7 @@ static void ssh2_bare_bpp_handle_input(BinaryPacketProtocol *bpp)
         /*
          * Allocate the packet to return, now we know its length.
          */
-        s->pktin = snew_plus(PktIn, s->packetlen);
-        s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-        s->pktin->qnode.on_free_queue = false;
+        s->pktin = ssh_new_pktin(s->packetlen);
         s->maxlen = 0;
         s->data = snew_plus_get_aux(s->pktin);
 
@@ -138,7 +137,7 @@ static void ssh2_bare_bpp_handle_input(BinaryPacketProtocol *bpp)
         }
 
         if (ssh2_bpp_check_unimplemented(&s->bpp, s->pktin)) {
-            sfree(s->pktin);
+            ssh_free_pktin(s->pktin);
             s->pktin = NULL;
             continue;
         }
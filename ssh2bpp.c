@@ -33,6 +33,7 @@ struct ssh2_bpp_state {
      * substructure, except that they have different types */
     ssh_decompressor *in_decomp;
     ssh_compressor *out_comp;
+    int out_comp_level;
 
     bool is_server;
     bool pending_newkeys;
@@ -107,7 +108,8 @@ static void ssh2_bpp_free(BinaryPacketProtocol *bpp)
     sfree(s->buf);
     ssh2_bpp_free_outgoing_crypto(s);
     ssh2_bpp_free_incoming_crypto(s);
-    sfree(s->pktin);
+    if (s->pktin)
+        ssh_free_pktin(s->pktin);
     sfree(s);
 }
 
@@ -115,13 +117,15 @@ void ssh2_bpp_new_outgoing_crypto(
     BinaryPacketProtocol *bpp,
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
     const ssh2_macalg *mac, bool etm_mode, const void *mac_key,
-    const ssh_compression_alg *compression, bool delayed_compression)
+    const ssh_compression_alg *compression, int compression_level,
+    bool delayed_compression)
 {
     struct ssh2_bpp_state *s;
     assert(bpp->vt == &ssh2_bpp_vtable);
     s = container_of(bpp, struct ssh2_bpp_state, bpp);
 
     ssh2_bpp_free_outgoing_crypto(s);
+    s->out_comp_level = compression_level;
 
     if (cipher) {
         s->out.cipher = ssh_cipher_new(cipher);
@@ -165,7 +169,7 @@ void ssh2_bpp_new_outgoing_crypto(
         /* 'compression' is always non-NULL, because no compression is
          * indicated by ssh_comp_none. But this setup call may return a
          * null out_comp. */
-        s->out_comp = ssh_compressor_new(compression);
+        s->out_comp = ssh_compressor_new(compression, s->out_comp_level);
 
         if (s->out_comp)
             bpp_logevent("Initialised %s compression",
@@ -258,7 +262,8 @@ static void ssh2_bpp_enable_pending_compression(struct ssh2_bpp_state *s)
         s->in.pending_compression = NULL;
     }
     if (s->out.pending_compression) {
-        s->out_comp = ssh_compressor_new(s->out.pending_compression);
+        s->out_comp = ssh_compressor_new(s->out.pending_compression,
+                                         s->out_comp_level);
         bpp_logevent("Initialised delayed %s compression",
                      ssh_compressor_alg(s->out_comp)->text_name);
         s->out.pending_compression = NULL;
@@ -362,10 +367,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             /*
              * Now transfer the data into an output packet.
              */
-            s->pktin = snew_plus(PktIn, s->maxlen);
-            s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-            s->pktin->type = 0;
-            s->pktin->qnode.on_free_queue = false;
+            s->pktin = ssh_new_pktin(s->maxlen);
             s->data = snew_plus_get_aux(s->pktin);
             memcpy(s->data, s->buf, s->maxlen);
         } else if (s->in.mac && s->in.etm_mode) {
@@ -412,10 +414,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             /*
              * Allocate the packet to return, now we know its length.
              */
-            s->pktin = snew_plus(PktIn, OUR_V2_PACKETLIMIT + s->maclen);
-            s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-            s->pktin->type = 0;
-            s->pktin->qnode.on_free_queue = false;
+            s->pktin = ssh_new_pktin(OUR_V2_PACKETLIMIT + s->maclen);
             s->data = snew_plus_get_aux(s->pktin);
             memcpy(s->data, s->buf, 4);
 
@@ -477,10 +476,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
              * Allocate the packet to return, now we know its length.
              */
             s->maxlen = s->packetlen + s->maclen;
-            s->pktin = snew_plus(PktIn, s->maxlen);
-            s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-            s->pktin->type = 0;
-            s->pktin->qnode.on_free_queue = false;
+            s->pktin = ssh_new_pktin(s->maxlen);
             s->data = snew_plus_get_aux(s->pktin);
             memcpy(s->data, s->buf, s->cipherblk);
 
@@ -523,11 +519,22 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
 
         s->pktin->sequence = s->in.sequence++;
 
+        /* Some ciphers need telling when a new message begins */
+        if (s->in.cipher &&
+            (ssh_cipher_alg(s->in.cipher)->flags & SSH_CIPHER_NEXT_MESSAGE))
+            ssh_cipher_next_message(s->in.cipher);
+
         s->length = s->packetlen - s->pad;
         assert(s->length >= 0);
 
         /*
          * Decompress packet payload.
+         *
+         * This can't decode straight into the PktIn, because the
+         * compressed data it's reading is still sitting in that same
+         * buffer, and the decompressed size isn't known until the
+         * decoding is finished. So it decodes into a buffer of its
+         * own and we copy the result back.
          */
         {
             unsigned char *newpayload;
@@ -539,12 +546,12 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
                     PktIn *old_pktin = s->pktin;
 
                     s->maxlen = newlen + 5;
-                    s->pktin = snew_plus(PktIn, s->maxlen);
+                    s->pktin = ssh_new_pktin(s->maxlen);
                     *s->pktin = *old_pktin; /* structure copy */
                     s->data = snew_plus_get_aux(s->pktin);
 
                     smemclr(old_pktin, s->packetlen + s->maclen);
-                    sfree(old_pktin);
+                    ssh_free_pktin(old_pktin);
                 }
                 s->length = 5 + newlen;
                 memcpy(s->data + 5, newpayload, newlen);
@@ -587,7 +594,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
         }
 
         if (ssh2_bpp_check_unimplemented(&s->bpp, s->pktin)) {
-            sfree(s->pktin);
+            ssh_free_pktin(s->pktin);
             s->pktin = NULL;
             continue;
         }
@@ -829,6 +836,11 @@ static void ssh2_bpp_format_packet_inner(struct ssh2_bpp_state *s, PktOut *pkt)
 
     s->out.sequence++;       /* whether or not we MACed */
 
+    /* Some ciphers need telling when a new message begins */
+    if (s->out.cipher &&
+        (ssh_cipher_alg(s->out.cipher)->flags & SSH_CIPHER_NEXT_MESSAGE))
+        ssh_cipher_next_message(s->out.cipher);
+
     dts_consume(&s->stats->out, origlen + padding);
 }
 
@@ -20,13 +20,14 @@ const struct ssh_signkey_with_user_pref_id ssh2_hostkey_algs[] = {
 };
 
 const static ssh2_macalg *const macs[] = {
-    &ssh_hmac_sha256, &ssh_hmac_sha1, &ssh_hmac_sha1_96, &ssh_hmac_md5
+    &ssh_umac_128, &ssh_hmac_sha256, &ssh_umac_64,
+    &ssh_hmac_sha1, &ssh_hmac_sha1_96, &ssh_hmac_md5
 };
 const static ssh2_macalg *const buggymacs[] = {
     &ssh_hmac_sha1_buggy, &ssh_hmac_sha1_96_buggy, &ssh_hmac_md5
 };
 
-static ssh_compressor *ssh_comp_none_init(void)
+static ssh_compressor *ssh_comp_none_init(int level)
 {
     return NULL;
 }
@@ -1435,7 +1436,8 @@ static void ssh2_transport_process_queue(PacketProtocolLayer *ppl)
             s->ppl.bpp,
             s->out.cipher, cipher_key->u, cipher_iv->u,
             s->out.mac, s->out.etm_mode, mac_key->u,
-            s->out.comp, s->out.comp_delayed);
+            s->out.comp, conf_get_int(s->conf, CONF_compression_level),
+            s->out.comp_delayed);
 
         strbuf_free(cipher_key);
         strbuf_free(cipher_iv);
@@ -2100,6 +2102,13 @@ static void ssh2_transport_reconfigure(PacketProtocolLayer *ppl, Conf *conf)
         rekey_reason = "compression setting changed";
         rekey_mandatory = true;
     }
+    if (conf_get_bool(conf, CONF_compression) &&
+        conf_get_int(s->conf, CONF_compression_level) !=
+        conf_get_int(conf, CONF_compression_level)) {
+        /* The new level takes effect with the next compressor, which
+         * we'll get from the next key exchange */
+        rekey_reason = "compression level changed";
+    }
 
     for (i = 0; i < CIPHER_MAX; i++)
         if (conf_get_int_int(s->conf, CONF_ssh_cipherlist, i) !=
@@ -100,11 +100,25 @@ static void aes_hw_free(ssh_cipher *);
 static void aes_hw_setiv_cbc(ssh_cipher *, const void *iv);
 static void aes_hw_setiv_sdctr(ssh_cipher *, const void *iv);
 static void aes_hw_setkey(ssh_cipher *, const void *key);
+static void aes_sw_setiv_gcm(ssh_cipher *, const void *iv);
+static void aes_sw_next_message_gcm(ssh_cipher *);
+static void aes_hw_setiv_gcm(ssh_cipher *, const void *iv);
+static void aes_hw_next_message_gcm(ssh_cipher *);
 
 struct aes_extra {
     const ssh_cipheralg *sw, *hw;
 };
 
+/*
+ * The real (not selector) GCM vtables have an extra structure of
+ * their own, containing the auxiliary functions that the GHASH half
+ * of AES-GCM in sshaesgcm.c calls back to.
+ */
+struct aesgcm_extra {
+    void (*crypt_hashkey)(ssh_cipher *, void *out);
+    void (*crypt_mask)(ssh_cipher *, void *out);
+};
+
 #define VTABLES_INNER(cid, pid, bits, name, encsuffix,                  \
                       decsuffix, setivsuffix, flagsval)                 \
     static void cid##_sw##encsuffix(ssh_cipher *, void *blk, int len);  \
@@ -166,6 +180,61 @@ VTABLES(128)
 VTABLES(192)
 VTABLES(256)
 
+/*
+ * GCM mode is only defined (by OpenSSH) for 128- and 256-bit keys.
+ * Its ciphers are flagged SSH_CIPHER_NEXT_MESSAGE, because the
+ * per-message nonce has to be advanced at every packet boundary.
+ */
+#define GCM_VTABLES_INNER(keylen, impl, impl_name)                      \
+    static void aes##keylen##_gcm_##impl(                               \
+        ssh_cipher *, void *blk, int len);                              \
+    static void aes##keylen##_gcm_##impl##_hashkey(                     \
+        ssh_cipher *, void *out);                                       \
+    static void aes##keylen##_gcm_##impl##_mask(                        \
+        ssh_cipher *, void *out);                                       \
+    static const struct aesgcm_extra gcm_extra_##keylen##_##impl = {    \
+        aes##keylen##_gcm_##impl##_hashkey,                             \
+        aes##keylen##_gcm_##impl##_mask };                              \
+    const ssh_cipheralg ssh_aes##keylen##_gcm_##impl = {                \
+        .new = aes_##impl##_new,                                        \
+        .free = aes_##impl##_free,                                      \
+        .setiv = aes_##impl##_setiv_gcm,                                \
+        .setkey = aes_##impl##_setkey,                                  \
+        .encrypt = aes##keylen##_gcm_##impl,                            \
+        .decrypt = aes##keylen##_gcm_##impl,                            \
+        .next_message = aes_##impl##_next_message_gcm,                  \
+        .ssh2_id = "aes" #keylen "-gcm@openssh.com",                    \
+        .blksize = 16,                                                  \
+        .real_keybits = keylen,                                         \
+        .padded_keybytes = keylen/8,                                    \
+        .flags = SSH_CIPHER_NEXT_MESSAGE,                               \
+        .text_name = "AES-" #keylen " GCM" impl_name,                   \
+        .required_mac = &ssh2_aesgcm_mac,                               \
+        .extra = &gcm_extra_##keylen##_##impl,                          \
+    };
+
+#define GCM_VTABLES(keylen)                                             \
+    GCM_VTABLES_INNER(keylen, sw, " (unaccelerated)")                   \
+    GCM_VTABLES_INNER(keylen, hw, HW_NAME_SUFFIX)                       \
+                                                                        \
+    static const struct aes_extra extra_aes##keylen##_gcm = {           \
+        &ssh_aes##keylen##_gcm_sw, &ssh_aes##keylen##_gcm_hw };         \
+                                                                        \
+    const ssh_cipheralg ssh_aes##keylen##_gcm = {                       \
+        .new = aes_select,                                              \
+        .ssh2_id = "aes" #keylen "-gcm@openssh.com",                    \
+        .blksize = 16,                                                  \
+        .real_keybits = keylen,                                         \
+        .padded_keybytes = keylen/8,                                    \
+        .flags = SSH_CIPHER_NEXT_MESSAGE,                               \
+        .text_name = "AES-" #keylen " GCM (dummy selector vtable)",     \
+        .required_mac = &ssh2_aesgcm_mac,                               \
+        .extra = &extra_aes##keylen##_gcm                               \
+    };
+
+GCM_VTABLES(128)
+GCM_VTABLES(256)
+
 static const ssh_cipheralg ssh_rijndael_lysator = {
     /* Same as aes256_cbc, but with a different protocol ID */
     .new = aes_select,
@@ -179,6 +248,8 @@ static const ssh_cipheralg ssh_rijndael_lysator = {
 };
 
 static const ssh_cipheralg *const aes_list[] = {
+    &ssh_aes256_gcm,
+    &ssh_aes128_gcm,
     &ssh_aes256_sdctr,
     &ssh_aes256_cbc,
     &ssh_rijndael_lysator,
@@ -220,6 +291,20 @@ static ssh_cipher *aes_select(const ssh_cipheralg *alg)
     return ssh_cipher_new(real_alg);
 }
 
+void aesgcm_cipher_crypt_hashkey(ssh_cipher *ciph, void *out)
+{
+    const struct aesgcm_extra *extra =
+        (const struct aesgcm_extra *)ciph->vt->extra;
+    extra->crypt_hashkey(ciph, out);
+}
+
+void aesgcm_cipher_crypt_mask(ssh_cipher *ciph, void *out)
+{
+    const struct aesgcm_extra *extra =
+        (const struct aesgcm_extra *)ciph->vt->extra;
+    extra->crypt_mask(ciph, out);
+}
+
 /* ----------------------------------------------------------------------
  * Definitions likely to be helpful to multiple implementations.
  */
@@ -1060,6 +1145,18 @@ struct aes_sw_context {
             uint8_t keystream[SLICE_PARALLELISM * 16];
             uint8_t *keystream_pos;
         } sdctr;
+        struct {
+            /* In GCM mode, the counter block is made of a fixed
+             * 32-bit prefix, a 64-bit message counter that
+             * increments once per SSH packet, and a 32-bit block
+             * counter that restarts for each message. We keep the
+             * three parts separately, plus a keystream cache as in
+             * SDCTR mode. */
+            uint32_t fixed_iv, block_counter;
+            uint64_t msg_counter;
+            uint8_t keystream[SLICE_PARALLELISM * 16];
+            uint8_t *keystream_pos;
+        } gcm;
     } iv;
     ssh_cipher ciph;
 };
@@ -1254,6 +1351,92 @@ static inline void aes_sdctr_sw(
     }
 }
 
+static inline void aes_gcm_sw_counter_block(
+    aes_sw_context *ctx, uint8_t *block, uint32_t block_counter)
+{
+    PUT_32BIT_MSB_FIRST(block, ctx->iv.gcm.fixed_iv);
+    PUT_64BIT_MSB_FIRST(block + 4, ctx->iv.gcm.msg_counter);
+    PUT_32BIT_MSB_FIRST(block + 12, block_counter);
+}
+
+static void aes_gcm_sw_start_message(aes_sw_context *ctx)
+{
+    /* Counter value 1 is reserved for making the MAC mask, so the
+     * keystream for the message data starts at 2. */
+    ctx->iv.gcm.block_counter = 2;
+
+    /* Mark the keystream cache as empty */
+    ctx->iv.gcm.keystream_pos =
+        ctx->iv.gcm.keystream + sizeof(ctx->iv.gcm.keystream);
+}
+
+static void aes_sw_setiv_gcm(ssh_cipher *ciph, const void *viv)
+{
+    aes_sw_context *ctx = container_of(ciph, aes_sw_context, ciph);
+    const uint8_t *iv = (const uint8_t *)viv;
+
+    /* Only the first 12 bytes of the IV are used */
+    ctx->iv.gcm.fixed_iv = GET_32BIT_MSB_FIRST(iv);
+    ctx->iv.gcm.msg_counter = GET_64BIT_MSB_FIRST(iv + 4);
+    aes_gcm_sw_start_message(ctx);
+}
+
+static void aes_sw_next_message_gcm(ssh_cipher *ciph)
+{
+    aes_sw_context *ctx = container_of(ciph, aes_sw_context, ciph);
+    ctx->iv.gcm.msg_counter++;
+    aes_gcm_sw_start_message(ctx);
+}
+
+static inline void aes_gcm_sw(
+    ssh_cipher *ciph, void *vblk, int blklen)
+{
+    aes_sw_context *ctx = container_of(ciph, aes_sw_context, ciph);
+
+    /*
+     * This is just like SDCTR mode, except for the way the counter
+     * is incremented.
+     */
+
+    uint8_t *keystream_end =
+        ctx->iv.gcm.keystream + sizeof(ctx->iv.gcm.keystream);
+
+    for (uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
+         blk < finish; blk += 16) {
+
+        if (ctx->iv.gcm.keystream_pos == keystream_end) {
+            for (uint8_t *block = ctx->iv.gcm.keystream;
+                 block < keystream_end; block += 16)
+                aes_gcm_sw_counter_block(
+                    ctx, block, ctx->iv.gcm.block_counter++);
+
+            aes_sliced_e_parallel(ctx->iv.gcm.keystream,
+                                  ctx->iv.gcm.keystream, &ctx->sk);
+
+            ctx->iv.gcm.keystream_pos = ctx->iv.gcm.keystream;
+        }
+
+        memxor16(blk, blk, ctx->iv.gcm.keystream_pos);
+        ctx->iv.gcm.keystream_pos += 16;
+    }
+}
+
+static inline void aes_gcm_sw_hashkey(ssh_cipher *ciph, void *out)
+{
+    aes_sw_context *ctx = container_of(ciph, aes_sw_context, ciph);
+    uint8_t block[16];
+    memset(block, 0, 16);
+    aes_sliced_e_serial(out, block, &ctx->sk);
+}
+
+static inline void aes_gcm_sw_mask(ssh_cipher *ciph, void *out)
+{
+    aes_sw_context *ctx = container_of(ciph, aes_sw_context, ciph);
+    uint8_t block[16];
+    aes_gcm_sw_counter_block(ctx, block, 1);
+    aes_sliced_e_serial(out, block, &ctx->sk);
+}
+
 #define SW_ENC_DEC(len)                                 \
     static void aes##len##_cbc_sw_encrypt(              \
         ssh_cipher *ciph, void *vblk, int blklen)       \
@@ -1265,9 +1448,22 @@ static inline void aes_sdctr_sw(
         ssh_cipher *ciph, void *vblk, int blklen)       \
     { aes_sdctr_sw(ciph, vblk, blklen); }
 
+#define SW_GCM(len)                                     \
+    static void aes##len##_gcm_sw(                      \
+        ssh_cipher *ciph, void *vblk, int blklen)       \
+    { aes_gcm_sw(ciph, vblk, blklen); }                 \
+    static void aes##len##_gcm_sw_hashkey(              \
+        ssh_cipher *ciph, void *out)                    \
+    { aes_gcm_sw_hashkey(ciph, out); }                  \
+    static void aes##len##_gcm_sw_mask(                 \
+        ssh_cipher *ciph, void *out)                    \
+    { aes_gcm_sw_mask(ciph, out); }
+
 SW_ENC_DEC(128)
 SW_ENC_DEC(192)
 SW_ENC_DEC(256)
+SW_GCM(128)
+SW_GCM(256)
 
 /* ----------------------------------------------------------------------
  * Hardware-accelerated implementation of AES using x86 AES-NI.
@@ -1330,6 +1526,45 @@ NI_CIPHER(192, d, dec, REP11)
 NI_CIPHER(256, e, enc, REP13)
 NI_CIPHER(256, d, dec, REP13)
 
+/*
+ * Versions of the same functions that process eight blocks at once.
+ * The AES instructions have a latency of several cycles but can be
+ * issued once per cycle, so interleaving the rounds of independent
+ * blocks keeps the pipeline full. Modes that allow it (CBC
+ * decryption, and counter modes) use these for the bulk of their
+ * input.
+ */
+
+#define NI_ROUND8(v, op, key) do {                                      \
+        __m128i k_ = (key);                                             \
+        v[0] = op(v[0], k_); v[1] = op(v[1], k_);                       \
+        v[2] = op(v[2], k_); v[3] = op(v[3], k_);                       \
+        v[4] = op(v[4], k_); v[5] = op(v[5], k_);                       \
+        v[6] = op(v[6], k_); v[7] = op(v[7], k_);                       \
+    } while (0)
+
+#define NI_CIPHER8(len, dir, dirlong, repmacro)                         \
+    static FUNC_ISA inline void aes_ni_##len##_##dir##8(                \
+        __m128i *v, const __m128i *keysched)                            \
+    {                                                                   \
+        /* Work on a local copy, so the compiler knows that storing   \
+         * to it can't change the key schedule */                       \
+        __m128i w[8] = { v[0], v[1], v[2], v[3],                        \
+                         v[4], v[5], v[6], v[7] };                      \
+        NI_ROUND8(w, _mm_xor_si128, *keysched++);                       \
+        repmacro(NI_ROUND8(w, _mm_aes##dirlong##_si128, *keysched++);); \
+        NI_ROUND8(w, _mm_aes##dirlong##last_si128, *keysched);          \
+        v[0] = w[0]; v[1] = w[1]; v[2] = w[2]; v[3] = w[3];             \
+        v[4] = w[4]; v[5] = w[5]; v[6] = w[6]; v[7] = w[7];             \
+    }
+
+NI_CIPHER8(128, e, enc, REP9)
+NI_CIPHER8(128, d, dec, REP9)
+NI_CIPHER8(192, e, enc, REP11)
+NI_CIPHER8(192, d, dec, REP11)
+NI_CIPHER8(256, e, enc, REP13)
+NI_CIPHER8(256, d, dec, REP13)
+
 /*
  * The main key expansion.
  */
@@ -1440,6 +1675,11 @@ typedef struct aes_ni_context aes_ni_context;
 struct aes_ni_context {
     __m128i keysched_e[MAXROUNDKEYS], keysched_d[MAXROUNDKEYS], iv;
 
+    /* In GCM mode, iv holds the counter block with its last 32 bits
+     * zero, and these fields hold its components separately. */
+    uint32_t gcm_fixed_iv, gcm_block_counter;
+    uint64_t gcm_msg_counter;
+
     void *pointer_to_free;
     ssh_cipher ciph;
 };
@@ -1497,7 +1737,51 @@ static FUNC_ISA void aes_hw_setiv_sdctr(ssh_cipher *ciph, const void *iv)
     ctx->iv = aes_ni_sdctr_reverse(counter);
 }
 
+static FUNC_ISA void aes_ni_gcm_start_message(aes_ni_context *ctx)
+{
+    uint8_t block[16];
+    PUT_32BIT_MSB_FIRST(block, ctx->gcm_fixed_iv);
+    PUT_64BIT_MSB_FIRST(block + 4, ctx->gcm_msg_counter);
+    PUT_32BIT_MSB_FIRST(block + 12, 0);
+    ctx->iv = _mm_loadu_si128((const __m128i *)block);
+    smemclr(block, sizeof(block));
+
+    /* Counter value 1 is reserved for making the MAC mask */
+    ctx->gcm_block_counter = 2;
+}
+
+static FUNC_ISA void aes_hw_setiv_gcm(ssh_cipher *ciph, const void *viv)
+{
+    aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    const uint8_t *iv = (const uint8_t *)viv;
+
+    /* Only the first 12 bytes of the IV are used */
+    ctx->gcm_fixed_iv = GET_32BIT_MSB_FIRST(iv);
+    ctx->gcm_msg_counter = GET_64BIT_MSB_FIRST(iv + 4);
+    aes_ni_gcm_start_message(ctx);
+}
+
+static FUNC_ISA void aes_hw_next_message_gcm(ssh_cipher *ciph)
+{
+    aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    ctx->gcm_msg_counter++;
+    aes_ni_gcm_start_message(ctx);
+}
+
+/*
+ * Make a GCM counter block, by inserting a big-endian 32-bit block
+ * counter into the last word of the stored IV.
+ */
+static FUNC_ISA inline __m128i aes_ni_gcm_counter_block(
+    __m128i iv, uint32_t counter)
+{
+    counter = ((counter >> 24) | ((counter >> 8) & 0xFF00) |
+               ((counter << 8) & 0xFF0000) | (counter << 24));
+    return _mm_insert_epi32(iv, counter, 3);
+}
+
 typedef __m128i (*aes_ni_fn)(__m128i v, const __m128i *keysched);
+typedef void (*aes_ni_fn8)(__m128i *v, const __m128i *keysched);
 
 static FUNC_ISA inline void aes_cbc_ni_encrypt(
     ssh_cipher *ciph, void *vblk, int blklen, aes_ni_fn encrypt)
@@ -1515,12 +1799,25 @@ static FUNC_ISA inline void aes_cbc_ni_encrypt(
 }
 
 static FUNC_ISA inline void aes_cbc_ni_decrypt(
-    ssh_cipher *ciph, void *vblk, int blklen, aes_ni_fn decrypt)
+    ssh_cipher *ciph, void *vblk, int blklen,
+    aes_ni_fn decrypt, aes_ni_fn8 decrypt8)
 {
     aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
+
+    for (; finish - blk >= 128; blk += 128) {
+        __m128i ciphertext[8], v[8];
+        for (size_t i = 0; i < 8; i++)
+            v[i] = ciphertext[i] = _mm_loadu_si128((const __m128i *)blk + i);
+        decrypt8(v, ctx->keysched_d);
+        _mm_storeu_si128((__m128i *)blk, _mm_xor_si128(v[0], ctx->iv));
+        for (size_t i = 1; i < 8; i++)
+            _mm_storeu_si128((__m128i *)blk + i,
+                             _mm_xor_si128(v[i], ciphertext[i-1]));
+        ctx->iv = ciphertext[7];
+    }
 
-    for (uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
-         blk < finish; blk += 16) {
+    for (; blk < finish; blk += 16) {
         __m128i ciphertext = _mm_loadu_si128((const __m128i *)blk);
         __m128i decrypted = decrypt(ciphertext, ctx->keysched_d);
         __m128i plaintext = _mm_xor_si128(decrypted, ctx->iv);
@@ -1529,13 +1826,32 @@ static FUNC_ISA inline void aes_cbc_ni_decrypt(
     }
 }
 
+static FUNC_ISA inline void aes_ni_xor8(uint8_t *blk, const __m128i *v)
+{
+    for (size_t i = 0; i < 8; i++) {
+        __m128i input = _mm_loadu_si128((const __m128i *)blk + i);
+        _mm_storeu_si128((__m128i *)blk + i, _mm_xor_si128(input, v[i]));
+    }
+}
+
 static FUNC_ISA inline void aes_sdctr_ni(
-    ssh_cipher *ciph, void *vblk, int blklen, aes_ni_fn encrypt)
+    ssh_cipher *ciph, void *vblk, int blklen,
+    aes_ni_fn encrypt, aes_ni_fn8 encrypt8)
 {
     aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
 
-    for (uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
-         blk < finish; blk += 16) {
+    for (; finish - blk >= 128; blk += 128) {
+        __m128i v[8];
+        for (size_t i = 0; i < 8; i++) {
+            v[i] = aes_ni_sdctr_reverse(ctx->iv);
+            ctx->iv = aes_ni_sdctr_increment(ctx->iv);
+        }
+        encrypt8(v, ctx->keysched_e);
+        aes_ni_xor8(blk, v);
+    }
+
+    for (; blk < finish; blk += 16) {
         __m128i counter = aes_ni_sdctr_reverse(ctx->iv);
         __m128i keystream = encrypt(counter, ctx->keysched_e);
         __m128i input = _mm_loadu_si128((const __m128i *)blk);
@@ -1545,20 +1861,79 @@ static FUNC_ISA inline void aes_sdctr_ni(
     }
 }
 
+static FUNC_ISA inline void aes_gcm_ni(
+    ssh_cipher *ciph, void *vblk, int blklen,
+    aes_ni_fn encrypt, aes_ni_fn8 encrypt8)
+{
+    aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
+
+    for (; finish - blk >= 128; blk += 128) {
+        __m128i v[8];
+        for (size_t i = 0; i < 8; i++)
+            v[i] = aes_ni_gcm_counter_block(
+                ctx->iv, ctx->gcm_block_counter++);
+        encrypt8(v, ctx->keysched_e);
+        aes_ni_xor8(blk, v);
+    }
+
+    for (; blk < finish; blk += 16) {
+        __m128i counter = aes_ni_gcm_counter_block(
+            ctx->iv, ctx->gcm_block_counter++);
+        __m128i keystream = encrypt(counter, ctx->keysched_e);
+        __m128i input = _mm_loadu_si128((const __m128i *)blk);
+        __m128i output = _mm_xor_si128(input, keystream);
+        _mm_storeu_si128((__m128i *)blk, output);
+    }
+}
+
+static FUNC_ISA inline void aes_gcm_ni_hashkey(
+    ssh_cipher *ciph, void *out, aes_ni_fn encrypt)
+{
+    aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    __m128i h = encrypt(_mm_setzero_si128(), ctx->keysched_e);
+    _mm_storeu_si128((__m128i *)out, h);
+}
+
+static FUNC_ISA inline void aes_gcm_ni_mask(
+    ssh_cipher *ciph, void *out, aes_ni_fn encrypt)
+{
+    aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    __m128i mask = encrypt(aes_ni_gcm_counter_block(ctx->iv, 1),
+                           ctx->keysched_e);
+    _mm_storeu_si128((__m128i *)out, mask);
+}
+
 #define NI_ENC_DEC(len)                                                 \
     static FUNC_ISA void aes##len##_cbc_hw_encrypt(                     \
         ssh_cipher *ciph, void *vblk, int blklen)                       \
     { aes_cbc_ni_encrypt(ciph, vblk, blklen, aes_ni_##len##_e); }       \
     static FUNC_ISA void aes##len##_cbc_hw_decrypt(                     \
         ssh_cipher *ciph, void *vblk, int blklen)                       \
-    { aes_cbc_ni_decrypt(ciph, vblk, blklen, aes_ni_##len##_d); }       \
+    { aes_cbc_ni_decrypt(ciph, vblk, blklen,                            \
+                         aes_ni_##len##_d, aes_ni_##len##_d8); }        \
     static FUNC_ISA void aes##len##_sdctr_hw(                           \
         ssh_cipher *ciph, void *vblk, int blklen)                       \
-    { aes_sdctr_ni(ciph, vblk, blklen, aes_ni_##len##_e); }             \
+    { aes_sdctr_ni(ciph, vblk, blklen,                                  \
+                   aes_ni_##len##_e, aes_ni_##len##_e8); }              \
+
+#define NI_GCM(len)                                                     \
+    static FUNC_ISA void aes##len##_gcm_hw(                             \
+        ssh_cipher *ciph, void *vblk, int blklen)                       \
+    { aes_gcm_ni(ciph, vblk, blklen,                                    \
+                 aes_ni_##len##_e, aes_ni_##len##_e8); }                \
+    static FUNC_ISA void aes##len##_gcm_hw_hashkey(                     \
+        ssh_cipher *ciph, void *out)                                    \
+    { aes_gcm_ni_hashkey(ciph, out, aes_ni_##len##_e); }                \
+    static FUNC_ISA void aes##len##_gcm_hw_mask(                        \
+        ssh_cipher *ciph, void *out)                                    \
+    { aes_gcm_ni_mask(ciph, out, aes_ni_##len##_e); }
 
 NI_ENC_DEC(128)
 NI_ENC_DEC(192)
 NI_ENC_DEC(256)
+NI_GCM(128)
+NI_GCM(256)
 
 /* ----------------------------------------------------------------------
  * Hardware-accelerated implementation of AES using Arm NEON.
@@ -1767,6 +2142,11 @@ typedef struct aes_neon_context aes_neon_context;
 struct aes_neon_context {
     uint8x16_t keysched_e[MAXROUNDKEYS], keysched_d[MAXROUNDKEYS], iv;
 
+    /* In GCM mode, iv holds the counter block with its last 32 bits
+     * zero, and these fields hold its components separately. */
+    uint32_t gcm_fixed_iv, gcm_block_counter;
+    uint64_t gcm_msg_counter;
+
     ssh_cipher ciph;
 };
 
@@ -1809,6 +2189,51 @@ static FUNC_ISA void aes_hw_setiv_sdctr(ssh_cipher *ciph, const void *iv)
     ctx->iv = aes_neon_sdctr_reverse(counter);
 }
 
+static FUNC_ISA void aes_neon_gcm_start_message(aes_neon_context *ctx)
+{
+    uint8_t block[16];
+    PUT_32BIT_MSB_FIRST(block, ctx->gcm_fixed_iv);
+    PUT_64BIT_MSB_FIRST(block + 4, ctx->gcm_msg_counter);
+    PUT_32BIT_MSB_FIRST(block + 12, 0);
+    ctx->iv = vld1q_u8(block);
+    smemclr(block, sizeof(block));
+
+    /* Counter value 1 is reserved for making the MAC mask */
+    ctx->gcm_block_counter = 2;
+}
+
+static FUNC_ISA void aes_hw_setiv_gcm(ssh_cipher *ciph, const void *viv)
+{
+    aes_neon_context *ctx = container_of(ciph, aes_neon_context, ciph);
+    const uint8_t *iv = (const uint8_t *)viv;
+
+    /* Only the first 12 bytes of the IV are used */
+    ctx->gcm_fixed_iv = GET_32BIT_MSB_FIRST(iv);
+    ctx->gcm_msg_counter = GET_64BIT_MSB_FIRST(iv + 4);
+    aes_neon_gcm_start_message(ctx);
+}
+
+static FUNC_ISA void aes_hw_next_message_gcm(ssh_cipher *ciph)
+{
+    aes_neon_context *ctx = container_of(ciph, aes_neon_context, ciph);
+    ctx->gcm_msg_counter++;
+    aes_neon_gcm_start_message(ctx);
+}
+
+/*
+ * Make a GCM counter block, by inserting a big-endian 32-bit block
+ * counter into the last word of the stored IV. (We only support
+ * little-endian Arm, so the byte swap is unconditional.)
+ */
+static FUNC_ISA inline uint8x16_t aes_neon_gcm_counter_block(
+    uint8x16_t iv, uint32_t counter)
+{
+    counter = ((counter >> 24) | ((counter >> 8) & 0xFF00) |
+               ((counter << 8) & 0xFF0000) | (counter << 24));
+    return vreinterpretq_u8_u32(
+        vsetq_lane_u32(counter, vreinterpretq_u32_u8(iv), 3));
+}
+
 typedef uint8x16_t (*aes_neon_fn)(uint8x16_t v, const uint8x16_t *keysched);
 
 static FUNC_ISA inline void aes_cbc_neon_encrypt(
@@ -1857,6 +2282,37 @@ static FUNC_ISA inline void aes_sdctr_neon(
     }
 }
 
+static FUNC_ISA inline void aes_gcm_neon(
+    ssh_cipher *ciph, void *vblk, int blklen, aes_neon_fn encrypt)
+{
+    aes_neon_context *ctx = container_of(ciph, aes_neon_context, ciph);
+
+    for (uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
+         blk < finish; blk += 16) {
+        uint8x16_t counter = aes_neon_gcm_counter_block(
+            ctx->iv, ctx->gcm_block_counter++);
+        uint8x16_t keystream = encrypt(counter, ctx->keysched_e);
+        uint8x16_t input = vld1q_u8(blk);
+        uint8x16_t output = veorq_u8(input, keystream);
+        vst1q_u8(blk, output);
+    }
+}
+
+static FUNC_ISA inline void aes_gcm_neon_hashkey(
+    ssh_cipher *ciph, void *out, aes_neon_fn encrypt)
+{
+    aes_neon_context *ctx = container_of(ciph, aes_neon_context, ciph);
+    vst1q_u8(out, encrypt(vdupq_n_u8(0), ctx->keysched_e));
+}
+
+static FUNC_ISA inline void aes_gcm_neon_mask(
+    ssh_cipher *ciph, void *out, aes_neon_fn encrypt)
+{
+    aes_neon_context *ctx = container_of(ciph, aes_neon_context, ciph);
+    vst1q_u8(out, encrypt(aes_neon_gcm_counter_block(ctx->iv, 1),
+                          ctx->keysched_e));
+}
+
 #define NEON_ENC_DEC(len)                                               \
     static FUNC_ISA void aes##len##_cbc_hw_encrypt(                     \
         ssh_cipher *ciph, void *vblk, int blklen)                       \
@@ -1868,9 +2324,22 @@ static FUNC_ISA inline void aes_sdctr_neon(
         ssh_cipher *ciph, void *vblk, int blklen)                       \
     { aes_sdctr_neon(ciph, vblk, blklen, aes_neon_##len##_e); }         \
 
+#define NEON_GCM(len)                                                   \
+    static FUNC_ISA void aes##len##_gcm_hw(                             \
+        ssh_cipher *ciph, void *vblk, int blklen)                       \
+    { aes_gcm_neon(ciph, vblk, blklen, aes_neon_##len##_e); }           \
+    static FUNC_ISA void aes##len##_gcm_hw_hashkey(                     \
+        ssh_cipher *ciph, void *out)                                    \
+    { aes_gcm_neon_hashkey(ciph, out, aes_neon_##len##_e); }            \
+    static FUNC_ISA void aes##len##_gcm_hw_mask(                        \
+        ssh_cipher *ciph, void *out)                                    \
+    { aes_gcm_neon_mask(ciph, out, aes_neon_##len##_e); }
+
 NEON_ENC_DEC(128)
 NEON_ENC_DEC(192)
 NEON_ENC_DEC(256)
+NEON_GCM(128)
+NEON_GCM(256)
 
 /* ----------------------------------------------------------------------
  * Stub functions if we have no hardware-accelerated AES. In this
@@ -1898,6 +2367,8 @@ static void aes_hw_free(ssh_cipher *ciph) STUB_BODY
 static void aes_hw_setkey(ssh_cipher *ciph, const void *key) STUB_BODY
 static void aes_hw_setiv_cbc(ssh_cipher *ciph, const void *iv) STUB_BODY
 static void aes_hw_setiv_sdctr(ssh_cipher *ciph, const void *iv) STUB_BODY
+static void aes_hw_setiv_gcm(ssh_cipher *ciph, const void *iv) STUB_BODY
+static void aes_hw_next_message_gcm(ssh_cipher *ciph) STUB_BODY
 #define STUB_ENC_DEC(len)                                       \
     static void aes##len##_cbc_hw_encrypt(                      \
         ssh_cipher *ciph, void *vblk, int blklen) STUB_BODY     \
@@ -1906,8 +2377,18 @@ static void aes_hw_setiv_sdctr(ssh_cipher *ciph, const void *iv) STUB_BODY
     static void aes##len##_sdctr_hw(                            \
         ssh_cipher *ciph, void *vblk, int blklen) STUB_BODY
 
+#define STUB_GCM(len)                                           \
+    static void aes##len##_gcm_hw(                              \
+        ssh_cipher *ciph, void *vblk, int blklen) STUB_BODY     \
+    static void aes##len##_gcm_hw_hashkey(                      \
+        ssh_cipher *ciph, void *out) STUB_BODY                  \
+    static void aes##len##_gcm_hw_mask(                         \
+        ssh_cipher *ciph, void *out) STUB_BODY
+
 STUB_ENC_DEC(128)
 STUB_ENC_DEC(192)
 STUB_ENC_DEC(256)
+STUB_GCM(128)
+STUB_GCM(256)
 
 #endif /* HW_AES */
@@ -0,0 +1,681 @@
+/*
+ * sshaesgcm.c - implementation of GHASH, the authenticator half of
+ * the AES-GCM authenticated encryption mode.
+ *
+ * The AES counter-mode half lives in sshaes.c, and the two halves
+ * are tied together by the cipher's required_mac field, in much the
+ * same way as ChaCha20-Poly1305 in sshccp.c. The MAC object here
+ * keeps a pointer to the cipher, and calls back to it to get the
+ * hash key H = E_K(0^128) when it's keyed, and the per-message mask
+ * E_K(J_0) when it outputs a tag.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ssh.h"
+
+/*
+ * Start by deciding whether we can support hardware GHASH at all.
+ * This requires the PCLMULQDQ carry-less multiplication instruction
+ * on x86, and the same compiler support as AES-NI in sshaes.c.
+ */
+#define HW_GHASH_NONE 0
+#define HW_GHASH_CLMUL 1
+
+#ifdef _FORCE_GHASH_CLMUL
+#   define HW_GHASH HW_GHASH_CLMUL
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<wmmintrin.h>) &&       \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_GHASH HW_GHASH_CLMUL
+#   endif
+#elif defined(__GNUC__)
+#    if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 4)) && \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_GHASH HW_GHASH_CLMUL
+#    endif
+#elif defined (_MSC_VER)
+#   if (defined(_M_X64) || defined(_M_IX86)) && _MSC_FULL_VER >= 150030729
+#      define HW_GHASH HW_GHASH_CLMUL
+#   endif
+#endif
+
+#if defined _FORCE_SOFTWARE_GHASH || !defined HW_GHASH
+#   undef HW_GHASH
+#   define HW_GHASH HW_GHASH_NONE
+#endif
+
+/*
+ * The actual query function that asks if hardware acceleration is
+ * available.
+ */
+static bool aesgcm_hw_available(void);
+
+/*
+ * The top-level selection function, caching the results of
+ * aesgcm_hw_available() so it only has to run once.
+ */
+static bool aesgcm_hw_available_cached(void)
+{
+    static bool initialised = false;
+    static bool hw_available;
+    if (!initialised) {
+        hw_available = aesgcm_hw_available();
+        initialised = true;
+    }
+    return hw_available;
+}
+
+static ssh2_mac *aesgcm_select(const ssh2_macalg *alg, ssh_cipher *cipher)
+{
+    const ssh2_macalg *real_alg = aesgcm_hw_available_cached() ?
+        &ssh2_aesgcm_mac_hw : &ssh2_aesgcm_mac_sw;
+    return ssh2_mac_new(real_alg, cipher);
+}
+
+const ssh2_macalg ssh2_aesgcm_mac = {
+    .new = aesgcm_select,
+    .name = "",
+    .etm_name = "", /* Not selectable individually, just part of
+                     * AES-GCM */
+    .len = 16,
+    .keylen = 0,
+};
+
+/* ----------------------------------------------------------------------
+ * Framing code common to all implementations.
+ *
+ * GHASH authenticates some associated data A (not encrypted) and
+ * some ciphertext C, each zero-padded to a multiple of 16 bytes,
+ * followed by a final block containing the bit lengths of A and C.
+ *
+ * The SSH packet layer feeds a MAC with the 32-bit sequence number,
+ * then the 4-byte packet length field, then the ciphertext. In
+ * AES-GCM the sequence number isn't authenticated at all (it's
+ * implicit in the nonce), and the length field is the associated
+ * data. So by default we skip 4 bytes, then treat the next 4 as A
+ * and the rest as C. testcrypt can change those lengths, so as to
+ * check us against standard test vectors.
+ */
+
+typedef struct aesgcm_framing aesgcm_framing;
+typedef void (*aesgcm_coeffs_fn)(
+    aesgcm_framing *f, const uint8_t *blocks, size_t nblocks);
+typedef void (*aesgcm_output_fn)(aesgcm_framing *f, uint8_t *out);
+
+struct aesgcm_framing {
+    ssh_cipher *cipher;
+
+    /* Implementation-specific functions to absorb whole blocks of
+     * input, and to write out the current accumulator. */
+    aesgcm_coeffs_fn coeffs;
+    aesgcm_output_fn output;
+
+    size_t skiplen, aadlen;            /* configured prefix lengths */
+    size_t skip_left, aad_left;        /* remaining in this message */
+    uint64_t ciphertext_len;
+
+    uint8_t partblk[16];
+    size_t partlen;
+
+    ssh2_mac mac;
+    BinarySink_IMPLEMENTATION;
+};
+
+static void aesgcm_framing_write(BinarySink *bs, const void *vp, size_t len);
+
+static void aesgcm_framing_init(
+    aesgcm_framing *f, const ssh2_macalg *alg, ssh_cipher *cipher,
+    aesgcm_coeffs_fn coeffs, aesgcm_output_fn output)
+{
+    f->cipher = cipher;
+    f->coeffs = coeffs;
+    f->output = output;
+    f->skiplen = 4;
+    f->aadlen = 4;
+    f->mac.vt = alg;
+    BinarySink_INIT(f, aesgcm_framing_write);
+    BinarySink_DELEGATE_INIT(&f->mac, f);
+}
+
+static void aesgcm_framing_start(aesgcm_framing *f)
+{
+    f->skip_left = f->skiplen;
+    f->aad_left = f->aadlen;
+    f->ciphertext_len = 0;
+    f->partlen = 0;
+}
+
+/* Absorb whatever is in partblk, zero-padded to a full block. */
+static void aesgcm_framing_flush(aesgcm_framing *f)
+{
+    if (f->partlen) {
+        memset(f->partblk + f->partlen, 0, 16 - f->partlen);
+        f->coeffs(f, f->partblk, 1);
+        f->partlen = 0;
+    }
+}
+
+static void aesgcm_framing_write(BinarySink *bs, const void *vp, size_t len)
+{
+    aesgcm_framing *f = BinarySink_DOWNCAST(bs, aesgcm_framing);
+    const uint8_t *data = (const uint8_t *)vp;
+    size_t n;
+
+    /* Discard the part of the input that isn't authenticated. */
+    n = min(len, f->skip_left);
+    data += n;
+    len -= n;
+    f->skip_left -= n;
+
+    /* Accumulate the associated data, padding it out to a block
+     * boundary once it's all arrived. */
+    while (len > 0 && f->aad_left > 0) {
+        n = min(min(len, f->aad_left), 16 - f->partlen);
+        memcpy(f->partblk + f->partlen, data, n);
+        f->partlen += n;
+        data += n;
+        len -= n;
+        f->aad_left -= n;
+        if (f->partlen == 16 || f->aad_left == 0)
+            aesgcm_framing_flush(f);
+    }
+
+    if (!len)
+        return;
+
+    /* Everything else is ciphertext. */
+    f->ciphertext_len += len;
+
+    if (f->partlen) {
+        n = min(len, 16 - f->partlen);
+        memcpy(f->partblk + f->partlen, data, n);
+        f->partlen += n;
+        data += n;
+        len -= n;
+        if (f->partlen < 16)
+            return;
+        f->coeffs(f, f->partblk, 1);
+        f->partlen = 0;
+    }
+
+    if (len >= 16) {
+        size_t nblocks = len / 16;
+        f->coeffs(f, data, nblocks);
+        data += 16 * nblocks;
+        len -= 16 * nblocks;
+    }
+
+    memcpy(f->partblk, data, len);
+    f->partlen = len;
+}
+
+static void aesgcm_framing_genresult(aesgcm_framing *f, uint8_t *out)
+{
+    aesgcm_framing_flush(f);
+
+    uint8_t lenblk[16];
+    PUT_64BIT_MSB_FIRST(lenblk, (uint64_t)(f->aadlen - f->aad_left) * 8);
+    PUT_64BIT_MSB_FIRST(lenblk + 8, f->ciphertext_len * 8);
+    f->coeffs(f, lenblk, 1);
+
+    uint8_t mask[16];
+    f->output(f, out);
+    aesgcm_cipher_crypt_mask(f->cipher, mask);
+    memxor(out, out, mask, 16);
+    smemclr(mask, sizeof(mask));
+}
+
+void aesgcm_set_prefix_lengths(ssh2_mac *mac, size_t skip, size_t aad)
+{
+    assert(mac->vt == &ssh2_aesgcm_mac_sw || mac->vt == &ssh2_aesgcm_mac_hw);
+    aesgcm_framing *f = container_of(mac, aesgcm_framing, mac);
+    f->skiplen = skip;
+    f->aadlen = aad;
+}
+
+/* ----------------------------------------------------------------------
+ * Software implementation of GHASH.
+ *
+ * This uses the technique of multiplying 64-bit polynomials using
+ * ordinary integer multiplication, after masking each input so that
+ * only every fourth bit is set. That leaves 'holes' of three zero
+ * bits between the set bits of each partial product, which are big
+ * enough to absorb any carries that integer multiplication
+ * introduces, so masking the result again recovers the carry-less
+ * product. This avoids any secret-dependent table lookups, at the
+ * cost of assuming that the platform's 64-bit multiplier runs in
+ * constant time.
+ *
+ * GHASH's bit ordering is reversed within each block relative to the
+ * natural polynomial representation, so we also compute bit-reversed
+ * products in order to get the high halves of each 128-bit product.
+ */
+
+typedef struct aesgcm_sw {
+    /* H and the accumulator, each as a high and low 64-bit word */
+    uint64_t h1, h0, y1, y0;
+
+    aesgcm_framing f;
+} aesgcm_sw;
+
+static inline uint64_t aesgcm_sw_bmul64(uint64_t x, uint64_t y)
+{
+    uint64_t x0 = x & 0x1111111111111111, y0 = y & 0x1111111111111111;
+    uint64_t x1 = x & 0x2222222222222222, y1 = y & 0x2222222222222222;
+    uint64_t x2 = x & 0x4444444444444444, y2 = y & 0x4444444444444444;
+    uint64_t x3 = x & 0x8888888888888888, y3 = y & 0x8888888888888888;
+
+    uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+    uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+    uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+    uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+
+    return ((z0 & 0x1111111111111111) | (z1 & 0x2222222222222222) |
+            (z2 & 0x4444444444444444) | (z3 & 0x8888888888888888));
+}
+
+static inline uint64_t aesgcm_sw_rev64(uint64_t x)
+{
+    x = ((x & 0x5555555555555555) << 1) | ((x >> 1) & 0x5555555555555555);
+    x = ((x & 0x3333333333333333) << 2) | ((x >> 2) & 0x3333333333333333);
+    x = ((x & 0x0F0F0F0F0F0F0F0F) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0F);
+    x = ((x & 0x00FF00FF00FF00FF) << 8) | ((x >> 8) & 0x00FF00FF00FF00FF);
+    x = ((x & 0x0000FFFF0000FFFF) << 16) | ((x >> 16) & 0x0000FFFF0000FFFF);
+    return (x << 32) | (x >> 32);
+}
+
+static void aesgcm_sw_coeffs(
+    aesgcm_framing *f, const uint8_t *blocks, size_t nblocks)
+{
+    aesgcm_sw *ctx = container_of(f, aesgcm_sw, f);
+
+    uint64_t h0 = ctx->h0, h1 = ctx->h1, h2 = h0 ^ h1;
+    uint64_t h0r = aesgcm_sw_rev64(h0), h1r = aesgcm_sw_rev64(h1);
+    uint64_t h2r = h0r ^ h1r;
+    uint64_t y0 = ctx->y0, y1 = ctx->y1;
+
+    for (; nblocks > 0; nblocks--, blocks += 16) {
+        y1 ^= GET_64BIT_MSB_FIRST(blocks);
+        y0 ^= GET_64BIT_MSB_FIRST(blocks + 8);
+
+        /* Karatsuba multiplication, once forwards for the low
+         * halves of the partial products and once bit-reversed for
+         * the high halves */
+        uint64_t y0r = aesgcm_sw_rev64(y0), y1r = aesgcm_sw_rev64(y1);
+        uint64_t y2 = y0 ^ y1, y2r = y0r ^ y1r;
+
+        uint64_t z0 = aesgcm_sw_bmul64(y0, h0);
+        uint64_t z1 = aesgcm_sw_bmul64(y1, h1);
+        uint64_t z2 = aesgcm_sw_bmul64(y2, h2);
+        uint64_t z0h = aesgcm_sw_bmul64(y0r, h0r);
+        uint64_t z1h = aesgcm_sw_bmul64(y1r, h1r);
+        uint64_t z2h = aesgcm_sw_bmul64(y2r, h2r);
+        z2 ^= z0 ^ z1;
+        z2h ^= z0h ^ z1h;
+        z0h = aesgcm_sw_rev64(z0h) >> 1;
+        z1h = aesgcm_sw_rev64(z1h) >> 1;
+        z2h = aesgcm_sw_rev64(z2h) >> 1;
+
+        /* Assemble the 256-bit product, shifting left by one to
+         * account for the reversed bit order */
+        uint64_t v0 = z0, v1 = z0h ^ z2, v2 = z1 ^ z2h, v3 = z1h;
+        v3 = (v3 << 1) | (v2 >> 63);
+        v2 = (v2 << 1) | (v1 >> 63);
+        v1 = (v1 << 1) | (v0 >> 63);
+        v0 = (v0 << 1);
+
+        /* Reduce modulo x^128 + x^7 + x^2 + x + 1 */
+        v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+        v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+        v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+        v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+
+        y0 = v2;
+        y1 = v3;
+    }
+
+    ctx->y0 = y0;
+    ctx->y1 = y1;
+}
+
+static void aesgcm_sw_output(aesgcm_framing *f, uint8_t *out)
+{
+    aesgcm_sw *ctx = container_of(f, aesgcm_sw, f);
+    PUT_64BIT_MSB_FIRST(out, ctx->y1);
+    PUT_64BIT_MSB_FIRST(out + 8, ctx->y0);
+}
+
+static ssh2_mac *aesgcm_sw_new(const ssh2_macalg *alg, ssh_cipher *cipher)
+{
+    aesgcm_sw *ctx = snew(aesgcm_sw);
+    memset(ctx, 0, sizeof(*ctx));
+    aesgcm_framing_init(&ctx->f, alg, cipher,
+                        aesgcm_sw_coeffs, aesgcm_sw_output);
+    return &ctx->f.mac;
+}
+
+static void aesgcm_sw_free(ssh2_mac *mac)
+{
+    aesgcm_sw *ctx = container_of(mac, aesgcm_sw, f.mac);
+    smemclr(ctx, sizeof(*ctx));
+    sfree(ctx);
+}
+
+static void aesgcm_sw_setkey(ssh2_mac *mac, ptrlen key)
+{
+    aesgcm_sw *ctx = container_of(mac, aesgcm_sw, f.mac);
+
+    /* The key itself is ignored: the hash key H is derived from the
+     * cipher key, so the cipher must be keyed before we are. */
+    uint8_t h[16];
+    aesgcm_cipher_crypt_hashkey(ctx->f.cipher, h);
+    ctx->h1 = GET_64BIT_MSB_FIRST(h);
+    ctx->h0 = GET_64BIT_MSB_FIRST(h + 8);
+    smemclr(h, sizeof(h));
+}
+
+static void aesgcm_sw_start(ssh2_mac *mac)
+{
+    aesgcm_sw *ctx = container_of(mac, aesgcm_sw, f.mac);
+    ctx->y0 = ctx->y1 = 0;
+    aesgcm_framing_start(&ctx->f);
+}
+
+static void aesgcm_sw_genresult(ssh2_mac *mac, unsigned char *out)
+{
+    aesgcm_sw *ctx = container_of(mac, aesgcm_sw, f.mac);
+    aesgcm_framing_genresult(&ctx->f, out);
+}
+
+static const char *aesgcm_sw_text_name(ssh2_mac *mac)
+{
+    return "GHASH (unaccelerated)";
+}
+
+const ssh2_macalg ssh2_aesgcm_mac_sw = {
+    .new = aesgcm_sw_new,
+    .free = aesgcm_sw_free,
+    .setkey = aesgcm_sw_setkey,
+    .start = aesgcm_sw_start,
+    .genresult = aesgcm_sw_genresult,
+    .text_name = aesgcm_sw_text_name,
+    .name = "",
+    .etm_name = "",
+    .len = 16,
+    .keylen = 0,
+};
+
+/* ----------------------------------------------------------------------
+ * Hardware-accelerated implementation of GHASH using x86 PCLMULQDQ.
+ */
+
+#if HW_GHASH == HW_GHASH_CLMUL
+
+/*
+ * Set target architecture for Clang and GCC
+ */
+#if !defined(__clang__) && defined(__GNUC__)
+#    pragma GCC target("pclmul")
+#    pragma GCC target("sse4.1")
+#endif
+
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)))
+#    define FUNC_ISA __attribute__ ((target("sse4.1,pclmul")))
+#else
+#    define FUNC_ISA
+#endif
+
+#include <wmmintrin.h>
+#include <smmintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID(out) __cpuid(1, (out)[0], (out)[1], (out)[2], (out)[3])
+#else
+#define GET_CPU_ID(out) __cpuid(out, 1)
+#endif
+
+static bool aesgcm_hw_available(void)
+{
+    /*
+     * Determine if PCLMULQDQ is available on this CPU, together with
+     * SSSE3 (for byte shuffling) and SSE4.1.
+     */
+    unsigned int CPUInfo[4];
+    GET_CPU_ID(CPUInfo);
+    return ((CPUInfo[2] & (1 << 1)) && (CPUInfo[2] & (1 << 9)) &&
+            (CPUInfo[2] & (1 << 19)));
+}
+
+/*
+ * We work throughout with byte-reversed blocks, so that the
+ * polynomial coefficients are in a consistent (if still bit-reversed)
+ * order across the whole 128-bit register. See Intel's white paper
+ * 'Carry-Less Multiplication Instruction and its Usage for Computing
+ * the GCM Mode' for the derivation.
+ *
+ * We also compute H^2, H^3 and H^4, so that four blocks at a time
+ * can be multiplied independently and summed before a single
+ * reduction step, keeping several multiplications in flight.
+ */
+
+typedef struct aesgcm_clmul {
+    __m128i hpow[4], acc;
+
+    void *pointer_to_free;
+    aesgcm_framing f;
+} aesgcm_clmul;
+
+static FUNC_ISA inline __m128i aesgcm_clmul_bswap(__m128i v)
+{
+    const __m128i mask = _mm_set_epi8(
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm_shuffle_epi8(v, mask);
+}
+
+/* Unreduced 256-bit carry-less product of a and b, as (lo, hi). */
+static FUNC_ISA inline void aesgcm_clmul_mul(
+    __m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+    __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+    __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+    __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+    t1 = _mm_xor_si128(t1, t2);
+    *lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+    *hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+}
+
+/* Shift a 256-bit product left by one bit to correct for the
+ * reflected bit order, and reduce it modulo the GCM polynomial. */
+static FUNC_ISA inline __m128i aesgcm_clmul_reduce(__m128i lo, __m128i hi)
+{
+    __m128i t7 = _mm_srli_epi32(lo, 31);
+    __m128i t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(hi, t8);
+    hi = _mm_or_si128(hi, t9);
+
+    t7 = _mm_slli_epi32(lo, 31);
+    t8 = _mm_slli_epi32(lo, 30);
+    t9 = _mm_slli_epi32(lo, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+
+    __m128i t2 = _mm_srli_epi32(lo, 1);
+    __m128i t4 = _mm_srli_epi32(lo, 2);
+    __m128i t5 = _mm_srli_epi32(lo, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    lo = _mm_xor_si128(lo, t2);
+    return _mm_xor_si128(hi, lo);
+}
+
+static FUNC_ISA inline __m128i aesgcm_clmul_gfmul(__m128i a, __m128i b)
+{
+    __m128i lo, hi;
+    aesgcm_clmul_mul(a, b, &lo, &hi);
+    return aesgcm_clmul_reduce(lo, hi);
+}
+
+static FUNC_ISA void aesgcm_clmul_coeffs(
+    aesgcm_framing *f, const uint8_t *blocks, size_t nblocks)
+{
+    aesgcm_clmul *ctx = container_of(f, aesgcm_clmul, f);
+    __m128i acc = ctx->acc;
+
+    for (; nblocks >= 4; nblocks -= 4, blocks += 64) {
+        __m128i x0 = aesgcm_clmul_bswap(
+            _mm_loadu_si128((const __m128i *)blocks));
+        __m128i x1 = aesgcm_clmul_bswap(
+            _mm_loadu_si128((const __m128i *)(blocks + 16)));
+        __m128i x2 = aesgcm_clmul_bswap(
+            _mm_loadu_si128((const __m128i *)(blocks + 32)));
+        __m128i x3 = aesgcm_clmul_bswap(
+            _mm_loadu_si128((const __m128i *)(blocks + 48)));
+
+        __m128i lo, hi, plo, phi;
+        aesgcm_clmul_mul(_mm_xor_si128(acc, x0), ctx->hpow[3], &lo, &hi);
+        aesgcm_clmul_mul(x1, ctx->hpow[2], &plo, &phi);
+        lo = _mm_xor_si128(lo, plo);
+        hi = _mm_xor_si128(hi, phi);
+        aesgcm_clmul_mul(x2, ctx->hpow[1], &plo, &phi);
+        lo = _mm_xor_si128(lo, plo);
+        hi = _mm_xor_si128(hi, phi);
+        aesgcm_clmul_mul(x3, ctx->hpow[0], &plo, &phi);
+        lo = _mm_xor_si128(lo, plo);
+        hi = _mm_xor_si128(hi, phi);
+        acc = aesgcm_clmul_reduce(lo, hi);
+    }
+
+    for (; nblocks > 0; nblocks--, blocks += 16) {
+        __m128i x = aesgcm_clmul_bswap(
+            _mm_loadu_si128((const __m128i *)blocks));
+        acc = aesgcm_clmul_gfmul(_mm_xor_si128(acc, x), ctx->hpow[0]);
+    }
+
+    ctx->acc = acc;
+}
+
+static FUNC_ISA void aesgcm_clmul_output(aesgcm_framing *f, uint8_t *out)
+{
+    aesgcm_clmul *ctx = container_of(f, aesgcm_clmul, f);
+    _mm_storeu_si128((__m128i *)out, aesgcm_clmul_bswap(ctx->acc));
+}
+
+static ssh2_mac *aesgcm_hw_new(const ssh2_macalg *alg, ssh_cipher *cipher)
+{
+    if (!aesgcm_hw_available_cached())
+        return NULL;
+
+    /*
+     * The __m128i variables in the context structure need to be
+     * 16-byte aligned, so we over-allocate and realign, as in the
+     * AES-NI code in sshaes.c.
+     */
+    void *allocation = smalloc(sizeof(aesgcm_clmul) + 15);
+    memset(allocation, 0, sizeof(aesgcm_clmul) + 15);
+    uintptr_t alloc_address = (uintptr_t)allocation;
+    uintptr_t aligned_address = (alloc_address + 15) & ~15;
+    aesgcm_clmul *ctx = (aesgcm_clmul *)aligned_address;
+
+    ctx->pointer_to_free = allocation;
+    aesgcm_framing_init(&ctx->f, alg, cipher,
+                        aesgcm_clmul_coeffs, aesgcm_clmul_output);
+    return &ctx->f.mac;
+}
+
+static void aesgcm_hw_free(ssh2_mac *mac)
+{
+    aesgcm_clmul *ctx = container_of(mac, aesgcm_clmul, f.mac);
+    void *allocation = ctx->pointer_to_free;
+    smemclr(ctx, sizeof(*ctx));
+    sfree(allocation);
+}
+
+static FUNC_ISA void aesgcm_hw_setkey(ssh2_mac *mac, ptrlen key)
+{
+    aesgcm_clmul *ctx = container_of(mac, aesgcm_clmul, f.mac);
+
+    /* As in the software version, H comes from the cipher. */
+    uint8_t h[16];
+    aesgcm_cipher_crypt_hashkey(ctx->f.cipher, h);
+    ctx->hpow[0] = aesgcm_clmul_bswap(_mm_loadu_si128((const __m128i *)h));
+    smemclr(h, sizeof(h));
+
+    for (size_t i = 1; i < 4; i++)
+        ctx->hpow[i] = aesgcm_clmul_gfmul(ctx->hpow[i-1], ctx->hpow[0]);
+}
+
+static FUNC_ISA void aesgcm_hw_start(ssh2_mac *mac)
+{
+    aesgcm_clmul *ctx = container_of(mac, aesgcm_clmul, f.mac);
+    ctx->acc = _mm_setzero_si128();
+    aesgcm_framing_start(&ctx->f);
+}
+
+static void aesgcm_hw_genresult(ssh2_mac *mac, unsigned char *out)
+{
+    aesgcm_clmul *ctx = container_of(mac, aesgcm_clmul, f.mac);
+    aesgcm_framing_genresult(&ctx->f, out);
+}
+
+static const char *aesgcm_hw_text_name(ssh2_mac *mac)
+{
+    return "GHASH (PCLMULQDQ accelerated)";
+}
+
+/* ----------------------------------------------------------------------
+ * Stub functions if we have no hardware-accelerated GHASH. In this
+ * case, aesgcm_hw_new returns NULL (though it should also never be
+ * selected by aesgcm_select, so the only thing that should even be
+ * _able_ to call it is testcrypt). As a result, the remaining vtable
+ * functions should never be called at all.
+ */
+
+#elif HW_GHASH == HW_GHASH_NONE
+
+static bool aesgcm_hw_available(void)
+{
+    return false;
+}
+
+static ssh2_mac *aesgcm_hw_new(const ssh2_macalg *alg, ssh_cipher *cipher)
+{
+    return NULL;
+}
+
+#define STUB_BODY { unreachable("Should never be called"); }
+
+static void aesgcm_hw_free(ssh2_mac *mac) STUB_BODY
+static void aesgcm_hw_setkey(ssh2_mac *mac, ptrlen key) STUB_BODY
+static void aesgcm_hw_start(ssh2_mac *mac) STUB_BODY
+static void aesgcm_hw_genresult(ssh2_mac *mac, unsigned char *out) STUB_BODY
+static const char *aesgcm_hw_text_name(ssh2_mac *mac) STUB_BODY
+
+#endif /* HW_GHASH */
+
+const ssh2_macalg ssh2_aesgcm_mac_hw = {
+    .new = aesgcm_hw_new,
+    .free = aesgcm_hw_free,
+    .setkey = aesgcm_hw_setkey,
+    .start = aesgcm_hw_start,
+    .genresult = aesgcm_hw_genresult,
+    .text_name = aesgcm_hw_text_name,
+    .name = "",
+    .etm_name = "",
+    .len = 16,
+    .keylen = 0,
+};
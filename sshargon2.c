@@ -155,7 +155,7 @@ static inline void P(uint64_t *out, unsigned outstep,
  * often XORed into an existing output block, so this API is designed with
  * that in mind: the mixing function's output is always XORed into whatever
  * 1Kb of data is already at 'out'. */
-static void G_xor(uint8_t *out, const uint8_t *X, const uint8_t *Y)
+static void G_xor_sw(uint8_t *out, const uint8_t *X, const uint8_t *Y)
 {
     uint64_t R[128], Q[128], Z[128];
 
@@ -177,6 +177,596 @@ static void G_xor(uint8_t *out, const uint8_t *X, const uint8_t *Y)
     smemclr(Z, sizeof(Z));
 }
 
+typedef void (*G_xor_fn)(uint8_t *out, const uint8_t *X, const uint8_t *Y);
+
+/* ----------------------------------------------------------------------
+ * Vectorised versions of G, in the style of the reference
+ * implementation's optimised code. The multiplication in GB only ever
+ * uses the low 32 bits of each word, which is exactly what the x86
+ * PMULUDQ instruction does for each 64-bit lane of a vector, so the
+ * whole of GB can be done lane-wise with no reshuffling. All we need
+ * beyond that is to rearrange the vectors between the column and
+ * diagonal halves of P.
+ */
+#define HW_ARGON2_NONE 0
+#define HW_ARGON2_X86 1
+
+#ifdef _FORCE_ARGON2_X86
+#   define HW_ARGON2 HW_ARGON2_X86
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<immintrin.h>) &&      \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_ARGON2 HW_ARGON2_X86
+#   endif
+#elif defined(__GNUC__)
+#    if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_ARGON2 HW_ARGON2_X86
+#    endif
+#elif defined (_MSC_VER)
+#   if (defined(_M_X64) || defined(_M_IX86)) && _MSC_VER >= 1800
+#      define HW_ARGON2 HW_ARGON2_X86
+#   endif
+#endif
+
+#if defined _FORCE_SOFTWARE_ARGON2 || !defined HW_ARGON2
+#   undef HW_ARGON2
+#   define HW_ARGON2 HW_ARGON2_NONE
+#endif
+
+#if HW_ARGON2 == HW_ARGON2_X86
+
+#if defined(__clang__) || defined(__GNUC__)
+#    define FUNC_ISA_SSE2 __attribute__ ((target("sse2")))
+#    define FUNC_ISA_AVX2 __attribute__ ((target("avx2")))
+#else
+#    define FUNC_ISA_SSE2
+#    define FUNC_ISA_AVX2
+#endif
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "sshcpuid.h"
+
+static bool argon2_sse2_available(void)
+{
+    return x86_sse2_available();
+}
+
+static bool argon2_avx2_available(void)
+{
+    return x86_avx2_available();
+}
+
+/*
+ * SSE2 version. Each vector holds one of the eight pairs of adjacent
+ * words that P works on, so the GB calls can be done two at a time.
+ */
+static inline FUNC_ISA_SSE2 __m128i blamka_sse2(__m128i x, __m128i y)
+{
+    __m128i xy = _mm_mul_epu32(x, y);
+    return _mm_add_epi64(_mm_add_epi64(x, y), _mm_add_epi64(xy, xy));
+}
+
+static inline FUNC_ISA_SSE2 __m128i ror24_sse2(__m128i x)
+{
+    return _mm_or_si128(_mm_srli_epi64(x, 24), _mm_slli_epi64(x, 40));
+}
+
+static inline FUNC_ISA_SSE2 __m128i ror16_sse2(__m128i x)
+{
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 3, 2, 1));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+static inline FUNC_ISA_SSE2 __m128i ror63_sse2(__m128i x)
+{
+    return _mm_xor_si128(_mm_srli_epi64(x, 63), _mm_add_epi64(x, x));
+}
+
+/* Make a vector out of the high word of x and the low word of y */
+static inline FUNC_ISA_SSE2 __m128i hilo_sse2(__m128i x, __m128i y)
+{
+    return _mm_castpd_si128(_mm_shuffle_pd(
+        _mm_castsi128_pd(x), _mm_castsi128_pd(y), 1));
+}
+
+static inline FUNC_ISA_SSE2 void GB_sse2(
+    __m128i *a, __m128i *b, __m128i *c, __m128i *d)
+{
+    *a = blamka_sse2(*a, *b);
+    *d = _mm_shuffle_epi32(_mm_xor_si128(*d, *a), _MM_SHUFFLE(2, 3, 0, 1));
+    *c = blamka_sse2(*c, *d);
+    *b = ror24_sse2(_mm_xor_si128(*b, *c));
+    *a = blamka_sse2(*a, *b);
+    *d = ror16_sse2(_mm_xor_si128(*d, *a));
+    *c = blamka_sse2(*c, *d);
+    *b = ror63_sse2(_mm_xor_si128(*b, *c));
+}
+
+/* Apply P in place to the pairs v[0], v[stride], ..., v[7*stride]. */
+static inline FUNC_ISA_SSE2 void P_sse2(__m128i *v, size_t stride)
+{
+    __m128i a0 = v[0*stride], a1 = v[1*stride];
+    __m128i b0 = v[2*stride], b1 = v[3*stride];
+    __m128i c0 = v[4*stride], c1 = v[5*stride];
+    __m128i d0 = v[6*stride], d1 = v[7*stride];
+    __m128i t;
+
+    GB_sse2(&a0, &b0, &c0, &d0);
+    GB_sse2(&a1, &b1, &c1, &d1);
+
+    /* Rotate the b, c and d rows so that the diagonals line up.
+     * (The c row only needs its two vectors swapping, which we do by
+     * just passing them to GB the other way round.) */
+    t = b0; b0 = hilo_sse2(b0, b1); b1 = hilo_sse2(b1, t);
+    t = d0; d0 = hilo_sse2(d1, d0); d1 = hilo_sse2(t, d1);
+
+    GB_sse2(&a0, &b0, &c1, &d0);
+    GB_sse2(&a1, &b1, &c0, &d1);
+
+    t = b0; b0 = hilo_sse2(b1, b0); b1 = hilo_sse2(t, b1);
+    t = d0; d0 = hilo_sse2(d0, d1); d1 = hilo_sse2(d1, t);
+
+    v[0*stride] = a0; v[1*stride] = a1;
+    v[2*stride] = b0; v[3*stride] = b1;
+    v[4*stride] = c0; v[5*stride] = c1;
+    v[6*stride] = d0; v[7*stride] = d1;
+}
+
+static FUNC_ISA_SSE2 void G_xor_sse2(
+    uint8_t *out, const uint8_t *X, const uint8_t *Y)
+{
+    /* x86 is little-endian, so we can load the words directly */
+    __m128i R[64], Q[64];
+
+    for (unsigned i = 0; i < 64; i++)
+        Q[i] = R[i] = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(X + 16*i)),
+            _mm_loadu_si128((const __m128i *)(Y + 16*i)));
+
+    for (unsigned i = 0; i < 8; i++)
+        P_sse2(Q + 8*i, 1);
+
+    for (unsigned i = 0; i < 8; i++)
+        P_sse2(Q + i, 8);
+
+    for (unsigned i = 0; i < 64; i++) {
+        __m128i *p = (__m128i *)(out + 16*i);
+        _mm_storeu_si128(p, _mm_xor_si128(
+                             _mm_loadu_si128(p), _mm_xor_si128(R[i], Q[i])));
+    }
+
+    smemclr(R, sizeof(R));
+    smemclr(Q, sizeof(Q));
+}
+
+/*
+ * AVX2 version. Now each vector holds two of the pairs, so that one
+ * P is four GB calls on whole vectors; we run two Ps side by side to
+ * give the processor some independent work to overlap.
+ */
+static inline FUNC_ISA_AVX2 __m256i blamka_avx2(__m256i x, __m256i y)
+{
+    __m256i xy = _mm256_mul_epu32(x, y);
+    return _mm256_add_epi64(_mm256_add_epi64(x, y),
+                            _mm256_add_epi64(xy, xy));
+}
+
+static inline FUNC_ISA_AVX2 void GB_avx2(
+    __m256i *a, __m256i *b, __m256i *c, __m256i *d)
+{
+    /* The rotations by multiples of 8 bits are byte shuffles */
+    const __m256i rot24 = _mm256_setr_epi8(
+        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const __m256i rot16 = _mm256_setr_epi8(
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+    __m256i t;
+
+    *a = blamka_avx2(*a, *b);
+    *d = _mm256_shuffle_epi32(_mm256_xor_si256(*d, *a),
+                              _MM_SHUFFLE(2, 3, 0, 1));
+    *c = blamka_avx2(*c, *d);
+    *b = _mm256_shuffle_epi8(_mm256_xor_si256(*b, *c), rot24);
+    *a = blamka_avx2(*a, *b);
+    *d = _mm256_shuffle_epi8(_mm256_xor_si256(*d, *a), rot16);
+    *c = blamka_avx2(*c, *d);
+    t = _mm256_xor_si256(*b, *c);
+    *b = _mm256_xor_si256(_mm256_srli_epi64(t, 63), _mm256_add_epi64(t, t));
+}
+
+static inline FUNC_ISA_AVX2 __m256i load_pairs_avx2(
+    const __m128i *lo, const __m128i *hi)
+{
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(lo)), _mm_loadu_si128(hi), 1);
+}
+
+static inline FUNC_ISA_AVX2 void store_pairs_avx2(
+    __m128i *lo, __m128i *hi, __m256i x)
+{
+    _mm_storeu_si128(lo, _mm256_castsi256_si128(x));
+    _mm_storeu_si128(hi, _mm256_extracti128_si256(x, 1));
+}
+
+/* Apply P in place to the pairs v[0], v[stride], ..., v[7*stride], and
+ * likewise to the ones starting at w. */
+static inline FUNC_ISA_AVX2 void P2_avx2(
+    __m128i *v, __m128i *w, size_t stride)
+{
+    __m256i a0 = load_pairs_avx2(v + 0*stride, v + 1*stride);
+    __m256i b0 = load_pairs_avx2(v + 2*stride, v + 3*stride);
+    __m256i c0 = load_pairs_avx2(v + 4*stride, v + 5*stride);
+    __m256i d0 = load_pairs_avx2(v + 6*stride, v + 7*stride);
+    __m256i a1 = load_pairs_avx2(w + 0*stride, w + 1*stride);
+    __m256i b1 = load_pairs_avx2(w + 2*stride, w + 3*stride);
+    __m256i c1 = load_pairs_avx2(w + 4*stride, w + 5*stride);
+    __m256i d1 = load_pairs_avx2(w + 6*stride, w + 7*stride);
+
+    GB_avx2(&a0, &b0, &c0, &d0);
+    GB_avx2(&a1, &b1, &c1, &d1);
+
+    /* Rotate the lanes of the b, c and d rows so that the diagonals
+     * line up, and afterwards rotate them back again. */
+    b0 = _mm256_permute4x64_epi64(b0, _MM_SHUFFLE(0, 3, 2, 1));
+    c0 = _mm256_permute4x64_epi64(c0, _MM_SHUFFLE(1, 0, 3, 2));
+    d0 = _mm256_permute4x64_epi64(d0, _MM_SHUFFLE(2, 1, 0, 3));
+    b1 = _mm256_permute4x64_epi64(b1, _MM_SHUFFLE(0, 3, 2, 1));
+    c1 = _mm256_permute4x64_epi64(c1, _MM_SHUFFLE(1, 0, 3, 2));
+    d1 = _mm256_permute4x64_epi64(d1, _MM_SHUFFLE(2, 1, 0, 3));
+
+    GB_avx2(&a0, &b0, &c0, &d0);
+    GB_avx2(&a1, &b1, &c1, &d1);
+
+    b0 = _mm256_permute4x64_epi64(b0, _MM_SHUFFLE(2, 1, 0, 3));
+    c0 = _mm256_permute4x64_epi64(c0, _MM_SHUFFLE(1, 0, 3, 2));
+    d0 = _mm256_permute4x64_epi64(d0, _MM_SHUFFLE(0, 3, 2, 1));
+    b1 = _mm256_permute4x64_epi64(b1, _MM_SHUFFLE(2, 1, 0, 3));
+    c1 = _mm256_permute4x64_epi64(c1, _MM_SHUFFLE(1, 0, 3, 2));
+    d1 = _mm256_permute4x64_epi64(d1, _MM_SHUFFLE(0, 3, 2, 1));
+
+    store_pairs_avx2(v + 0*stride, v + 1*stride, a0);
+    store_pairs_avx2(v + 2*stride, v + 3*stride, b0);
+    store_pairs_avx2(v + 4*stride, v + 5*stride, c0);
+    store_pairs_avx2(v + 6*stride, v + 7*stride, d0);
+    store_pairs_avx2(w + 0*stride, w + 1*stride, a1);
+    store_pairs_avx2(w + 2*stride, w + 3*stride, b1);
+    store_pairs_avx2(w + 4*stride, w + 5*stride, c1);
+    store_pairs_avx2(w + 6*stride, w + 7*stride, d1);
+}
+
+static FUNC_ISA_AVX2 void G_xor_avx2(
+    uint8_t *out, const uint8_t *X, const uint8_t *Y)
+{
+    __m256i R[32], Q[32];
+    __m128i *Q2 = (__m128i *)Q;
+
+    for (unsigned i = 0; i < 32; i++)
+        Q[i] = R[i] = _mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)(X + 32*i)),
+            _mm256_loadu_si256((const __m256i *)(Y + 32*i)));
+
+    for (unsigned i = 0; i < 8; i += 2)
+        P2_avx2(Q2 + 8*i, Q2 + 8*(i+1), 1);
+
+    for (unsigned i = 0; i < 8; i += 2)
+        P2_avx2(Q2 + i, Q2 + i+1, 8);
+
+    for (unsigned i = 0; i < 32; i++) {
+        __m256i *p = (__m256i *)(out + 32*i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(
+                                _mm256_loadu_si256(p),
+                                _mm256_xor_si256(R[i], Q[i])));
+    }
+
+    smemclr(R, sizeof(R));
+    smemclr(Q, sizeof(Q));
+}
+
+#else /* HW_ARGON2 == HW_ARGON2_NONE */
+
+static bool argon2_sse2_available(void)
+{
+    return false;
+}
+
+static bool argon2_avx2_available(void)
+{
+    return false;
+}
+
+/* These should never be called, because G_xor_select won't choose
+ * them if the availability checks above fail */
+#define STUB_BODY { unreachable("Should never be called"); }
+static void G_xor_sse2(uint8_t *out, const uint8_t *X, const uint8_t *Y)
+    STUB_BODY
+static void G_xor_avx2(uint8_t *out, const uint8_t *X, const uint8_t *Y)
+    STUB_BODY
+
+#endif /* HW_ARGON2 */
+
+/*
+ * Choose the widest implementation of G available. The CPU checks
+ * are only done once. Tests can override the choice, to check every
+ * implementation the CPU supports.
+ */
+static G_xor_fn G_xor_forced;
+
+bool argon2_force_impl(const char *name)
+{
+    if (!name)
+        G_xor_forced = NULL;
+    else if (!strcmp(name, "sw"))
+        G_xor_forced = G_xor_sw;
+    else if (!strcmp(name, "sse2") && argon2_sse2_available())
+        G_xor_forced = G_xor_sse2;
+    else if (!strcmp(name, "avx2") && argon2_avx2_available())
+        G_xor_forced = G_xor_avx2;
+    else
+        return false;
+    return true;
+}
+
+static G_xor_fn G_xor_select(void)
+{
+    static bool initialised = false;
+    static G_xor_fn G_xor;
+    if (G_xor_forced)
+        return G_xor_forced;
+    if (!initialised) {
+        if (argon2_avx2_available())
+            G_xor = G_xor_avx2;
+        else if (argon2_sse2_available())
+            G_xor = G_xor_sse2;
+        else
+            G_xor = G_xor_sw;
+        initialised = true;
+    }
+    return G_xor;
+}
+
+/* ----------------------------------------------------------------------
+ * Processing of one segment of the Argon2 block array. This is
+ * separated out from the main function so that the segments making
+ * up a slice can be handed out to different threads.
+ */
+
+struct blk { uint8_t data[1024]; };
+
+/* Per-thread scratch space for generating pseudorandom addresses in the
+ * data-independent mode */
+typedef struct argon2_scratch {
+    struct blk out2i, tmp2i, in2i;
+} argon2_scratch;
+
+typedef struct argon2_state {
+    /* Parameters of the hash, and dimensions of the block array (see the
+     * main function below for what these all mean) */
+    uint32_t p, t, y;
+    size_t SL, q, mprime;
+    struct blk *B;
+
+    /* Implementation of G to use */
+    G_xor_fn G_xor;
+
+    /* Our position in the main loop, which is what varies between one
+     * slice and the next */
+    size_t pass, jstart;
+    unsigned slice;
+    bool d_mode;
+
+    /* The lanes are divided between nworkers workers, each with its
+     * own scratch space */
+    size_t nworkers;
+    argon2_scratch *scratch;
+} argon2_state;
+
+static void argon2_segment(const argon2_state *st, size_t i,
+                           argon2_scratch *sc)
+{
+    uint32_t p = st->p, t = st->t, y = st->y;
+    size_t SL = st->SL, q = st->q, mprime = st->mprime;
+    struct blk *B = st->B;
+    G_xor_fn G_xor = st->G_xor;
+    size_t pass = st->pass, jstart = st->jstart;
+    unsigned slice = st->slice;
+    bool d_mode = st->d_mode;
+
+    /* Process the blocks of the segment in lane i from left to right,
+     * starting at 'jstart' (usually 0, but 2 in the first slice). */
+    for (size_t jpre = jstart; jpre < SL; jpre++) {
+
+        /* j is the x-coordinate of each block we process, made up
+         * of the slice number and the index 'jpre' within the
+         * segment. */
+        size_t j = slice * SL + jpre;
+
+        /* jm1 is j-1 (mod q) */
+        uint32_t jm1 = (j == 0 ? q-1 : j-1);
+
+        /*
+         * Construct two 32-bit pseudorandom integers J1 and J2.
+         * This is the part of the algorithm that varies between
+         * the data-dependent and independent modes.
+         */
+        uint32_t J1, J2;
+        if (d_mode) {
+            /*
+             * Data-dependent: grab the first 64 bits of the block
+             * to the left of this one.
+             */
+            J1 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data);
+            J2 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data + 4);
+        } else {
+            /*
+             * Data-independent: generate pseudorandom data by
+             * hashing a sequence of preimage blocks that include
+             * all our input parameters, plus the coordinates of
+             * this point in the algorithm (array position and
+             * pass number) to make all the hash outputs distinct.
+             *
+             * The hash we use is G itself, applied twice. So we
+             * generate 1Kb of data at a time, which is enough for
+             * 128 (J1,J2) pairs. Hence we only need to do the
+             * hashing if our index within the segment is a
+             * multiple of 128, or if we're at the very start of
+             * the algorithm (in which case we started at 2 rather
+             * than 0). After that we can just keep picking data
+             * out of our most recent hash output.
+             */
+            if (jpre == jstart || jpre % 128 == 0) {
+                /*
+                 * Hash preimage is mostly zeroes, with a
+                 * collection of assorted integer values we had
+                 * anyway.
+                 */
+                memset(sc->in2i.data, 0, sizeof(sc->in2i.data));
+                PUT_64BIT_LSB_FIRST(sc->in2i.data +  0, pass);
+                PUT_64BIT_LSB_FIRST(sc->in2i.data +  8, i);
+                PUT_64BIT_LSB_FIRST(sc->in2i.data + 16, slice);
+                PUT_64BIT_LSB_FIRST(sc->in2i.data + 24, mprime);
+                PUT_64BIT_LSB_FIRST(sc->in2i.data + 32, t);
+                PUT_64BIT_LSB_FIRST(sc->in2i.data + 40, y);
+                PUT_64BIT_LSB_FIRST(sc->in2i.data + 48, jpre / 128 + 1);
+
+                /*
+                 * Now apply G twice to generate the hash output
+                 * in out2i.
+                 */
+                memset(sc->tmp2i.data, 0, sizeof(sc->tmp2i.data));
+                G_xor(sc->tmp2i.data, sc->tmp2i.data, sc->in2i.data);
+                memset(sc->out2i.data, 0, sizeof(sc->out2i.data));
+                G_xor(sc->out2i.data, sc->out2i.data, sc->tmp2i.data);
+            }
+
+            /*
+             * Extract J1 and J2 from the most recent hash output
+             * (whether we've just computed it or not).
+             */
+            J1 = GET_32BIT_LSB_FIRST(
+                sc->out2i.data + 8 * (jpre % 128));
+            J2 = GET_32BIT_LSB_FIRST(
+                sc->out2i.data + 8 * (jpre % 128) + 4);
+        }
+
+        /*
+         * Now convert J1 and J2 into the index of an existing
+         * block of the array to use as input to this step. This
+         * is fairly fiddly.
+         *
+         * The easy part: the y-coordinate of the input block is
+         * obtained by reducing J2 mod p, except that at the very
+         * start of the algorithm (processing the first slice on
+         * the first pass) we simply use the same y-coordinate as
+         * our output block.
+         *
+         * Note that it's safe to use the ordinary % operator
+         * here, without any concern for timing side channels: in
+         * data-independent mode J2 is not correlated to any
+         * secrets, and in data-dependent mode we're going to be
+         * giving away side-channel data _anyway_ when we use it
+         * as an array index (and by assumption we don't care,
+         * because it's already massively randomised from the real
+         * inputs).
+         */
+        uint32_t index_l = (pass == 0 && slice == 0) ? i : J2 % p;
+
+        /*
+         * The hard part: which block in this array row do we use?
+         *
+         * First, we decide what the possible candidates are. This
+         * requires some case analysis, and depends on whether the
+         * array row is the same one we're writing into or not.
+         *
+         * If it's not the same row: we can't use any block from
+         * the current slice (because the segments within a slice
+         * have to be processable in parallel, so in a concurrent
+         * implementation those blocks are potentially in the
+         * process of being overwritten by other threads). But the
+         * other three slices are fair game, except that in the
+         * first pass, slices to the right of us won't have had
+         * any values written into them yet at all.
+         *
+         * If it is the same row, we _are_ allowed to use blocks
+         * from the current slice, but only the ones before our
+         * current position.
+         *
+         * In both cases, we also exclude the individual _column_
+         * just to the left of the current one. (The block
+         * immediately to our left is going to be the _other_
+         * input to G, but the spec also says that we avoid that
+         * column even in a different row.)
+         *
+         * All of this means that we end up choosing from a
+         * cyclically contiguous interval of blocks within this
+         * lane, but the start and end points require some thought
+         * to get them right.
+         */
+
+        /* Start position is the beginning of the _next_ slice
+         * (containing data from the previous pass), unless we're
+         * on pass 0, where the start position has to be 0. */
+        uint32_t Wstart = (pass == 0 ? 0 : (slice + 1) % 4 * SL);
+
+        /* End position splits up by cases. */
+        uint32_t Wend;
+        if (index_l == i) {
+            /* Same lane as output: we can use anything up to (but
+             * not including) the block immediately left of us. */
+            Wend = jm1;
+        } else {
+            /* Different lane from output: we can use anything up
+             * to the previous slice boundary, or one less than
+             * that if we're at the very left edge of our slice
+             * right now. */
+            Wend = SL * slice;
+            if (jpre == 0)
+                Wend = (Wend + q-1) % q;
+        }
+
+        /* Total number of blocks available to choose from */
+        uint32_t Wsize = (Wend + q - Wstart) % q;
+
+        /* Fiddly computation from the spec that chooses from the
+         * available blocks, in a deliberately non-uniform
+         * fashion, using J1 as pseudorandom input data. Output is
+         * zz which is the index within our contiguous interval. */
+        uint32_t x = ((uint64_t)J1 * J1) >> 32;
+        uint32_t y = ((uint64_t)Wsize * x) >> 32;
+        uint32_t zz = Wsize - 1 - y;
+
+        /* And index_z is the actual x coordinate of the block we
+         * want. */
+        uint32_t index_z = (Wstart + zz) % q;
+
+        /* Phew! Combine that block with the one immediately to
+         * our left, and XOR over the top of whatever is already
+         * in our current output block. */
+        G_xor(B[i + p * j].data, B[i + p * jm1].data,
+              B[index_l + p * index_z].data);
+    }
+}
+
+/* Tests can override the number of workers, which is otherwise one
+ * per CPU (but never more than the number of lanes). */
+static size_t argon2_forced_workers;
+
+void argon2_force_workers(size_t nworkers)
+{
+    argon2_forced_workers = nworkers;
+}
+
+/* Worker function that processes a subset of the lanes of a slice. */
+static void argon2_worker(void *vctx, size_t index)
+{
+    argon2_state *st = (argon2_state *)vctx;
+    for (size_t i = index; i < st->p; i += st->nworkers)
+        argon2_segment(st, i, &st->scratch[index]);
+}
+
 /* ----------------------------------------------------------------------
  * The main Argon2 function.
  */
@@ -210,8 +800,6 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
         ssh_hash_final(h, h0);
     }
 
-    struct blk { uint8_t data[1024]; };
-
     /*
      * Array of 1Kb blocks. The total size is (approximately) m, the
      * caller-specified parameter for how much memory to use; the blocks are
@@ -274,9 +862,33 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
      * independent, and then once we've mixed things up enough, switch over to
      * dependent mode to force long serial chains of computation.
      */
-    size_t jstart = 2;
+    argon2_state st;
+    st.p = p;
+    st.t = t;
+    st.y = y;
+    st.SL = SL;
+    st.q = q;
+    st.mprime = mprime;
+    st.B = B;
+    st.G_xor = G_xor_select();
+    st.jstart = 2;
     bool d_mode = (y == 0);
-    struct blk out2i, tmp2i, in2i;
+
+    /*
+     * The segments of a slice can be processed concurrently, so we
+     * divide the lanes between as many worker threads as there are
+     * CPUs to run them on. Each worker needs its own scratch space for
+     * the data-independent addressing.
+     */
+    size_t maxworkers = (argon2_forced_workers ? argon2_forced_workers :
+                         worker_pool_ncpus());
+    st.nworkers = p;
+    if (st.nworkers > maxworkers)
+        st.nworkers = maxworkers;
+    WorkerPool *pool = worker_pool_new(st.nworkers, argon2_worker, &st);
+    if (!pool)
+        st.nworkers = 1;
+    st.scratch = snewn(st.nworkers, argon2_scratch);
 
     /* Outermost loop: t whole passes from left to right over the array */
     for (size_t pass = 0; pass < t; pass++) {
@@ -289,191 +901,21 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
             if (pass == 0 && slice == 2 && y == 2)
                 d_mode = true;
 
-            /* Loop over every segment in the slice (i.e. every row). So i is
-             * the y-coordinate of each block we process. */
-            for (size_t i = 0; i < p; i++) {
-
-                /* And within that segment, process the blocks from left to
-                 * right, starting at 'jstart' (usually 0, but 2 in the first
-                 * slice). */
-                for (size_t jpre = jstart; jpre < SL; jpre++) {
-
-                    /* j is the x-coordinate of each block we process, made up
-                     * of the slice number and the index 'jpre' within the
-                     * segment. */
-                    size_t j = slice * SL + jpre;
-
-                    /* jm1 is j-1 (mod q) */
-                    uint32_t jm1 = (j == 0 ? q-1 : j-1);
-
-                    /*
-                     * Construct two 32-bit pseudorandom integers J1 and J2.
-                     * This is the part of the algorithm that varies between
-                     * the data-dependent and independent modes.
-                     */
-                    uint32_t J1, J2;
-                    if (d_mode) {
-                        /*
-                         * Data-dependent: grab the first 64 bits of the block
-                         * to the left of this one.
-                         */
-                        J1 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data);
-                        J2 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data + 4);
-                    } else {
-                        /*
-                         * Data-independent: generate pseudorandom data by
-                         * hashing a sequence of preimage blocks that include
-                         * all our input parameters, plus the coordinates of
-                         * this point in the algorithm (array position and
-                         * pass number) to make all the hash outputs distinct.
-                         *
-                         * The hash we use is G itself, applied twice. So we
-                         * generate 1Kb of data at a time, which is enough for
-                         * 128 (J1,J2) pairs. Hence we only need to do the
-                         * hashing if our index within the segment is a
-                         * multiple of 128, or if we're at the very start of
-                         * the algorithm (in which case we started at 2 rather
-                         * than 0). After that we can just keep picking data
-                         * out of our most recent hash output.
-                         */
-                        if (jpre == jstart || jpre % 128 == 0) {
-                            /*
-                             * Hash preimage is mostly zeroes, with a
-                             * collection of assorted integer values we had
-                             * anyway.
-                             */
-                            memset(in2i.data, 0, sizeof(in2i.data));
-                            PUT_64BIT_LSB_FIRST(in2i.data +  0, pass);
-                            PUT_64BIT_LSB_FIRST(in2i.data +  8, i);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 16, slice);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 24, mprime);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 32, t);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 40, y);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 48, jpre / 128 + 1);
-
-                            /*
-                             * Now apply G twice to generate the hash output
-                             * in out2i.
-                             */
-                            memset(tmp2i.data, 0, sizeof(tmp2i.data));
-                            G_xor(tmp2i.data, tmp2i.data, in2i.data);
-                            memset(out2i.data, 0, sizeof(out2i.data));
-                            G_xor(out2i.data, out2i.data, tmp2i.data);
-                        }
-
-                        /*
-                         * Extract J1 and J2 from the most recent hash output
-                         * (whether we've just computed it or not).
-                         */
-                        J1 = GET_32BIT_LSB_FIRST(
-                            out2i.data + 8 * (jpre % 128));
-                        J2 = GET_32BIT_LSB_FIRST(
-                            out2i.data + 8 * (jpre % 128) + 4);
-                    }
-
-                    /*
-                     * Now convert J1 and J2 into the index of an existing
-                     * block of the array to use as input to this step. This
-                     * is fairly fiddly.
-                     *
-                     * The easy part: the y-coordinate of the input block is
-                     * obtained by reducing J2 mod p, except that at the very
-                     * start of the algorithm (processing the first slice on
-                     * the first pass) we simply use the same y-coordinate as
-                     * our output block.
-                     *
-                     * Note that it's safe to use the ordinary % operator
-                     * here, without any concern for timing side channels: in
-                     * data-independent mode J2 is not correlated to any
-                     * secrets, and in data-dependent mode we're going to be
-                     * giving away side-channel data _anyway_ when we use it
-                     * as an array index (and by assumption we don't care,
-                     * because it's already massively randomised from the real
-                     * inputs).
-                     */
-                    uint32_t index_l = (pass == 0 && slice == 0) ? i : J2 % p;
-
-                    /*
-                     * The hard part: which block in this array row do we use?
-                     *
-                     * First, we decide what the possible candidates are. This
-                     * requires some case analysis, and depends on whether the
-                     * array row is the same one we're writing into or not.
-                     *
-                     * If it's not the same row: we can't use any block from
-                     * the current slice (because the segments within a slice
-                     * have to be processable in parallel, so in a concurrent
-                     * implementation those blocks are potentially in the
-                     * process of being overwritten by other threads). But the
-                     * other three slices are fair game, except that in the
-                     * first pass, slices to the right of us won't have had
-                     * any values written into them yet at all.
-                     *
-                     * If it is the same row, we _are_ allowed to use blocks
-                     * from the current slice, but only the ones before our
-                     * current position.
-                     *
-                     * In both cases, we also exclude the individual _column_
-                     * just to the left of the current one. (The block
-                     * immediately to our left is going to be the _other_
-                     * input to G, but the spec also says that we avoid that
-                     * column even in a different row.)
-                     *
-                     * All of this means that we end up choosing from a
-                     * cyclically contiguous interval of blocks within this
-                     * lane, but the start and end points require some thought
-                     * to get them right.
-                     */
-
-                    /* Start position is the beginning of the _next_ slice
-                     * (containing data from the previous pass), unless we're
-                     * on pass 0, where the start position has to be 0. */
-                    uint32_t Wstart = (pass == 0 ? 0 : (slice + 1) % 4 * SL);
-
-                    /* End position splits up by cases. */
-                    uint32_t Wend;
-                    if (index_l == i) {
-                        /* Same lane as output: we can use anything up to (but
-                         * not including) the block immediately left of us. */
-                        Wend = jm1;
-                    } else {
-                        /* Different lane from output: we can use anything up
-                         * to the previous slice boundary, or one less than
-                         * that if we're at the very left edge of our slice
-                         * right now. */
-                        Wend = SL * slice;
-                        if (jpre == 0)
-                            Wend = (Wend + q-1) % q;
-                    }
-
-                    /* Total number of blocks available to choose from */
-                    uint32_t Wsize = (Wend + q - Wstart) % q;
-
-                    /* Fiddly computation from the spec that chooses from the
-                     * available blocks, in a deliberately non-uniform
-                     * fashion, using J1 as pseudorandom input data. Output is
-                     * zz which is the index within our contiguous interval. */
-                    uint32_t x = ((uint64_t)J1 * J1) >> 32;
-                    uint32_t y = ((uint64_t)Wsize * x) >> 32;
-                    uint32_t zz = Wsize - 1 - y;
-
-                    /* And index_z is the actual x coordinate of the block we
-                     * want. */
-                    uint32_t index_z = (Wstart + zz) % q;
-
-                    /* Phew! Combine that block with the one immediately to
-                     * our left, and XOR over the top of whatever is already
-                     * in our current output block. */
-                    G_xor(B[i + p * j].data, B[i + p * jm1].data,
-                          B[index_l + p * index_z].data);
-                }
-            }
+            /* Process every segment in the slice (i.e. every row), on
+             * as many threads as we've got */
+            st.pass = pass;
+            st.slice = slice;
+            st.d_mode = d_mode;
+            if (pool)
+                worker_pool_run(pool);
+            else
+                argon2_worker(&st, 0);
 
             /* We've finished processing a slice. Reset jstart to 0. It will
              * onily _not_ have been 0 if this was pass 0 slice 0, in which
              * case it still had its initial value of 2 to avoid the starting
              * data. */
-            jstart = 0;
+            st.jstart = 0;
         }
     }
 
@@ -497,9 +939,10 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
     /*
      * Clean up.
      */
-    smemclr(out2i.data, sizeof(out2i.data));
-    smemclr(tmp2i.data, sizeof(tmp2i.data));
-    smemclr(in2i.data, sizeof(in2i.data));
+    if (pool)
+        worker_pool_free(pool);
+    smemclr(st.scratch, st.nworkers * sizeof(argon2_scratch));
+    sfree(st.scratch);
     smemclr(C.data, sizeof(C.data));
     smemclr(B, mprime * sizeof(struct blk));
     sfree(B);
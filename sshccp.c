@@ -27,6 +27,11 @@
  * instantiation of the cipher using a different key and IV made from
  * the sequence number which is passed in addition when calling
  * encrypt/decrypt on it.
+ *
+ * On x86, the ChaCha20 keystream for packet contents can also be
+ * generated several blocks at a time using SSE2 or AVX2, with one
+ * block in each vector lane. As with AES, the implementation is
+ * chosen at run time by a selector vtable.
  */
 
 #include "ssh.h"
@@ -36,8 +41,51 @@
 #define INLINE
 #endif
 
+/*
+ * Start by deciding whether we can support vectorised ChaCha20 at
+ * all. Unlike AES-NI, this doesn't need any special instructions,
+ * only the compiler support for SSE2 and AVX2 intrinsics.
+ */
+#define HW_CHACHA20_NONE 0
+#define HW_CHACHA20_X86 1
+
+#ifdef _FORCE_CHACHA20_X86
+#   define HW_CHACHA20 HW_CHACHA20_X86
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<immintrin.h>) &&      \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_CHACHA20 HW_CHACHA20_X86
+#   endif
+#elif defined(__GNUC__)
+#    if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_CHACHA20 HW_CHACHA20_X86
+#    endif
+#elif defined (_MSC_VER)
+#   if (defined(_M_X64) || defined(_M_IX86)) && _MSC_VER >= 1800
+#      define HW_CHACHA20 HW_CHACHA20_X86
+#   endif
+#endif
+
+#if defined _FORCE_SOFTWARE_CHACHA20 || !defined HW_CHACHA20
+#   undef HW_CHACHA20
+#   define HW_CHACHA20 HW_CHACHA20_NONE
+#endif
+
 /* ChaCha20 implementation, only supporting 256-bit keys */
 
+/* The most keystream blocks any implementation generates at once */
+#define CHACHA20_MAX_BLOCKS 8
+
+struct chacha20;
+
+/*
+ * A function to generate at least nblocks blocks of keystream into
+ * ctx->current, advancing the counter. Returns the number of blocks
+ * actually generated, which is never more than CHACHA20_MAX_BLOCKS.
+ */
+typedef int (*chacha20_blocks_fn)(struct chacha20 *ctx, int nblocks);
+
 /* State for each ChaCha20 instance */
 struct chacha20 {
     /* Current context, usually with the count incremented
@@ -47,9 +95,13 @@ struct chacha20 {
      * 14-15 are the IV */
     uint32_t state[16];
     /* The output of the state above ready to xor */
-    unsigned char current[64];
-    /* The index of the above currently used to allow a true streaming cipher */
-    int currentIndex;
+    unsigned char current[64 * CHACHA20_MAX_BLOCKS];
+    /* How much of the above is valid, and the index of the part
+     * currently used to allow a true streaming cipher */
+    int currentLen, currentIndex;
+    /* Multi-block keystream generator, or NULL to use only
+     * chacha20_round */
+    chacha20_blocks_fn blocks;
 };
 
 static INLINE void chacha20_round(struct chacha20 *ctx)
@@ -108,6 +160,7 @@ static INLINE void chacha20_round(struct chacha20 *ctx)
         ctx->current[i * 4 + 3] = copy[i] >> 24;
     }
     /* State full, reset pointer to beginning */
+    ctx->currentLen = 64;
     ctx->currentIndex = 0;
     smemclr(copy, sizeof(copy));
 
@@ -141,7 +194,7 @@ static void chacha20_key(struct chacha20 *ctx, const unsigned char *key)
     ctx->state[11] = GET_32BIT_LSB_FIRST(key + 28);
 
     /* New key, dump context */
-    ctx->currentIndex = 64;
+    ctx->currentLen = ctx->currentIndex = 0;
 }
 
 static void chacha20_iv(struct chacha20 *ctx, const unsigned char *iv)
@@ -152,22 +205,29 @@ static void chacha20_iv(struct chacha20 *ctx, const unsigned char *iv)
     ctx->state[15] = GET_32BIT_MSB_FIRST(iv + 4);
 
     /* New IV, dump context */
-    ctx->currentIndex = 64;
+    ctx->currentLen = ctx->currentIndex = 0;
 }
 
 static void chacha20_encrypt(struct chacha20 *ctx, unsigned char *blk, int len)
 {
     while (len) {
-        /* If we don't have any state left, then cycle to the next */
-        if (ctx->currentIndex >= 64) {
-            chacha20_round(ctx);
+        /* If we don't have any state left, then cycle to the next,
+         * several blocks at a time if there's enough data to use
+         * them and we can do it faster than one by one */
+        if (ctx->currentIndex >= ctx->currentLen) {
+            int nblocks = (len + 63) / 64;
+            if (ctx->blocks && nblocks > 1)
+                ctx->blocks(ctx, nblocks);
+            else
+                chacha20_round(ctx);
         }
 
         /* Do the xor while there's some state left and some plaintext left */
-        while (ctx->currentIndex < 64 && len) {
-            *blk++ ^= ctx->current[ctx->currentIndex++];
-            --len;
-        }
+        int n = min(len, ctx->currentLen - ctx->currentIndex);
+        memxor(blk, blk, ctx->current + ctx->currentIndex, n);
+        ctx->currentIndex += n;
+        blk += n;
+        len -= n;
     }
 }
 
@@ -178,6 +238,219 @@ static INLINE void chacha20_decrypt(struct chacha20 *ctx,
     chacha20_encrypt(ctx, blk, len);
 }
 
+#if HW_CHACHA20 == HW_CHACHA20_X86
+
+#if defined(__clang__) || defined(__GNUC__)
+#    define FUNC_ISA_SSE2 __attribute__ ((target("sse2")))
+#    define FUNC_ISA_AVX2 __attribute__ ((target("avx2")))
+#else
+#    define FUNC_ISA_SSE2
+#    define FUNC_ISA_AVX2
+#endif
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include "sshcpuid.h"
+
+static bool chacha20_sse2_available(void)
+{
+    return x86_sse2_available();
+}
+
+static bool chacha20_avx2_available(void)
+{
+    return x86_avx2_available();
+}
+
+/*
+ * Work out the block counters for the next n blocks, which the
+ * vectorised implementations load one per lane, and advance the
+ * counter in the state past them.
+ */
+static void chacha20_lane_counters(struct chacha20 *ctx, int n,
+                                   uint32_t *lo, uint32_t *hi)
+{
+    for (int i = 0; i < n; i++) {
+        lo[i] = ctx->state[12] + i;
+        hi[i] = ctx->state[13] + (lo[i] < ctx->state[12]);
+    }
+    ctx->state[12] += n;
+    /* Check for overflow, as in chacha20_round */
+    if ((uint32_t)ctx->state[12] < (uint32_t)n) {
+        ++ctx->state[13];
+    }
+}
+
+/*
+ * The vectorised implementations keep each of the 16 state words in
+ * its own vector register, with one keystream block in each lane.
+ * So the rounds are exactly the same as in chacha20_round, and the
+ * only reshuffling needed is a transpose at the end to turn lanes
+ * back into blocks.
+ */
+#define CHACHA20_QUARTER(x, add, xor, rotl, a, b, c, d) do {            \
+        x[a] = add(x[a], x[b]); x[d] = xor(x[d], x[a]); x[d] = rotl(x[d], 16); \
+        x[c] = add(x[c], x[d]); x[b] = xor(x[b], x[c]); x[b] = rotl(x[b], 12); \
+        x[a] = add(x[a], x[b]); x[d] = xor(x[d], x[a]); x[d] = rotl(x[d], 8); \
+        x[c] = add(x[c], x[d]); x[b] = xor(x[b], x[c]); x[b] = rotl(x[b], 7); \
+    } while (0)
+
+#define CHACHA20_ROUNDS(x, add, xor, rotl) do {                         \
+        for (int i = 0; i < 20; i += 2) {                               \
+            CHACHA20_QUARTER(x, add, xor, rotl, 0, 4, 8, 12);           \
+            CHACHA20_QUARTER(x, add, xor, rotl, 1, 5, 9, 13);           \
+            CHACHA20_QUARTER(x, add, xor, rotl, 2, 6, 10, 14);          \
+            CHACHA20_QUARTER(x, add, xor, rotl, 3, 7, 11, 15);          \
+            CHACHA20_QUARTER(x, add, xor, rotl, 0, 5, 10, 15);          \
+            CHACHA20_QUARTER(x, add, xor, rotl, 1, 6, 11, 12);          \
+            CHACHA20_QUARTER(x, add, xor, rotl, 2, 7, 8, 13);           \
+            CHACHA20_QUARTER(x, add, xor, rotl, 3, 4, 9, 14);           \
+        }                                                               \
+    } while (0)
+
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n),              \
+                                     _mm_srli_epi32(v, 32 - (n)))
+
+/* Four blocks at a time, in 128-bit SSE2 registers */
+static FUNC_ISA_SSE2 int chacha20_blocks_sse2(
+    struct chacha20 *ctx, int nblocks)
+{
+    uint32_t lo[4], hi[4];
+    __m128i x[16], orig[16];
+
+    chacha20_lane_counters(ctx, 4, lo, hi);
+    for (int i = 0; i < 16; i++)
+        orig[i] = _mm_set1_epi32(ctx->state[i]);
+    orig[12] = _mm_loadu_si128((const __m128i *)lo);
+    orig[13] = _mm_loadu_si128((const __m128i *)hi);
+    for (int i = 0; i < 16; i++)
+        x[i] = orig[i];
+
+    CHACHA20_ROUNDS(x, _mm_add_epi32, _mm_xor_si128, SSE2_ROTL);
+
+    for (int i = 0; i < 16; i++)
+        x[i] = _mm_add_epi32(x[i], orig[i]);
+
+    /* Transpose each group of four words, and store them to the
+     * appropriate position in each of the four blocks */
+    unsigned char *out = ctx->current;
+    for (int g = 0; g < 16; g += 4) {
+        __m128i t0 = _mm_unpacklo_epi32(x[g], x[g+1]);
+        __m128i t1 = _mm_unpacklo_epi32(x[g+2], x[g+3]);
+        __m128i t2 = _mm_unpackhi_epi32(x[g], x[g+1]);
+        __m128i t3 = _mm_unpackhi_epi32(x[g+2], x[g+3]);
+        _mm_storeu_si128((__m128i *)(out + 4*g),
+                         _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)(out + 64 + 4*g),
+                         _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *)(out + 128 + 4*g),
+                         _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *)(out + 192 + 4*g),
+                         _mm_unpackhi_epi64(t2, t3));
+    }
+
+    smemclr(x, sizeof(x));
+    smemclr(orig, sizeof(orig));
+
+    ctx->currentLen = 4 * 64;
+    ctx->currentIndex = 0;
+    return 4;
+}
+
+/* In AVX2, the 16- and 8-bit rotations can be done as byte shuffles */
+static FUNC_ISA_AVX2 inline __m256i chacha20_avx2_rotl(__m256i v, int n)
+{
+    if (n == 16) {
+        const __m256i mask = _mm256_setr_epi8(
+            2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+            2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+        return _mm256_shuffle_epi8(v, mask);
+    } else if (n == 8) {
+        const __m256i mask = _mm256_setr_epi8(
+            3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+            3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+        return _mm256_shuffle_epi8(v, mask);
+    } else {
+        return _mm256_or_si256(_mm256_slli_epi32(v, n),
+                               _mm256_srli_epi32(v, 32 - n));
+    }
+}
+
+/* Eight blocks at a time, in 256-bit AVX2 registers */
+static FUNC_ISA_AVX2 int chacha20_blocks_avx2(
+    struct chacha20 *ctx, int nblocks)
+{
+    /* For a short run, four blocks at a time is enough */
+    if (nblocks <= 4)
+        return chacha20_blocks_sse2(ctx, nblocks);
+
+    uint32_t lo[8], hi[8];
+    __m256i x[16], orig[16];
+
+    chacha20_lane_counters(ctx, 8, lo, hi);
+    for (int i = 0; i < 16; i++)
+        orig[i] = _mm256_set1_epi32(ctx->state[i]);
+    orig[12] = _mm256_loadu_si256((const __m256i *)lo);
+    orig[13] = _mm256_loadu_si256((const __m256i *)hi);
+    for (int i = 0; i < 16; i++)
+        x[i] = orig[i];
+
+    CHACHA20_ROUNDS(x, _mm256_add_epi32, _mm256_xor_si256,
+                    chacha20_avx2_rotl);
+
+    for (int i = 0; i < 16; i++)
+        x[i] = _mm256_add_epi32(x[i], orig[i]);
+
+    /* Transpose as in the SSE2 version, which leaves blocks j and
+     * j+4 in the low and high halves of each 256-bit result */
+    unsigned char *out = ctx->current;
+    for (int g = 0; g < 16; g += 4) {
+        __m256i t0 = _mm256_unpacklo_epi32(x[g], x[g+1]);
+        __m256i t1 = _mm256_unpacklo_epi32(x[g+2], x[g+3]);
+        __m256i t2 = _mm256_unpackhi_epi32(x[g], x[g+1]);
+        __m256i t3 = _mm256_unpackhi_epi32(x[g+2], x[g+3]);
+        __m256i r[4];
+        r[0] = _mm256_unpacklo_epi64(t0, t1);
+        r[1] = _mm256_unpackhi_epi64(t0, t1);
+        r[2] = _mm256_unpacklo_epi64(t2, t3);
+        r[3] = _mm256_unpackhi_epi64(t2, t3);
+        for (int j = 0; j < 4; j++) {
+            _mm_storeu_si128((__m128i *)(out + 64*j + 4*g),
+                             _mm256_castsi256_si128(r[j]));
+            _mm_storeu_si128((__m128i *)(out + 64*(j+4) + 4*g),
+                             _mm256_extracti128_si256(r[j], 1));
+        }
+    }
+
+    smemclr(x, sizeof(x));
+    smemclr(orig, sizeof(orig));
+
+    ctx->currentLen = 8 * 64;
+    ctx->currentIndex = 0;
+    return 8;
+}
+
+#else /* HW_CHACHA20 == HW_CHACHA20_NONE */
+
+static bool chacha20_sse2_available(void)
+{
+    return false;
+}
+
+static bool chacha20_avx2_available(void)
+{
+    return false;
+}
+
+/* These should never be called, because the ccp_new functions that
+ * would install them return NULL */
+#define STUB_BODY { unreachable("Should never be called"); }
+static int chacha20_blocks_sse2(struct chacha20 *ctx, int nblocks) STUB_BODY
+static int chacha20_blocks_avx2(struct chacha20 *ctx, int nblocks) STUB_BODY
+
+#endif /* HW_CHACHA20 */
+
 /* Poly1305 implementation (no AES, nonce is not encrypted) */
 
 #define NWORDS ((130 + BIGNUM_INT_BITS-1) / BIGNUM_INT_BITS)
@@ -755,6 +1028,21 @@ static void bigval_final_reduce(bigval *n)
 #error Add another bit count to contrib/make1305.py and rerun it
 #endif
 
+struct poly1305;
+
+/*
+ * A function to absorb a run of whole 16-byte blocks several at a
+ * time. It may leave some of them unprocessed (e.g. if the number
+ * isn't a multiple of its parallelism), and returns the number it
+ * did absorb.
+ */
+typedef size_t (*poly1305_blocks_fn)(
+    struct poly1305 *ctx, const unsigned char *buf, size_t nblocks);
+
+/* Don't bother with a multi-block function for fewer bytes than this,
+ * because it has to compute powers of r before it can start */
+#define POLY1305_MULTI_THRESHOLD 256
+
 struct poly1305 {
     unsigned char nonce[16];
     bigval r;
@@ -763,6 +1051,13 @@ struct poly1305 {
     /* Buffer in case we get less that a multiple of 16 bytes */
     unsigned char buffer[16];
     int bufferIndex;
+
+    /* Multi-block implementation, or NULL to use only bigval code */
+    poly1305_blocks_fn blocks;
+    /* r^4, r^3, r^2 and r in radix 2^26, computed on first use of
+     * the multi-block function after each key change */
+    bool powers_ready;
+    uint32_t rpow[4][5];
 };
 
 static void poly1305_init(struct poly1305 *ctx)
@@ -791,11 +1086,219 @@ static void poly1305_key(struct poly1305 *ctx, ptrlen key)
     key_copy[12] &= 0xfc;
     bigval_import_le(&ctx->r, key_copy, 16);
     smemclr(key_copy, sizeof(key_copy));
+    ctx->powers_ready = false;
 
     /* Use second 128 bits as the nonce */
     memcpy(ctx->nonce, (const char *)key.ptr + 16, 16);
 }
 
+/*
+ * Conversions between bigval and five limbs in radix 2^26, which is
+ * the representation used by the vectorised implementation. The
+ * limbs going into limbs_to_bigval must be fully carried, i.e. all
+ * but the top one less than 2^26.
+ */
+static void poly1305_bigval_to_limbs(const bigval *v, uint32_t *l)
+{
+    unsigned char bytes[17];
+    bigval_export_le(v, bytes, 17);
+    uint64_t t0 = GET_64BIT_LSB_FIRST(bytes);
+    uint64_t t1 = GET_64BIT_LSB_FIRST(bytes + 8);
+    l[0] = t0 & 0x3ffffff;
+    l[1] = (t0 >> 26) & 0x3ffffff;
+    l[2] = ((t0 >> 52) | (t1 << 12)) & 0x3ffffff;
+    l[3] = (t1 >> 14) & 0x3ffffff;
+    l[4] = (t1 >> 40) | ((uint32_t)bytes[16] << 24);
+    smemclr(bytes, sizeof(bytes));
+}
+
+static void poly1305_limbs_to_bigval(bigval *v, const uint32_t *l)
+{
+    unsigned char bytes[17];
+    PUT_64BIT_LSB_FIRST(bytes, ((uint64_t)l[0] | ((uint64_t)l[1] << 26) |
+                                ((uint64_t)l[2] << 52)));
+    PUT_64BIT_LSB_FIRST(bytes + 8, (((uint64_t)l[2] >> 12) |
+                                    ((uint64_t)l[3] << 14) |
+                                    ((uint64_t)l[4] << 40)));
+    bytes[16] = l[4] >> 24;
+    bigval_import_le(v, bytes, 17);
+    smemclr(bytes, sizeof(bytes));
+}
+
+static void poly1305_compute_powers(struct poly1305 *ctx)
+{
+    bigval pow, tmp;
+
+    pow = ctx->r;
+    for (int i = 3; i >= 0; i--) {
+        if (i < 3) {
+            bigval_mul_mod_p(&tmp, &pow, &ctx->r);
+            pow = tmp;
+        }
+        tmp = pow;
+        bigval_final_reduce(&tmp);
+        poly1305_bigval_to_limbs(&tmp, ctx->rpow[i]);
+    }
+    smemclr(&pow, sizeof(pow));
+    smemclr(&tmp, sizeof(tmp));
+    ctx->powers_ready = true;
+}
+
+#if HW_CHACHA20 == HW_CHACHA20_X86
+
+/*
+ * AVX2 implementation, absorbing four blocks at a time with one in
+ * each 64-bit lane. The accumulator in lane i has the ith of each
+ * group of four blocks added to it, and at each step all four lanes
+ * are multiplied by r^4. At the end, the lanes are multiplied by
+ * r^4, r^3, r^2 and r respectively and summed, which gives the same
+ * result as absorbing the blocks one by one.
+ *
+ * Each multiplication is a schoolbook product of five 26-bit limbs
+ * by five, using the identity 2^130 = 5 (mod p) to fold the top half
+ * of the product back down, and then a partial carry to bring the
+ * limbs back into range.
+ */
+
+static FUNC_ISA_AVX2 inline void poly1305_avx2_mulmod(
+    __m256i *h, const __m256i *r, const __m256i *s)
+{
+#define MUL _mm256_mul_epu32
+#define ADD _mm256_add_epi64
+    __m256i d0 = ADD(ADD(ADD(ADD(MUL(h[0], r[0]), MUL(h[1], s[4])),
+                             MUL(h[2], s[3])), MUL(h[3], s[2])),
+                     MUL(h[4], s[1]));
+    __m256i d1 = ADD(ADD(ADD(ADD(MUL(h[0], r[1]), MUL(h[1], r[0])),
+                             MUL(h[2], s[4])), MUL(h[3], s[3])),
+                     MUL(h[4], s[2]));
+    __m256i d2 = ADD(ADD(ADD(ADD(MUL(h[0], r[2]), MUL(h[1], r[1])),
+                             MUL(h[2], r[0])), MUL(h[3], s[4])),
+                     MUL(h[4], s[3]));
+    __m256i d3 = ADD(ADD(ADD(ADD(MUL(h[0], r[3]), MUL(h[1], r[2])),
+                             MUL(h[2], r[1])), MUL(h[3], r[0])),
+                     MUL(h[4], s[4]));
+    __m256i d4 = ADD(ADD(ADD(ADD(MUL(h[0], r[4]), MUL(h[1], r[3])),
+                             MUL(h[2], r[2])), MUL(h[3], r[1])),
+                     MUL(h[4], r[0]));
+
+    const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+    __m256i c;
+#define CARRY(from, to)                                         \
+    c = _mm256_srli_epi64(from, 26);                            \
+    from = _mm256_and_si256(from, mask);                        \
+    to = ADD(to, c)
+    CARRY(d0, d1);
+    CARRY(d3, d4);
+    CARRY(d1, d2);
+    c = _mm256_srli_epi64(d4, 26);
+    d4 = _mm256_and_si256(d4, mask);
+    d0 = ADD(d0, ADD(c, _mm256_slli_epi64(c, 2)));
+    CARRY(d2, d3);
+    CARRY(d0, d1);
+    CARRY(d3, d4);
+#undef CARRY
+#undef MUL
+#undef ADD
+
+    h[0] = d0;
+    h[1] = d1;
+    h[2] = d2;
+    h[3] = d3;
+    h[4] = d4;
+}
+
+/* Split four consecutive blocks into limbs, one block per lane, and
+ * add them to the accumulator */
+static FUNC_ISA_AVX2 inline void poly1305_avx2_absorb(
+    __m256i *h, const unsigned char *buf)
+{
+    uint64_t m[5][4];
+    for (int i = 0; i < 4; i++, buf += 16) {
+        uint64_t t0 = GET_64BIT_LSB_FIRST(buf);
+        uint64_t t1 = GET_64BIT_LSB_FIRST(buf + 8);
+        m[0][i] = t0 & 0x3ffffff;
+        m[1][i] = (t0 >> 26) & 0x3ffffff;
+        m[2][i] = ((t0 >> 52) | (t1 << 12)) & 0x3ffffff;
+        m[3][i] = (t1 >> 14) & 0x3ffffff;
+        m[4][i] = (t1 >> 40) | (1 << 24); /* the 2^128 bit */
+    }
+    for (int j = 0; j < 5; j++)
+        h[j] = _mm256_add_epi64(
+            h[j], _mm256_loadu_si256((const __m256i *)m[j]));
+}
+
+static FUNC_ISA_AVX2 size_t poly1305_blocks_avx2(
+    struct poly1305 *ctx, const unsigned char *buf, size_t nblocks)
+{
+    nblocks &= ~(size_t)3;
+    if (!nblocks)
+        return 0;
+
+    if (!ctx->powers_ready)
+        poly1305_compute_powers(ctx);
+
+    __m256i h[5], r[5], s[5];
+
+    /* Start with the existing accumulator in lane 0 */
+    uint32_t l[5];
+    poly1305_bigval_to_limbs(&ctx->h, l);
+    for (int j = 0; j < 5; j++)
+        h[j] = _mm256_set_epi64x(0, 0, 0, l[j]);
+
+    for (int j = 0; j < 5; j++) {
+        r[j] = _mm256_set1_epi64x(ctx->rpow[0][j]);
+        s[j] = _mm256_add_epi64(r[j], _mm256_slli_epi64(r[j], 2));
+    }
+
+    poly1305_avx2_absorb(h, buf);
+    for (size_t i = 4; i < nblocks; i += 4) {
+        poly1305_avx2_mulmod(h, r, s);
+        poly1305_avx2_absorb(h, buf + 16 * i);
+    }
+
+    /* Final multiplication by a different power of r in each lane */
+    for (int j = 0; j < 5; j++) {
+        r[j] = _mm256_set_epi64x(ctx->rpow[3][j], ctx->rpow[2][j],
+                                 ctx->rpow[1][j], ctx->rpow[0][j]);
+        s[j] = _mm256_add_epi64(r[j], _mm256_slli_epi64(r[j], 2));
+    }
+    poly1305_avx2_mulmod(h, r, s);
+
+    /* Sum the lanes, and carry fully */
+    uint64_t sum[5], lanes[4];
+    for (int j = 0; j < 5; j++) {
+        _mm256_storeu_si256((__m256i *)lanes, h[j]);
+        sum[j] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    for (int j = 0; j < 4; j++) {
+        sum[j+1] += sum[j] >> 26;
+        sum[j] &= 0x3ffffff;
+    }
+    sum[0] += 5 * (sum[4] >> 26);
+    sum[4] &= 0x3ffffff;
+    for (int j = 0; j < 4; j++) {
+        sum[j+1] += sum[j] >> 26;
+        sum[j] &= 0x3ffffff;
+    }
+    for (int j = 0; j < 5; j++)
+        l[j] = sum[j];
+    poly1305_limbs_to_bigval(&ctx->h, l);
+
+    smemclr(l, sizeof(l));
+    smemclr(sum, sizeof(sum));
+    smemclr(lanes, sizeof(lanes));
+    smemclr(h, sizeof(h));
+    return nblocks;
+}
+
+#else /* HW_CHACHA20 == HW_CHACHA20_NONE */
+
+static size_t poly1305_blocks_avx2(
+    struct poly1305 *ctx, const unsigned char *buf, size_t nblocks)
+    STUB_BODY
+
+#endif /* HW_CHACHA20 */
+
 /* Feed up to 16 bytes (should only be less for the last chunk) */
 static void poly1305_feed_chunk(struct poly1305 *ctx,
                                 const unsigned char *chunk, int len)
@@ -824,7 +1327,13 @@ static void poly1305_feed(struct poly1305 *ctx,
         }
     }
 
-    /* Process 16 byte whole chunks */
+    /* Process 16 byte whole chunks, several at a time if we can and
+     * there are enough of them to be worth it */
+    if (ctx->blocks && len >= POLY1305_MULTI_THRESHOLD) {
+        size_t done = ctx->blocks(ctx, buf, len / 16);
+        len -= 16 * done;
+        buf += 16 * done;
+    }
     while (len >= 16) {
         poly1305_feed_chunk(ctx, buf, 16);
         len -= 16;
@@ -923,7 +1432,7 @@ static void poly_BinarySink_write(BinarySink *bs, const void *blkv, size_t len)
         poly1305_key(&ctx->mac, make_ptrlen(ctx->b_cipher.current, 32));
 
         /* Set the first round as used */
-        ctx->b_cipher.currentIndex = 64;
+        ctx->b_cipher.currentIndex = ctx->b_cipher.currentLen;
     }
 
     /* Update the MAC with anything left */
@@ -940,7 +1449,8 @@ static void poly_genresult(ssh2_mac *mac, unsigned char *blk)
 
 static const char *poly_text_name(ssh2_mac *mac)
 {
-    return "Poly1305";
+    struct ccp_context *ctx = container_of(mac, struct ccp_context, mac_if);
+    return ctx->mac.blocks ? "Poly1305 (AVX2 accelerated)" : "Poly1305";
 }
 
 const ssh2_macalg ssh2_poly1305 = {
@@ -957,15 +1467,85 @@ const ssh2_macalg ssh2_poly1305 = {
     .keylen = 0,
 };
 
-static ssh_cipher *ccp_new(const ssh_cipheralg *alg)
+static ssh_cipher *ccp_new_common(const ssh_cipheralg *alg,
+                                  chacha20_blocks_fn blocks,
+                                  poly1305_blocks_fn mac_blocks)
 {
     struct ccp_context *ctx = snew(struct ccp_context);
     BinarySink_INIT(ctx, poly_BinarySink_write);
     poly1305_init(&ctx->mac);
+    /* Only the content cipher ever has more than one block to do */
+    ctx->a_cipher.blocks = NULL;
+    ctx->b_cipher.blocks = blocks;
+    ctx->mac.blocks = mac_blocks;
     ctx->ciph.vt = alg;
     return &ctx->ciph;
 }
 
+/*
+ * The availability checks are cached so they only have to run once.
+ */
+static bool chacha20_sse2_available_cached(void)
+{
+    static bool initialised = false;
+    static bool available;
+    if (!initialised) {
+        available = chacha20_sse2_available();
+        initialised = true;
+    }
+    return available;
+}
+
+static bool chacha20_avx2_available_cached(void)
+{
+    static bool initialised = false;
+    static bool available;
+    if (!initialised) {
+        available = chacha20_avx2_available();
+        initialised = true;
+    }
+    return available;
+}
+
+static ssh_cipher *ccp_new_sw(const ssh_cipheralg *alg)
+{
+    return ccp_new_common(alg, NULL, NULL);
+}
+
+static ssh_cipher *ccp_new_sse2(const ssh_cipheralg *alg)
+{
+    if (!chacha20_sse2_available_cached())
+        return NULL;
+    return ccp_new_common(alg, chacha20_blocks_sse2, NULL);
+}
+
+static ssh_cipher *ccp_new_avx2(const ssh_cipheralg *alg)
+{
+    if (!chacha20_avx2_available_cached())
+        return NULL;
+    return ccp_new_common(alg, chacha20_blocks_avx2, poly1305_blocks_avx2);
+}
+
+/*
+ * The selector vtable picks the widest implementation available,
+ * falling back to the scalar one.
+ */
+static ssh_cipher *ccp_select(const ssh_cipheralg *alg)
+{
+    static const ssh_cipheralg *const real_algs[] = {
+        &ssh2_chacha20_poly1305_avx2,
+        &ssh2_chacha20_poly1305_sse2,
+        &ssh2_chacha20_poly1305_sw,
+    };
+
+    for (size_t i = 0; i < lenof(real_algs); i++) {
+        ssh_cipher *c = ssh_cipher_new(real_algs[i]);
+        if (c)
+            return c;
+    }
+    unreachable("scalar ChaCha20 should always be available");
+}
+
 static void ccp_free(ssh_cipher *cipher)
 {
     struct ccp_context *ctx = container_of(cipher, struct ccp_context, ciph);
@@ -1037,21 +1617,37 @@ static void ccp_decrypt_length(ssh_cipher *cipher, void *blk, int len,
     chacha20_decrypt(&ctx->a_cipher, blk, len);
 }
 
+#define CCP_VTABLE(impl, impl_name)                                     \
+    const ssh_cipheralg ssh2_chacha20_poly1305_##impl = {               \
+        .new = ccp_new_##impl,                                          \
+        .free = ccp_free,                                               \
+        .setiv = ccp_iv,                                                \
+        .setkey = ccp_key,                                              \
+        .encrypt = ccp_encrypt,                                         \
+        .decrypt = ccp_decrypt,                                         \
+        .encrypt_length = ccp_encrypt_length,                           \
+        .decrypt_length = ccp_decrypt_length,                           \
+        .ssh2_id = "chacha20-poly1305@openssh.com",                     \
+        .blksize = 1,                                                   \
+        .real_keybits = 512,                                            \
+        .padded_keybytes = 64,                                          \
+        .flags = SSH_CIPHER_SEPARATE_LENGTH,                            \
+        .text_name = "ChaCha20" impl_name,                              \
+        .required_mac = &ssh2_poly1305,                                 \
+    };
+
+CCP_VTABLE(sw, " (unaccelerated)")
+CCP_VTABLE(sse2, " (SSE2 accelerated)")
+CCP_VTABLE(avx2, " (AVX2 accelerated)")
+
 const ssh_cipheralg ssh2_chacha20_poly1305 = {
-    .new = ccp_new,
-    .free = ccp_free,
-    .setiv = ccp_iv,
-    .setkey = ccp_key,
-    .encrypt = ccp_encrypt,
-    .decrypt = ccp_decrypt,
-    .encrypt_length = ccp_encrypt_length,
-    .decrypt_length = ccp_decrypt_length,
+    .new = ccp_select,
     .ssh2_id = "chacha20-poly1305@openssh.com",
     .blksize = 1,
     .real_keybits = 512,
     .padded_keybytes = 64,
     .flags = SSH_CIPHER_SEPARATE_LENGTH,
-    .text_name = "ChaCha20",
+    .text_name = "ChaCha20 (dummy selector vtable)",
     .required_mac = &ssh2_poly1305,
 };
 
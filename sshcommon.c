@@ -64,7 +64,7 @@ static void pktin_free_queue_callback(void *vctx)
         PacketQueueNode *node = pktin_freeq_head.next;
         PktIn *pktin = container_of(node, PktIn, qnode);
         pktin_freeq_head.next = node->next;
-        sfree(pktin);
+        ssh_free_pktin(pktin);
     }
 
     pktin_freeq_head.prev = &pktin_freeq_head;
@@ -234,49 +234,6 @@ void pq_base_concatenate(PacketQueueBase *qdest,
     qdest->total_size = total_size;
 }
 
-/* ----------------------------------------------------------------------
- * Low-level functions for the packet structures themselves.
- */
-
-static void ssh_pkt_BinarySink_write(BinarySink *bs,
-                                     const void *data, size_t len);
-PktOut *ssh_new_packet(void)
-{
-    PktOut *pkt = snew(PktOut);
-
-    BinarySink_INIT(pkt, ssh_pkt_BinarySink_write);
-    pkt->data = NULL;
-    pkt->length = 0;
-    pkt->maxlen = 0;
-    pkt->downstream_id = 0;
-    pkt->additional_log_text = NULL;
-    pkt->qnode.next = pkt->qnode.prev = NULL;
-    pkt->qnode.on_free_queue = false;
-
-    return pkt;
-}
-
-static void ssh_pkt_adddata(PktOut *pkt, const void *data, int len)
-{
-    sgrowarrayn_nm(pkt->data, pkt->maxlen, pkt->length, len);
-    memcpy(pkt->data + pkt->length, data, len);
-    pkt->length += len;
-    pkt->qnode.formal_size = pkt->length;
-}
-
-static void ssh_pkt_BinarySink_write(BinarySink *bs,
-                                     const void *data, size_t len)
-{
-    PktOut *pkt = BinarySink_DOWNCAST(bs, PktOut);
-    ssh_pkt_adddata(pkt, data, len);
-}
-
-void ssh_free_pktout(PktOut *pkt)
-{
-    sfree(pkt->data);
-    sfree(pkt);
-}
-
 /* ----------------------------------------------------------------------
  * Implement zombiechan_new() and its trivial vtable.
  */
@@ -0,0 +1,71 @@
+/*
+ * Run-time detection of the x86 vector instruction sets used by the
+ * SSE2 and AVX2 implementations in sshccp.c, sshargon2.c and
+ * sshsh512.c.
+ *
+ * Only include this from code that is already conditioned on an x86
+ * target and a compiler that provides <cpuid.h> or <intrin.h>.
+ */
+
+#ifndef PUTTY_SSHCPUID_H
+#define PUTTY_SSHCPUID_H
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID(leaf, out) __cpuid_count(leaf, 0, (out)[0], (out)[1], \
+                                            (out)[2], (out)[3])
+static inline uint32_t x86_xgetbv0(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return lo;
+}
+#else
+#include <intrin.h>
+#define GET_CPU_ID(leaf, out) __cpuidex(out, leaf, 0)
+#define x86_xgetbv0() ((uint32_t)_xgetbv(0))
+#endif
+
+static inline bool x86_sse2_available(void)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;                       /* SSE2 is part of the base ISA */
+#else
+    unsigned int CPUInfo[4];
+    GET_CPU_ID(1, CPUInfo);
+    return CPUInfo[3] & (1 << 26);
+#endif
+}
+
+/*
+ * AVX2 needs support from both the CPU (CPUID leaf 7, EBX bit 5) and
+ * the OS, which must have enabled saving of the YMM registers
+ * (indicated by OSXSAVE, and then by bits 1 and 2 of XCR0).
+ */
+static inline bool x86_avx2_available(void)
+{
+    unsigned int CPUInfo[4];
+    GET_CPU_ID(0, CPUInfo);
+    if (CPUInfo[0] < 7)
+        return false;
+    GET_CPU_ID(1, CPUInfo);
+    if (!(CPUInfo[2] & (1 << 27)) || !(CPUInfo[2] & (1 << 28)))
+        return false;
+    if ((x86_xgetbv0() & 6) != 6)
+        return false;
+    GET_CPU_ID(7, CPUInfo);
+    return CPUInfo[1] & (1 << 5);
+}
+
+/* BMI2 is CPUID leaf 7, EBX bit 8. It uses no extra register state. */
+static inline bool x86_bmi2_available(void)
+{
+    unsigned int CPUInfo[4];
+    GET_CPU_ID(0, CPUInfo);
+    if (CPUInfo[0] < 7)
+        return false;
+    GET_CPU_ID(7, CPUInfo);
+    return CPUInfo[1] & (1 << 8);
+}
+
+#endif /* PUTTY_SSHCPUID_H */
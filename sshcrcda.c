@@ -29,34 +29,73 @@
 #define SSH_MAXBLOCKS   (32 * 1024)
 #define SSH_BLOCKSIZE   (8)
 
-/* Hashing constants */
-#define HASH_MINSIZE    (8 * 1024)
-#define HASH_ENTRYSIZE  (sizeof(uint16_t))
-#define HASH_FACTOR(x)  ((x)*3/2)
-#define HASH_UNUSEDCHAR (0xff)
-#define HASH_UNUSED     (0xffff)
-#define HASH_IV         (0xfffe)
+/*
+ * Hashing constants.
+ *
+ * The hash table is open-addressed with linear probing. Each entry
+ * records the block's index in the packet along with a few more bits
+ * of its hash value, so that most mismatches during a probe can be
+ * rejected without going back to the packet itself; and a generation
+ * number, so that the table can be reused for the next packet
+ * without clearing it, by just moving on to the next generation.
+ * Only when the generation counter wraps round do we have to wipe
+ * the whole thing.
+ *
+ * The table is allocated at the largest size we've needed so far,
+ * but each packet only uses a power-of-two prefix of it big enough
+ * to keep the load factor at most 1/2, so that small packets after
+ * a large one stay within a small region of memory.
+ */
+#define HASH_MINSIZE    (64)
+#define HASH_FACTOR(x)  ((x)*2)
+#define HASH_IV         (0xffff)
 
 #define HASH_MINBLOCKS  (7*SSH_BLOCKSIZE)
 
-/* Hash function (Input keys are cipher results) */
-#define HASH(x)         GET_32BIT_MSB_FIRST(x)
+struct crcda_entry {
+    uint16_t index;     /* block number within the packet, or HASH_IV */
+    uint8_t gen;        /* entry is only live if this matches ctx->gen */
+    uint8_t tag;        /* TAG_BITS of the hash, plus TAG_CHECKED */
+};
+#define TAG_BITS        (0x7f)
+#define TAG_CHECKED     (0x80)  /* check_crc has already failed for this */
+
+/* Hash function (input keys are cipher results, but an attacker can
+ * influence them, so mix in the whole block rather than just part) */
+static inline uint32_t HASH(const uint8_t *b)
+{
+    uint32_t h = (GET_32BIT_MSB_FIRST(b) ^ GET_32BIT_MSB_FIRST(b + 4))
+        * 0x9E3779B1U;
+    return h ^ (h >> 16);
+}
+
+/* The tag is taken from the top of the hash, which the slot index
+ * (taken from the bottom) doesn't use unless the table is huge */
+#define TAG(h)          (((h) >> 25) & TAG_BITS)
 
 #define CMP(a, b)       (memcmp(a, b, SSH_BLOCKSIZE))
 
-static const uint8_t ONE[4] = { 1, 0, 0, 0 };
-static const uint8_t ZERO[4] = { 0, 0, 0, 0 };
+static const uint8_t ONE[SSH_BLOCKSIZE] = { 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t ZERO[SSH_BLOCKSIZE] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 
 struct crcda_ctx {
-    uint16_t *h;
-    uint32_t n;
+    struct crcda_entry *h;
+    uint32_t size;      /* number of entries allocated */
+    uint8_t gen;        /* generation number of the current packet */
+
+    /* Space to lay out the pattern that check_crc takes the CRC of */
+    uint8_t *pattern;
+    size_t patternsize;
 };
 
 struct crcda_ctx *crcda_make_context(void)
 {
     struct crcda_ctx *ret = snew(struct crcda_ctx);
     ret->h = NULL;
-    ret->n = HASH_MINSIZE / HASH_ENTRYSIZE;
+    ret->size = 0;
+    ret->gen = 0;
+    ret->pattern = NULL;
+    ret->patternsize = 0;
     return ret;
 }
 
@@ -65,37 +104,60 @@ void crcda_free_context(struct crcda_ctx *ctx)
     if (ctx) {
         sfree(ctx->h);
         ctx->h = NULL;
+        sfree(ctx->pattern);
         sfree(ctx);
     }
 }
 
-static void crc_update(uint32_t *a, const void *b)
-{
-    *a = crc32_update(*a, make_ptrlen(b, 4));
-}
-
-/* detect if a block is used in a particular pattern */
-static bool check_crc(const uint8_t *S, const uint8_t *buf,
-                      uint32_t len, const uint8_t *IV)
+/*
+ * Detect if a block is used in a particular pattern.
+ *
+ * We take the CRC of a string with one 8-byte block per block of the
+ * packet (plus one for the IV, if it matches), which is ONE where
+ * the packet block equals S and ZERO elsewhere. Laying the whole
+ * string out first and taking its CRC in one go is much faster than
+ * feeding it to the CRC piecemeal, because crc32_update can then use
+ * its hardware implementation where there is one.
+ */
+static bool check_crc(struct crcda_ctx *ctx, const uint8_t *S,
+                      const uint8_t *buf, uint32_t len, const uint8_t *IV)
 {
-    uint32_t crc;
     const uint8_t *c;
+    uint8_t *p;
+
+    sgrowarray(ctx->pattern, ctx->patternsize, len + SSH_BLOCKSIZE);
+    p = ctx->pattern;
 
-    crc = 0;
     if (IV && !CMP(S, IV)) {
-        crc_update(&crc, ONE);
-        crc_update(&crc, ZERO);
+        memcpy(p, ONE, SSH_BLOCKSIZE);
+        p += SSH_BLOCKSIZE;
     }
     for (c = buf; c < buf + len; c += SSH_BLOCKSIZE) {
-        if (!CMP(S, c)) {
-            crc_update(&crc, ONE);
-            crc_update(&crc, ZERO);
-        } else {
-            crc_update(&crc, ZERO);
-            crc_update(&crc, ZERO);
-        }
+        memcpy(p, CMP(S, c) ? ZERO : ONE, SSH_BLOCKSIZE);
+        p += SSH_BLOCKSIZE;
+    }
+    return crc32_ssh1(make_ptrlen(ctx->pattern, p - ctx->pattern)) == 0;
+}
+
+/* Start a new generation of the hash table, with at least n entries */
+static void crcda_new_generation(struct crcda_ctx *ctx, uint32_t n)
+{
+    if (n > ctx->size) {
+        /* Entries from any previous generation are irrelevant, so
+         * there's no need to preserve them across the resize. */
+        sfree(ctx->h);
+        ctx->h = snewn(n, struct crcda_entry);
+        ctx->size = n;
+        memset(ctx->h, 0, n * sizeof(*ctx->h));
+        ctx->gen = 0;
+    }
+
+    if (++ctx->gen == 0) {
+        /* Generation counter wrapped, so stale entries might now
+         * look live. Wipe the table and start again from 1. */
+        memset(ctx->h, 0, ctx->size * sizeof(*ctx->h));
+        ctx->gen = 1;
     }
-    return (crc == 0);
 }
 
 /* Detect a crc32 compensation attack on a packet */
@@ -103,37 +165,25 @@ bool detect_attack(struct crcda_ctx *ctx,
                    const unsigned char *buf, uint32_t len,
                    const unsigned char *IV)
 {
-    register uint32_t i, j;
-    uint32_t l;
-    register const uint8_t *c;
-    const uint8_t *d;
+    uint32_t i, j, n, mask, h;
+    uint8_t tag;
+    const uint8_t *c, *d;
+    struct crcda_entry *e;
 
     assert(!(len > (SSH_MAXBLOCKS * SSH_BLOCKSIZE) ||
              len % SSH_BLOCKSIZE != 0));
-    for (l = ctx->n; l < HASH_FACTOR(len / SSH_BLOCKSIZE); l = l << 2)
-        ;
-
-    if (ctx->h == NULL) {
-        ctx->n = l;
-        ctx->h = snewn(ctx->n, uint16_t);
-    } else {
-        if (l > ctx->n) {
-            ctx->n = l;
-            ctx->h = sresize(ctx->h, ctx->n, uint16_t);
-        }
-    }
 
     if (len <= HASH_MINBLOCKS) {
         for (c = buf; c < buf + len; c += SSH_BLOCKSIZE) {
             if (IV && (!CMP(c, IV))) {
-                if ((check_crc(c, buf, len, IV)))
+                if ((check_crc(ctx, c, buf, len, IV)))
                     return true;          /* attack detected */
                 else
                     break;
             }
             for (d = buf; d < c; d += SSH_BLOCKSIZE) {
                 if (!CMP(c, d)) {
-                    if ((check_crc(c, buf, len, IV)))
+                    if ((check_crc(ctx, c, buf, len, IV)))
                         return true;      /* attack detected */
                     else
                         break;
@@ -142,30 +192,49 @@ bool detect_attack(struct crcda_ctx *ctx,
         }
         return false;                  /* ok */
     }
-    memset(ctx->h, HASH_UNUSEDCHAR, ctx->n * HASH_ENTRYSIZE);
 
-    if (IV)
-        ctx->h[HASH(IV) & (ctx->n - 1)] = HASH_IV;
+    for (n = HASH_MINSIZE; n < HASH_FACTOR(len / SSH_BLOCKSIZE); n <<= 1)
+        ;
+    crcda_new_generation(ctx, n);
+    mask = n - 1;
+
+    if (IV) {
+        h = HASH(IV);
+        e = &ctx->h[h & mask];
+        e->index = HASH_IV;
+        e->gen = ctx->gen;
+        e->tag = TAG(h);
+    }
 
     for (c = buf, j = 0; c < (buf + len); c += SSH_BLOCKSIZE, j++) {
-        for (i = HASH(c) & (ctx->n - 1); ctx->h[i] != HASH_UNUSED;
-             i = (i + 1) & (ctx->n - 1)) {
-            if (ctx->h[i] == HASH_IV) {
+        h = HASH(c);
+        tag = TAG(h);
+        for (i = h & mask; (e = &ctx->h[i])->gen == ctx->gen;
+             i = (i + 1) & mask) {
+            if ((e->tag & TAG_BITS) != tag)
+                continue;
+            if (e->index == HASH_IV) {
                 assert(IV); /* or we wouldn't have stored HASH_IV above */
-                if (!CMP(c, IV)) {
-                    if (check_crc(c, buf, len, IV))
-                        return true;      /* attack detected */
-                    else
-                        break;
-                }
-            } else if (!CMP(c, buf + ctx->h[i] * SSH_BLOCKSIZE)) {
-                if (check_crc(c, buf, len, IV))
-                    return true;          /* attack detected */
-                else
-                    break;
+                d = IV;
+            } else {
+                d = buf + e->index * SSH_BLOCKSIZE;
             }
+            if (!CMP(c, d))
+                break;
+        }
+
+        if (e->gen != ctx->gen) {
+            /* First occurrence of this block: remember it. */
+            e->index = j;
+            e->gen = ctx->gen;
+            e->tag = tag;
+        } else if (!(e->tag & TAG_CHECKED)) {
+            /* A repeat. The result of check_crc depends only on the
+             * block's value, so we need only do it once per value. */
+            if (check_crc(ctx, c, buf, len, IV))
+                return true;              /* attack detected */
+            e->tag |= TAG_CHECKED;
         }
-        ctx->h[i] = j;
     }
     return false;                          /* ok */
 }
@@ -63,6 +63,7 @@ static void initialise_wcurve(
 
     curve->w.G = ecc_weierstrass_point_new(curve->w.wc, G_x, G_y);
     curve->w.G_order = mp_copy(G_order);
+    curve->w.G_comb = NULL;
 }
 
 static void initialise_mcurve(
@@ -73,6 +74,7 @@ static void initialise_mcurve(
 
     curve->m.mc = ecc_montgomery_curve(p, a, b);
     curve->m.log2_cofactor = log2_cofactor;
+    curve->m.ecurve = NULL;
 
     curve->m.G = ecc_montgomery_point_new(curve->m.mc, G_x);
 }
@@ -91,8 +93,11 @@ static void initialise_ecurve(
 
     curve->e.G = ecc_edwards_point_new(curve->e.ec, G_x, G_y);
     curve->e.G_order = mp_copy(G_order);
+    curve->e.G_comb = NULL;
 }
 
+static struct ec_curve *ec_ed25519(void);
+
 static struct ec_curve *ec_p256(void)
 {
     static struct ec_curve curve = { 0 };
@@ -211,6 +216,9 @@ static struct ec_curve *ec_curve25519(void)
         curve.name = NULL;
         curve.textname = "Curve25519";
 
+        /* Multiples of G can be computed faster on Ed25519 */
+        curve.m.ecurve = ec_ed25519;
+
         /* Now initialised, no need to do it again */
         initialised = true;
     }
@@ -321,6 +329,70 @@ static struct ec_curve *ec_ed448(void)
     return &curve;
 }
 
+/* ----------------------------------------------------------------------
+ * Multiples of a curve's base point. These are computed using a
+ * precomputed comb table (see ecc.h), which we only build the first
+ * time it's needed, since many of our curves are never used at all
+ * in a given run.
+ */
+
+static WeierstrassPoint *wcurve_multiply_G(struct ec_curve *curve, mp_int *n)
+{
+    assert(curve->type == EC_WEIERSTRASS);
+    if (!curve->w.G_comb)
+        curve->w.G_comb = ecc_weierstrass_comb_new(
+            curve->w.G, curve->fieldBits);
+    return ecc_weierstrass_comb_multiply(curve->w.G_comb, n);
+}
+
+static EdwardsPoint *ecurve_multiply_G(struct ec_curve *curve, mp_int *n)
+{
+    assert(curve->type == EC_EDWARDS);
+    /*
+     * The comb has to cover a whole fieldBytes-sized integer, not
+     * just fieldBits, because eddsa_verify passes in the signature's
+     * s value without reducing it. Dropping its top bits would let
+     * anyone set them in a valid signature without invalidating it.
+     */
+    if (!curve->e.G_comb)
+        curve->e.G_comb = ecc_edwards_comb_new(
+            curve->e.G, curve->fieldBytes * 8);
+    return ecc_edwards_comb_multiply(curve->e.G_comb, n);
+}
+
+static MontgomeryPoint *mcurve_multiply_G(struct ec_curve *curve, mp_int *n)
+{
+    assert(curve->type == EC_MONTGOMERY);
+    if (!curve->m.ecurve)
+        return ecc_montgomery_multiply(curve->m.G, n);
+
+    /*
+     * Montgomery curves only do x-coordinate arithmetic, which
+     * doesn't lend itself to a comb. But if there's an equivalent
+     * Edwards curve, we can do the multiplication there using its
+     * comb, and map the answer back.
+     */
+    EdwardsPoint *eP = ecurve_multiply_G(curve->m.ecurve(), n);
+    mp_int *y;
+    ecc_edwards_get_affine(eP, NULL, &y);
+    ecc_edwards_point_free(eP);
+
+    mp_int *one = mp_from_integer(1);
+    mp_int *num = mp_modadd(one, y, curve->p);
+    mp_int *den = mp_modsub(one, y, curve->p);
+    mp_int *den_inv = mp_invert(den, curve->p);
+    mp_int *u = mp_modmul(num, den_inv, curve->p);
+    MontgomeryPoint *toret = ecc_montgomery_point_new(curve->m.mc, u);
+
+    mp_free(y);
+    mp_free(one);
+    mp_free(num);
+    mp_free(den);
+    mp_free(den_inv);
+    mp_free(u);
+    return toret;
+}
+
 /* ----------------------------------------------------------------------
  * Public point from private
  */
@@ -346,8 +418,7 @@ WeierstrassPoint *ecdsa_public(mp_int *private_key, const ssh_keyalg *alg)
     assert(curve->type == EC_WEIERSTRASS);
 
     mp_int *priv_reduced = mp_mod(private_key, curve->p);
-    WeierstrassPoint *toret = ecc_weierstrass_multiply(
-        curve->w.G, priv_reduced);
+    WeierstrassPoint *toret = wcurve_multiply_G(curve, priv_reduced);
     mp_free(priv_reduced);
     return toret;
 }
@@ -394,7 +465,7 @@ EdwardsPoint *eddsa_public(mp_int *private_key, const ssh_keyalg *alg)
     mp_int *exponent = eddsa_exponent_from_hash(
         make_ptrlen(hash, extra->hash->hlen), curve);
 
-    EdwardsPoint *toret = ecc_edwards_multiply(curve->e.G, exponent);
+    EdwardsPoint *toret = ecurve_multiply_G(curve, exponent);
     mp_free(exponent);
 
     return toret;
@@ -1021,7 +1092,7 @@ static bool ecdsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
     mp_free(z);
     mp_int *u2 = mp_modmul(r, w, ek->curve->w.G_order);
     mp_free(w);
-    WeierstrassPoint *u1G = ecc_weierstrass_multiply(ek->curve->w.G, u1);
+    WeierstrassPoint *u1G = wcurve_multiply_G(extra->curve(), u1);
     mp_free(u1);
     WeierstrassPoint *u2P = ecc_weierstrass_multiply(ek->publicKey, u2);
     mp_free(u2);
@@ -1063,12 +1134,13 @@ static mp_int *eddsa_signing_exponent_from_data(
     return toret;
 }
 
-static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
+/*
+ * Split an EdDSA signature blob into the encoded point r and the
+ * encoded integer s, or return false if it's malformed.
+ */
+static bool eddsa_parse_signature(struct eddsa_key *ek, ptrlen sig,
+                                  ptrlen *rstr, ptrlen *sstr)
 {
-    struct eddsa_key *ek = container_of(key, struct eddsa_key, sshk);
-    const struct ecsign_extra *extra =
-        (const struct ecsign_extra *)ek->sshk.vt->extra;
-
     BinarySource src[1];
     BinarySource_BARE_INIT_PL(src, sig);
 
@@ -1082,11 +1154,24 @@ static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
     if (get_err(src))
         return false;
     BinarySource_BARE_INIT_PL(src, sigstr);
-    ptrlen rstr = get_data(src, ek->curve->fieldBytes);
-    ptrlen sstr = get_data(src, ek->curve->fieldBytes);
+    *rstr = get_data(src, ek->curve->fieldBytes);
+    *sstr = get_data(src, ek->curve->fieldBytes);
     if (get_err(src) || get_avail(src))
         return false;
 
+    return true;
+}
+
+static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
+{
+    struct eddsa_key *ek = container_of(key, struct eddsa_key, sshk);
+    const struct ecsign_extra *extra =
+        (const struct ecsign_extra *)ek->sshk.vt->extra;
+
+    ptrlen rstr, sstr;
+    if (!eddsa_parse_signature(ek, sig, &rstr, &sstr))
+        return false;
+
     EdwardsPoint *r = eddsa_decode(rstr, ek->curve);
     if (!r)
         return false;
@@ -1095,7 +1180,7 @@ static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
     mp_int *H = eddsa_signing_exponent_from_data(ek, extra, rstr, data);
 
     /* Verify that s*G == r + H*publicKey */
-    EdwardsPoint *lhs = ecc_edwards_multiply(ek->curve->e.G, s);
+    EdwardsPoint *lhs = ecurve_multiply_G(extra->curve(), s);
     mp_free(s);
     EdwardsPoint *hpk = ecc_edwards_multiply(ek->publicKey, H);
     mp_free(H);
@@ -1109,6 +1194,153 @@ static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
     return valid;
 }
 
+/*
+ * Verify a batch of EdDSA signatures with one big multi-scalar
+ * multiplication. For each signature (r_i, s_i) by public key A_i,
+ * with hash value H_i, we check a random linear combination of the
+ * individual verification equations:
+ *
+ *   (sum z_i s_i) G == sum z_i r_i + sum (z_i H_i) A_i
+ *
+ * which can't hold by accident unless every individual equation
+ * holds, except with probability about 2^-128.
+ *
+ * The coefficients z_i are derived by hashing the entire batch, so
+ * that nobody submitting signatures can know them in advance and
+ * arrange for errors to cancel out.
+ *
+ * Both sides are multiplied by the curve's cofactor before comparing.
+ * Without that, small-order components of r_i or A_i could survive
+ * the random combination with non-negligible probability. RFC 8032
+ * specifies this cofactored equation, and eddsa_verify's stricter
+ * cofactorless check is permitted as an alternative. So this batch
+ * check agrees with eddsa_verify on every signature that an honest
+ * signer could produce, but might accept a deliberately malformed one
+ * that eddsa_verify rejects.
+ */
+static bool eddsa_verify_batch(
+    const ssh_keyalg *alg, ssh_key *const *keys,
+    const ptrlen *sigs, const ptrlen *data, size_t n)
+{
+    const struct ecsign_extra *extra = (const struct ecsign_extra *)alg->extra;
+    struct ec_curve *curve = extra->curve();
+    mp_int *order = curve->e.G_order;
+
+    if (n == 0)
+        return true;
+
+    unsigned char seed[64];
+    {
+        ssh_hash *h = ssh_hash_new(&ssh_sha512);
+        put_asciz(h, "PuTTY EdDSA batch verification coefficients");
+        for (size_t i = 0; i < n; i++) {
+            struct eddsa_key *ek = container_of(keys[i], struct eddsa_key,
+                                                sshk);
+            put_epoint(h, ek->publicKey, curve, false);
+            put_stringpl(h, sigs[i]);
+            put_stringpl(h, data[i]);
+        }
+        ssh_hash_final(h, seed);
+    }
+
+    /*
+     * Each signature contributes a term for r_i and (unless its key
+     * already appeared earlier in the batch) one for A_i. 'keyterm'
+     * records where each key's coefficient lives.
+     */
+    EdwardsPoint **points = snewn(2 * n, EdwardsPoint *);
+    mp_int **scalars = snewn(2 * n, mp_int *);
+    size_t *keyterm = snewn(n, size_t);
+    size_t nterms = 0;
+    mp_int *Gcoeff = mp_new(mp_max_bits(order));
+    bool valid = true;
+
+    for (size_t i = 0; i < n; i++) {
+        assert(keys[i]->vt == alg);
+        struct eddsa_key *ek = container_of(keys[i], struct eddsa_key, sshk);
+
+        ptrlen rstr, sstr;
+        EdwardsPoint *r;
+        if (!eddsa_parse_signature(ek, sigs[i], &rstr, &sstr) ||
+            !(r = eddsa_decode(rstr, curve))) {
+            valid = false;
+            break;
+        }
+
+        /* Coefficient z_i: 128 bits, top one forced to 1 to avoid 0 */
+        unsigned char zbytes[64];
+        {
+            ssh_hash *h = ssh_hash_new(&ssh_sha512);
+            put_data(h, seed, sizeof(seed));
+            put_uint32(h, i);
+            ssh_hash_final(h, zbytes);
+        }
+        zbytes[15] |= 0x80;
+        mp_int *z = mp_from_bytes_le(make_ptrlen(zbytes, 16));
+
+        mp_int *s = mp_from_bytes_le(sstr);
+        mp_int *zs = mp_modmul(z, s, order);
+        mp_int *newG = mp_modadd(Gcoeff, zs, order);
+        mp_free(Gcoeff);
+        Gcoeff = newG;
+        mp_free(zs);
+        mp_free(s);
+
+        mp_int *H = eddsa_signing_exponent_from_data(ek, extra, rstr, data[i]);
+        mp_int *zH = mp_modmul(z, H, order);
+        mp_free(H);
+
+        points[nterms] = r;
+        scalars[nterms] = z;
+        nterms++;
+
+        size_t j;
+        for (j = 0; j < i; j++)
+            if (keys[j] == keys[i])
+                break;
+        if (j < i) {
+            mp_int *sum = mp_modadd(scalars[keyterm[j]], zH, order);
+            mp_free(scalars[keyterm[j]]);
+            scalars[keyterm[j]] = sum;
+            mp_free(zH);
+            keyterm[i] = keyterm[j];
+        } else {
+            points[nterms] = ecc_edwards_point_copy(ek->publicKey);
+            scalars[nterms] = zH;
+            keyterm[i] = nterms;
+            nterms++;
+        }
+    }
+
+    if (valid) {
+        EdwardsPoint *lhs = ecurve_multiply_G(curve, Gcoeff);
+        EdwardsPoint *rhs = ecc_edwards_multiscalar(points, scalars, nterms);
+        for (unsigned bit = 0; bit < curve->e.log2_cofactor; bit++) {
+            EdwardsPoint *lhs2 = ecc_edwards_add(lhs, lhs);
+            ecc_edwards_point_free(lhs);
+            lhs = lhs2;
+            EdwardsPoint *rhs2 = ecc_edwards_add(rhs, rhs);
+            ecc_edwards_point_free(rhs);
+            rhs = rhs2;
+        }
+        valid = ecc_edwards_eq(lhs, rhs);
+        ecc_edwards_point_free(lhs);
+        ecc_edwards_point_free(rhs);
+    }
+
+    for (size_t t = 0; t < nterms; t++) {
+        ecc_edwards_point_free(points[t]);
+        mp_free(scalars[t]);
+    }
+    sfree(points);
+    sfree(scalars);
+    sfree(keyterm);
+    mp_free(Gcoeff);
+    smemclr(seed, sizeof(seed));
+
+    return valid;
+}
+
 static void ecdsa_sign(ssh_key *key, ptrlen data,
                        unsigned flags, BinarySink *bs)
 {
@@ -1130,7 +1362,7 @@ static void ecdsa_sign(ssh_key *key, ptrlen data,
             ek->privateKey, digest, sizeof(digest));
     }
 
-    WeierstrassPoint *kG = ecc_weierstrass_multiply(ek->curve->w.G, k);
+    WeierstrassPoint *kG = wcurve_multiply_G(extra->curve(), k);
     mp_int *x;
     ecc_weierstrass_get_affine(kG, &x, NULL);
     ecc_weierstrass_point_free(kG);
@@ -1212,7 +1444,7 @@ static void eddsa_sign(ssh_key *key, ptrlen data,
         make_ptrlen(hash, extra->hash->hlen));
     mp_int *log_r = mp_mod(log_r_unreduced, ek->curve->e.G_order);
     mp_free(log_r_unreduced);
-    EdwardsPoint *r = ecc_edwards_multiply(ek->curve->e.G, log_r);
+    EdwardsPoint *r = ecurve_multiply_G(extra->curve(), log_r);
 
     /*
      * Encode r now, because we'll need its encoding for the next
@@ -1259,6 +1491,7 @@ const ssh_keyalg ssh_ecdsa_ed25519 = {
     .invalid = ec_signkey_invalid,
     .sign = eddsa_sign,
     .verify = eddsa_verify,
+    .verify_batch = eddsa_verify_batch,
     .public_blob = eddsa_public_blob,
     .private_blob = eddsa_private_blob,
     .openssh_blob = eddsa_openssh_blob,
@@ -1282,6 +1515,7 @@ const ssh_keyalg ssh_ecdsa_ed448 = {
     .invalid = ec_signkey_invalid,
     .sign = eddsa_sign,
     .verify = eddsa_verify,
+    .verify_batch = eddsa_verify_batch,
     .public_blob = eddsa_public_blob,
     .private_blob = eddsa_private_blob,
     .openssh_blob = eddsa_openssh_blob,
@@ -1409,7 +1643,7 @@ static void ssh_ecdhkex_w_setup(ecdh_key *dh)
     dh->private = mp_random_in_range(one, dh->curve->w.G_order);
     mp_free(one);
 
-    dh->w_public = ecc_weierstrass_multiply(dh->curve->w.G, dh->private);
+    dh->w_public = wcurve_multiply_G(dh->extra->curve(), dh->private);
 }
 
 static void ssh_ecdhkex_m_setup(ecdh_key *dh)
@@ -1431,7 +1665,7 @@ static void ssh_ecdhkex_m_setup(ecdh_key *dh)
 
     strbuf_free(bytes);
 
-    dh->m_public = ecc_montgomery_multiply(dh->curve->m.G, dh->private);
+    dh->m_public = mcurve_multiply_G(dh->extra->curve(), dh->private);
 }
 
 ecdh_key *ssh_ecdhkex_newkey(const ssh_kex *kex)
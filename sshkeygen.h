@@ -67,6 +67,17 @@ void pcs_ready(PrimeCandidateSource *s);
  * course. */
 mp_int *pcs_generate(PrimeCandidateSource *s);
 
+/* The two halves of pcs_generate, separated so that the sieving can
+ * be done on a different thread from the random number generation.
+ * pcs_draw makes up a random starting value (and must be called on
+ * the thread that owns the random number generator). pcs_sieve turns
+ * that into a candidate, or returns NULL if the candidate would have
+ * been divisible by a small prime; it doesn't free x, and doesn't
+ * modify the PrimeCandidateSource, so it can be called concurrently.
+ * Neither of these pays attention to pcs_set_oneshot. */
+mp_int *pcs_draw(PrimeCandidateSource *s);
+mp_int *pcs_sieve(PrimeCandidateSource *s, mp_int *x);
+
 /* Free a PrimeCandidateSource. */
 void pcs_free(PrimeCandidateSource *s);
 
@@ -77,6 +88,7 @@ void pcs_inspect(PrimeCandidateSource *pcs, mp_int **limit_out,
 
 /* Query functions for primegen to use */
 unsigned pcs_get_bits(PrimeCandidateSource *pcs);
+bool pcs_is_oneshot(PrimeCandidateSource *pcs);
 unsigned pcs_get_bits_remaining(PrimeCandidateSource *pcs);
 mp_int *pcs_get_upper_bound(PrimeCandidateSource *pcs);
 mp_int **pcs_get_known_prime_factors(PrimeCandidateSource *pcs, size_t *nout);
@@ -97,6 +109,14 @@ void miller_rabin_free(MillerRabin *mr);
 /* Perform a single Miller-Rabin test, using a random witness value. */
 bool miller_rabin_test_random(MillerRabin *mr);
 
+/* The two halves of miller_rabin_test_random: make up a random
+ * witness value, and test the number using it. The witness is only
+ * meaningful to the MillerRabin it came from. Separated so that
+ * witnesses can be chosen in a fixed order on one thread while the
+ * tests themselves run on others. */
+mp_int *miller_rabin_random_witness(MillerRabin *mr);
+bool miller_rabin_test_witness(MillerRabin *mr, mp_int *mw);
+
 /* Suggest how many tests are needed to make it sufficiently unlikely
  * that a composite number will pass them all */
 unsigned miller_rabin_checks_needed(unsigned bits);
@@ -276,10 +296,16 @@ static inline strbuf *primegen_mpu_certificate(
 { return ctx->vt->mpu_certificate(ctx, p); }
 
 extern const PrimeGenerationPolicy primegen_probabilistic;
+extern const PrimeGenerationPolicy primegen_probabilistic_parallel;
 extern const PrimeGenerationPolicy primegen_provable_fast;
 extern const PrimeGenerationPolicy primegen_provable_maurer_simple;
 extern const PrimeGenerationPolicy primegen_provable_maurer_complex;
 
+/* For testing: make primegen_probabilistic_parallel contexts created
+ * from now on use this many workers, or go back to one per processor
+ * if nworkers is 0. */
+void primegen_parallel_force_workers(size_t nworkers);
+
 /* ----------------------------------------------------------------------
  * The overall top-level API for generating entire key pairs.
  */
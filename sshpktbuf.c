@@ -0,0 +1,180 @@
+/*
+ * Allocation of the SSH packet structures PktIn and PktOut, and of
+ * the data buffers behind PktOut, from a pool of recycled buffers.
+ *
+ * This is kept apart from sshcommon.c, which needs most of the rest
+ * of the SSH code to link against, so that testcrypt can test it.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "putty.h"
+#include "ssh.h"
+
+/* ----------------------------------------------------------------------
+ * Pool of packet buffers.
+ *
+ * Every block allocated here is preceded by a header recording which
+ * size class it belongs to, so that it can be returned to the right
+ * free list without the caller having to know its size. Blocks too
+ * big for the largest class are allocated and freed normally.
+ *
+ * The free lists are bounded, so a burst of queued packets doesn't
+ * leave us holding on to an unbounded amount of memory afterwards.
+ */
+
+#define PKTBUF_MAX_FREE 16
+
+static const size_t pktbuf_class_sizes[] = {
+    256, 1024, 4096, 16384,
+
+    /* enough for a PktIn holding a maximum-size SSH-2 packet and MAC */
+    sizeof(PktIn) + OUR_V2_PACKETLIMIT + 256,
+};
+#define PKTBUF_NCLASSES lenof(pktbuf_class_sizes)
+
+typedef union PktBufHeader PktBufHeader;
+union PktBufHeader {
+    struct {
+        PktBufHeader *next;            /* when on a free list */
+        size_t sizeclass;              /* PKTBUF_NCLASSES if not pooled */
+    } h;
+
+    /* Make sure the data after the header is suitably aligned */
+    void *align_ptr;
+    uint64_t align_u64;
+    double align_double;
+};
+
+static PktBufHeader *pktbuf_freelist[PKTBUF_NCLASSES];
+static size_t pktbuf_nfree[PKTBUF_NCLASSES];
+static PacketPoolStats pktbuf_stats;
+
+static void *pktbuf_alloc(size_t size, size_t *capacity)
+{
+    PktBufHeader *hdr;
+    size_t sizeclass;
+
+    for (sizeclass = 0; sizeclass < PKTBUF_NCLASSES; sizeclass++)
+        if (size <= pktbuf_class_sizes[sizeclass])
+            break;
+
+    pktbuf_stats.allocs++;
+    if (sizeclass == PKTBUF_NCLASSES) {
+        pktbuf_stats.oversize++;
+        hdr = snew_plus(PktBufHeader, size);
+    } else {
+        size = pktbuf_class_sizes[sizeclass];
+        if ((hdr = pktbuf_freelist[sizeclass]) != NULL) {
+            pktbuf_freelist[sizeclass] = hdr->h.next;
+            pktbuf_nfree[sizeclass]--;
+            pktbuf_stats.reused++;
+        } else {
+            hdr = snew_plus(PktBufHeader, size);
+        }
+    }
+
+    hdr->h.sizeclass = sizeclass;
+    if (capacity)
+        *capacity = size;
+    return snew_plus_get_aux(hdr);
+}
+
+static void pktbuf_free(void *ptr)
+{
+    PktBufHeader *hdr = (PktBufHeader *)ptr - 1;
+    size_t sizeclass = hdr->h.sizeclass;
+
+    if (sizeclass < PKTBUF_NCLASSES &&
+        pktbuf_nfree[sizeclass] < PKTBUF_MAX_FREE) {
+        hdr->h.next = pktbuf_freelist[sizeclass];
+        pktbuf_freelist[sizeclass] = hdr;
+        pktbuf_nfree[sizeclass]++;
+    } else {
+        sfree(hdr);
+    }
+}
+
+void ssh_packet_pool_stats(PacketPoolStats *stats)
+{
+    *stats = pktbuf_stats;
+}
+
+PktIn *ssh_new_pktin(size_t datalen)
+{
+    PktIn *pktin = pktbuf_alloc(sizeof(PktIn) + datalen, NULL);
+
+    pktin->qnode.prev = pktin->qnode.next = NULL;
+    pktin->qnode.on_free_queue = false;
+    pktin->type = 0;
+
+    return pktin;
+}
+
+void ssh_free_pktin(PktIn *pktin)
+{
+    pktbuf_free(pktin);
+}
+
+/* ----------------------------------------------------------------------
+ * Low-level functions for the packet structures themselves.
+ */
+
+static void ssh_pkt_BinarySink_write(BinarySink *bs,
+                                     const void *data, size_t len);
+PktOut *ssh_new_packet(void)
+{
+    PktOut *pkt = pktbuf_alloc(sizeof(PktOut), NULL);
+
+    BinarySink_INIT(pkt, ssh_pkt_BinarySink_write);
+    pkt->data = NULL;
+    pkt->length = 0;
+    pkt->maxlen = 0;
+    pkt->downstream_id = 0;
+    pkt->additional_log_text = NULL;
+    pkt->qnode.next = pkt->qnode.prev = NULL;
+    pkt->qnode.on_free_queue = false;
+
+    return pkt;
+}
+
+static void ssh_pkt_adddata(PktOut *pkt, const void *data, int len)
+{
+    if (pkt->length + len > pkt->maxlen) {
+        /*
+         * Move to a bigger buffer, clearing the old one as
+         * sgrowarray_nm would. Most packets fit in whatever size
+         * class their first write put them in, but for ones that
+         * don't, make sure repeated small writes can't make this
+         * quadratic.
+         */
+        size_t newlen = pkt->length + len;
+        if (newlen < pkt->maxlen + pkt->maxlen / 4)
+            newlen = pkt->maxlen + pkt->maxlen / 4;
+        unsigned char *newdata = pktbuf_alloc(newlen, &pkt->maxlen);
+        if (pkt->data) {
+            memcpy(newdata, pkt->data, pkt->length);
+            smemclr(pkt->data, pkt->length);
+            pktbuf_free(pkt->data);
+        }
+        pkt->data = newdata;
+    }
+    memcpy(pkt->data + pkt->length, data, len);
+    pkt->length += len;
+    pkt->qnode.formal_size = pkt->length;
+}
+
+static void ssh_pkt_BinarySink_write(BinarySink *bs,
+                                     const void *data, size_t len)
+{
+    PktOut *pkt = BinarySink_DOWNCAST(bs, PktOut);
+    ssh_pkt_adddata(pkt, data, len);
+}
+
+void ssh_free_pktout(PktOut *pkt)
+{
+    if (pkt->data)
+        pktbuf_free(pkt->data);
+    pktbuf_free(pkt);
+}
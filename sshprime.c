@@ -116,6 +116,255 @@ const PrimeGenerationPolicy primegen_probabilistic = {
     null_mpu_certificate,
 };
 
+/* ----------------------------------------------------------------------
+ * Parallel version of the probabilistic algorithm, which shares the
+ * expensive parts of the search (sieving candidates against the
+ * small primes, and the first Miller-Rabin test of each survivor)
+ * between a pool of worker threads.
+ *
+ * All the random numbers are still drawn on the calling thread, in
+ * an order that doesn't depend on the number of threads or how they
+ * get scheduled. So given the same random data, this always finds
+ * the same prime, no matter how many processors it had to work with
+ * (although not the same one primegen_probabilistic would have
+ * found).
+ *
+ * Each batch of the search goes like this:
+ *
+ *  - draw PARALLEL_BATCH random starting values from the
+ *    PrimeCandidateSource
+ *
+ *  - [in parallel] sieve each one against the small primes
+ *
+ *  - [in parallel] set up a Miller-Rabin context for every survivor
+ *
+ *  - draw all the M-R witness values for every survivor, in order
+ *
+ *  - take the next few survivors, one per worker, and [in parallel]
+ *    do one M-R test on each of them. Nearly every composite fails
+ *    the first test, so anything that passes is very probably prime
+ *
+ *  - go through the ones that passed in order, doing the rest of the
+ *    M-R tests on each, and return the first one that passes them
+ *    all, abandoning the rest of the batch. If none did, go back for
+ *    the next few survivors.
+ *
+ * Because the candidates are always considered in the same order,
+ * and all the witnesses for a batch are drawn before any of them is
+ * used, neither stopping early nor the number of survivors tested at
+ * a time affects which prime we return, or how much random data we
+ * consumed on the way. So the next prime generated from the same
+ * random source is the same, too.
+ */
+
+#define PARALLEL_BATCH 64
+
+typedef enum ParallelPhase {
+    PP_SIEVE, PP_SETUP, PP_TEST
+} ParallelPhase;
+
+typedef struct ParallelCandidate {
+    mp_int *x, *p;
+    MillerRabin *mr;
+    mp_int **mws;                      /* one witness per M-R check */
+    bool passed;
+} ParallelCandidate;
+
+typedef struct ParallelPrimeContext ParallelPrimeContext;
+struct ParallelPrimeContext {
+    WorkerPool *pool;                  /* NULL if we're on our own */
+    size_t nworkers;
+
+    /* The batch currently being searched */
+    PrimeCandidateSource *pcs;
+    ParallelCandidate cands[PARALLEL_BATCH];
+    size_t live[PARALLEL_BATCH], nlive; /* indices of sieve survivors */
+    size_t chunk;                      /* first survivor being tested */
+    ParallelPhase phase;
+
+    PrimeGenerationContext pgc;
+};
+
+static void parprime_worker(void *vctx, size_t index)
+{
+    ParallelPrimeContext *pctx = (ParallelPrimeContext *)vctx;
+
+    if (pctx->phase == PP_SIEVE) {
+        for (size_t i = index; i < PARALLEL_BATCH; i += pctx->nworkers) {
+            ParallelCandidate *c = &pctx->cands[i];
+            c->p = pcs_sieve(pctx->pcs, c->x);
+        }
+        return;
+    }
+
+    if (pctx->phase == PP_SETUP) {
+        for (size_t j = index; j < pctx->nlive; j += pctx->nworkers) {
+            ParallelCandidate *c = &pctx->cands[pctx->live[j]];
+            c->mr = miller_rabin_new(c->p);
+        }
+        return;
+    }
+
+    size_t j = pctx->chunk + index;
+    if (j >= pctx->nlive)
+        return;
+    ParallelCandidate *c = &pctx->cands[pctx->live[j]];
+    c->passed = miller_rabin_test_witness(c->mr, c->mws[0]);
+}
+
+static void parprime_run(ParallelPrimeContext *pctx, ParallelPhase phase)
+{
+    pctx->phase = phase;
+    if (pctx->pool) {
+        worker_pool_run(pctx->pool);
+    } else {
+        for (size_t i = 0; i < pctx->nworkers; i++)
+            parprime_worker(pctx, i);
+    }
+}
+
+static size_t parprime_forced_workers;
+
+void primegen_parallel_force_workers(size_t nworkers)
+{
+    parprime_forced_workers = nworkers;
+}
+
+static PrimeGenerationContext *parprime_new_context(
+    const PrimeGenerationPolicy *policy)
+{
+    ParallelPrimeContext *pctx = snew(ParallelPrimeContext);
+    memset(pctx, 0, sizeof(*pctx));
+    pctx->pgc.vt = policy;
+
+    pctx->nworkers = (parprime_forced_workers ? parprime_forced_workers :
+                      worker_pool_ncpus());
+    if (pctx->nworkers > PARALLEL_BATCH)
+        pctx->nworkers = PARALLEL_BATCH;
+    pctx->pool = worker_pool_new(pctx->nworkers, parprime_worker, pctx);
+    if (!pctx->pool)
+        pctx->nworkers = 1;
+
+    return &pctx->pgc;
+}
+
+static void parprime_free_context(PrimeGenerationContext *ctx)
+{
+    ParallelPrimeContext *pctx = container_of(
+        ctx, ParallelPrimeContext, pgc);
+    if (pctx->pool)
+        worker_pool_free(pctx->pool);
+    sfree(pctx);
+}
+
+static mp_int *parprime_generate(
+    PrimeGenerationContext *ctx,
+    PrimeCandidateSource *pcs, ProgressReceiver *prog)
+{
+    ParallelPrimeContext *pctx = container_of(
+        ctx, ParallelPrimeContext, pgc);
+
+    /*
+     * A one-shot PrimeCandidateSource only gets one candidate, so
+     * there's nothing to share out.
+     */
+    if (pcs_is_oneshot(pcs))
+        return probprime_generate(ctx, pcs, prog);
+
+    pcs_ready(pcs);
+    pctx->pcs = pcs;
+
+    unsigned nchecks = miller_rabin_checks_needed(pcs_get_bits(pcs));
+    mp_int *toret = NULL;
+
+    while (!toret) {
+        for (size_t i = 0; i < PARALLEL_BATCH; i++) {
+            ParallelCandidate *c = &pctx->cands[i];
+            c->x = pcs_draw(pcs);
+            c->p = NULL;
+            c->mr = NULL;
+            c->mws = NULL;
+            c->passed = false;
+        }
+
+        parprime_run(pctx, PP_SIEVE);
+
+        pctx->nlive = 0;
+        for (size_t i = 0; i < PARALLEL_BATCH; i++)
+            if (pctx->cands[i].p)
+                pctx->live[pctx->nlive++] = i;
+
+        parprime_run(pctx, PP_SETUP);
+
+        for (size_t j = 0; j < pctx->nlive; j++) {
+            ParallelCandidate *c = &pctx->cands[pctx->live[j]];
+            c->mws = snewn(nchecks, mp_int *);
+            for (unsigned check = 0; check < nchecks; check++)
+                c->mws[check] = miller_rabin_random_witness(c->mr);
+        }
+
+        for (pctx->chunk = 0; pctx->chunk < pctx->nlive && !toret;
+             pctx->chunk += pctx->nworkers) {
+            size_t chunk_end = pctx->chunk + pctx->nworkers;
+            if (chunk_end > pctx->nlive)
+                chunk_end = pctx->nlive;
+
+            for (size_t j = pctx->chunk; j < chunk_end; j++)
+                progress_report_attempt(prog);
+
+            parprime_run(pctx, PP_TEST);
+
+            for (size_t j = pctx->chunk; j < chunk_end && !toret; j++) {
+                ParallelCandidate *c = &pctx->cands[pctx->live[j]];
+                if (!c->passed)
+                    continue;
+
+                bool known_bad = false;
+                for (unsigned check = 1; check < nchecks; check++) {
+                    if (!miller_rabin_test_witness(c->mr, c->mws[check])) {
+                        known_bad = true;
+                        break;
+                    }
+                }
+
+                if (!known_bad) {
+                    /*
+                     * We have a prime!
+                     */
+                    toret = c->p;
+                    c->p = NULL;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < PARALLEL_BATCH; i++) {
+            ParallelCandidate *c = &pctx->cands[i];
+            mp_free(c->x);
+            if (c->p)
+                mp_free(c->p);
+            if (c->mws) {
+                for (unsigned check = 0; check < nchecks; check++)
+                    mp_free(c->mws[check]);
+                sfree(c->mws);
+            }
+            if (c->mr)
+                miller_rabin_free(c->mr);
+        }
+    }
+
+    pctx->pcs = NULL;
+    pcs_free(pcs);
+    return toret;
+}
+
+const PrimeGenerationPolicy primegen_probabilistic_parallel = {
+    probprime_add_progress_phase,
+    parprime_new_context,
+    parprime_free_context,
+    parprime_generate,
+    null_mpu_certificate,
+};
+
 /* ----------------------------------------------------------------------
  * Alternative provable-prime algorithm, based on the following paper:
  *
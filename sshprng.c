@@ -42,6 +42,9 @@
 #define NCOLLECTORS 32
 #define RESEED_DATA_SIZE 64
 
+/* Number of generator output blocks made at a time by prng_read_buffered */
+#define BUFFER_BLOCKS 32
+
 typedef struct prng_impl prng_impl;
 struct prng_impl {
     prng Prng;
@@ -74,6 +77,27 @@ struct prng_impl {
      */
     ssh_hash *keymaker;
 
+    /*
+     * Buffered output, for prng_read_buffered.
+     *
+     * Making lots of small requests of prng_read is expensive,
+     * because each one rekeys the generator afterwards (so that the
+     * output can't be reconstructed from the state of the PRNG). So
+     * prng_read_buffered instead generates BUFFER_BLOCKS blocks at a
+     * time, rekeys once, and doles them out from this buffer.
+     *
+     * Output still waiting in the buffer is no more sensitive than
+     * the generator key, which would let you compute it anyway. But
+     * output that has been handed out is wiped from the buffer at
+     * once, so it's no more recoverable than it would have been from
+     * prng_read. And the whole buffer is thrown away when the PRNG is
+     * reseeded, so that fresh entropy takes effect immediately.
+     *
+     * The bytes not yet handed out are buffer[bufpos..bufsize-1].
+     */
+    unsigned char *buffer;
+    size_t bufsize, bufpos;
+
     /*
      * Collection side:
      *
@@ -117,6 +141,9 @@ prng *prng_new(const ssh_hashalg *hashalg)
     for (size_t i = 0; i < NCOLLECTORS; i++)
         pi->collectors[i] = ssh_hash_new(pi->hashalg);
     pi->until_reseed = 0;
+    pi->bufsize = BUFFER_BLOCKS * pi->hashalg->hlen;
+    pi->buffer = snewn(pi->bufsize, unsigned char);
+    pi->bufpos = pi->bufsize;
     BinarySink_INIT(&pi->Prng, prng_seed_BinarySink_write);
 
     pi->Prng.savesize = pi->hashalg->hlen * 4;
@@ -135,14 +162,20 @@ void prng_free(prng *pr)
         ssh_hash_free(pi->generator);
     if (pi->keymaker)
         ssh_hash_free(pi->keymaker);
+    smemclr(pi->buffer, pi->bufsize);
+    sfree(pi->buffer);
     smemclr(pi, sizeof(*pi));
     sfree(pi);
 }
 
-void prng_seed_begin(prng *pr)
+static void prng_discard_buffer(prng_impl *pi)
 {
-    prng_impl *pi = container_of(pr, prng_impl, Prng);
+    smemclr(pi->buffer, pi->bufsize);
+    pi->bufpos = pi->bufsize;
+}
 
+static void prng_seed_begin_internal(prng_impl *pi)
+{
     assert(!pi->keymaker);
 
     prngdebug("prng: reseed begin\n");
@@ -160,6 +193,18 @@ void prng_seed_begin(prng *pr)
     put_byte(pi->keymaker, 'R');
 }
 
+void prng_seed_begin(prng *pr)
+{
+    prng_impl *pi = container_of(pr, prng_impl, Prng);
+
+    /*
+     * Anything generated under the old key is discarded, so that
+     * the new seed data affects the very next output.
+     */
+    prng_discard_buffer(pi);
+    prng_seed_begin_internal(pi);
+}
+
 static void prng_seed_BinarySink_write(
     BinarySink *bs, const void *data, size_t len)
 {
@@ -199,9 +244,13 @@ void prng_seed_finish(prng *pr)
     smemclr(buf, sizeof(buf));
 }
 
-static inline void prng_generate(prng_impl *pi, void *outbuf)
+/*
+ * Generate one block of output, using 'h' as scratch space for the
+ * hash computation.
+ */
+static inline void prng_generate(prng_impl *pi, ssh_hash *h, void *outbuf)
 {
-    ssh_hash *h = ssh_hash_copy(pi->generator);
+    ssh_hash_copyfrom(h, pi->generator);
 
     prngdebug("prng_generate\n");
     put_byte(h, 'G');
@@ -210,7 +259,17 @@ static inline void prng_generate(prng_impl *pi, void *outbuf)
     BignumCarry c = 1;
     for (unsigned i = 0; i < lenof(pi->counter); i++)
         BignumADC(pi->counter[i], c, pi->counter[i], 0, c);
-    ssh_hash_final(h, outbuf);
+    ssh_hash_digest(h, outbuf);
+}
+
+/*
+ * Rekey the generator after producing output, so that the output
+ * can't be reconstructed from the state of the PRNG.
+ */
+static void prng_rekey(prng_impl *pi)
+{
+    prng_seed_begin_internal(pi);
+    prng_seed_finish(&pi->Prng);
 }
 
 void prng_read(prng *pr, void *vout, size_t size)
@@ -222,19 +281,66 @@ void prng_read(prng *pr, void *vout, size_t size)
 
     prngdebug("prng_read %"SIZEu"\n", size);
 
+    ssh_hash *h = ssh_hash_copy(pi->generator);
     uint8_t *out = (uint8_t *)vout;
     while (size > 0) {
-        prng_generate(pi, buf);
+        prng_generate(pi, h, buf);
         size_t to_use = size > pi->hashalg->hlen ? pi->hashalg->hlen : size;
         memcpy(out, buf, to_use);
         out += to_use;
         size -= to_use;
     }
+    ssh_hash_free(h);
 
     smemclr(buf, sizeof(buf));
 
-    prng_seed_begin(&pi->Prng);
-    prng_seed_finish(&pi->Prng);
+    prng_rekey(pi);
+}
+
+static void prng_refill_buffer(prng_impl *pi)
+{
+    size_t hlen = pi->hashalg->hlen;
+
+    prngdebug("prng_refill_buffer\n");
+
+    ssh_hash *h = ssh_hash_copy(pi->generator);
+    for (size_t pos = 0; pos < pi->bufsize; pos += hlen)
+        prng_generate(pi, h, pi->buffer + pos);
+    ssh_hash_free(h);
+    pi->bufpos = 0;
+
+    prng_rekey(pi);
+}
+
+void prng_read_buffered(prng *pr, void *vout, size_t size)
+{
+    prng_impl *pi = container_of(pr, prng_impl, Prng);
+
+    assert(!pi->keymaker);
+
+    prngdebug("prng_read_buffered %"SIZEu"\n", size);
+
+    uint8_t *out = (uint8_t *)vout;
+    while (size > 0) {
+        if (pi->bufpos == pi->bufsize) {
+            /* Requests too big to gain anything from the buffer just
+             * go straight to the generator. */
+            if (size >= pi->bufsize) {
+                prng_read(pr, out, size);
+                return;
+            }
+            prng_refill_buffer(pi);
+        }
+
+        size_t to_use = pi->bufsize - pi->bufpos;
+        if (to_use > size)
+            to_use = size;
+        memcpy(out, pi->buffer + pi->bufpos, to_use);
+        smemclr(pi->buffer + pi->bufpos, to_use);
+        pi->bufpos += to_use;
+        out += to_use;
+        size -= to_use;
+    }
 }
 
 void prng_add_entropy(prng *pr, unsigned source_id, ptrlen data)
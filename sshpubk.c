@@ -586,6 +586,20 @@ const ssh_keyalg *find_pubkey_alg(const char *name)
     return find_pubkey_alg_len(ptrlen_from_asciz(name));
 }
 
+bool ssh_key_verify_batch(const ssh_keyalg *alg, ssh_key *const *keys,
+                          const ptrlen *sigs, const ptrlen *data, size_t n)
+{
+    if (alg->verify_batch)
+        return alg->verify_batch(alg, keys, sigs, data, n);
+
+    for (size_t i = 0; i < n; i++) {
+        assert(ssh_key_alg(keys[i]) == alg);
+        if (!ssh_key_verify(keys[i], sigs[i], data[i]))
+            return false;
+    }
+    return true;
+}
+
 struct ppk_cipher {
     const char *name;
     size_t blocklen, keylen, ivlen;
@@ -1447,14 +1461,17 @@ const ppk_save_parameters ppk_save_default_parameters = {
     .argon2_milliseconds = 100,
 
     /*
-     * PuTTY's own Argon2 implementation is single-threaded. So we
-     * might as well set parallelism to 1, which requires that
+     * PuTTY's own Argon2 implementation can process lanes on separate
+     * threads, but not every build or machine that might later load
+     * the key file will have threads or spare cores to run them on.
+     * So we set parallelism to 1 by default, which requires that
      * attackers' implementations must also be effectively
      * single-threaded, and they don't get any benefit from using
      * multiple cores on the same hash attempt. (Of course they can
      * still use multiple cores for _separate_ hash attempts, but at
      * least they don't get a speed advantage over us in computing
-     * even one hash.)
+     * even one hash.) Users who know their key files will only be
+     * loaded on multi-core machines can ask for more.
      */
     .argon2_parallelism = 1,
 };
@@ -131,7 +131,7 @@ void random_unref(void)
 void random_read(void *buf, size_t size)
 {
     assert(random_active > 0);
-    prng_read(global_prng, buf, size);
+    prng_read_buffered(global_prng, buf, size);
 }
 
 void random_get_savedata(void **data, int *len)
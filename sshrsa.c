@@ -41,6 +41,7 @@ void BinarySource_get_rsa_ssh1_priv(
     BinarySource *src, RSAKey *rsa)
 {
     rsa->private_exponent = get_mp_ssh1(src);
+    rsa->crt = NULL;                   /* computed on first use */
 }
 
 key_components *rsa_components(RSAKey *rsa)
@@ -138,38 +139,118 @@ bool rsa_ssh1_encrypt(unsigned char *data, int length, RSAKey *key)
 }
 
 /*
- * Compute (base ^ exp) % mod, provided mod == p * q, with p,q
- * distinct primes, and iqmp is the multiplicative inverse of q mod p.
- * Uses Chinese Remainder Theorem to speed computation up over the
- * obvious implementation of a single big modpow.
+ * Values needed by every private-key operation that depend only on
+ * the key: a Montgomery context for each prime, the private exponent
+ * reduced mod p-1 and mod q-1, and the inverse of q mod p in
+ * Montgomery form. Setting these up from scratch costs a noticeable
+ * fraction of a signature, so we keep them alongside the key.
+ *
+ * The recombination step below wants p > q. rsa_verify arranges
+ * that for the key itself, but not every route to an RSAKey goes
+ * through rsa_verify, so the cache makes its own choice of which
+ * prime to call p.
  */
-static mp_int *crt_modpow(mp_int *base, mp_int *exp, mp_int *mod,
-                          mp_int *p, mp_int *q, mp_int *iqmp)
+typedef struct RSACrtHalf {
+    MontyContext *mc;
+    mp_int *base, *exp, *result;
+} RSACrtHalf;
+
+struct RSACrtCache {
+    MontyContext *mc_p, *mc_q;
+    mp_int *dp, *dq;
+    mp_int *iqmp_m;                    /* (q^-1 mod p) * r mod p */
+
+    /* If non-NULL, a pool of two workers which crt_modpow uses to do
+     * the two halves at once. It's kept here so that each signature
+     * doesn't have to start new threads. */
+    WorkerPool *pool;
+    RSACrtHalf halves[2];
+};
+
+static RSACrtCache *rsa_crt_cache_new(RSAKey *key)
 {
-    mp_int *pm1, *qm1, *pexp, *qexp, *presult, *qresult;
-    mp_int *diff, *multiplier, *ret0, *ret;
+    RSACrtCache *crt = snew(RSACrtCache);
+
+    mp_int *p = mp_max(key->p, key->q);
+    mp_int *q = mp_min(key->p, key->q);
 
     /*
      * Reduce the exponent mod phi(p) and phi(q), to save time when
      * exponentiating mod p and mod q respectively. Of course, since p
      * and q are prime, phi(p) == p-1 and similarly for q.
      */
-    pm1 = mp_copy(p);
+    mp_int *pm1 = mp_copy(p);
     mp_sub_integer_into(pm1, pm1, 1);
-    qm1 = mp_copy(q);
+    mp_int *qm1 = mp_copy(q);
     mp_sub_integer_into(qm1, qm1, 1);
-    pexp = mp_mod(exp, pm1);
-    qexp = mp_mod(exp, qm1);
+    crt->dp = mp_mod(key->private_exponent, pm1);
+    crt->dq = mp_mod(key->private_exponent, qm1);
+    mp_free(pm1);
+    mp_free(qm1);
+
+    crt->mc_p = monty_new(p);
+    crt->mc_q = monty_new(q);
+    mp_int *iqmp = mp_invert(q, p);
+    crt->iqmp_m = monty_import(crt->mc_p, iqmp);
+
+    mp_free(iqmp);
+    mp_free(p);
+    mp_free(q);
+
+    crt->pool = NULL;
+
+    return crt;
+}
+
+static void rsa_crt_cache_free(RSACrtCache *crt)
+{
+    if (crt->pool)
+        worker_pool_free(crt->pool);
+    mp_free(crt->dp);
+    mp_free(crt->dq);
+    mp_free(crt->iqmp_m);
+    monty_free(crt->mc_p);
+    monty_free(crt->mc_q);
+    smemclr(crt, sizeof(*crt));
+    sfree(crt);
+}
+
+static void rsa_crt_half(void *vctx, size_t index)
+{
+    RSACrtHalf *half = (RSACrtHalf *)vctx + index;
+    mp_int *m_base = monty_import(half->mc, half->base);
+    mp_int *m_out = monty_pow(half->mc, m_base, half->exp);
+    half->result = monty_export(half->mc, m_out);
+    mp_free(m_base);
+    mp_free(m_out);
+}
+
+/*
+ * Compute (base ^ d) % n, where d is the key's private exponent and
+ * n == p * q, with p,q distinct primes and iqmp the multiplicative
+ * inverse of q mod p. Uses Chinese Remainder Theorem to speed
+ * computation up over the obvious implementation of a single big
+ * modpow.
+ */
+static mp_int *crt_modpow(mp_int *base, RSAKey *key)
+{
+    RSACrtCache *crt = key->crt;
+    mp_int *p = monty_modulus(crt->mc_p), *q = monty_modulus(crt->mc_q);
 
     /*
-     * Do the two modpows.
+     * Do the two modpows. (monty_import reduces the base mod p or q
+     * as a side effect, so we needn't do that separately.)
      */
-    mp_int *base_mod_p = mp_mod(base, p);
-    presult = mp_modpow(base_mod_p, pexp, p);
-    mp_free(base_mod_p);
-    mp_int *base_mod_q = mp_mod(base, q);
-    qresult = mp_modpow(base_mod_q, qexp, q);
-    mp_free(base_mod_q);
+    RSACrtHalf *halves = crt->halves;
+    halves[0] = (RSACrtHalf){ crt->mc_p, base, crt->dp, NULL };
+    halves[1] = (RSACrtHalf){ crt->mc_q, base, crt->dq, NULL };
+    if (crt->pool) {
+        worker_pool_run(crt->pool);
+    } else {
+        rsa_crt_half(halves, 0);
+        rsa_crt_half(halves, 1);
+    }
+    mp_int *presult = halves[0].result, *qresult = halves[1].result;
 
     /*
      * Recombine the results. We want a value which is congruent to
@@ -181,45 +262,61 @@ static mp_int *crt_modpow(mp_int *base, mp_int *exp, mp_int *mod,
      * (presult-qresult) * (iqmp * q) which adjusts it to be congruent
      * to presult mod p without affecting its value mod q.
      *
-     * (If presult-qresult < 0, we add p to it to keep it positive.)
+     * We reduce (presult-qresult) * iqmp mod p before multiplying by
+     * q, which keeps the result below n = pq and saves a reduction
+     * mod n at the end. Since q < p, qresult is also less than p, so
+     * adding p at most once makes presult-qresult non-negative.
      */
     unsigned presult_too_small = mp_cmp_hs(qresult, presult);
     mp_cond_add_into(presult, presult, p, presult_too_small);
 
-    diff = mp_sub(presult, qresult);
-    multiplier = mp_mul(iqmp, q);
-    ret0 = mp_mul(multiplier, diff);
-    mp_add_into(ret0, ret0, qresult);
+    mp_int *diff = mp_sub(presult, qresult);
+    mp_int *h = monty_mul(crt->mc_p, diff, crt->iqmp_m);
 
-    /*
-     * Finally, reduce the result mod n.
-     */
-    ret = mp_mod(ret0, mod);
+    mp_int *ret = mp_new(mp_max_bits(key->modulus));
+    mp_mul_into(ret, h, q);
+    mp_add_into(ret, ret, qresult);
 
     /*
      * Free all the intermediate results before returning.
      */
-    mp_free(pm1);
-    mp_free(qm1);
-    mp_free(pexp);
-    mp_free(qexp);
     mp_free(presult);
     mp_free(qresult);
     mp_free(diff);
-    mp_free(multiplier);
-    mp_free(ret0);
+    mp_free(h);
 
     return ret;
 }
 
 /*
- * Wrapper on crt_modpow that looks up all the right values from an
- * RSAKey.
+ * Wrapper on crt_modpow that makes sure the key's CRT values are
+ * available.
  */
 static mp_int *rsa_privkey_op(mp_int *input, RSAKey *key)
 {
-    return crt_modpow(input, key->private_exponent,
-                      key->modulus, key->p, key->q, key->iqmp);
+    if (!key->crt)
+        key->crt = rsa_crt_cache_new(key);
+    return crt_modpow(input, key);
+}
+
+/*
+ * The two half-size exponentiations are independent of each other,
+ * so a private key can optionally run them on two threads at once.
+ * The setting belongs to the key's CRT cache, and the worker pool it
+ * needs is made once here rather than on every operation.
+ */
+void rsa_set_crt_threads(RSAKey *key, bool enabled)
+{
+    assert(key->private_exponent);
+    if (!key->crt)
+        key->crt = rsa_crt_cache_new(key);
+
+    if (enabled && !key->crt->pool) {
+        key->crt->pool = worker_pool_new(2, rsa_crt_half, key->crt->halves);
+    } else if (!enabled && key->crt->pool) {
+        worker_pool_free(key->crt->pool);
+        key->crt->pool = NULL;
+    }
 }
 
 mp_int *rsa_ssh1_decrypt(mp_int *input, RSAKey *key)
@@ -342,6 +439,16 @@ bool rsa_verify(RSAKey *key)
     mp_int *n, *ed, *pm1, *qm1;
     unsigned ok = 1;
 
+    /* We might be about to swap p and q and regenerate iqmp, so any
+     * existing CRT cache would be out of date. Remember whether it
+     * was threaded, so the new one can be made the same way. */
+    bool threads = false;
+    if (key->crt) {
+        threads = key->crt->pool != NULL;
+        rsa_crt_cache_free(key->crt);
+        key->crt = NULL;
+    }
+
     /* Preliminary checks: p,q can't be 0 or 1. (Of course no other
      * very small value is any good either, but these are the values
      * we _must_ check for to avoid assertion failures further down
@@ -386,6 +493,14 @@ bool rsa_verify(RSAKey *key)
     key->q = q_new;
     key->iqmp = mp_invert(key->q, key->p);
 
+    /* Precompute the CRT values now, so that the first signature
+     * doesn't have to. */
+    if (ok) {
+        key->crt = rsa_crt_cache_new(key);
+        if (threads)
+            rsa_set_crt_threads(key, true);
+    }
+
     return ok;
 }
 
@@ -433,6 +548,10 @@ int rsa_ssh1_public_blob_len(ptrlen data)
 
 void freersapriv(RSAKey *key)
 {
+    if (key->crt) {
+        rsa_crt_cache_free(key->crt);
+        key->crt = NULL;
+    }
     if (key->private_exponent) {
         mp_free(key->private_exponent);
         key->private_exponent = NULL;
@@ -494,6 +613,7 @@ static ssh_key *rsa2_new_pub(const ssh_keyalg *self, ptrlen data)
     rsa->private_exponent = NULL;
     rsa->p = rsa->q = rsa->iqmp = NULL;
     rsa->comment = NULL;
+    rsa->crt = NULL;
 
     if (get_err(src)) {
         rsa2_freekey(&rsa->sshk);
@@ -575,6 +695,7 @@ static ssh_key *rsa2_new_priv_openssh(const ssh_keyalg *self,
     rsa = snew(RSAKey);
     rsa->sshk.vt = &ssh_rsa;
     rsa->comment = NULL;
+    rsa->crt = NULL;
 
     rsa->modulus = get_mp_ssh2(src);
     rsa->exponent = get_mp_ssh2(src);
@@ -176,6 +176,8 @@ int rsa_generate(RSAKey *key, int bits, bool strong,
     key->bits = mp_get_nbits(modulus);
     key->bytes = (key->bits + 7) / 8;
 
+    key->crt = NULL;                   /* computed on first use */
+
     return 1;
 }
 
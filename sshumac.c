@@ -0,0 +1,572 @@
+/*
+ * Implementation of UMAC (RFC 4418), as used in SSH-2 by OpenSSH
+ * under the names umac-64@openssh.com and umac-128@openssh.com.
+ *
+ * UMAC computes a fast universal hash of the message, keyed by
+ * material derived from the MAC key, and then encrypts it by XORing
+ * with a pad made by enciphering a nonce. The block cipher, for both
+ * the key derivation and the pad, is AES-128, and we use the same
+ * implementation as everything else in sshaes.c (hardware-accelerated
+ * where available).
+ *
+ * The universal hash is done in three layers, each of which is
+ * carried out 'iters' times in parallel with different keys, where
+ * iters is the tag length in 32-bit words (2 for UMAC-64, 4 for
+ * UMAC-128):
+ *
+ *  - L1 ('NH') splits the message into 1024-byte chunks, and turns
+ *    each one into a 64-bit value using 32-bit additions and 32x32
+ *    bit multiplications. This is the part that sees every byte of
+ *    the message, and it's what makes UMAC fast.
+ *
+ *  - L2 is a polynomial hash of the sequence of L1 outputs, modulo
+ *    2^64-59 (or, for messages beyond 16Mb, mostly modulo 2^128-159).
+ *    If the message is only one chunk long, it's skipped.
+ *
+ *  - L3 reduces the 128-bit L2 output to 32 bits with an inner
+ *    product modulo 2^36-5.
+ *
+ * For use in SSH, the nonce is the 32-bit packet sequence number,
+ * extended to 64 bits. The SSH packet layer feeds a MAC with the
+ * sequence number followed by the packet, so we take the first 4
+ * bytes we're given as the nonce rather than part of the message.
+ * testcrypt can instead set an explicit nonce, so as to check us
+ * against the RFC's test vectors.
+ */
+
+#include <assert.h>
+
+#include "ssh.h"
+#include "mpint.h"
+
+#define UMAC_MAX_ITERS 4
+#define UMAC_KEYLEN 16
+
+#define L1_CHUNK 1024                  /* bytes of message per NH call */
+#define L1_BLOCK 32                    /* bytes NH processes at a time */
+#define L1_KEYWORDS (L1_CHUNK/4 + 4*(UMAC_MAX_ITERS-1))
+
+/* After this many L1 outputs, L2 switches from POLY64 to POLY128 */
+#define L2_POLY64_LIMIT ((1 << 17) / 8)
+
+#define P36 ((UINT64_C(1) << 36) - 5)
+#define P64 (~UINT64_C(0) - 58)        /* 2^64 - 59 */
+
+typedef struct umac umac;
+struct umac {
+    unsigned iters;
+
+    /*
+     * Keys. The L1 key is stored as 32-bit words, already decoded
+     * from the big-endian byte string the KDF produced; iteration i
+     * uses the words starting at 4*i.
+     */
+    uint32_t l1key[L1_KEYWORDS];
+    uint64_t l2key64[UMAC_MAX_ITERS];
+    mp_int *l2key128[UMAC_MAX_ITERS];
+    uint64_t l3key1[UMAC_MAX_ITERS][8];
+    uint32_t l3key2[UMAC_MAX_ITERS];
+
+    /* AES-128 keyed for the pad-derivation function, and a cache of
+     * its most recent input and output. For UMAC-64, consecutive
+     * nonces share a pad block, so this saves half the encryptions. */
+    ssh_cipher *pdf_cipher;
+    uint8_t pdf_in[16], pdf_out[16];
+    bool pdf_valid;
+
+    /* Nonce for the current message */
+    uint8_t nonce[8];
+    bool explicit_nonce;
+    size_t nonce_left;                 /* sequence number bytes to come */
+
+    /* L1 state: a partial NH block, and the NH accumulators for the
+     * chunk in progress */
+    uint8_t partblk[L1_BLOCK];
+    size_t partlen;
+    uint64_t nh[UMAC_MAX_ITERS];
+    size_t chunk_words;                /* words of the chunk processed */
+    size_t chunk_len;                  /* real message bytes in them */
+
+    /* L2 state */
+    size_t nl1;                        /* number of L1 outputs so far */
+    uint64_t l1first[UMAC_MAX_ITERS];  /* held back until nl1 > 1 */
+    uint64_t poly64[UMAC_MAX_ITERS];
+    mp_int *poly128[UMAC_MAX_ITERS], *p128;
+    uint64_t l1pending[UMAC_MAX_ITERS]; /* half a POLY128 word */
+    bool pending;
+
+    ssh2_mac mac;
+    BinarySink_IMPLEMENTATION;
+};
+
+static void umac_BinarySink_write(BinarySink *bs, const void *vp, size_t len);
+
+static ssh2_mac *umac_new(const ssh2_macalg *alg, ssh_cipher *cipher)
+{
+    umac *ctx = snew(umac);
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->iters = alg->len / 4;
+    assert(ctx->iters <= UMAC_MAX_ITERS);
+    ctx->pdf_cipher = ssh_cipher_new(&ssh_aes128_sdctr);
+
+    ctx->p128 = MP_LITERAL(0xffffffffffffffffffffffffffffff61);
+    for (unsigned i = 0; i < ctx->iters; i++) {
+        ctx->l2key128[i] = mp_new(128);
+        ctx->poly128[i] = mp_new(128);
+    }
+
+    ctx->mac.vt = alg;
+    BinarySink_INIT(ctx, umac_BinarySink_write);
+    BinarySink_DELEGATE_INIT(&ctx->mac, ctx);
+    return &ctx->mac;
+}
+
+static void umac_free(ssh2_mac *mac)
+{
+    umac *ctx = container_of(mac, umac, mac);
+
+    ssh_cipher_free(ctx->pdf_cipher);
+    for (unsigned i = 0; i < ctx->iters; i++) {
+        mp_free(ctx->l2key128[i]);
+        mp_free(ctx->poly128[i]);
+    }
+    mp_free(ctx->p128);
+    smemclr(ctx, sizeof(*ctx));
+    sfree(ctx);
+}
+
+/*
+ * The key derivation function: enciphers the 128-bit values
+ * (index << 64) + 1, (index << 64) + 2, ..., which is just what
+ * counter mode does given the first of them as its IV.
+ */
+static void umac_kdf(ssh_cipher *aes, unsigned index,
+                     uint8_t *out, size_t len)
+{
+    uint8_t iv[16], buf[L1_CHUNK + 16*UMAC_MAX_ITERS];
+    size_t padlen = (len + 15) & ~(size_t)15;
+    assert(padlen <= sizeof(buf));
+
+    PUT_64BIT_MSB_FIRST(iv, index);
+    PUT_64BIT_MSB_FIRST(iv + 8, 1);
+    ssh_cipher_setiv(aes, iv);
+    memset(buf, 0, padlen);
+    ssh_cipher_encrypt(aes, buf, padlen);
+    memcpy(out, buf, len);
+    smemclr(buf, sizeof(buf));
+}
+
+static void umac_key(ssh2_mac *mac, ptrlen key)
+{
+    umac *ctx = container_of(mac, umac, mac);
+    uint8_t buf[L1_KEYWORDS * 4];
+    unsigned iters = ctx->iters;
+
+    assert(key.len == UMAC_KEYLEN);
+    ssh_cipher *aes = ssh_cipher_new(&ssh_aes128_sdctr);
+    ssh_cipher_setkey(aes, key.ptr);
+
+    umac_kdf(aes, 0, buf, UMAC_KEYLEN);
+    ssh_cipher_setkey(ctx->pdf_cipher, buf);
+    ctx->pdf_valid = false;
+
+    umac_kdf(aes, 1, buf, L1_CHUNK + 16 * (iters-1));
+    for (size_t i = 0; i < L1_CHUNK/4 + 4 * (iters-1); i++)
+        ctx->l1key[i] = GET_32BIT_MSB_FIRST(buf + 4*i);
+
+    umac_kdf(aes, 2, buf, 24 * iters);
+    for (unsigned i = 0; i < iters; i++) {
+        uint8_t *k = buf + 24*i;
+        ctx->l2key64[i] = GET_64BIT_MSB_FIRST(k) &
+            UINT64_C(0x01FFFFFF01FFFFFF);
+        for (unsigned j = 8; j < 24; j += 4)
+            k[j] &= 0x01;
+        mp_int *k128 = mp_from_bytes_be(make_ptrlen(k + 8, 16));
+        mp_copy_into(ctx->l2key128[i], k128);
+        mp_free(k128);
+    }
+
+    umac_kdf(aes, 3, buf, 64 * iters);
+    for (unsigned i = 0; i < iters; i++)
+        for (unsigned j = 0; j < 8; j++)
+            ctx->l3key1[i][j] = GET_64BIT_MSB_FIRST(buf + 64*i + 8*j) % P36;
+
+    umac_kdf(aes, 4, buf, 4 * iters);
+    for (unsigned i = 0; i < iters; i++)
+        ctx->l3key2[i] = GET_32BIT_MSB_FIRST(buf + 4*i);
+
+    smemclr(buf, sizeof(buf));
+    ssh_cipher_free(aes);
+}
+
+static void umac_start(ssh2_mac *mac)
+{
+    umac *ctx = container_of(mac, umac, mac);
+
+    if (!ctx->explicit_nonce) {
+        memset(ctx->nonce, 0, 8);
+        ctx->nonce_left = 4;
+    }
+
+    ctx->partlen = 0;
+    for (unsigned i = 0; i < ctx->iters; i++)
+        ctx->nh[i] = 0;
+    ctx->chunk_words = ctx->chunk_len = 0;
+    ctx->nl1 = 0;
+    ctx->pending = false;
+}
+
+/*
+ * One step of POLY64 from RFC 4418: y = (k*y + m) mod 2^64-59, except
+ * that we don't bother to fully reduce the output, only to keep it
+ * below 2^64. The masking of the L2 key keeps both halves of k below
+ * 2^25, which leaves room to multiply in 32-bit pieces and fold the
+ * top half of the product back in without overflow.
+ */
+static inline uint64_t umac_poly64_step(uint64_t y, uint64_t k, uint64_t m)
+{
+    uint64_t ylo = (uint32_t)y, yhi = y >> 32;
+    uint64_t klo = (uint32_t)k, khi = k >> 32;
+
+    uint64_t mid = ylo * khi + yhi * klo;
+    uint64_t lo = ylo * klo;
+    uint64_t hi = yhi * khi + (mid >> 32);
+    uint64_t t = mid << 32;
+    lo += t;
+    hi += (lo < t);
+
+    /* 2^64 is congruent to 59. All the values we're hashing are
+     * derived from the message and key, so fold in the carries
+     * without branching. */
+    uint64_t r = lo + hi * 59;
+    r += 59 & -(uint64_t)(r < lo);
+    r += m;
+    r += 59 & -(uint64_t)(r < m);
+    return r;
+}
+
+static inline uint64_t umac_poly64(uint64_t y, uint64_t k, uint64_t m)
+{
+    /* Words too close to the modulus are split into two. We do the
+     * extra step regardless, and keep its result only if needed. */
+    uint64_t big = -(uint64_t)(m >= ~UINT64_C(0) - 0xFFFFFFFFU);
+    uint64_t ymarked = umac_poly64_step(y, k, P64 - 1);
+    y ^= (y ^ ymarked) & big;
+    m -= 59 & big;
+    return umac_poly64_step(y, k, m);
+}
+
+static inline uint64_t umac_poly64_result(uint64_t y)
+{
+    return y - (P64 & -(uint64_t)(y >= P64));
+}
+
+/*
+ * POLY128 is only needed for messages bigger than 16Mb, which SSH
+ * never sends, so it's done the easy way, with mp_int.
+ */
+static void umac_poly128_step(umac *ctx, unsigned i, mp_int *m)
+{
+    mp_int *t = mp_modmul(ctx->l2key128[i], ctx->poly128[i], ctx->p128);
+    mp_int *y = mp_modadd(t, m, ctx->p128);
+    mp_copy_into(ctx->poly128[i], y);
+    mp_free(t);
+    mp_free(y);
+}
+
+static void umac_poly128(umac *ctx, unsigned i, uint64_t mhi, uint64_t mlo)
+{
+    uint8_t bytes[16];
+    PUT_64BIT_MSB_FIRST(bytes, mhi);
+    PUT_64BIT_MSB_FIRST(bytes + 8, mlo);
+    mp_int *m = mp_from_bytes_be(make_ptrlen(bytes, 16));
+    unsigned big = (((mhi >> 32) ^ 0xFFFFFFFF) - 1) >> 63;
+
+    mp_int *yorig = mp_copy(ctx->poly128[i]);
+    mp_int *marker = mp_copy(ctx->p128);
+    mp_sub_integer_into(marker, marker, 1);
+    umac_poly128_step(ctx, i, marker);
+    mp_select_into(ctx->poly128[i], yorig, ctx->poly128[i], big);
+
+    mp_int *mreduced = mp_copy(m);
+    mp_sub_integer_into(mreduced, m, 159);
+    mp_select_into(m, m, mreduced, big);
+    umac_poly128_step(ctx, i, m);
+
+    mp_free(yorig);
+    mp_free(marker);
+    mp_free(mreduced);
+    mp_free(m);
+    smemclr(bytes, sizeof(bytes));
+}
+
+/*
+ * Pass one L1 output (per iteration) on to L2.
+ */
+static void umac_l2_absorb(umac *ctx, size_t index, const uint64_t *a)
+{
+    for (unsigned i = 0; i < ctx->iters; i++) {
+        if (index < L2_POLY64_LIMIT) {
+            ctx->poly64[i] = umac_poly64(
+                index == 0 ? 1 : ctx->poly64[i], ctx->l2key64[i], a[i]);
+        } else {
+            if (index == L2_POLY64_LIMIT) {
+                /* Start POLY128 with the result of POLY64 */
+                mp_copy_integer_into(ctx->poly128[i], 1);
+                umac_poly128(ctx, i, 0, umac_poly64_result(ctx->poly64[i]));
+            }
+            if (ctx->pending)
+                umac_poly128(ctx, i, ctx->l1pending[i], a[i]);
+            else
+                ctx->l1pending[i] = a[i];
+        }
+    }
+    if (index >= L2_POLY64_LIMIT)
+        ctx->pending = !ctx->pending;
+}
+
+/*
+ * Finish the current L1 chunk, whose bit length is given.
+ */
+static void umac_l1_output(umac *ctx, uint64_t lenbits)
+{
+    uint64_t a[UMAC_MAX_ITERS];
+
+    for (unsigned i = 0; i < ctx->iters; i++) {
+        a[i] = ctx->nh[i] + lenbits;
+        ctx->nh[i] = 0;
+    }
+    ctx->chunk_words = ctx->chunk_len = 0;
+
+    /* We can't tell yet whether L2 will be needed at all, so the
+     * first output is held back until a second one turns up. */
+    if (ctx->nl1 == 0) {
+        memcpy(ctx->l1first, a, sizeof(a));
+    } else {
+        if (ctx->nl1 == 1)
+            umac_l2_absorb(ctx, 0, ctx->l1first);
+        umac_l2_absorb(ctx, ctx->nl1, a);
+    }
+    ctx->nl1++;
+    smemclr(a, sizeof(a));
+}
+
+/*
+ * NH over a run of 32-byte blocks within one chunk, for all
+ * iterations at once, so that each message word is loaded only once.
+ * Message words are little-endian; the pairing of words 4 apart is
+ * specified by the RFC to suit vector implementations. 'iters' is
+ * always a compile-time constant at the call sites, so the compiler
+ * can keep all the accumulators in registers.
+ */
+static inline void umac_nh_run(uint64_t *nh, const uint32_t *key,
+                               const uint8_t *p, size_t nblocks,
+                               const unsigned iters)
+{
+    uint64_t y[UMAC_MAX_ITERS];
+    for (unsigned i = 0; i < iters; i++)
+        y[i] = nh[i];
+
+    for (; nblocks > 0; nblocks--, p += L1_BLOCK, key += 8) {
+        uint32_t m[8];
+        for (unsigned j = 0; j < 8; j++)
+            m[j] = GET_32BIT_LSB_FIRST(p + 4*j);
+
+        for (unsigned i = 0; i < iters; i++) {
+            const uint32_t *k = key + 4*i;
+            for (unsigned j = 0; j < 4; j++)
+                y[i] += (uint64_t)(uint32_t)(m[j] + k[j]) *
+                    (uint32_t)(m[j+4] + k[j+4]);
+        }
+    }
+
+    for (unsigned i = 0; i < iters; i++)
+        nh[i] = y[i];
+}
+
+static void umac_nh_blocks(umac *ctx, const uint8_t *p, size_t nblocks)
+{
+    while (nblocks > 0) {
+        if (ctx->chunk_words == L1_CHUNK/4)
+            umac_l1_output(ctx, 8 * L1_CHUNK);
+
+        size_t n = (L1_CHUNK/4 - ctx->chunk_words) / 8;
+        if (n > nblocks)
+            n = nblocks;
+
+        const uint32_t *key = ctx->l1key + ctx->chunk_words;
+        if (ctx->iters == 2)
+            umac_nh_run(ctx->nh, key, p, n, 2);
+        else
+            umac_nh_run(ctx->nh, key, p, n, 4);
+
+        ctx->chunk_words += 8 * n;
+        ctx->chunk_len += L1_BLOCK * n;
+        p += L1_BLOCK * n;
+        nblocks -= n;
+    }
+}
+
+static void umac_BinarySink_write(BinarySink *bs, const void *vp, size_t len)
+{
+    umac *ctx = BinarySink_DOWNCAST(bs, umac);
+    const uint8_t *p = (const uint8_t *)vp;
+
+    while (len > 0 && ctx->nonce_left > 0) {
+        ctx->nonce[8 - ctx->nonce_left--] = *p++;
+        len--;
+    }
+
+    if (ctx->partlen > 0) {
+        size_t to_use = L1_BLOCK - ctx->partlen;
+        if (to_use > len)
+            to_use = len;
+        memcpy(ctx->partblk + ctx->partlen, p, to_use);
+        ctx->partlen += to_use;
+        p += to_use;
+        len -= to_use;
+        if (ctx->partlen < L1_BLOCK)
+            return;
+
+        /* Don't process a full block until we know whether it's the
+         * last: the final block of the message may need padding,
+         * which a block that just happens to end it doesn't. */
+        if (len == 0)
+            return;
+        umac_nh_blocks(ctx, ctx->partblk, 1);
+        ctx->partlen = 0;
+    }
+
+    if (len > L1_BLOCK) {
+        size_t nblocks = (len - 1) / L1_BLOCK;
+        umac_nh_blocks(ctx, p, nblocks);
+        p += L1_BLOCK * nblocks;
+        len -= L1_BLOCK * nblocks;
+    }
+
+    memcpy(ctx->partblk, p, len);
+    ctx->partlen = len;
+}
+
+static void umac_genresult(ssh2_mac *mac, unsigned char *output)
+{
+    umac *ctx = container_of(mac, umac, mac);
+    uint8_t tag[4 * UMAC_MAX_ITERS];
+
+    /*
+     * L1: finish the last chunk, zero-padding it to a whole number of
+     * blocks. An empty message still counts as one block of zeroes.
+     */
+    if (ctx->partlen > 0 || ctx->nl1 + ctx->chunk_words == 0) {
+        memset(ctx->partblk + ctx->partlen, 0, L1_BLOCK - ctx->partlen);
+        umac_nh_blocks(ctx, ctx->partblk, 1);
+        ctx->chunk_len -= L1_BLOCK - ctx->partlen;
+        ctx->partlen = 0;
+    }
+    umac_l1_output(ctx, 8 * (uint64_t)ctx->chunk_len);
+
+    for (unsigned i = 0; i < ctx->iters; i++) {
+        /*
+         * L2, whose output is a 128-bit integer, given to L3 as eight
+         * 16-bit words.
+         */
+        uint64_t yhi = 0, ylo;
+        if (ctx->nl1 == 1) {
+            ylo = ctx->l1first[i];
+        } else if (ctx->nl1 <= L2_POLY64_LIMIT) {
+            ylo = umac_poly64_result(ctx->poly64[i]);
+        } else {
+            /* Pad the POLY128 input with a 1 bit and then zeroes */
+            if (ctx->pending)
+                umac_poly128(ctx, i, ctx->l1pending[i],
+                             UINT64_C(0x80) << 56);
+            else
+                umac_poly128(ctx, i, UINT64_C(0x80) << 56, 0);
+            yhi = ylo = 0;
+            for (unsigned b = 0; b < 8; b++) {
+                yhi |= (uint64_t)mp_get_byte(ctx->poly128[i], b+8) << (8*b);
+                ylo |= (uint64_t)mp_get_byte(ctx->poly128[i], b) << (8*b);
+            }
+        }
+
+        /* L3 */
+        uint64_t y = 0;
+        for (unsigned j = 0; j < 4; j++) {
+            y += ((yhi >> (48 - 16*j)) & 0xFFFF) * ctx->l3key1[i][j];
+            y += ((ylo >> (48 - 16*j)) & 0xFFFF) * ctx->l3key1[i][j+4];
+        }
+        y %= P36;
+        PUT_32BIT_MSB_FIRST(tag + 4*i, (uint32_t)y ^ ctx->l3key2[i]);
+    }
+
+    /*
+     * The pad. For UMAC-64, the low bit of the nonce selects which
+     * half of the AES output block to use.
+     */
+    uint8_t pdf_in[16];
+    memcpy(pdf_in, ctx->nonce, 8);
+    memset(pdf_in + 8, 0, 8);
+    if (ctx->iters == 2)
+        pdf_in[7] &= ~1;
+    if (!ctx->pdf_valid || !smemeq(pdf_in, ctx->pdf_in, 16)) {
+        memcpy(ctx->pdf_in, pdf_in, 16);
+        ssh_cipher_setiv(ctx->pdf_cipher, pdf_in);
+        memset(ctx->pdf_out, 0, 16);
+        ssh_cipher_encrypt(ctx->pdf_cipher, ctx->pdf_out, 16);
+        ctx->pdf_valid = true;
+    }
+
+    if (ctx->iters == 2) {
+        /* Select the half of the block without a data-dependent
+         * memory access */
+        uint8_t mask = -(ctx->nonce[7] & 1);
+        for (size_t j = 0; j < 8; j++)
+            output[j] = tag[j] ^ ctx->pdf_out[j] ^
+                ((ctx->pdf_out[j] ^ ctx->pdf_out[j+8]) & mask);
+    } else {
+        memxor(output, tag, ctx->pdf_out, 16);
+    }
+    smemclr(tag, sizeof(tag));
+}
+
+void umac_set_nonce(ssh2_mac *mac, ptrlen nonce)
+{
+    assert(mac->vt == &ssh_umac_64 || mac->vt == &ssh_umac_128);
+    umac *ctx = container_of(mac, umac, mac);
+    assert(nonce.len == 8);
+    memcpy(ctx->nonce, nonce.ptr, 8);
+    ctx->explicit_nonce = true;
+    ctx->nonce_left = 0;
+}
+
+static const char *umac_text_name(ssh2_mac *mac)
+{
+    return mac->vt->len == 8 ? "UMAC-64" : "UMAC-128";
+}
+
+const ssh2_macalg ssh_umac_64 = {
+    .new = umac_new,
+    .free = umac_free,
+    .setkey = umac_key,
+    .start = umac_start,
+    .genresult = umac_genresult,
+    .text_name = umac_text_name,
+    .name = "umac-64@openssh.com",
+    .etm_name = "umac-64-etm@openssh.com",
+    .len = 8,
+    .keylen = UMAC_KEYLEN,
+};
+
+const ssh2_macalg ssh_umac_128 = {
+    .new = umac_new,
+    .free = umac_free,
+    .setkey = umac_key,
+    .start = umac_start,
+    .genresult = umac_genresult,
+    .text_name = umac_text_name,
+    .name = "umac-128@openssh.com",
+    .etm_name = "umac-128-etm@openssh.com",
+    .len = 16,
+    .keylen = UMAC_KEYLEN,
+};
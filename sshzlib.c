@@ -59,69 +59,136 @@ struct LZ77Context {
 };
 
 /*
- * Initialise the private fields of an LZ77Context. It's up to the
- * user to initialise the public fields.
+ * Initialise the private fields of an LZ77Context, for a given
+ * compression level from 1 (fastest) to 9 (most thorough). It's up
+ * to the user to initialise the public fields.
  */
-static int lz77_init(struct LZ77Context *ctx);
+static int lz77_init(struct LZ77Context *ctx, int level);
 
 /*
  * Supply data to be compressed. Will update the private fields of
  * the LZ77Context, and will call literal() and match() to output.
- * If `compress' is false, it will never emit a match, but will
- * instead call literal() for everything.
+ * Every byte of the data is accounted for by the time this function
+ * returns; nothing is held back to wait for more input.
  */
 static void lz77_compress(struct LZ77Context *ctx,
                           const unsigned char *data, int len);
 
+/*
+ * Supply data that the caller is sending some other way, e.g. in a
+ * stored block. It goes into the window, so that distances to
+ * matches later on still come out right, but it isn't indexed for
+ * anything to match against, and literal() and match() aren't called.
+ */
+static void lz77_skip(struct LZ77Context *ctx,
+                      const unsigned char *data, int len);
+
 /*
  * Modifiable parameters.
  */
 #define WINSIZE 32768                  /* window size. Must be power of 2! */
-#define HASHMAX 2039                   /* one more than max hash value */
-#define MAXMATCH 32                    /* how many matches we track */
+#define HASHBITS 15                    /* log2 of number of hash chains */
 #define HASHCHARS 3                    /* how many chars make a hash */
+#define MAXMATCHLEN 258                /* longest match Deflate can send */
 
 /*
- * This compressor takes a less slapdash approach than the
- * gzip/zlib one. Rather than allowing our hash chains to fall into
- * disuse near the far end, we keep them doubly linked so we can
- * _find_ the far end, and then every time we add a new byte to the
- * window (thus rolling round by one and removing the previous
- * byte), we can carefully remove the hash chain entry.
+ * The matcher works the same way as the one in zlib itself. The
+ * data is kept in a buffer of twice the window size; every position
+ * in it is entered into a hash chain, keyed on the HASHCHARS bytes
+ * starting there; and at each point in the input we search back
+ * along the relevant chain for the longest match. When the buffer
+ * fills up, its second half slides down to become the first, and
+ * every stored position is adjusted to match.
+ *
+ * The chains are singly linked and never explicitly pruned: a chain
+ * entry is known to have gone stale when it's too far back to be in
+ * the window, and that's where a search stops. Position 0 in the
+ * buffer doubles as the null pointer, so it's never found as a match.
+ *
+ * To keep the slide from moving data a pending match still refers
+ * to, we never look further back than LZ77_MAXDIST, and we always
+ * keep LZ77_LOOKAHEAD bytes of input ahead of the current position
+ * unless we've run out.
  */
+#define LZ77_BUFSIZE (2 * WINSIZE)
+#define LZ77_LOOKAHEAD (MAXMATCHLEN + HASHCHARS + 1)
+#define LZ77_MAXDIST (WINSIZE - LZ77_LOOKAHEAD)
+#define LZ77_NIL 0
 
-#define INVALID -1                     /* invalid hash _and_ invalid offset */
-struct WindowEntry {
-    short next, prev;                  /* array indices within the window */
-    short hashval;
-};
+/*
+ * A length-3 match isn't worth much more than three literals, so if
+ * it's a long way back (and hence has an expensive distance code),
+ * the lazy matcher would rather not bother.
+ */
+#define LZ77_TOO_FAR 4096
 
-struct HashEntry {
-    short first;                       /* window index of first in chain */
+/*
+ * Parameters for each compression level, matching the ones zlib uses
+ * so that the trade-off between speed and compression is familiar.
+ *
+ *  - 'good': once we have a match this long, only search a quarter
+ *    as far for a better one.
+ *  - 'lazy': in lazy mode, don't look for a better match if we
+ *    already have one this long. In greedy mode, don't bother to
+ *    index the positions inside a match longer than this.
+ *  - 'nice': stop searching once we find a match this long.
+ *  - 'chain': the maximum number of hash chain entries to try.
+ *
+ * Levels 1-3 use greedy matching: any match found is emitted at
+ * once. Levels 4-9 use lazy matching: having found a match, we look
+ * for a better one starting at the next byte before committing.
+ */
+struct lz77_params {
+    unsigned short good, lazy, nice, chain;
+    bool lazy_eval;
 };
-
-struct Match {
-    int distance, len;
+static const struct lz77_params lz77_levels[] = {
+    /* 0 isn't a level we offer; it's treated as 1 */
+    {4, 4, 8, 4, false},
+    {4, 4, 8, 4, false},
+    {4, 5, 16, 8, false},
+    {4, 6, 32, 32, false},
+    {4, 4, 16, 16, true},
+    {8, 16, 32, 32, true},
+    {8, 16, 128, 128, true},
+    {8, 32, 128, 256, true},
+    {32, 128, 258, 1024, true},
+    {32, 258, 258, 4096, true},
 };
 
 struct LZ77InternalContext {
-    struct WindowEntry win[WINSIZE];
-    unsigned char data[WINSIZE];
-    int winpos;
-    struct HashEntry hashtab[HASHMAX];
-    unsigned char pending[HASHCHARS];
-    int npending;
+    const struct lz77_params *params;
+
+    unsigned char buf[LZ77_BUFSIZE];
+    unsigned short head[1 << HASHBITS];
+    unsigned short prev[WINSIZE];
+
+    /*
+     * Offsets into buf: the end of the data we've been given, the
+     * next position to be encoded, and the next position to be
+     * entered into the hash chains. 'insert' can lag behind 'pos'
+     * when a previous call ended less than HASHCHARS bytes from the
+     * end of its data.
+     */
+    int end, pos, insert;
+
+    /*
+     * Lazy matching state: whether the byte before 'pos' is still
+     * waiting to be emitted, and the best match found starting at it.
+     */
+    bool pending;
+    int prevlen, prevdist;
 };
 
-static int lz77_hash(const unsigned char *data)
+static inline unsigned lz77_hash(const unsigned char *data)
 {
-    return (257 * data[0] + 263 * data[1] + 269 * data[2]) % HASHMAX;
+    uint32_t h = ((uint32_t)data[0] << 16) | (data[1] << 8) | data[2];
+    return (h * 0x9E3779B1U) >> (32 - HASHBITS);
 }
 
-static int lz77_init(struct LZ77Context *ctx)
+static int lz77_init(struct LZ77Context *ctx, int level)
 {
     struct LZ77InternalContext *st;
-    int i;
 
     st = snew(struct LZ77InternalContext);
     if (!st)
@@ -129,201 +196,262 @@ static int lz77_init(struct LZ77Context *ctx)
 
     ctx->ictx = st;
 
-    for (i = 0; i < WINSIZE; i++)
-        st->win[i].next = st->win[i].prev = st->win[i].hashval = INVALID;
-    for (i = 0; i < HASHMAX; i++)
-        st->hashtab[i].first = INVALID;
-    st->winpos = 0;
+    if (level < 1)
+        level = 1;
+    if (level > 9)
+        level = 9;
+    st->params = &lz77_levels[level];
 
-    st->npending = 0;
+    memset(st->head, 0, sizeof(st->head));
+    memset(st->prev, 0, sizeof(st->prev));
+
+    /* Start at 1, so that position 0 can serve as the null pointer */
+    st->end = st->pos = st->insert = 1;
+    st->pending = false;
+    st->prevlen = st->prevdist = 0;
 
     return 1;
 }
 
-static void lz77_advance(struct LZ77InternalContext *st,
-                         unsigned char c, int hash)
+/*
+ * Add a position to the head of its hash chain, and return the
+ * previous head of the chain.
+ */
+static inline unsigned lz77_insert(struct LZ77InternalContext *st, int pos)
 {
-    int off;
+    unsigned h = lz77_hash(st->buf + pos);
+    unsigned old = st->head[h];
+    st->prev[pos & (WINSIZE - 1)] = old;
+    st->head[h] = pos;
+    return old;
+}
 
-    /*
-     * Remove the hash entry at winpos from the tail of its chain,
-     * or empty the chain if it's the only thing on the chain.
-     */
-    if (st->win[st->winpos].prev != INVALID) {
-        st->win[st->win[st->winpos].prev].next = INVALID;
-    } else if (st->win[st->winpos].hashval != INVALID) {
-        st->hashtab[st->win[st->winpos].hashval].first = INVALID;
+/*
+ * Bring the hash chains up to date as far as 'pos', and return the
+ * chain of earlier positions with the same hash as 'pos' itself.
+ */
+static inline unsigned lz77_catch_up(struct LZ77InternalContext *st)
+{
+    while (st->insert < st->pos && st->insert + HASHCHARS <= st->end)
+        lz77_insert(st, st->insert++);
+    if (st->insert == st->pos && st->pos + HASHCHARS <= st->end) {
+        st->insert++;
+        return lz77_insert(st, st->pos);
     }
+    return LZ77_NIL;
+}
 
-    /*
-     * Create a new entry at winpos and add it to the head of its
-     * hash chain.
-     */
-    st->win[st->winpos].hashval = hash;
-    st->win[st->winpos].prev = INVALID;
-    off = st->win[st->winpos].next = st->hashtab[hash].first;
-    st->hashtab[hash].first = st->winpos;
-    if (off != INVALID)
-        st->win[off].prev = st->winpos;
-    st->data[st->winpos] = c;
+/*
+ * Search the hash chain starting at 'cand' for the longest match for
+ * the data at 'pos', if it's longer than 'bestlen'. Returns the
+ * length found (or 'bestlen' if nothing better), and the distance
+ * via *distp.
+ */
+static int lz77_longest_match(struct LZ77InternalContext *st, unsigned cand,
+                              int bestlen, int *distp)
+{
+    const struct lz77_params *params = st->params;
+    const unsigned char *cur = st->buf + st->pos;
+    int limit = st->pos > LZ77_MAXDIST ? st->pos - LZ77_MAXDIST : LZ77_NIL;
+    int maxlen = st->end - st->pos;
+    unsigned chain = params->chain;
+    int nice = params->nice;
+
+    if (maxlen > MAXMATCHLEN)
+        maxlen = MAXMATCHLEN;
+    if (nice > maxlen)
+        nice = maxlen;
+    if (bestlen >= params->good)
+        chain >>= 2;
+    if (bestlen >= maxlen)
+        return bestlen;
+
+    for (; cand > limit && chain > 0;
+         cand = st->prev[cand & (WINSIZE - 1)], chain--) {
+        const unsigned char *m = st->buf + cand;
+
+        /* Quick rejection: a better match must agree at bestlen */
+        if (m[bestlen] != cur[bestlen] || m[0] != cur[0] || m[1] != cur[1])
+            continue;
 
-    /*
-     * Advance the window pointer.
-     */
-    st->winpos = (st->winpos + 1) & (WINSIZE - 1);
+        int len = 2;
+        while (len < maxlen && m[len] == cur[len])
+            len++;
+
+        if (len > bestlen) {
+            bestlen = len;
+            *distp = st->pos - cand;
+            if (len >= nice)
+                break;
+        }
+    }
+
+    return bestlen;
 }
 
-#define CHARAT(k) ( (k)<0 ? st->data[(st->winpos+k)&(WINSIZE-1)] : data[k] )
+/*
+ * Move the second half of the buffer down to the first, when we're
+ * running out of room in it.
+ */
+static void lz77_slide(struct LZ77InternalContext *st)
+{
+    size_t i;
+
+    memmove(st->buf, st->buf + WINSIZE, st->end - WINSIZE);
+    st->end -= WINSIZE;
+    st->pos -= WINSIZE;
+    st->insert -= WINSIZE;
 
-static void lz77_compress(struct LZ77Context *ctx,
-                          const unsigned char *data, int len)
+    for (i = 0; i < lenof(st->head); i++)
+        st->head[i] = st->head[i] >= WINSIZE ? st->head[i] - WINSIZE : 0;
+    for (i = 0; i < lenof(st->prev); i++)
+        st->prev[i] = st->prev[i] >= WINSIZE ? st->prev[i] - WINSIZE : 0;
+}
+
+/*
+ * Greedy matching, for the fast levels: emit a match as soon as we
+ * find one.
+ */
+static void lz77_greedy(struct LZ77Context *ctx, int stop)
 {
     struct LZ77InternalContext *st = ctx->ictx;
-    int i, distance, off, nmatch, matchlen, advance;
-    struct Match defermatch, matches[MAXMATCH];
-    int deferchr;
 
-    assert(st->npending <= HASHCHARS);
-
-    /*
-     * Add any pending characters from last time to the window. (We
-     * might not be able to.)
-     *
-     * This leaves st->pending empty in the usual case (when len >=
-     * HASHCHARS); otherwise it leaves st->pending empty enough that
-     * adding all the remaining 'len' characters will not push it past
-     * HASHCHARS in size.
-     */
-    for (i = 0; i < st->npending; i++) {
-        unsigned char foo[HASHCHARS];
-        int j;
-        if (len + st->npending - i < HASHCHARS) {
-            /* Update the pending array. */
-            for (j = i; j < st->npending; j++)
-                st->pending[j - i] = st->pending[j];
-            break;
-        }
-        for (j = 0; j < HASHCHARS; j++)
-            foo[j] = (i + j < st->npending ? st->pending[i + j] :
-                      data[i + j - st->npending]);
-        lz77_advance(st, foo[0], lz77_hash(foo));
-    }
-    st->npending -= i;
+    while (st->pos < stop) {
+        unsigned cand = lz77_catch_up(st);
+        int dist = 0, len = 0;
 
-    defermatch.distance = 0; /* appease compiler */
-    defermatch.len = 0;
-    deferchr = '\0';
-    while (len > 0) {
+        if (cand != LZ77_NIL)
+            len = lz77_longest_match(st, cand, HASHCHARS - 1, &dist);
 
         if (len >= HASHCHARS) {
-            /*
-             * Hash the next few characters.
-             */
-            int hash = lz77_hash(data);
+            ctx->match(ctx, dist, len);
+            st->pos += len;
 
-            /*
-             * Look the hash up in the corresponding hash chain and see
-             * what we can find.
-             */
-            nmatch = 0;
-            for (off = st->hashtab[hash].first;
-                 off != INVALID; off = st->win[off].next) {
-                /* distance = 1       if off == st->winpos-1 */
-                /* distance = WINSIZE if off == st->winpos   */
-                distance =
-                    WINSIZE - (off + WINSIZE - st->winpos) % WINSIZE;
-                for (i = 0; i < HASHCHARS; i++)
-                    if (CHARAT(i) != CHARAT(i - distance))
-                        break;
-                if (i == HASHCHARS) {
-                    matches[nmatch].distance = distance;
-                    matches[nmatch].len = 3;
-                    if (++nmatch >= MAXMATCH)
-                        break;
-                }
-            }
+            /* Positions inside a long match aren't worth indexing */
+            if (len > st->params->lazy && st->insert < st->pos)
+                st->insert = st->pos;
         } else {
-            nmatch = 0;
+            ctx->literal(ctx, st->buf[st->pos]);
+            st->pos++;
         }
+    }
+}
 
-        if (nmatch > 0) {
-            /*
-             * We've now filled up matches[] with nmatch potential
-             * matches. Follow them down to find the longest. (We
-             * assume here that it's always worth favouring a
-             * longer match over a shorter one.)
-             */
-            matchlen = HASHCHARS;
-            while (matchlen < len) {
-                int j;
-                for (i = j = 0; i < nmatch; i++) {
-                    if (CHARAT(matchlen) ==
-                        CHARAT(matchlen - matches[i].distance)) {
-                        matches[j++] = matches[i];
-                    }
-                }
-                if (j == 0)
-                    break;
-                matchlen++;
-                nmatch = j;
-            }
+/*
+ * Lazy matching: having found a match at one position, see if
+ * there's a better one at the next before deciding what to emit.
+ */
+static void lz77_lazy(struct LZ77Context *ctx, int stop)
+{
+    struct LZ77InternalContext *st = ctx->ictx;
+    const struct lz77_params *params = st->params;
+
+    while (st->pos < stop) {
+        unsigned cand = lz77_catch_up(st);
+        int dist = 0, len = HASHCHARS - 1;
+
+        if (cand != LZ77_NIL && st->prevlen < params->lazy) {
+            len = lz77_longest_match(st, cand, st->prevlen > len ?
+                                     st->prevlen : len, &dist);
+            if (len <= st->prevlen ||
+                (len == HASHCHARS && dist > LZ77_TOO_FAR))
+                len = HASHCHARS - 1;
+        }
 
+        if (st->prevlen >= HASHCHARS && len <= st->prevlen) {
             /*
-             * We've now got all the longest matches. We favour the
-             * shorter distances, which means we go with matches[0].
-             * So see if we want to defer it or throw it away.
+             * The match starting at the previous byte is at least as
+             * good as anything we found here, so emit it, and skip
+             * to the end of it.
              */
-            matches[0].len = matchlen;
-            if (defermatch.len > 0) {
-                if (matches[0].len > defermatch.len + 1) {
-                    /* We have a better match. Emit the deferred char,
-                     * and defer this match. */
-                    ctx->literal(ctx, (unsigned char) deferchr);
-                    defermatch = matches[0];
-                    deferchr = data[0];
-                    advance = 1;
-                } else {
-                    /* We don't have a better match. Do the deferred one. */
-                    ctx->match(ctx, defermatch.distance, defermatch.len);
-                    advance = defermatch.len - 1;
-                    defermatch.len = 0;
-                }
-            } else {
-                /* There was no deferred match. Defer this one. */
-                defermatch = matches[0];
-                deferchr = data[0];
-                advance = 1;
-            }
+            ctx->match(ctx, st->prevdist, st->prevlen);
+            st->pos += st->prevlen - 1;
+            st->pending = false;
+            st->prevlen = 0;
         } else {
             /*
-             * We found no matches. Emit the deferred match, if
-             * any; otherwise emit a literal.
+             * Either the match here is better, or there's nothing
+             * either here or at the previous byte. In both cases,
+             * the previous byte goes out as a literal, and what we
+             * found here is what we'll compare the next byte with.
              */
-            if (defermatch.len > 0) {
-                ctx->match(ctx, defermatch.distance, defermatch.len);
-                advance = defermatch.len - 1;
-                defermatch.len = 0;
-            } else {
-                ctx->literal(ctx, data[0]);
-                advance = 1;
-            }
+            if (st->pending)
+                ctx->literal(ctx, st->buf[st->pos - 1]);
+            st->pending = true;
+            st->prevlen = len;
+            st->prevdist = dist;
+            st->pos++;
         }
+    }
+}
 
+static void lz77_compress(struct LZ77Context *ctx,
+                          const unsigned char *data, int len)
+{
+    struct LZ77InternalContext *st = ctx->ictx;
+
+    while (true) {
         /*
-         * Now advance the position by `advance' characters,
-         * keeping the window and hash chains consistent.
+         * Make room for more data if we're near the end of the
+         * buffer, and then copy in as much as will fit.
          */
-        while (advance > 0) {
-            if (len >= HASHCHARS) {
-                lz77_advance(st, *data, lz77_hash(data));
-            } else {
-                assert(st->npending < HASHCHARS);
-                st->pending[st->npending++] = *data;
-            }
-            data++;
-            len--;
-            advance--;
-        }
+        if (st->pos >= LZ77_BUFSIZE - LZ77_LOOKAHEAD)
+            lz77_slide(st);
+
+        int to_copy = LZ77_BUFSIZE - st->end;
+        if (to_copy > len)
+            to_copy = len;
+        memcpy(st->buf + st->end, data, to_copy);
+        st->end += to_copy;
+        data += to_copy;
+        len -= to_copy;
+
+        /*
+         * Encode the data we have, except that if there's more input
+         * to come, we stop early enough to keep a full-length match
+         * worth of lookahead.
+         */
+        int stop = len > 0 ? st->end - LZ77_LOOKAHEAD : st->end;
+        if (st->params->lazy_eval)
+            lz77_lazy(ctx, stop);
+        else
+            lz77_greedy(ctx, stop);
+
+        if (len == 0)
+            break;
+    }
+
+    /*
+     * The lazy matcher can finish with the last byte still waiting
+     * to be output. There can't be a match waiting too, because that
+     * would need at least HASHCHARS bytes after it.
+     */
+    if (st->pending) {
+        assert(st->prevlen < HASHCHARS);
+        ctx->literal(ctx, st->buf[st->pos - 1]);
+        st->pending = false;
+        st->prevlen = 0;
+    }
+}
+
+static void lz77_skip(struct LZ77Context *ctx,
+                      const unsigned char *data, int len)
+{
+    struct LZ77InternalContext *st = ctx->ictx;
+
+    while (len > 0) {
+        if (st->pos >= LZ77_BUFSIZE - LZ77_LOOKAHEAD)
+            lz77_slide(st);
+
+        int to_copy = LZ77_BUFSIZE - st->end;
+        if (to_copy > len)
+            to_copy = len;
+        memcpy(st->buf + st->end, data, to_copy);
+        st->end += to_copy;
+        data += to_copy;
+        len -= to_copy;
+
+        st->pos = st->insert = st->end;
     }
 }
 
@@ -568,17 +696,93 @@ static void zlib_match(struct LZ77Context *ectx, int distance, int len)
     }
 }
 
+/*
+ * Data that's already compressed or encrypted - a tarball, or an
+ * SSH connection tunnelled through a port forwarding - comes out of
+ * Deflate about 5% _bigger_ than it went in, and we've spent a lot of
+ * CPU making it so. So we watch how well each block compresses, and
+ * if it isn't saving at least 1/BYPASS_SAVING of its size, we send
+ * the next few blocks as Deflate stored blocks instead, and then try
+ * compressing again. Every time the retry fails too, we double the
+ * number of blocks we skip before the next one.
+ *
+ * So that a stream which turns compressible again (a file transfer
+ * finishing, say) doesn't sit out the rest of a long backoff, every
+ * block we store is still given a quick look: we estimate its byte
+ * entropy from a sample, and if that has dropped by BYPASS_ENTROPY_DROP
+ * (in 1/256ths of a bit per byte) below the block that started the
+ * bypass, we stop bypassing and compress it after all.
+ *
+ * Small blocks (keystrokes, window adjusts) don't tell us much about
+ * the data stream, and cost very little to compress anyway, so they
+ * are always compressed and don't count either way.
+ */
+#define BYPASS_SAVING 32
+#define BYPASS_MIN_BLOCK 256
+#define BYPASS_BACKOFF_MIN 4
+#define BYPASS_BACKOFF_MAX 256
+#define BYPASS_SAMPLE 1024
+#define BYPASS_ENTROPY_DROP 256
+
 struct ssh_zlib_compressor {
     struct LZ77Context ectx;
+    int level;
+    unsigned bypass_left, bypass_backoff, bypass_entropy;
     ssh_compressor sc;
 };
 
-ssh_compressor *zlib_compress_init(void)
+/*
+ * 256 * log2(x), near enough: the integer part from the position of
+ * the top bit, and the fraction from a table on the next four bits.
+ */
+static unsigned bypass_log2(unsigned x)
+{
+    static const unsigned char frac[16] = {
+        0, 22, 44, 63, 82, 100, 118, 134,
+        150, 165, 179, 193, 207, 220, 232, 244,
+    };
+    unsigned bits = 0;
+
+    assert(x > 0);
+    while (x >> bits > 1)
+        bits++;
+    if (bits >= 4)
+        return bits * 256 + frac[(x >> (bits - 4)) & 15];
+    else
+        return bits * 256 + frac[(x << (4 - bits)) & 15];
+}
+
+/*
+ * Estimate the order-0 entropy of a block, in 1/256ths of a bit per
+ * byte, from at most BYPASS_SAMPLE bytes spread evenly across it.
+ */
+static unsigned bypass_entropy(const unsigned char *block, int len)
+{
+    unsigned counts[256];
+    unsigned n = 0, i;
+    int step = (len + BYPASS_SAMPLE - 1) / BYPASS_SAMPLE;
+    unsigned long sum = 0;
+
+    memset(counts, 0, sizeof(counts));
+    for (int pos = 0; pos < len; pos += step, n++)
+        counts[block[pos]]++;
+
+    for (i = 0; i < 256; i++)
+        if (counts[i])
+            sum += (unsigned long)counts[i] * bypass_log2(counts[i]);
+    return ((unsigned long)n * bypass_log2(n) - sum) / n;
+}
+
+ssh_compressor *zlib_compress_init(int level)
 {
     struct Outbuf *out;
     struct ssh_zlib_compressor *comp = snew(struct ssh_zlib_compressor);
 
-    lz77_init(&comp->ectx);
+    comp->level = level;
+    comp->bypass_left = 0;
+    comp->bypass_backoff = BYPASS_BACKOFF_MIN;
+    comp->bypass_entropy = 0;
+    lz77_init(&comp->ectx, level);
     comp->sc.vt = &ssh_zlib;
     comp->ectx.literal = zlib_literal;
     comp->ectx.match = zlib_match;
@@ -613,23 +817,70 @@ void zlib_compress_block(ssh_compressor *sc,
         container_of(sc, struct ssh_zlib_compressor, sc);
     struct Outbuf *out = (struct Outbuf *) comp->ectx.userdata;
     bool in_block;
+    size_t startlen;
 
     assert(!out->outbuf);
     out->outbuf = strbuf_new_nm();
 
     /*
-     * If this is the first block, output the Zlib (RFC1950) header
-     * bytes 78 9C. (Deflate compression, 32K window size, default
-     * algorithm.)
+     * If this is the first block, output the Zlib (RFC1950) header:
+     * 78 (Deflate compression, 32K window size), then a byte whose
+     * top two bits say roughly how hard we're trying (purely for
+     * information; decompressors ignore it), and whose low bits make
+     * the header a multiple of 31.
      */
     if (out->firstblock) {
-        outbits(out, 0x9C78, 16);
+        static const unsigned char flg[4] = { 0x01, 0x5E, 0x9C, 0xDA };
+        int flevel = (comp->level <= 1 ? 0 : comp->level <= 5 ? 1 :
+                      comp->level == 6 ? 2 : 3);
+        outbits(out, 0x78 | (flg[flevel] << 8), 16);
         out->firstblock = false;
 
         in_block = false;
     } else
         in_block = true;
 
+    if (comp->bypass_left > 0 && len >= BYPASS_MIN_BLOCK &&
+        bypass_entropy(block, len) + BYPASS_ENTROPY_DROP <
+        comp->bypass_entropy) {
+        /* The data has changed character: give compression a go. */
+        comp->bypass_left = 0;
+        comp->bypass_backoff = BYPASS_BACKOFF_MIN;
+    }
+
+    if (comp->bypass_left > 0 && len >= BYPASS_MIN_BLOCK) {
+        comp->bypass_left--;
+
+        /*
+         * Send the data uncompressed, in as many stored blocks as it
+         * takes. Each one is a 3-bit header (BFINAL=0, BTYPE=00),
+         * padding to a byte boundary, and then 16-bit LEN and NLEN
+         * fields before the data.
+         */
+        if (in_block)
+            outbits(out, 0, 7);        /* close block */
+        lz77_skip(&comp->ectx, block, len);
+        while (len > 0) {
+            int thislen = len < 0xFFFF ? len : 0xFFFF;
+            outbits(out, 0, 3);
+            outbits(out, 0, (8 - out->noutbits) & 7);
+            outbits(out, thislen, 16);
+            outbits(out, thislen ^ 0xFFFF, 16);
+            assert(out->noutbits == 0);
+            put_data(out->outbuf, block, thislen);
+            block += thislen;
+            len -= thislen;
+        }
+
+        /*
+         * That leaves us byte-aligned with nothing pending, so the
+         * data is already flushed. Just open a new static block, to
+         * be in the same state as after compressing.
+         */
+        outbits(out, 2, 3);
+        goto pad;
+    }
+
     if (!in_block) {
         /*
          * Start a Deflate (RFC1951) fixed-trees block. We
@@ -641,9 +892,21 @@ void zlib_compress_block(ssh_compressor *sc,
     }
 
     /*
-     * Do the compression.
+     * Do the compression, and see whether it was worth it.
      */
+    startlen = out->outbuf->len;
     lz77_compress(&comp->ectx, block, len);
+    if (len >= BYPASS_MIN_BLOCK) {
+        size_t complen = out->outbuf->len - startlen;
+        if (complen > (size_t)len - len / BYPASS_SAVING) {
+            comp->bypass_left = comp->bypass_backoff;
+            comp->bypass_entropy = bypass_entropy(block, len);
+            if (comp->bypass_backoff < BYPASS_BACKOFF_MAX)
+                comp->bypass_backoff *= 2;
+        } else {
+            comp->bypass_backoff = BYPASS_BACKOFF_MIN;
+        }
+    }
 
     /*
      * End the block (by transmitting code 256, which is
@@ -672,6 +935,7 @@ void zlib_compress_block(ssh_compressor *sc,
     outbits(out, 2, 3 + 7);    /* empty static block */
     outbits(out, 2, 3);        /* open new block */
 
+  pad:
     /*
      * If we've been asked to pad out the compressed data until it's
      * at least a given length, do so by emitting further empty static
@@ -712,11 +976,31 @@ struct zlib_tableentry {
 struct zlib_table {
     int mask;                          /* mask applied to input bit stream */
     struct zlib_tableentry *table;
+    struct zlib_fastentry *fast;       /* only in literal/length tables */
 };
 
 #define MAXCODELEN 16
 #define MAXSYMS 288
 
+/*
+ * For the literal/length alphabet, we also build a flat table
+ * indexed by the next FASTBITS bits of input, which decodes the
+ * symbol in one lookup. Literals are short codes in most trees, so
+ * where a literal's code leaves room for the whole of another
+ * literal's code within the same FASTBITS, the entry gives both at
+ * once. Codes longer than FASTBITS get nbits == 0, meaning 'go
+ * through zlib_huflookup'.
+ */
+#define FASTBITS 10
+#define FASTMASK ((1 << FASTBITS) - 1)
+
+struct zlib_fastentry {
+    unsigned char nbits;               /* total bits used by the entry */
+    unsigned char lit2;                /* second symbol, if twolits */
+    bool twolits;
+    unsigned short sym;
+};
+
 /*
  * Build a single-level decode table for elements
  * [minlength,maxlength) of the provided code/length tables, and
@@ -732,6 +1016,7 @@ static struct zlib_table *zlib_mkonetab(int *codes, unsigned char *lengths,
 
     tab->table = snewn((size_t)1 << bits, struct zlib_tableentry);
     tab->mask = (1 << bits) - 1;
+    tab->fast = NULL;
 
     for (code = 0; code <= tab->mask; code++) {
         tab->table[code].code = -1;
@@ -830,6 +1115,7 @@ static int zlib_freetable(struct zlib_table **ztab)
 
     sfree(tab->table);
     tab->table = NULL;
+    sfree(tab->fast);
 
     sfree(tab);
     *ztab = NULL;
@@ -837,6 +1123,68 @@ static int zlib_freetable(struct zlib_table **ztab)
     return (0);
 }
 
+static int zlib_huflookup(uint64_t *bitsp, int *nbitsp,
+                          struct zlib_table *tab)
+{
+    uint64_t bits = *bitsp;
+    int nbits = *nbitsp;
+    while (1) {
+        struct zlib_tableentry *ent;
+        ent = &tab->table[bits & tab->mask];
+        if (ent->nbits > nbits)
+            return -1;                 /* not enough data */
+        bits >>= ent->nbits;
+        nbits -= ent->nbits;
+        if (ent->code == -1)
+            tab = ent->nexttable;
+        else {
+            *bitsp = bits;
+            *nbitsp = nbits;
+            return ent->code;
+        }
+
+        if (!tab) {
+            /*
+             * There was a missing entry in the table, presumably
+             * due to an invalid Huffman table description, and the
+             * subsequent data has attempted to use the missing
+             * entry. Return a decoding failure.
+             */
+            return -2;
+        }
+    }
+}
+
+static void zlib_mkfasttable(struct zlib_table *tab)
+{
+    tab->fast = snewn(FASTMASK + 1, struct zlib_fastentry);
+
+    for (int i = 0; i <= FASTMASK; i++) {
+        struct zlib_fastentry *ent = &tab->fast[i];
+        uint64_t bits = i;
+        int nbits = FASTBITS;
+
+        ent->nbits = 0;
+        ent->twolits = false;
+        ent->lit2 = 0;
+
+        int code = zlib_huflookup(&bits, &nbits, tab);
+        if (code < 0 || code > 285)
+            continue;    /* too long, or an error: leave to the slow path */
+        ent->sym = code;
+        ent->nbits = FASTBITS - nbits;
+
+        if (code < 256) {
+            int code2 = zlib_huflookup(&bits, &nbits, tab);
+            if (code2 >= 0 && code2 < 256) {
+                ent->lit2 = code2;
+                ent->twolits = true;
+                ent->nbits = FASTBITS - nbits;
+            }
+        }
+    }
+}
+
 struct zlib_decompress_ctx {
     struct zlib_table *staticlentable, *staticdisttable;
     struct zlib_table *currlentable, *currdisttable, *lenlentable;
@@ -895,11 +1243,20 @@ struct zlib_decompress_ctx {
      */
     unsigned char lengths[288 + 32];
 
-    unsigned long bits;
+    uint64_t bits;
     int nbits;
+
+    /*
+     * Output is written straight into outbuf, which is handed to the
+     * caller at the end of each zlib_decompress_block. Back-references
+     * that reach back past the start of it are resolved from window,
+     * which holds the last WINSIZE bytes of previous blocks' output,
+     * and is only updated once a block has been completely decoded.
+     */
     unsigned char window[WINSIZE];
     int winpos;
-    strbuf *outblk;
+    unsigned char *outbuf;
+    size_t outlen, outsize;
 
     ssh_decompressor dc;
 };
@@ -914,6 +1271,7 @@ ssh_decompressor *zlib_decompress_init(void)
     memset(lengths + 256, 7, 280 - 256);
     memset(lengths + 280, 8, 288 - 280);
     dctx->staticlentable = zlib_mktable(lengths, 288);
+    zlib_mkfasttable(dctx->staticlentable);
     memset(lengths, 5, 32);
     dctx->staticdisttable = zlib_mktable(lengths, 32);
     dctx->state = START;                       /* even before header */
@@ -921,7 +1279,8 @@ ssh_decompressor *zlib_decompress_init(void)
     dctx->bits = 0;
     dctx->nbits = 0;
     dctx->winpos = 0;
-    dctx->outblk = NULL;
+    dctx->outbuf = NULL;
+    dctx->outlen = dctx->outsize = 0;
 
     dctx->dc.vt = &ssh_zlib;
     return &dctx->dc;
@@ -940,48 +1299,174 @@ void zlib_decompress_cleanup(ssh_decompressor *dc)
         zlib_freetable(&dctx->lenlentable);
     zlib_freetable(&dctx->staticlentable);
     zlib_freetable(&dctx->staticdisttable);
-    if (dctx->outblk)
-        strbuf_free(dctx->outblk);
+    if (dctx->outbuf) {
+        smemclr(dctx->outbuf, dctx->outsize);
+        sfree(dctx->outbuf);
+    }
     sfree(dctx);
 }
 
-static int zlib_huflookup(unsigned long *bitsp, int *nbitsp,
-                   struct zlib_table *tab)
+static inline void zlib_out_reserve(struct zlib_decompress_ctx *dctx,
+                                    size_t len)
 {
-    unsigned long bits = *bitsp;
-    int nbits = *nbitsp;
-    while (1) {
-        struct zlib_tableentry *ent;
-        ent = &tab->table[bits & tab->mask];
-        if (ent->nbits > nbits)
-            return -1;                 /* not enough data */
-        bits >>= ent->nbits;
-        nbits -= ent->nbits;
-        if (ent->code == -1)
-            tab = ent->nexttable;
-        else {
-            *bitsp = bits;
-            *nbitsp = nbits;
-            return ent->code;
-        }
+    if (dctx->outsize - dctx->outlen < len)
+        sgrowarrayn_nm(dctx->outbuf, dctx->outsize, dctx->outlen, len);
+}
 
-        if (!tab) {
-            /*
-             * There was a missing entry in the table, presumably
-             * due to an invalid Huffman table description, and the
-             * subsequent data has attempted to use the missing
-             * entry. Return a decoding failure.
-             */
-            return -2;
+static void zlib_emit_char(struct zlib_decompress_ctx *dctx, int c)
+{
+    zlib_out_reserve(dctx, 1);
+    dctx->outbuf[dctx->outlen++] = c;
+}
+
+/*
+ * Copy len bytes from dist bytes back in the output.
+ */
+static void zlib_copy_back(struct zlib_decompress_ctx *dctx,
+                           int dist, int len)
+{
+    zlib_out_reserve(dctx, len);
+    unsigned char *out = dctx->outbuf + dctx->outlen;
+    dctx->outlen += len;
+
+    if (dist > out - dctx->outbuf) {
+        /*
+         * The start of the source is in the output of previous
+         * blocks, which we find in the window.
+         */
+        int back = dist - (out - dctx->outbuf);
+        int wpos = (dctx->winpos - back) & (WINSIZE - 1);
+        int n = back < len ? back : len;
+        int n1 = WINSIZE - wpos < n ? WINSIZE - wpos : n;
+        memcpy(out, dctx->window + wpos, n1);
+        memcpy(out + n1, dctx->window, n - n1);
+        out += n;
+        len -= n;
+    }
+
+    if (dist == 1) {
+        memset(out, out[-1], len);
+    } else {
+        /*
+         * Source and destination overlap if dist < len, in which case
+         * the data repeats with period dist. Copying dist bytes at a
+         * time produces exactly that.
+         */
+        while (len > 0) {
+            int n = dist < len ? dist : len;
+            memcpy(out, out - dist, n);
+            out += n;
+            len -= n;
         }
     }
 }
 
-static void zlib_emit_char(struct zlib_decompress_ctx *dctx, int c)
+static void zlib_update_window(struct zlib_decompress_ctx *dctx)
 {
-    dctx->window[dctx->winpos] = c;
-    dctx->winpos = (dctx->winpos + 1) & (WINSIZE - 1);
-    put_byte(dctx->outblk, c);
+    size_t n = dctx->outlen < WINSIZE ? dctx->outlen : WINSIZE;
+    const unsigned char *src = dctx->outbuf + dctx->outlen - n;
+    size_t n1 = WINSIZE - dctx->winpos < n ? WINSIZE - dctx->winpos : n;
+
+    memcpy(dctx->window + dctx->winpos, src, n1);
+    memcpy(dctx->window, src + n1, n - n1);
+    dctx->winpos = (dctx->winpos + n) & (WINSIZE - 1);
+}
+
+static void zlib_end_block(struct zlib_decompress_ctx *dctx)
+{
+    dctx->state = OUTSIDEBLK;
+    if (dctx->currlentable != dctx->staticlentable) {
+        zlib_freetable(&dctx->currlentable);
+        dctx->currlentable = NULL;
+    }
+    if (dctx->currdisttable != dctx->staticdisttable) {
+        zlib_freetable(&dctx->currdisttable);
+        dctx->currdisttable = NULL;
+    }
+}
+
+/*
+ * Fast path through the body of a compressed block. Decodes whole
+ * literal/length/distance sequences at a time, without going back
+ * round the state machine, for as long as there's enough input left
+ * that we can't run out in the middle of one: the longest sequence
+ * is 15+5+15+13 = 48 bits, and we keep at least 57 in hand.
+ *
+ * Returns false on a decoding error. Otherwise, the state is left as
+ * INBLK or OUTSIDEBLK, and the slow path can carry on from there.
+ */
+#define FAST_MIN_INPUT 8
+
+static bool zlib_inflate_fast(struct zlib_decompress_ctx *dctx,
+                              const unsigned char **blockp, int *lenp)
+{
+    const unsigned char *block = *blockp;
+    int len = *lenp;
+    uint64_t bits = dctx->bits;
+    int nbits = dctx->nbits;
+    struct zlib_table *lentab = dctx->currlentable;
+    struct zlib_table *disttab = dctx->currdisttable;
+    const struct zlib_fastentry *fast = lentab->fast;
+    const coderecord *rec;
+    bool ok = false;
+
+    while (len >= FAST_MIN_INPUT) {
+        while (nbits <= 56) {
+            bits |= (uint64_t)*block++ << nbits;
+            nbits += 8;
+            len--;
+        }
+
+        int code;
+        const struct zlib_fastentry *ent = &fast[bits & FASTMASK];
+        if (ent->nbits) {
+            bits >>= ent->nbits;
+            nbits -= ent->nbits;
+            code = ent->sym;
+            if (ent->twolits) {
+                zlib_out_reserve(dctx, 2);
+                dctx->outbuf[dctx->outlen++] = code;
+                dctx->outbuf[dctx->outlen++] = ent->lit2;
+                continue;
+            }
+        } else {
+            code = zlib_huflookup(&bits, &nbits, lentab);
+            if (code < 0 || code > 285)
+                goto out;
+        }
+
+        if (code < 256) {
+            zlib_emit_char(dctx, code);
+            continue;
+        }
+        if (code == 256) {
+            zlib_end_block(dctx);
+            break;
+        }
+
+        rec = &lencodes[code - 257];
+        int matchlen = rec->min + (bits & ((1 << rec->extrabits) - 1));
+        bits >>= rec->extrabits;
+        nbits -= rec->extrabits;
+
+        code = zlib_huflookup(&bits, &nbits, disttab);
+        if (code < 0 || code >= 30)
+            goto out;
+        rec = &distcodes[code];
+        int dist = rec->min + (bits & ((1 << rec->extrabits) - 1));
+        bits >>= rec->extrabits;
+        nbits -= rec->extrabits;
+
+        zlib_copy_back(dctx, dist, matchlen);
+    }
+    ok = true;
+
+  out:
+    dctx->bits = bits;
+    dctx->nbits = nbits;
+    *blockp = block;
+    *lenp = len;
+    return ok;
 }
 
 #define EATBITS(n) ( dctx->nbits -= (n), dctx->bits >>= (n) )
@@ -998,12 +1483,17 @@ bool zlib_decompress_block(ssh_decompressor *dc,
         16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
     };
 
-    assert(!dctx->outblk);
-    dctx->outblk = strbuf_new_nm();
+    /*
+     * Size the output buffer for typical compression ratios, so that
+     * it rarely needs to be reallocated while we decode.
+     */
+    assert(!dctx->outbuf);
+    dctx->outlen = dctx->outsize = 0;
+    zlib_out_reserve(dctx, 4 * (size_t)len + 512);
 
     while (len > 0 || dctx->nbits > 0) {
         while (dctx->nbits < 24 && len > 0) {
-            dctx->bits |= (*block++) << dctx->nbits;
+            dctx->bits |= (uint64_t)(*block++) << dctx->nbits;
             dctx->nbits += 8;
             len--;
         }
@@ -1095,6 +1585,7 @@ bool zlib_decompress_block(ssh_decompressor *dc,
                 dctx->currlentable = zlib_mktable(dctx->lengths, dctx->hlit);
                 dctx->currdisttable = zlib_mktable(dctx->lengths + dctx->hlit,
                                                   dctx->hdist);
+                zlib_mkfasttable(dctx->currlentable);
                 zlib_freetable(&dctx->lenlentable);
                 dctx->lenlentable = NULL;
                 dctx->state = INBLK;
@@ -1131,6 +1622,11 @@ bool zlib_decompress_block(ssh_decompressor *dc,
             dctx->state = TREES_LEN;
             break;
           case INBLK:
+            if (len >= FAST_MIN_INPUT) {
+                if (!zlib_inflate_fast(dctx, &block, &len))
+                    goto decode_error;
+                break;
+            }
             code =
                 zlib_huflookup(&dctx->bits, &dctx->nbits, dctx->currlentable);
             if (code == -1)
@@ -1140,15 +1636,7 @@ bool zlib_decompress_block(ssh_decompressor *dc,
             if (code < 256)
                 zlib_emit_char(dctx, code);
             else if (code == 256) {
-                dctx->state = OUTSIDEBLK;
-                if (dctx->currlentable != dctx->staticlentable) {
-                    zlib_freetable(&dctx->currlentable);
-                    dctx->currlentable = NULL;
-                }
-                if (dctx->currdisttable != dctx->staticdisttable) {
-                    zlib_freetable(&dctx->currdisttable);
-                    dctx->currdisttable = NULL;
-                }
+                zlib_end_block(dctx);
             } else if (code < 286) {
                 dctx->state = GOTLENSYM;
                 dctx->sym = code;
@@ -1186,9 +1674,7 @@ bool zlib_decompress_block(ssh_decompressor *dc,
             dist = rec->min + (dctx->bits & ((1 << rec->extrabits) - 1));
             EATBITS(rec->extrabits);
             dctx->state = INBLK;
-            while (dctx->len--)
-                zlib_emit_char(dctx, dctx->window[(dctx->winpos - dist) &
-                                                  (WINSIZE - 1)]);
+            zlib_copy_back(dctx, dist, dctx->len);
             break;
           case UNCOMP_LEN:
             /*
@@ -1220,21 +1706,41 @@ bool zlib_decompress_block(ssh_decompressor *dc,
           case UNCOMP_DATA:
             if (dctx->nbits < 8)
                 goto finished;
-            zlib_emit_char(dctx, dctx->bits & 0xFF);
-            EATBITS(8);
-            if (--dctx->uncomplen == 0)
+            while (dctx->nbits >= 8 && dctx->uncomplen > 0) {
+                zlib_emit_char(dctx, dctx->bits & 0xFF);
+                EATBITS(8);
+                dctx->uncomplen--;
+            }
+            if (dctx->nbits == 0 && dctx->uncomplen > 0 && len > 0) {
+                /*
+                 * Bit buffer is empty, so the rest of the stored data
+                 * can be copied straight out of the input.
+                 */
+                int n = dctx->uncomplen < len ? dctx->uncomplen : len;
+                zlib_out_reserve(dctx, n);
+                memcpy(dctx->outbuf + dctx->outlen, block, n);
+                dctx->outlen += n;
+                block += n;
+                len -= n;
+                dctx->uncomplen -= n;
+            }
+            if (dctx->uncomplen == 0)
                 dctx->state = OUTSIDEBLK;       /* end of uncompressed block */
             break;
         }
     }
 
   finished:
-    *outlen = dctx->outblk->len;
-    *outblock = (unsigned char *)strbuf_to_str(dctx->outblk);
-    dctx->outblk = NULL;
+    zlib_update_window(dctx);
+    *outlen = dctx->outlen;
+    *outblock = dctx->outbuf;
+    dctx->outbuf = NULL;
     return true;
 
   decode_error:
+    smemclr(dctx->outbuf, dctx->outsize);
+    sfree(dctx->outbuf);
+    dctx->outbuf = NULL;
     *outblock = NULL;
     *outlen = 0;
     return false;
@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+
+# Rough performance measurements of PuTTY's cryptographic code, driven
+# through testcrypt in the same way as cryptsuite.py.
+#
+# Usage: cryptbench.py [benchmark name...]
+# With no arguments, runs every benchmark; '--list' lists them.
+#
+# Every measurement includes the overhead of talking to testcrypt
+# over a pipe, so these numbers are only good for comparing things of
+# the same order of magnitude, e.g. one implementation against another
+# or a batched operation against the equivalent sequence of single
+# ones.
+
+import sys
+import time
+import random
+
+from testcrypt import *
+from ssh import *
+from numbertheory import invert
+
+assert sys.version_info[:2] >= (3,0), "This is Python 3 code"
+
+benchmarks = {}
+
+def benchmark(fn):
+    benchmarks[fn.__name__] = fn
+    return fn
+
+def time_per_call(fn, mintime=0.5):
+    # Call fn repeatedly, doubling the count each time, until the
+    # whole run takes at least mintime seconds.
+    count = 1
+    while True:
+        start = time.perf_counter()
+        for _ in range(count):
+            fn()
+        elapsed = time.perf_counter() - start
+        if elapsed >= mintime:
+            return elapsed / count
+        count *= 2
+
+def report(name, seconds, baseline=None, unit="ms"):
+    scale = {"ms": 1e3, "us": 1e6}[unit]
+    line = "  {:<40s} {:10.3f} {}".format(name, seconds * scale, unit)
+    if baseline is not None:
+        line += "  ({:.2f}x)".format(baseline / seconds)
+    print(line)
+
+def eddsa_key(alg, privkey):
+    bits = {'ed25519': 255, 'ed448': 455}[alg]
+    x, y = ecc_edwards_get_affine(eddsa_public(mp_from_bytes_le(privkey), alg))
+    pubint = int(y) | ((int(x) & 1) << bits)
+    pubbytes = pubint.to_bytes((bits + 8) // 8, 'little')
+    pubblob = ssh_string(b"ssh-" + alg.encode('ASCII')) + ssh_string(pubbytes)
+    return pubblob, ssh_key_new_priv(alg, pubblob, ssh_string(privkey))
+
+@benchmark
+def eddsa_batch_verify():
+    for alg, privlen in [('ed25519', 32), ('ed448', 57)]:
+        print("{} signature verification, time per signature:".format(alg))
+        keys = [eddsa_key(alg, bytes([k+1] * privlen)) for k in range(8)]
+        pubkeys = [ssh_key_new_pub(alg, pubblob) for pubblob, _ in keys]
+
+        for n in [1, 8, 64]:
+            entries = []
+            for i in range(n):
+                msg = "message {:d}".format(i).encode('ASCII')
+                sig = ssh_key_sign(keys[i % len(keys)][1], msg, 0)
+                entries.append((i % len(keys), sig, msg))
+
+            def single():
+                for k, sig, msg in entries:
+                    ssh_key_verify(pubkeys[k], sig, msg)
+            batch = b''.join(ssh_string(keys[k][0]) + ssh_string(sig) +
+                             ssh_string(msg) for k, sig, msg in entries)
+            def batched():
+                ssh_key_verify_batch(alg, batch)
+
+            t_single = time_per_call(single) / n
+            t_batch = time_per_call(batched) / n
+            report("{:d} one at a time".format(n), t_single)
+            report("{:d} as a batch".format(n), t_batch, t_single)
+
+def mp_benchmark(fn, *args, mintime=0.1):
+    # The *_benchmark functions in testcrypt time an operation
+    # in-process, so choose a repeat count to make each measurement
+    # take about mintime. Returns seconds per operation.
+    reps = 1
+    while True:
+        ns = fn(*args, reps)
+        if ns * reps >= mintime * 1e9 or reps >= 1 << 24:
+            return ns / 1e9
+        reps = reps * 2 if ns == 0 else max(
+            reps * 2, int(mintime * 1e9 / ns) + 1)
+
+@benchmark
+def mp_arith():
+    # Time per operation of multiprecision arithmetic at a range of
+    # sizes. To tune the Karatsuba thresholds in mpint.c, rebuild
+    # testcrypt with e.g. XFLAGS="-DKARATSUBA_THRESHOLD=32
+    # -DKARATSUBA_SQR_THRESHOLD=48" and compare the results.
+    print("Multiprecision arithmetic, time per operation:")
+    print("  {:>6s} {:>11s} {:>11s} {:>11s} {:>11s} {:>11s}".format(
+        "bits", "mul ns", "square ns", "modmul ns", "montymul ns",
+        "modpow us"))
+    rng = random.Random("cryptbench mp")
+    for bits in [256, 512, 1024, 1536, 2048, 3072, 4096, 6144, 8192]:
+        m = mp_copy(rng.getrandbits(bits) | (1 << (bits-1)) | 1)
+        a = mp_copy(rng.getrandbits(bits - 1))
+        b = mp_copy(rng.getrandbits(bits - 1))
+        print("  {:6d} {:11.0f} {:11.0f} {:11.0f} {:11.0f} {:11.1f}".format(
+            bits,
+            mp_benchmark(mp_mul_benchmark, a, b) * 1e9,
+            mp_benchmark(mp_mul_benchmark, a, a) * 1e9,
+            mp_benchmark(mp_modmul_benchmark, a, b, m) * 1e9,
+            mp_benchmark(monty_mul_benchmark, a, b, m) * 1e9,
+            mp_benchmark(mp_modpow_benchmark, a, b, m, mintime=0.3) * 1e6))
+
+def probable_prime(bits, rng):
+    # Plain Miller-Rabin, good enough for making test keys.
+    while True:
+        n = rng.getrandbits(bits) | (3 << (bits-2)) | 1
+        d, r = n - 1, 0
+        while d % 2 == 0:
+            d, r = d // 2, r + 1
+        for _ in range(20):
+            x = pow(rng.randrange(2, n - 1), d, n)
+            if x in (1, n - 1):
+                continue
+            for _ in range(r - 1):
+                x = x * x % n
+                if x == n - 1:
+                    break
+            else:
+                break
+        else:
+            return n
+
+def rsa_key(bits, seed):
+    rng = random.Random(seed)
+    e = 65537
+    while True:
+        p = probable_prime(bits // 2, rng)
+        q = probable_prime(bits // 2, rng)
+        if (p - 1) % e and (q - 1) % e:
+            break
+    n = p * q
+    d = invert(e, (p - 1) * (q - 1))
+    pubblob = ssh_string(b"ssh-rsa") + ssh2_mpint(e) + ssh2_mpint(n)
+    privblob = (ssh2_mpint(d) + ssh2_mpint(p) + ssh2_mpint(q) +
+                ssh2_mpint(invert(q, p)))
+    return ssh_key_new_priv('rsa', pubblob, privblob)
+
+@benchmark
+def rsa_sign():
+    # Signing with the same key repeatedly, as Pageant or a server
+    # would, with the two CRT halves done one after the other and
+    # then on two threads (which only helps on a multi-core machine).
+    print("RSA signature generation:")
+    for bits in [2048, 4096]:
+        key = rsa_key(bits, "cryptbench rsa {:d}".format(bits))
+        t_serial = None
+        for threads in [False, True]:
+            rsa_set_crt_threads(key, threads)
+            t = time_per_call(lambda: ssh_key_sign(key, b"message", 0))
+            report("{:d}-bit, {}: {:.0f} sig/s".format(
+                bits, "two threads" if threads else "one thread", 1 / t),
+                   t, t_serial)
+            t_serial = t
+
+@benchmark
+def dh():
+    # The two modular exponentiations done by dh_create_e and
+    # dh_find_K. Only the size of the modulus matters to the speed,
+    # not its primality, so make up an odd number of the right length
+    # instead of quoting the real group primes. Exponents are the 512
+    # bits used by our SHA-256 key exchange methods.
+    print("Diffie-Hellman, time for both exponentiations:")
+    rng = random.Random("cryptbench dh")
+    for name, bits in [("group14", 2048), ("group16", 4096),
+                       ("group18", 8192)]:
+        p = rng.getrandbits(bits) | (1 << (bits-1)) | 1
+        f = rng.randrange(2, p - 1)
+        x = mp_copy(rng.getrandbits(512))
+        def run():
+            mp_modpow(2, x, p)
+            mp_modpow(f, x, p)
+        report("{} ({:d}-bit)".format(name, bits), time_per_call(run))
+
+@benchmark
+def crc32():
+    # The portable byte-at-a-time CRC against the PCLMULQDQ one, if
+    # this machine has it. Buffers are big enough that the testcrypt
+    # overhead doesn't completely swamp the difference.
+    print("CRC-32, time per call:")
+    data = bytes(random.Random("cryptbench crc32").getrandbits(8)
+                 for _ in range(1 << 16))
+    impls = [("software", crc32_update_sw)]
+    if crc32_hw_available():
+        impls.append(("hardware", crc32_update_hw))
+    for size in [64, 1024, 1 << 16]:
+        t_sw = None
+        for name, fn in impls:
+            t = time_per_call(lambda: fn(0, data[:size]))
+            report("{:d} bytes, {}".format(size, name), t, t_sw)
+            t_sw = t
+
+@benchmark
+def prng():
+    # Small reads, of the sizes used for packet padding, DH exponents
+    # and ECDSA nonces, with and without the output buffer.
+    print("PRNG output, time per read:")
+    pr = prng_new('sha256')
+    prng_seed_begin(pr)
+    prng_seed_update(pr, b"cryptbench prng")
+    prng_seed_finish(pr)
+    for size in [4, 16, 64, 256]:
+        t_plain = None
+        for buffered in [False, True]:
+            t = mp_benchmark(prng_read_benchmark, pr, size, buffered)
+            report("{:d} bytes, {}".format(
+                size, "buffered" if buffered else "unbuffered"), t, t_plain,
+                   unit="us")
+            t_plain = t
+
+@benchmark
+def crcda():
+    # The SSH-1 CRC compensation attack detector, run repeatedly on
+    # the same context as the SSH-1 BPP does. Random blocks are the
+    # normal case; a packet of all-identical blocks is the worst case
+    # for the check that runs whenever a repeated block is found.
+    print("SSH-1 CRC attack detection, time per packet:")
+    rng = random.Random("cryptbench crcda")
+    for nblocks in [8, 64, 1024, 32768]:
+        packet = bytes(rng.getrandbits(8) for _ in range(8 * nblocks))
+        iv = bytes(rng.getrandbits(8) for _ in range(8))
+        for desc, data in [("random", packet),
+                           ("repeated", packet[:8] * nblocks)]:
+            report("{:d} bytes, {}".format(8 * nblocks, desc),
+                   mp_benchmark(crcda_benchmark, data, iv), unit="us")
+
+@benchmark
+def macs():
+    # The SSH-2 MACs on a maximum-size packet, against HMAC-SHA-256
+    # as the baseline.
+    print("SSH-2 MAC, time per 32Kb packet:")
+    data = bytes(random.Random("cryptbench macs").getrandbits(8)
+                 for _ in range(32768))
+    key = b'\x55' * 32
+    t_base = None
+    for alg, keylen in [("hmac_sha256", 32), ("hmac_sha1", 20),
+                        ("umac64", 16), ("umac128", 16)]:
+        m = ssh2_mac_new(alg, None)
+        ssh2_mac_setkey(m, key[:keylen])
+        t = mp_benchmark(ssh2_mac_benchmark, m, data)
+        report(alg, t, t_base, unit="us")
+        if t_base is None:
+            t_base = t
+
+def main():
+    args = sys.argv[1:]
+    if args == ['--list']:
+        for name in benchmarks:
+            print(name)
+        return
+    for name in args:
+        if name not in benchmarks:
+            sys.exit("cryptbench.py: unknown benchmark '{}'".format(name))
+    for name in args or list(benchmarks):
+        benchmarks[name]()
+    childprocess.wait_for_exit()
+
+if __name__ == "__main__":
+    main()
@@ -6,10 +6,12 @@ import struct
 import itertools
 import functools
 import contextlib
+import gc
 import hashlib
 import binascii
 import base64
 import json
+import zlib
 try:
     from math import gcd
 except ImportError:
@@ -94,6 +96,41 @@ def le_integer(x, nbits):
     assert nbits % 8 == 0
     return bytes([0xFF & (x >> (8*n)) for n in range(nbits//8)])
 
+# Reference implementation of the ChaCha20 variant used in
+# chacha20-poly1305@openssh.com, with a 64-bit counter and nonce.
+def chacha20_block(key, counter, nonce):
+    def rotl(x, n):
+        return ((x << n) | (x >> (32 - n))) & 0xFFFFFFFF
+    def quarter(x, a, b, c, d):
+        for (p, q, r, n) in [(a,b,d,16), (c,d,b,12),
+                             (a,b,d,8), (c,d,b,7)]:
+            x[p] = (x[p] + x[q]) & 0xFFFFFFFF
+            x[r] = rotl(x[r] ^ x[p], n)
+    init = (list(struct.unpack("<4L", b"expand 32-byte k")) +
+            list(struct.unpack("<8L", key)) +
+            [counter & 0xFFFFFFFF, counter >> 32] +
+            list(struct.unpack("<2L", nonce)))
+    x = list(init)
+    for i in range(10):
+        quarter(x, 0, 4, 8, 12)
+        quarter(x, 1, 5, 9, 13)
+        quarter(x, 2, 6, 10, 14)
+        quarter(x, 3, 7, 11, 15)
+        quarter(x, 0, 5, 10, 15)
+        quarter(x, 1, 6, 11, 12)
+        quarter(x, 2, 7, 8, 13)
+        quarter(x, 3, 4, 9, 14)
+    return struct.pack("<16L", *[(a + b) & 0xFFFFFFFF
+                                 for a, b in zip(x, init)])
+
+def chacha20_keystream(key, seq, counter, length):
+    nonce = struct.pack(">Q", seq)
+    data = b""
+    while len(data) < length:
+        data += chacha20_block(key, counter, nonce)
+        counter += 1
+    return data[:length]
+
 @contextlib.contextmanager
 def queued_random_data(nbytes, seed):
     hashsize = 512 // 8
@@ -365,6 +402,25 @@ class mpint(MyTestBase):
         bm = mp_copy(bi)
         self.assertEqual(int(mp_mul(am, bm)), ai * bi)
 
+    def testSquaring(self):
+        # Multiplying a number by itself goes through a separate
+        # squaring routine, which has its own Karatsuba threshold. So
+        # test squares of numbers on both sides of that, including
+        # all-ones values to stress the carries, and with outputs
+        # truncated to a range of sizes.
+        testnumbers = [(1 << bits) - 1 for bits in
+                       (1, 63, 64, 65, 1000, 2048, 2049, 4096, 8200)]
+        testnumbers.extend(
+            (0x123456789abcdef0fedcba9876543210 ** (bits // 128 + 1)) >> 7
+            for bits in (128, 1024, 2048, 3000, 8200))
+        for ai in testnumbers:
+            am = mp_copy(ai)
+            self.assertEqual(int(mp_mul(am, am)), ai * ai)
+            for bits in [64, 320, 1024, 2112, 4160, 8256]:
+                cm = mp_new(bits)
+                mp_mul_into(cm, am, am)
+                self.assertEqual(int(cm), (ai * ai) & mp_mask(cm))
+
     def testAddInteger(self):
         initial = mp_copy(4444444444444444444444444)
 
@@ -606,6 +662,15 @@ class mpint(MyTestBase):
         # modulus, by pre-reducing it
         assert(int(mp_modpow(1<<877, 907, 999979)) == pow(2, 877*907, 999979))
 
+        # Exponents of a range of sizes, so that monty_pow chooses a
+        # range of window sizes, and bit lengths not a multiple of any
+        # of them.
+        m = (1 << 2047) + 0x1234567 * 2 + 1
+        b = 0x3141592653589793238462643383279502884197169399375105820974944
+        for bits in [1, 2, 17, 64, 65, 127, 300, 1000, 2048, 4000, 8193]:
+            e = (b ** (bits // 200 + 1)) % (1 << bits) | (1 << (bits-1))
+            self.assertEqual(int(mp_modpow(b, e, m)), pow(b, e, m))
+
     def testModsqrt(self):
         moduli = [
             5, 19, 2**16+1, 2**31-1, 2**128-159, 2**255-19,
@@ -919,6 +984,62 @@ class ecc(MyTestBase):
             self.assertEqual(int(x), int(rGi.x))
             self.assertEqual(int(y), int(rGi.y))
 
+    def testWeierstrassCombMultiply(self):
+        wc = ecc_weierstrass_curve(p256.p, int(p256.a), int(p256.b), None)
+        wG = ecc_weierstrass_point_new(wc, int(p256.G.x), int(p256.G.y))
+        comb = ecc_weierstrass_comb_new(wG, 256)
+
+        # Unlike the ladder, the comb copes with a zero multiple, and
+        # with multiples of the group order
+        self.assertTrue(ecc_weierstrass_is_identity(
+            ecc_weierstrass_comb_multiply(comb, 0)))
+        self.assertTrue(ecc_weierstrass_is_identity(
+            ecc_weierstrass_comb_multiply(comb, p256.G_order)))
+
+        ints = set(i % p256.p for i in fibonacci_scattered(10))
+        ints.discard(0) # tested above
+        ints.update([1, 2, 3, p256.G_order - 1, p256.G_order + 1,
+                     2**256 - 1])
+        for i in sorted(ints):
+            wGi = ecc_weierstrass_comb_multiply(comb, i)
+            x, y = ecc_weierstrass_get_affine(wGi)
+            rGi = p256.G * i
+            self.assertEqual(int(x), int(rGi.x))
+            self.assertEqual(int(y), int(rGi.y))
+
+    def testEdwardsCombMultiply(self):
+        ec = ecc_edwards_curve(ed25519.p, int(ed25519.d), int(ed25519.a), None)
+        eG = ecc_edwards_point_new(ec, int(ed25519.G.x), int(ed25519.G.y))
+        comb = ecc_edwards_comb_new(eG, 255)
+
+        ints = set(i % ed25519.p for i in fibonacci_scattered(10))
+        ints.update([0, 1, 2, 3, ed25519.G_order, 2**255 - 1])
+        for i in sorted(ints):
+            eGi = ecc_edwards_comb_multiply(comb, i)
+            x, y = ecc_edwards_get_affine(eGi)
+            rGi = ed25519.G * i
+            self.assertEqual(int(x), int(rGi.x))
+            self.assertEqual(int(y), int(rGi.y))
+
+    def testEdwardsFromY(self):
+        # Point decompression on Ed25519 has its own implementation,
+        # so test it separately from the small curve in testEdwards.
+        ec = ecc_edwards_curve(ed25519.p, int(ed25519.d), int(ed25519.a),
+                               find_non_square_mod(ed25519.p))
+
+        ints = set(i % ed25519.G_order for i in fibonacci_scattered(10))
+        ints.update([0, 1, 2, 3])
+        for i in sorted(ints):
+            rGi = ed25519.G * i
+            y, xp = int(rGi.y), int(rGi.x) & 1
+            for parity, rP in [(xp, rGi), (xp ^ 1, -rGi)]:
+                if int(rGi.x) == 0 and parity:
+                    continue
+                x, y = ecc_edwards_get_affine(
+                    ecc_edwards_point_new_from_y(ec, y, parity))
+                self.assertEqual(int(x), int(rP.x))
+                self.assertEqual(int(y), int(rP.y))
+
 class keygen(MyTestBase):
     def testPrimeCandidateSource(self):
         def inspect(pcs):
@@ -991,6 +1112,55 @@ class keygen(MyTestBase):
                 for p in [2,3,5,7,11,13,17,19,23,29,31,37,41,43,47,53,59,61]:
                     self.assertNotEqual(n % p, 0)
 
+    def testParallelPrimeGeneration(self):
+        # The parallel search should give the same answer every time
+        # it's given the same random data, however its threads happen
+        # to be scheduled.
+        def generate(bits, seed):
+            pgc = primegen_new_context('probabilistic_parallel')
+            pcs = pcs_new_with_firstbits(bits, 0xB, 4)
+            pcs_avoid_residue_small(pcs, 65537, 1)
+            with random_prng(seed):
+                return int(primegen_generate(pgc, pcs))
+
+        for bits in [64, 512, 1024]:
+            seed = "parallel primegen {:d}".format(bits)
+            p = generate(bits, seed)
+            self.assertEqual(p >> (bits-4), 0xB)
+            self.assertNotEqual(p % 65537, 1)
+            for witness in [2, 3, 5, 7]:
+                self.assertEqual(pow(witness, p-1, p), 1)
+            for i in range(3):
+                self.assertEqual(generate(bits, seed), p)
+
+        # It also shouldn't depend on how many workers there are:
+        # not just the first prime, but the amount of random data used
+        # to find it, so that the next prime along (as when making an
+        # RSA key) and anything drawn after that come out the same.
+        def generate_several(bits, seed):
+            pgc = primegen_new_context('probabilistic_parallel')
+            with random_prng(seed):
+                toret = []
+                for i in range(2):
+                    pcs = pcs_new_with_firstbits(bits, 0xB, 4)
+                    toret.append(int(primegen_generate(pgc, pcs)))
+                toret.append(int(mp_random_bits(64)))
+                return toret
+
+        try:
+            for bits in [40, 256]:
+                for seed in ["a", "b", "c"]:
+                    primegen_parallel_force_workers(1)
+                    serial = generate_several(bits, seed)
+                    for nworkers in [2, 3, 8]:
+                        with self.subTest(bits=bits, seed=seed,
+                                          nworkers=nworkers):
+                            primegen_parallel_force_workers(nworkers)
+                            self.assertEqual(
+                                generate_several(bits, seed), serial)
+        finally:
+            primegen_parallel_force_workers(0)
+
     def testPocklePositive(self):
         def add_small(po, *ps):
             for p in ps:
@@ -1311,8 +1481,8 @@ class crypt(MyTestBase):
 
     def testAESParallelism(self):
         # Since at least one of our implementations of AES works in
-        # parallel, here's a test that CBC decryption works the same
-        # way no matter how the input data is divided up.
+        # parallel, here's a test that CBC decryption and SDCTR work
+        # the same way no matter how the input data is divided up.
 
         # A pile of conveniently available random-looking test data.
         test_ciphertext = ssh2_mpint(last(fibonacci_scattered(14)))
@@ -1340,6 +1510,207 @@ class crypt(MyTestBase):
             for d in decryptions:
                 self.assertEqualBin(d, decryptions[0])
 
+        # Similarly for SDCTR, starting from an IV that makes the
+        # counter carry out of its low 64 bits part way through the
+        # data, so that the carry happens inside a batch of blocks.
+        test_iv = b"FOOBARBA\xff\xff\xff\xff\xff\xff\xff\xfb"
+        for keylen in [128, 192, 256]:
+            encryptions = []
+
+            for suffix in "hw", "sw":
+                c = ssh_cipher_new("aes{:d}_ctr_{}".format(keylen, suffix))
+                if c is None: continue
+                ssh_cipher_setkey(c, test_key[:keylen//8])
+                for chunklen in range(16, 16*20, 16):
+                    ssh_cipher_setiv(c, test_iv)
+                    encryption = b""
+                    for pos in range(0, len(test_ciphertext), chunklen):
+                        chunk = test_ciphertext[pos:pos+chunklen]
+                        encryption += ssh_cipher_encrypt(c, chunk)
+                    encryptions.append(encryption)
+
+            for e in encryptions:
+                self.assertEqualBin(e, encryptions[0])
+
+    def testAESGCM(self):
+        # Check that the software and hardware implementations of
+        # both halves of AES-GCM agree with each other, in the
+        # configuration the SSH packet layer uses: MAC input prefixed
+        # by a sequence number that isn't authenticated and a length
+        # field that's authenticated as associated data, and the IV
+        # advancing by one at each message boundary.
+
+        test_key = b"foobarbazquxquuxFooBarBazQuxQuux"
+        test_iv = b"FOOBARBAZQUXQUUX"
+        lengths = [0, 16, 32, 48, 64, 80, 112, 256]
+
+        for keylen in [128, 256]:
+            results = []
+
+            for cimpl, mimpl in itertools.product(["hw", "sw"], repeat=2):
+                c = ssh_cipher_new("aes{:d}_gcm_{}".format(keylen, cimpl))
+                if c is None: continue
+                m = ssh2_mac_new("aesgcm_{}".format(mimpl), c)
+                if m is None: continue
+                ssh_cipher_setkey(c, test_key[:keylen//8])
+                ssh_cipher_setiv(c, test_iv)
+                ssh2_mac_setkey(m, b'')
+
+                result = b""
+                for seq, datalen in enumerate(lengths):
+                    data = bytes(range(datalen))
+                    ciphertext = ssh_cipher_encrypt(c, data)
+
+                    # Feed the MAC in uneven pieces, to exercise the
+                    # buffering of partial blocks, and then in one
+                    # go, to exercise processing many blocks at once.
+                    macinput = (struct.pack(">II", seq, datalen) +
+                                ciphertext)
+                    ssh2_mac_start(m)
+                    for pos in range(0, len(macinput), 7):
+                        ssh2_mac_update(m, macinput[pos:pos+7])
+                    tag = ssh2_mac_genresult(m)
+                    ssh2_mac_start(m)
+                    ssh2_mac_update(m, macinput)
+                    self.assertEqualBin(ssh2_mac_genresult(m), tag)
+                    result += ciphertext + tag
+
+                    ssh_cipher_next_message(c)
+                results.append(result)
+
+            for r in results:
+                self.assertEqualBin(r, results[0])
+
+        # Check that moving on to the next message is equivalent to
+        # incrementing the last 64 bits of the 96-bit IV.
+        for suffix in "hw", "sw":
+            c = ssh_cipher_new("aes128_gcm_{}".format(suffix))
+            if c is None: continue
+            ssh_cipher_setkey(c, test_key[:16])
+            iv = unhex('000000010000000fffffffff00000000')
+            ssh_cipher_setiv(c, iv)
+            ssh_cipher_next_message(c)
+            ssh_cipher_next_message(c)
+            ks = ssh_cipher_encrypt(c, b'\0' * 32)
+            ssh_cipher_setiv(c, unhex('00000001000000100000000100000000'))
+            self.assertEqualBin(ssh_cipher_encrypt(c, b'\0' * 32), ks)
+
+    def testChaCha20(self):
+        # Check every implementation of the ChaCha20 half of
+        # chacha20-poly1305@openssh.com against a simple reference
+        # implementation in Python, at enough different lengths to
+        # exercise each multi-block path and the partial blocks at
+        # either end of it.
+
+        key = b'sixty-four bytes of test key data, enough to key any cipher pqrs'
+        length_field = b"\x00\x00\x01\x00"
+        lengths = [1, 63, 64, 65, 128, 191, 256, 300, 511, 512, 513, 1000]
+
+        results = []
+        for suffix in "sw", "sse2", "avx2":
+            c = ssh_cipher_new("chacha20_poly1305_" + suffix)
+            if c is None: continue # skip if not available
+            m = ssh2_mac_new("poly1305", c)
+            ssh_cipher_setkey(c, key)
+
+            result = b""
+            for seq, length in enumerate(lengths, 0x12345678):
+                # The length field is encrypted with the second half
+                # of the key, starting from block 0.
+                self.assertEqualBin(
+                    ssh_cipher_encrypt_length(c, length_field, seq),
+                    bytes(a ^ b for a, b in zip(
+                        length_field,
+                        chacha20_keystream(key[32:], seq, 0, 4))))
+
+                # The packet contents are encrypted with the first
+                # half, starting from block 1 (block 0 being used to
+                # make the Poly1305 key).
+                plaintext = bytes(i & 0xFF for i in range(length))
+                ciphertext = ssh_cipher_encrypt(c, plaintext)
+                self.assertEqualBin(ciphertext, bytes(
+                    a ^ b for a, b in zip(
+                        plaintext,
+                        chacha20_keystream(key[:32], seq, 1, length))))
+
+                ssh2_mac_start(m)
+                ssh2_mac_update(m, struct.pack(">L", seq) + ciphertext)
+                result += ciphertext + ssh2_mac_genresult(m)
+
+                ssh_cipher_decrypt_length(c, length_field, seq)
+                self.assertEqualBin(ssh_cipher_decrypt(c, ciphertext),
+                                    plaintext)
+            results.append(result)
+            del m # the Poly1305 MAC lives inside the cipher object
+
+        for r in results:
+            self.assertEqualBin(r, results[0])
+
+        # Check that the keystream carries on seamlessly when the
+        # data is fed in pieces that don't line up with the batches
+        # of blocks generated by the vectorised implementations.
+        for suffix in "sw", "sse2", "avx2":
+            c = ssh_cipher_new("chacha20_poly1305_" + suffix)
+            if c is None: continue
+            ssh_cipher_setkey(c, key)
+            seq = 0x12345678
+            ssh_cipher_encrypt_length(c, length_field, seq)
+            data = b""
+            for piece in [5, 200, 64, 700, 3, 300]:
+                data += ssh_cipher_encrypt(c, b"\0" * piece)
+            self.assertEqualBin(
+                data, chacha20_keystream(key[:32], seq, 1, len(data)))
+
+    def testPoly1305(self):
+        # Check the Poly1305 half of chacha20-poly1305@openssh.com
+        # against a reference implementation in Python, at lengths
+        # long enough to use any multi-block code path, and with the
+        # data fed in pieces that don't line up with its batches.
+
+        def poly1305(key, msg):
+            r = int.from_bytes(key[:16], 'little')
+            r &= 0x0ffffffc0ffffffc0ffffffc0fffffff
+            s = int.from_bytes(key[16:32], 'little')
+            p = 2**130 - 5
+            h = 0
+            for i in range(0, len(msg), 16):
+                block = msg[i:i+16] + b'\x01'
+                h = (h + int.from_bytes(block, 'little')) * r % p
+            return ((h + s) & (2**128 - 1)).to_bytes(16, 'little')
+
+        key = b'sixty-four bytes of test key data, enough to key any cipher pqrs'
+
+        for suffix in "sw", "sse2", "avx2":
+            c = ssh_cipher_new("chacha20_poly1305_" + suffix)
+            if c is None: continue # skip if not available
+            m = ssh2_mac_new("poly1305", c)
+            ssh_cipher_setkey(c, key)
+
+            for seq, length in enumerate(
+                    [15, 252, 253, 256, 257, 320, 1000, 1024, 4095,
+                     4096, 4100, 20000], 0x12345678):
+                # The first four bytes written to the MAC are the
+                # sequence number, which aren't authenticated
+                # themselves but select the nonce; the Poly1305 key is
+                # the first 32 bytes of block 0 of that keystream.
+                polykey = chacha20_keystream(key[:32], seq, 0, 32)
+                msg = bytes((i * 37 + length) & 0xFF for i in range(length))
+                want = poly1305(polykey, msg)
+
+                ssh2_mac_start(m)
+                ssh2_mac_update(m, struct.pack(">L", seq) + msg)
+                self.assertEqualBin(ssh2_mac_genresult(m), want)
+
+                ssh2_mac_start(m)
+                ssh2_mac_update(m, struct.pack(">L", seq))
+                pos = 0
+                for piece in itertools.cycle([3, 300, 64, 1, 700]):
+                    if pos >= length: break
+                    ssh2_mac_update(m, msg[pos:pos+piece])
+                    pos += piece
+                self.assertEqualBin(ssh2_mac_genresult(m), want)
+            del m # the Poly1305 MAC lives inside the cipher object
+
     def testCRC32(self):
         # Check the effect of every possible single-byte input to
         # crc32_update. In the traditional implementation with a
@@ -1370,6 +1741,24 @@ class crypt(MyTestBase):
                 # we're at it!
                 self.assertEqual(shift8(i ^ prior), exp)
 
+    def testCRC32HW(self):
+        # The hardware CRC folds 16 bytes at a time and hands any
+        # leftover to the software version, so compare the two at
+        # every length around the block and fold boundaries, and at
+        # a variety of alignments of the input start.
+        if not crc32_hw_available():
+            return # skip testing of unavailable HW implementation
+        data = b''.join(hashlib.sha512("crc32:{:d}".format(i).encode('ascii'))
+                        .digest() for i in range(16))
+        priors = itertools.cycle([0, 0xFFFFFFFF, 0x45CC1F6A, 0xA0C4ADCF])
+        for length in itertools.chain(range(200), [255, 256, 257, 1000]):
+            for offset in [0, 1, 7]:
+                msg = data[offset:offset+length]
+                prior = next(priors)
+                exp = crc32_update_sw(prior, msg)
+                self.assertEqual(crc32_update_hw(prior, msg), exp)
+                self.assertEqual(crc32_update(prior, msg), exp)
+
     def testCRCDA(self):
         def pattern(badblk, otherblks, pat):
             # Arrange copies of the bad block in a pattern
@@ -1429,6 +1818,300 @@ class crypt(MyTestBase):
         negativeTest(0x1751997d000000000000000000000001000000001)
         negativeTest(0x800000000000002000000000000000000f128a2d1)
 
+    def testCRCDAReference(self):
+        # Compare detect_attack against a direct model of what it's
+        # supposed to compute, on packets made from a small alphabet
+        # of blocks so that there are plenty of repeats, and with
+        # some planted attack patterns. Use one context for all of
+        # them, to check that reusing the hash table between packets
+        # of varying sizes doesn't leave anything behind.
+        def check_crc(s, blocks, iv):
+            data = b'\1\0\0\0\0\0\0\0' if iv == s else b''
+            data += b''.join(b'\1\0\0\0\0\0\0\0' if blk == s
+                             else b'\0' * 8 for blk in blocks)
+            # binascii.crc32 is the RFC 1662 CRC, so undo its initial
+            # and final complement to get the SSH-1 one.
+            return binascii.crc32(data, 0xFFFFFFFF) == 0xFFFFFFFF
+
+        def reference(packet, iv):
+            blocks = [packet[i:i+8] for i in range(0, len(packet), 8)]
+            if len(blocks) <= 7:
+                # The short-packet path gives up entirely after the
+                # first block that matches the IV.
+                for j, blk in enumerate(blocks):
+                    if blk == iv:
+                        return check_crc(blk, blocks, iv)
+                    if blk in blocks[:j] and check_crc(blk, blocks, iv):
+                        return True
+                return False
+            seen, checked = {iv}, set()
+            for blk in blocks:
+                if blk in seen and blk not in checked:
+                    if check_crc(blk, blocks, iv):
+                        return True
+                    checked.add(blk) # same answer every time
+                seen.add(blk)
+            return False
+
+        ctx = crcda_make_context()
+        alphabets = [[hashlib.sha256(b"%d:%d" % (size, i)).digest()[:8]
+                      for i in range(size)] for size in [1, 2, 3, 50]]
+        for seed in range(400):
+            # Cheap deterministic pseudo-random choices.
+            h = hashlib.sha512(b"crcda:%d" % seed).digest()
+            alphabet = alphabets[h[0] % len(alphabets)]
+            if h[1] & 1:
+                # Plant a multiple of the CRC polynomial.
+                pat = [0x1db710641, 0x26d930ac3, 0xbdbdf21cf][h[2] % 3]
+                pat ^= h[3] & 3 # and sometimes break it
+                bad = alphabet[h[4] % len(alphabet)]
+                blocks = []
+                i = 5
+                while pat:
+                    blocks.append(bad if pat & 1 else
+                                  alphabet[h[i % len(h)] % len(alphabet)])
+                    pat >>= 1
+                    i += 1
+            else:
+                nblocks = [h[2] % 8, h[2] * 4, h[2] * h[3] // 4][h[4] % 3]
+                blocks = [alphabet[(h[5] + i * h[6]) % len(alphabet)]
+                          for i in range(nblocks)]
+            iv = b""
+            if blocks and h[7] & 1:
+                iv, blocks = blocks[0], blocks[1:]
+            packet = b"".join(blocks)
+            self.assertEqual(detect_attack(ctx, packet, iv),
+                             reference(packet, iv))
+
+    def testZlibLevels(self):
+        # Round-trip data bigger than the 32K window and the 64K
+        # limit on a stored block through the compressor at every
+        # level, checking the output with both our decompressor and
+        # Python's zlib. The data mixes text that the matcher can
+        # find long matches in (at distances near the far end of the
+        # window, too), runs, and stretches of noise.
+        text = b"".join(b"%d: compressible line number %d\n" % (i, i*i)
+                        for i in range(1000))
+        noise = b"".join(hashlib.sha256(b"level noise %d" % i).digest()
+                         for i in range(128))
+        data = (text + b"a" * 5000 + noise + text[100:] + b"xy" * 3000 +
+                noise[7:] + text + text[:-13] + noise)
+        self.assertGreater(len(data), 65536)
+
+        for level in range(1, 10):
+            with self.subTest(level=level):
+                comp = zlib_compressor_new(level)
+                decomp = zlib_decompressor_new()
+                ref = zlib.decompressobj()
+                for piece in [data, data[:300], data]:
+                    out = comp.compress(piece)
+                    self.assertEqualBin(decomp.decompress(out), piece)
+                    self.assertEqualBin(ref.decompress(out), piece)
+                    self.assertLess(len(out), len(piece))
+
+    def testZlibBypass(self):
+        # The compressor gives up on data that isn't compressing, and
+        # sends the next few blocks of 256 bytes or more as stored
+        # (uncompressed) Deflate blocks. Check that the stored blocks
+        # decode, that the compressor goes back to compressing
+        # afterwards, and that it can still refer back past the
+        # skipped data to text it saw before it.
+        text = b"".join(b"%d: compressible line number %d\n" % (i, i*i)
+                        for i in range(80))
+        def noise(seed, length):
+            return b"".join(hashlib.sha256(b"%s %d" % (seed, i)).digest()
+                            for i in range(length // 32))
+
+        for level in [1, 6, 9]:
+            with self.subTest(level=level):
+                comp = zlib_compressor_new(level)
+                decomp = zlib_decompressor_new()
+                ref = zlib.decompressobj()
+
+                def packet(data):
+                    out = comp.compress(data)
+                    self.assertEqualBin(decomp.decompress(out), data)
+                    self.assertEqualBin(ref.decompress(out), data)
+                    return out
+
+                first = packet(text)
+
+                # The first block of noise goes through the compressor
+                # and fails to shrink, so the next few are stored.
+                packet(noise(b"trial", 1024))
+                for i, length in enumerate([256, 1024, 4096, 8192]):
+                    data = noise(b"bypass %d" % i, length)
+                    out = packet(data)
+                    self.assertIn(data, out)
+                    self.assertLess(len(out), length + 16)
+
+                # Now the text again: it should compress to a few
+                # back-references across all the noise (which still
+                # leaves it inside the 32K window), far smaller than
+                # it did the first time.
+                again = packet(text)
+                self.assertLess(len(again) * 5, len(first))
+
+                # A stored packet too big for one stored block has to
+                # be split into several.
+                packet(noise(b"trial 2", 1024))
+                data = noise(b"huge", 70016)
+                out = packet(data)
+                self.assertIn(data[:65535], out)
+                self.assertLess(len(out), len(data) + 32)
+                packet(text)
+
+    def testZlibBypassRecovers(self):
+        # Once the compressor is bypassing noise, it should notice
+        # when the data turns compressible again, and start
+        # compressing within a packet or so, rather than waiting out
+        # the rest of its backoff.
+        text = b"".join(b"%d: compressible line number %d\n" % (i, i*i)
+                        for i in range(20000))
+        noise = b"".join(hashlib.sha256(b"noise %d" % i).digest()
+                         for i in range(50000 // 32))
+        stream = text[:200000] + noise + text[200000:]
+        noise_end = 200000 + len(noise)
+        size = 35000
+
+        for level in [1, 6, 9]:
+            with self.subTest(level=level):
+                comp = zlib_compressor_new(level)
+                decomp = zlib_decompressor_new()
+                ref = zlib.decompressobj()
+                recovered = None
+                for pos in range(0, len(stream), size):
+                    data = stream[pos:pos+size]
+                    out = comp.compress(data)
+                    self.assertEqualBin(decomp.decompress(out), data)
+                    self.assertEqualBin(ref.decompress(out), data)
+                    if pos >= noise_end and len(data) == size:
+                        self.assertLess(len(out) * 3, len(data))
+                    if pos < noise_end < pos + size:
+                        recovered = len(out) < len(data)
+                # The packet the noise ends in is mostly text, and
+                # should be compressed too.
+                self.assertTrue(recovered)
+
+    def testZlibDecompress(self):
+        # Decode streams made by Python's zlib, which uses dynamic
+        # Huffman trees where our compressor only uses static ones.
+        # The data has long matches, overlapping runs at distances 1
+        # and 2, and matches reaching back into earlier packets near
+        # the far end of the 32K window; and the compressed data is
+        # handed over in pieces of awkward sizes, so that the fast
+        # decoding loop keeps running out of input part way through
+        # a symbol.
+        text = b"".join(b"%d: decompressible line number %d\n" % (i, i*i)
+                        for i in range(200))
+        noise = b"".join(hashlib.sha256(b"noise %d" % i).digest()
+                         for i in range(64))
+        data = b""
+        for i in range(4):
+            data += (text + b"a" * 3000 + noise + b"ab" * 1000 +
+                     noise[i:] + text[i*100:] + b"x" * (20000 + i*1000))
+
+        sizes = [1, 100, 5000, 16384, 37, 300, 65536]
+        for level, strategy in [(0, zlib.Z_DEFAULT_STRATEGY),
+                                (1, zlib.Z_DEFAULT_STRATEGY),
+                                (6, zlib.Z_DEFAULT_STRATEGY),
+                                (9, zlib.Z_DEFAULT_STRATEGY),
+                                (6, zlib.Z_HUFFMAN_ONLY),
+                                (6, zlib.Z_RLE),
+                                (6, zlib.Z_FIXED)]:
+            with self.subTest(level=level, strategy=strategy):
+                ref = zlib.compressobj(level, zlib.DEFLATED, 15, 9, strategy)
+                packets, pos = [], 0
+                for size in itertools.cycle(sizes):
+                    if pos >= len(data):
+                        break
+                    chunk = data[pos:pos+size]
+                    pos += size
+                    packets.append((chunk, ref.compress(chunk) +
+                                    ref.flush(zlib.Z_SYNC_FLUSH)))
+
+                # One packet at a time, as SSH delivers them.
+                decomp = zlib_decompressor_new()
+                for chunk, comp in packets:
+                    self.assertEqualBin(decomp.decompress(comp), chunk)
+
+                # The same stream cut up without regard to packets.
+                # (Very small pieces only for the start of it, to
+                # keep the number of calls down.)
+                stream = b"".join(comp for chunk, comp in packets)
+                for cut, limit in [(1, 3000), (7, 20000), (1000, None)]:
+                    decomp = zlib_decompressor_new()
+                    part = stream[:limit]
+                    out = b"".join(decomp.decompress(part[i:i+cut])
+                                   for i in range(0, len(part), cut))
+                    self.assertGreater(len(out), 0)
+                    self.assertEqualBin(out, data[:len(out)])
+                self.assertEqual(len(out), len(data))
+
+        # Invalid input must be rejected, whether or not there's
+        # enough of it for the fast loop to be the one that finds the
+        # problem. These are a static block with the literal 'a'
+        # followed by the invalid length symbol 286; the same with a
+        # valid length followed by the invalid distance symbol 30;
+        # and a stored block whose NLEN doesn't match its LEN.
+        for bad in ["789c4a1c03", "789c4a043e", "789c0004000400"]:
+            for padding in [0, 16]:
+                decomp = zlib_decompressor_new()
+                self.assertIsNone(decomp.decompress(
+                    unhex(bad) + bytes(padding)))
+
+    def testPacketPool(self):
+        # Outgoing packets take their data buffers from a pool with a
+        # few fixed size classes, moving up to the next one as they
+        # grow. Beyond the largest class, buffers are allocated at
+        # the exact size, and not recycled.
+        allocs, reused, oversize = ssh_packet_pool_stats()
+        pkt = ssh_new_packet()
+        data = b""
+        for length, maxlen in [(1, 256), (300, 1024), (3300, 4096),
+                               (10000, 16384), (30000, None)]:
+            pkt.put(b"x" * (length - len(data)))
+            data += b"x" * (length - len(data))
+            if maxlen is not None:
+                self.assertEqual(pkt.maxlen(), maxlen)
+            else:
+                self.assertGreaterEqual(pkt.maxlen(), length)
+        self.assertEqual(ssh_packet_pool_stats()[2], oversize)
+        pkt.put(b"y" * 30000)
+        data += b"y" * 30000
+        self.assertEqual(pkt.maxlen(), 60000)
+        self.assertEqual(ssh_packet_pool_stats()[2], oversize + 1)
+        self.assertEqualBin(pkt.data(), data)
+        del pkt
+
+        # Lots of small writes mustn't reallocate the buffer every
+        # time: past the largest size class it grows geometrically.
+        allocs = ssh_packet_pool_stats()[0]
+        pkt = ssh_new_packet()
+        data = b"".join(b"%049d\n" % i for i in range(2000))
+        for i in range(0, len(data), 50):
+            pkt.put(data[i:i+50])
+        self.assertEqualBin(pkt.data(), data)
+        self.assertLess(ssh_packet_pool_stats()[0] - allocs, 16)
+        del pkt
+
+        # Each free list holds at most 16 buffers. Freeing 40 packets
+        # fills the list for the size class their PktOut structures
+        # come from (whatever was there before); then only 16 of the
+        # next 40 can be reused.
+        # (Value objects refer to themselves through their method
+        # closures, so it takes the garbage collector to free them.)
+        pkts = [ssh_new_packet() for i in range(40)]
+        del pkts
+        gc.collect()
+        allocs, reused, oversize = ssh_packet_pool_stats()
+        pkts = [ssh_new_packet() for i in range(40)]
+        allocs2, reused2, oversize2 = ssh_packet_pool_stats()
+        self.assertEqual(allocs2 - allocs, 40)
+        self.assertEqual(reused2 - reused, 16)
+        self.assertEqual(oversize2, oversize)
+        del pkts
+
     def testAuxEncryptFns(self):
         # Test helper functions such as aes256_encrypt_pubkey. The
         # test cases are all just things I made up at random, and the
@@ -1591,6 +2274,44 @@ class crypt(MyTestBase):
             '7964541892e7511798e61dd78429358f4d6a887a50d2c5ebccf0e04f48fc665c'
         ))
 
+        # Decryption shouldn't depend on which way round the primes
+        # are given.
+        _, swapped = blobs(n, e, d, q, p, int(mp_invert(p, q)))
+        for blob in [privblob, swapped]:
+            privkey = get_rsa_ssh1_priv_agent(blob)
+            decoded = ssh_rsakex_decrypt(privkey, hashalg, cipher)
+            self.assertEqual(int(decoded), plain)
+
+    def testRSACrtThreads(self):
+        # Doing the two CRT halves of an RSA signature on two threads
+        # must give the same (deterministic) signature as doing them
+        # one after the other. The setting is per key, so turning it
+        # on for one key mustn't change how another key signs, and it
+        # can be switched back and forth on the same key.
+        pubblob = base64decode(
+            b'AAAAB3NzaC1yc2EAAAABJQAAAGEA2ChX9+mQD/NULFkBrxLDI8d1PHgrInC2'
+            b'u11U4Grqu4oVzKvnFROo6DZeCu6sKhFJE5CnIL7evAthQ9hkXVHDhQ7xGVau'
+            b'zqyHGdIU4/pHRScAYWBv/PZOlNMrSoP/PP91')
+        privblob = base64decode(
+            b'AAAAYCMNdgyGvWpez2EjMLSbQj0nQ3GW8jzvru3zdYwtA3hblNUU9QpWNxDm'
+            b'OMOApkwCzUgsdIPsBxctIeWT2h+v8sVOH+d66LCaNmNR0lp+dQ+iXM67hcGN'
+            b'uxJwRdMupD9ZbQAAADEA7XMrMAb4WuHaFafoTfGrf6Jhdy9Ozjqi1fStuld7'
+            b'Nj9JkoZluiL2dCwIrxqOjwU5AAAAMQDpC1gYiGVSPeDRILr2oxREtXWOsW+/'
+            b'ZZTfZNX7lvoufnp+qvwZPqvZnXQFHyZ8qB0AAAAwQE0wx8TPgcvRVEVv8Wt+'
+            b'o1NFlkJZayWD5hqpe/8AqUMZbqfg/aiso5mvecDLFgfV')
+        serial = ssh_key_new_priv('rsa', pubblob, privblob)
+        threaded = ssh_key_new_priv('rsa', pubblob, privblob)
+        msg = b"Message to be signed by crypt.testRSACrtThreads\n"
+        expected = ssh_key_sign(serial, msg, 0)
+        self.assertTrue(ssh_key_verify(serial, expected, msg))
+
+        for setting in [True, True, False, True]:
+            rsa_set_crt_threads(threaded, setting)
+            for flags in [0, 2, 4]:
+                self.assertEqualBin(ssh_key_sign(threaded, msg, flags),
+                                    ssh_key_sign(serial, msg, flags))
+        self.assertEqualBin(ssh_key_sign(serial, msg, 0), expected)
+
     def testMontgomeryKexLowOrderPoints(self):
         # List of all the bad input values for Curve25519 which can
         # end up generating a zero output key. You can find the first
@@ -1696,6 +2417,53 @@ class crypt(MyTestBase):
         self.assertEqualBin(data2, expected_data2[:127])
         self.assertEqualBin(data3, expected_data3)
 
+    def testPRNGBuffered(self):
+        hashalg = 'sha256'
+        seed = b"hello, world"
+        entropy = b'1234567890' * 100
+        nblocks = 32 # BUFFER_BLOCKS in sshprng.c
+
+        le128 = lambda x: le_integer(x, 128)
+        blocks = lambda key, start, n: b''.join(
+            hash_str(hashalg, key + b'G' + le128(counter))
+            for counter in range(start, start + n))
+
+        pr = prng_new(hashalg)
+        prng_seed_begin(pr)
+        prng_seed_update(pr, seed)
+        prng_seed_finish(pr)
+
+        # Lots of small reads should come out of one batch of output
+        # blocks, generated all under the same key, followed by a
+        # single rekey before the next batch.
+        key1 = hash_str(hashalg, b'R' + seed)
+        key2 = hash_str(hashalg, key1 + b'R')
+        expected = blocks(key1, 0, nblocks) + blocks(key2, nblocks, nblocks)
+        data = b''.join(prng_read_buffered(pr, n)
+                        for n in itertools.islice(
+                                itertools.cycle([1, 4, 16, 7, 33]), 150))
+        self.assertEqualBin(data, expected[:len(data)])
+
+        # Reseeding throws away the rest of the buffer, so the next
+        # read uses the new key at once.
+        key3 = hash_str(hashalg, key2 + b'R')
+        prng_add_entropy(pr, 0, entropy) # forces a reseed
+        key4 = hash_str(hashalg, key3 + b'R' + hash_str(hashalg, entropy))
+        self.assertEqualBin(prng_read_buffered(pr, 100),
+                            blocks(key4, 2 * nblocks, 4)[:100])
+
+        # A request at least as big as the whole buffer, arriving when
+        # the buffer is empty, is passed straight to prng_read. (An
+        # explicit reseed also empties the buffer.)
+        key4a = hash_str(hashalg, key4 + b'R') # rekeyed after the refill
+        prng_seed_begin(pr)
+        prng_seed_update(pr, seed)
+        prng_seed_finish(pr)
+        key5 = hash_str(hashalg, key4a + b'R' + seed)
+        self.assertEqualBin(prng_read_buffered(pr, 32 * nblocks + 1),
+                            blocks(key5, 3 * nblocks, nblocks + 1)[
+                                :32 * nblocks + 1])
+
     def testHashPadding(self):
         # A consistency test for hashes that use MD5/SHA-1/SHA-2 style
         # padding of the message into a whole number of fixed-size
@@ -1926,12 +2694,39 @@ culpa qui officia deserunt mollit anim id est laborum.
 
     def testArgon2(self):
         # A few tests of my own of Argon2, derived from the reference
-        # implementation.
+        # implementation. Run them against every implementation of
+        # the compression function that this CPU supports.
         pwd = b"password"
         salt = b"salt of at least 16 bytes"
         secret = b"secret"
         assoc = b"associated data"
 
+        try:
+            for impl in "sw", "sse2", "avx2":
+                if not argon2_force_impl(impl):
+                    continue # skip if not available
+                with self.subTest(impl=impl):
+                    self.argon2_vectors(pwd, salt, secret, assoc)
+        finally:
+            argon2_force_impl(None)
+
+    def testArgon2Workers(self):
+        # The same vectors again, with the lanes divided between
+        # different numbers of worker threads, including ones that
+        # don't divide the number of lanes evenly. This happens even
+        # on a single-CPU machine, which wouldn't otherwise use
+        # threads at all.
+        try:
+            for nworkers in [1, 2, 3, 5]:
+                argon2_force_workers(nworkers)
+                with self.subTest(nworkers=nworkers):
+                    self.argon2_vectors(b"password",
+                                        b"salt of at least 16 bytes",
+                                        b"secret", b"associated data")
+        finally:
+            argon2_force_workers(0)
+
+    def argon2_vectors(self, pwd, salt, secret, assoc):
         # Smallest memory (8Kbyte) and parallelism (1) parameters the
         # reference implementation will accept, but lots of passes
         self.assertEqualBin(
@@ -2136,6 +2931,108 @@ culpa qui officia deserunt mollit anim id est laborum.
                         self.assertFalse(ssh_key_verify(
                             key, badsig, test_message))
 
+    def testBatchVerify(self):
+        def eddsa_key(alg, privkey):
+            bits = {'ed25519': 255, 'ed448': 455}[alg]
+            x, y = ecc_edwards_get_affine(eddsa_public(
+                mp_from_bytes_le(privkey), alg))
+            pubint = int(y) | ((int(x) & 1) << bits)
+            pubbytes = pubint.to_bytes((bits + 8) // 8, 'little')
+            sshid = b"ssh-" + alg.encode('ASCII')
+            pubblob = ssh_string(sshid) + ssh_string(pubbytes)
+            return pubblob, ssh_key_new_priv(
+                alg, pubblob, ssh_string(privkey))
+
+        def batch(entries):
+            return b''.join(ssh_string(pub) + ssh_string(sig) +
+                            ssh_string(msg) for pub, sig, msg in entries)
+
+        for alg, privlen in [('ed25519', 32), ('ed448', 57)]:
+            with self.subTest(alg=alg):
+                keys = [eddsa_key(alg, bytes([k+1] * privlen))
+                        for k in range(4)]
+
+                # Some keys sign more than one message, to exercise
+                # merging of their terms.
+                entries = []
+                for i in range(7):
+                    pubblob, privkey = keys[i % len(keys)]
+                    msg = "message {:d}".format(i).encode('ASCII')
+                    entries.append((pubblob, ssh_key_sign(privkey, msg, 0),
+                                    msg))
+
+                self.assertTrue(ssh_key_verify_batch(alg, batch(entries)))
+                self.assertTrue(ssh_key_verify_batch(alg, b''))
+                self.assertTrue(ssh_key_verify_batch(alg, batch(entries[:1])))
+
+                for i in range(len(entries)):
+                    pub, sig, msg = entries[i]
+
+                    # Wrong message
+                    bad = list(entries)
+                    bad[i] = (pub, sig, msg + b'!')
+                    self.assertFalse(ssh_key_verify_batch(alg, batch(bad)))
+
+                    # Perturbed s or r
+                    for pos in [len(sig) - 1, len(sig) - 1 - privlen]:
+                        sigbytes = bytearray(sig)
+                        sigbytes[pos] ^= 0x01
+                        bad = list(entries)
+                        bad[i] = (pub, bytes(sigbytes), msg)
+                        self.assertFalse(ssh_key_verify_batch(
+                            alg, batch(bad)))
+
+                # Two signatures swapped between their messages
+                bad = list(entries)
+                bad[0], bad[1] = ((entries[0][0], entries[1][1], entries[0][2]),
+                                  (entries[1][0], entries[0][1], entries[1][2]))
+                self.assertFalse(ssh_key_verify_batch(alg, batch(bad)))
+
+        # An algorithm without a batch method falls back to checking
+        # each signature in turn.
+        pubblob = base64decode(
+            b'AAAAE2VjZHNhLXNoYTItbmlzdHAyNTYAAAAIbmlzdHAyNTYAAABBBHkYQ0sQoq5'
+            b'LbJI1VMWhw3bV43TSYi3WVpqIgKcBKK91TcFFlAMZgceOHQ0xAFYcSczIttLvFu'
+            b'+xkcLXrRd4N7Q=')
+        privblob = base64decode(
+            b'AAAAIQCV/1VqiCsHZm/n+bq7lHEHlyy7KFgZBEbzqYaWtbx48Q==')
+        privkey = ssh_key_new_priv('p256', pubblob, privblob)
+        entries = [(pubblob, ssh_key_sign(privkey, msg, 0), msg)
+                   for msg in [b'one', b'two', b'three']]
+        self.assertTrue(ssh_key_verify_batch('p256', batch(entries)))
+        entries[2] = (pubblob, entries[1][1], b'three')
+        self.assertFalse(ssh_key_verify_batch('p256', batch(entries)))
+
+    def testEdDSAUnreducedScalar(self):
+        # The s half of an EdDSA signature is stored in a full
+        # fieldBytes-sized string, which has spare bits above the
+        # group order (three for Ed25519, a whole byte for Ed448).
+        # Setting any of them changes s by a non-multiple of the
+        # order, so the signature must stop verifying, however s*G
+        # is computed.
+        for alg, bits, privlen in [('ed25519', 255, 32), ('ed448', 455, 57)]:
+            with self.subTest(alg=alg):
+                privkey = bytes(range(1, privlen+1))
+                x, y = ecc_edwards_get_affine(eddsa_public(
+                    mp_from_bytes_le(privkey), alg))
+                pubint = int(y) | ((int(x) & 1) << bits)
+                pubbytes = pubint.to_bytes((bits + 8) // 8, 'little')
+                pubblob = (ssh_string(b"ssh-" + alg.encode('ASCII')) +
+                           ssh_string(pubbytes))
+                key = ssh_key_new_priv(alg, pubblob, ssh_string(privkey))
+
+                msg = b'unreduced scalar'
+                sig = ssh_key_sign(key, msg, 0)
+                self.assertTrue(ssh_key_verify(key, sig, msg))
+
+                for bit in range(8):
+                    if sig[-1] & (1 << bit):
+                        continue
+                    sigbytes = bytearray(sig)
+                    sigbytes[-1] |= 1 << bit
+                    self.assertFalse(ssh_key_verify(
+                        key, bytes(sigbytes), msg))
+
     def testPPKLoadSave(self):
         # Stability test of PPK load/save functions.
         input_clear_key = b"""\
@@ -2363,6 +3260,54 @@ class standard_test_vectors(MyTestBase):
         vector('aes256_cbc', fullkey[:32], plaintext,
                unhex('8ea2b7ca516745bfeafc49904b496089'))
 
+    def testAESGCM(self):
+        # Test cases 2, 3, 14 and 15 from McGrew and Viega's original
+        # GCM specification: 96-bit IVs and no associated data. The
+        # SSH protocol always uses 96-bit IVs, but testcrypt insists
+        # on a full cipher block, so we pad them to 16 bytes; the
+        # last 4 are ignored.
+        def vector(cipher, key, iv, plaintext, ciphertext, tag):
+            for cimpl, mimpl in itertools.product(["hw", "sw"], repeat=2):
+                c = ssh_cipher_new("{}_{}".format(cipher, cimpl))
+                if c is None: continue # skip if HW AES not available
+                m = ssh2_mac_new("aesgcm_{}".format(mimpl), c)
+                if m is None: continue # skip if HW GHASH not available
+                aesgcm_set_prefix_lengths(m, 0, 0)
+
+                ssh_cipher_setkey(c, key)
+                ssh_cipher_setiv(c, iv + b'\0' * 4)
+                ssh2_mac_setkey(m, b'')
+                self.assertEqualBin(
+                    ssh_cipher_encrypt(c, plaintext), ciphertext)
+                ssh2_mac_start(m)
+                ssh2_mac_update(m, ciphertext)
+                self.assertEqualBin(ssh2_mac_genresult(m), tag)
+
+                ssh_cipher_setiv(c, iv + b'\0' * 4)
+                self.assertEqualBin(
+                    ssh_cipher_decrypt(c, ciphertext), plaintext)
+
+        vector('aes128_gcm', b'\0' * 16, b'\0' * 12, b'\0' * 16,
+               unhex('0388dace60b6a392f328c2b971b2fe78'),
+               unhex('ab6e47d42cec13bdf53a67b21257bddf'))
+        vector('aes256_gcm', b'\0' * 32, b'\0' * 12, b'\0' * 16,
+               unhex('cea7403d4d606b6e074ec5d3baf39d18'),
+               unhex('d0d1c8a799996bf0265b98b5d48ab919'))
+
+        key = unhex('feffe9928665731c6d6a8f9467308308')
+        iv = unhex('cafebabefacedbaddecaf888')
+        plaintext = unhex('''
+        d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72
+        1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255''')
+        vector('aes128_gcm', key, iv, plaintext, unhex('''
+        42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e
+        21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985'''),
+               unhex('4d5c2af327cd64a62cf35abd2ba6fab4'))
+        vector('aes256_gcm', key + key, iv, plaintext, unhex('''
+        522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa
+        8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad'''),
+               unhex('b094dac5d93471bdec1a502270e3cc6c'))
+
     def testDES(self):
         c = ssh_cipher_new("des_cbc")
         def vector(key, plaintext, ciphertext):
@@ -2829,6 +3774,40 @@ class standard_test_vectors(MyTestBase):
             "before being used by the HMAC algorithm.",
             s256="9B09FFA71B942FCB27635FBCD5B0E944BFDC63644F0713938A7F51535C3A35E2")
 
+    def testUMAC(self):
+        # Key, nonce and messages from the test vectors in RFC 4418
+        # section 5 (leaving out the 32Mb one, which is slow through
+        # testcrypt). The expected tags agree with Nettle's UMAC.
+        key = b'abcdefghijklmnop'
+        def vector(message, t64, t128):
+            for alg, tag in [("umac64", t64), ("umac128", t128)]:
+                m = ssh2_mac_new(alg, None)
+                ssh2_mac_setkey(m, key)
+                umac_set_nonce(m, b'bcdefghi')
+                ssh2_mac_start(m)
+                ssh2_mac_update(m, message)
+                self.assertEqualBin(ssh2_mac_genresult(m), unhex(tag))
+        vector(b'', "6E155FAD26900BE1",
+               "32FEDB100C79AD58F07FF7643CC60465")
+        vector(b'a' * 3, "44B5CB542F220104",
+               "185E4FE905CBA7BD85E4C2DC3D117D8D")
+        vector(b'a' * 2**10, "26BF2F5D60118BD9",
+               "7A54ABE04AF82D60FB298C3CBD195BCB")
+        vector(b'a' * 2**15, "27F8EF643B0D118D",
+               "7B136BD911E4B734286EF2BE501F2C3C")
+        vector(b'a' * 2**20, "A4477E87E9F55853",
+               "F8ACFA3AC31CFEEA047F7B115B03BEF5")
+        vector(b'abc', "D4D7B9F6BD4FBFCF",
+               "883C3D4B97A61976FFCF232308CBA5A5")
+        vector(b'abc' * 500, "D4CF26DDEFD5C01A",
+               "8824A260C53C66A36C9260A62CB83AA1")
+
+        # In SSH use, the nonce is the sequence number, which is the
+        # first thing fed to the MAC. An odd one makes UMAC-64 use the
+        # second half of its pad block.
+        self.assertEqualBin(mac_str('umac64', key, b'\0\0\0\7abc'),
+                            unhex("2EE8E8C638435041"))
+
     def testEd25519(self):
         def vector(privkey, pubkey, message, signature):
             x, y = ecc_edwards_get_affine(eddsa_public(
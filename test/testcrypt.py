@@ -99,6 +99,9 @@ method_prefixes = {
     'val_prng': 'prng_',
     'val_pcs': 'pcs_',
     'val_pockle': 'pockle_',
+    'val_compressor': 'ssh_compressor_',
+    'val_decompressor': 'ssh_decompressor_',
+    'val_pktout': 'pktout_',
 }
 method_lists = {t: [] for t in method_prefixes}
 
@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "defs.h"
 #include "ssh.h"
@@ -84,10 +85,12 @@ uint64_t prng_reseed_time_ms(void)
     X(monty, MontyContext *, monty_free(v))                             \
     X(wcurve, WeierstrassCurve *, ecc_weierstrass_curve_free(v))        \
     X(wpoint, WeierstrassPoint *, ecc_weierstrass_point_free(v))        \
+    X(wcomb, WeierstrassComb *, ecc_weierstrass_comb_free(v))           \
     X(mcurve, MontgomeryCurve *, ecc_montgomery_curve_free(v))          \
     X(mpoint, MontgomeryPoint *, ecc_montgomery_point_free(v))          \
     X(ecurve, EdwardsCurve *, ecc_edwards_curve_free(v))                \
     X(epoint, EdwardsPoint *, ecc_edwards_point_free(v))                \
+    X(ecomb, EdwardsComb *, ecc_edwards_comb_free(v))                   \
     X(hash, ssh_hash *, ssh_hash_free(v))                               \
     X(key, ssh_key *, ssh_key_free(v))                                  \
     X(cipher, ssh_cipher *, ssh_cipher_free(v))                         \
@@ -101,6 +104,10 @@ uint64_t prng_reseed_time_ms(void)
     X(pcs, PrimeCandidateSource *, pcs_free(v))                         \
     X(pgc, PrimeGenerationContext *, primegen_free_context(v))          \
     X(pockle, Pockle *, pockle_free(v))                                 \
+    X(crcda, struct crcda_ctx *, crcda_free_context(v))                 \
+    X(compressor, ssh_compressor *, ssh_compressor_free(v))             \
+    X(decompressor, ssh_decompressor *, ssh_decompressor_free(v))       \
+    X(pktout, PktOut *, ssh_free_pktout(v))                             \
     /* end of list */
 
 typedef struct Value Value;
@@ -252,7 +259,12 @@ static const ssh2_macalg *get_macalg(BinarySource *in)
         {"hmac_sha1_96", &ssh_hmac_sha1_96},
         {"hmac_sha1_96_buggy", &ssh_hmac_sha1_96_buggy},
         {"hmac_sha256", &ssh_hmac_sha256},
+        {"umac64", &ssh_umac_64},
+        {"umac128", &ssh_umac_128},
         {"poly1305", &ssh2_poly1305},
+        {"aesgcm", &ssh2_aesgcm_mac},
+        {"aesgcm_sw", &ssh2_aesgcm_mac_sw},
+        {"aesgcm_hw", &ssh2_aesgcm_mac_hw},
     };
 
     ptrlen name = get_word(in);
@@ -314,12 +326,21 @@ static const ssh_cipheralg *get_cipheralg(BinarySource *in)
         {"aes128_cbc", &ssh_aes128_cbc},
         {"aes128_cbc_hw", &ssh_aes128_cbc_hw},
         {"aes128_cbc_sw", &ssh_aes128_cbc_sw},
+        {"aes256_gcm", &ssh_aes256_gcm},
+        {"aes256_gcm_hw", &ssh_aes256_gcm_hw},
+        {"aes256_gcm_sw", &ssh_aes256_gcm_sw},
+        {"aes128_gcm", &ssh_aes128_gcm},
+        {"aes128_gcm_hw", &ssh_aes128_gcm_hw},
+        {"aes128_gcm_sw", &ssh_aes128_gcm_sw},
         {"blowfish_ctr", &ssh_blowfish_ssh2_ctr},
         {"blowfish_ssh2", &ssh_blowfish_ssh2},
         {"blowfish_ssh1", &ssh_blowfish_ssh1},
         {"arcfour256", &ssh_arcfour256_ssh2},
         {"arcfour128", &ssh_arcfour128_ssh2},
         {"chacha20_poly1305", &ssh2_chacha20_poly1305},
+        {"chacha20_poly1305_sw", &ssh2_chacha20_poly1305_sw},
+        {"chacha20_poly1305_sse2", &ssh2_chacha20_poly1305_sse2},
+        {"chacha20_poly1305_avx2", &ssh2_chacha20_poly1305_avx2},
     };
 
     ptrlen name = get_word(in);
@@ -394,6 +415,7 @@ static const PrimeGenerationPolicy *get_primegenpolicy(BinarySource *in)
         const PrimeGenerationPolicy *value;
     } algs[] = {
         {"probabilistic", &primegen_probabilistic},
+        {"probabilistic_parallel", &primegen_probabilistic_parallel},
         {"provable_fast", &primegen_provable_fast},
         {"provable_maurer_simple", &primegen_provable_maurer_simple},
         {"provable_maurer_complex", &primegen_provable_maurer_complex},
@@ -723,6 +745,7 @@ NULLABLE_RETURN_WRAPPER(val_string_asciz, char *)
 NULLABLE_RETURN_WRAPPER(val_string_asciz_const, const char *)
 NULLABLE_RETURN_WRAPPER(val_cipher, ssh_cipher *)
 NULLABLE_RETURN_WRAPPER(val_hash, ssh_hash *)
+NULLABLE_RETURN_WRAPPER(val_mac, ssh2_mac *)
 NULLABLE_RETURN_WRAPPER(val_key, ssh_key *)
 NULLABLE_RETURN_WRAPPER(val_mpint, mp_int *)
 
@@ -938,6 +961,15 @@ strbuf *ssh_cipher_decrypt_length_wrapper(ssh_cipher *c, ptrlen input,
 #undef ssh_cipher_decrypt_length
 #define ssh_cipher_decrypt_length ssh_cipher_decrypt_length_wrapper
 
+void ssh_cipher_next_message_wrapper(ssh_cipher *c)
+{
+    if (!(ssh_cipher_alg(c)->flags & SSH_CIPHER_NEXT_MESSAGE))
+        fatal_error("ssh_cipher_next_message: not supported by this cipher");
+    ssh_cipher_next_message(c);
+}
+#undef ssh_cipher_next_message
+#define ssh_cipher_next_message ssh_cipher_next_message_wrapper
+
 strbuf *ssh2_mac_genresult_wrapper(ssh2_mac *m)
 {
     strbuf *sb = strbuf_new();
@@ -1108,6 +1140,24 @@ strbuf *aes256_decrypt_pubkey_wrapper(ptrlen key, ptrlen iv, ptrlen data)
 }
 #define aes256_decrypt_pubkey aes256_decrypt_pubkey_wrapper
 
+/* Defined here, before the wrappers below replace prng_read */
+static uintmax_t ns_per_rep(clock_t start, uintmax_t reps);
+uintmax_t prng_read_benchmark(prng *pr, uintmax_t size, bool buffered,
+                              uintmax_t reps)
+{
+    unsigned char buf[256];
+    if (size > sizeof(buf))
+        fatal_error("prng_read_benchmark: size too large");
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++) {
+        if (buffered)
+            prng_read_buffered(pr, buf, size);
+        else
+            prng_read(pr, buf, size);
+    }
+    return ns_per_rep(start, reps);
+}
+
 strbuf *prng_read_wrapper(prng *pr, size_t size)
 {
     strbuf *sb = strbuf_new();
@@ -1116,24 +1166,185 @@ strbuf *prng_read_wrapper(prng *pr, size_t size)
 }
 #define prng_read prng_read_wrapper
 
+strbuf *prng_read_buffered_wrapper(prng *pr, size_t size)
+{
+    strbuf *sb = strbuf_new();
+    prng_read_buffered(pr, strbuf_append(sb, size), size);
+    return sb;
+}
+#define prng_read_buffered prng_read_buffered_wrapper
+
 void prng_seed_update(prng *pr, ptrlen data)
 {
     put_datapl(pr, data);
 }
 
-bool crcda_detect(ptrlen packet, ptrlen iv)
+/*
+ * Timing functions for test/cryptbench.py. Multiprecision arithmetic
+ * is too fast to measure usefully from the other end of a pipe, so
+ * these repeat one operation 'reps' times within testcrypt, and
+ * return the average time per operation in nanoseconds.
+ */
+static uintmax_t ns_per_rep(clock_t start, uintmax_t reps)
+{
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    return (uintmax_t)(elapsed * 1e9 / (reps ? reps : 1));
+}
+
+uintmax_t mp_mul_benchmark(mp_int *a, mp_int *b, uintmax_t reps)
+{
+    mp_int *r = mp_new(mp_max_bits(a) + mp_max_bits(b));
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++)
+        mp_mul_into(r, a, b);
+    uintmax_t toret = ns_per_rep(start, reps);
+    mp_free(r);
+    return toret;
+}
+
+uintmax_t mp_modmul_benchmark(mp_int *a, mp_int *b, mp_int *m,
+                              uintmax_t reps)
+{
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++)
+        mp_free(mp_modmul(a, b, m));
+    return ns_per_rep(start, reps);
+}
+
+uintmax_t monty_mul_benchmark(mp_int *a, mp_int *b, mp_int *m,
+                              uintmax_t reps)
+{
+    MontyContext *mc = monty_new(m);
+    mp_int *r = mp_new(mp_max_bits(m));
+    mp_int *ma = monty_import(mc, a), *mb = monty_import(mc, b);
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++)
+        monty_mul_into(mc, r, ma, mb);
+    uintmax_t toret = ns_per_rep(start, reps);
+    mp_free(ma);
+    mp_free(mb);
+    mp_free(r);
+    monty_free(mc);
+    return toret;
+}
+
+uintmax_t mp_modpow_benchmark(mp_int *a, mp_int *e, mp_int *m,
+                              uintmax_t reps)
+{
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++)
+        mp_free(mp_modpow(a, e, m));
+    return ns_per_rep(start, reps);
+}
+
+bool detect_attack_wrapper(struct crcda_ctx *ctx, ptrlen packet, ptrlen iv)
 {
     if (iv.len != 0 && iv.len != 8)
-        fatal_error("crcda_detect: iv must be empty or 8 bytes long");
+        fatal_error("detect_attack: iv must be empty or 8 bytes long");
     if (packet.len % 8 != 0)
-        fatal_error("crcda_detect: packet must be a multiple of 8 bytes");
+        fatal_error("detect_attack: packet must be a multiple of 8 bytes");
+    if (packet.len > 32768 * 8)
+        fatal_error("detect_attack: packet too long");
+    return detect_attack(ctx, packet.ptr, packet.len,
+                         iv.len ? iv.ptr : NULL);
+}
+#define detect_attack detect_attack_wrapper
+
+bool crcda_detect(ptrlen packet, ptrlen iv)
+{
     struct crcda_ctx *ctx = crcda_make_context();
-    bool toret = detect_attack(ctx, packet.ptr, packet.len,
-                               iv.len ? iv.ptr : NULL);
+    bool toret = detect_attack(ctx, packet, iv);
     crcda_free_context(ctx);
     return toret;
 }
 
+uintmax_t crcda_benchmark(ptrlen packet, ptrlen iv, uintmax_t reps)
+{
+    struct crcda_ctx *ctx = crcda_make_context();
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++)
+        detect_attack(ctx, packet, iv);
+    uintmax_t toret = ns_per_rep(start, reps);
+    crcda_free_context(ctx);
+    return toret;
+}
+
+static ssh_compressor *zlib_compressor_new(int level)
+{
+    return ssh_compressor_new(&ssh_zlib, level);
+}
+
+static ssh_decompressor *zlib_decompressor_new(void)
+{
+    return ssh_decompressor_new(&ssh_zlib);
+}
+
+strbuf *ssh_compressor_compress_wrapper(ssh_compressor *c, ptrlen input)
+{
+    unsigned char *out;
+    int outlen;
+    ssh_compressor_compress(c, input.ptr, input.len, &out, &outlen, 0);
+    strbuf *sb = strbuf_new();
+    put_data(sb, out, outlen);
+    sfree(out);
+    return sb;
+}
+#define ssh_compressor_compress ssh_compressor_compress_wrapper
+
+strbuf *ssh_decompressor_decompress_wrapper(ssh_decompressor *d, ptrlen input)
+{
+    unsigned char *out;
+    int outlen;
+    if (!ssh_decompressor_decompress(d, input.ptr, input.len, &out, &outlen))
+        return NULL;
+    strbuf *sb = strbuf_new();
+    put_data(sb, out, outlen);
+    sfree(out);
+    return sb;
+}
+#define ssh_decompressor_decompress ssh_decompressor_decompress_wrapper
+
+static void pktout_put(PktOut *pkt, ptrlen data)
+{
+    put_datapl(pkt, data);
+}
+
+static strbuf *pktout_data(PktOut *pkt)
+{
+    strbuf *sb = strbuf_new();
+    put_data(sb, pkt->data, pkt->length);
+    return sb;
+}
+
+static uintmax_t pktout_maxlen(PktOut *pkt)
+{
+    return pkt->maxlen;
+}
+
+void ssh_packet_pool_stats_wrapper(
+    unsigned *allocs, unsigned *reused, unsigned *oversize)
+{
+    PacketPoolStats pps;
+    ssh_packet_pool_stats(&pps);
+    *allocs = pps.allocs;
+    *reused = pps.reused;
+    *oversize = pps.oversize;
+}
+#define ssh_packet_pool_stats ssh_packet_pool_stats_wrapper
+
+uintmax_t ssh2_mac_benchmark(ssh2_mac *m, ptrlen data, uintmax_t reps)
+{
+    unsigned char out[64];
+    assert(m->vt->len <= sizeof(out));
+    clock_t start = clock();
+    for (uintmax_t i = 0; i < reps; i++) {
+        ssh2_mac_start(m);
+        put_datapl(m, data);
+        m->vt->genresult(m, out); /* bypass the strbuf wrapper */
+    }
+    return ns_per_rep(start, reps);
+}
+
 ssh_key *ppk_load_s_wrapper(BinarySource *src, char **comment,
                             const char *passphrase, const char **errorstr)
 {
@@ -1152,6 +1363,76 @@ ssh_key *ppk_load_s_wrapper(BinarySource *src, char **comment,
 }
 #define ppk_load_s ppk_load_s_wrapper
 
+/*
+ * The batch of signatures to check is passed in as a single string,
+ * consisting of a sequence of SSH-format strings in groups of three:
+ * public key blob, signature blob, signed data. Repeated public key
+ * blobs share a single ssh_key, as they might in real use.
+ */
+bool ssh_key_verify_batch_wrapper(const ssh_keyalg *alg, ptrlen batch)
+{
+    ssh_key **keys = NULL;
+    ptrlen *pubs = NULL, *sigs = NULL, *data = NULL;
+    size_t n = 0, keysize = 0, pubsize = 0, sigsize = 0, datasize = 0;
+
+    BinarySource src[1];
+    BinarySource_BARE_INIT_PL(src, batch);
+    while (get_avail(src)) {
+        ptrlen pub = get_string(src);
+        ptrlen sig = get_string(src);
+        ptrlen msg = get_string(src);
+        if (get_err(src))
+            fatal_error("ssh_key_verify_batch: malformed batch");
+
+        ssh_key *key = NULL;
+        for (size_t i = 0; i < n && !key; i++)
+            if (ptrlen_eq_ptrlen(pubs[i], pub))
+                key = keys[i];
+        if (!key && !(key = ssh_key_new_pub(alg, pub)))
+            fatal_error("ssh_key_verify_batch: bad public key");
+
+        sgrowarray(keys, keysize, n);
+        sgrowarray(pubs, pubsize, n);
+        sgrowarray(sigs, sigsize, n);
+        sgrowarray(data, datasize, n);
+        keys[n] = key;
+        pubs[n] = pub;
+        sigs[n] = sig;
+        data[n] = msg;
+        n++;
+    }
+
+    bool toret = ssh_key_verify_batch(alg, keys, sigs, data, n);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t j;
+        for (j = 0; j < i; j++)
+            if (keys[j] == keys[i])
+                break;
+        if (j == i)
+            ssh_key_free(keys[i]);
+    }
+    sfree(keys);
+    sfree(pubs);
+    sfree(sigs);
+    sfree(data);
+    return toret;
+}
+#define ssh_key_verify_batch ssh_key_verify_batch_wrapper
+
+/*
+ * rsa_set_crt_threads works on an RSAKey, but the RSA keys that
+ * sign things are only visible to Python as ssh_key.
+ */
+void rsa_set_crt_threads_wrapper(ssh_key *key, bool enabled)
+{
+    const ssh_keyalg *alg = ssh_key_alg(key);
+    if (alg != &ssh_rsa && alg != &ssh_rsa_sha256 && alg != &ssh_rsa_sha512)
+        fatal_error("rsa_set_crt_threads: not an RSA key");
+    rsa_set_crt_threads(container_of(key, RSAKey, sshk), enabled);
+}
+#define rsa_set_crt_threads rsa_set_crt_threads_wrapper
+
 int rsa1_load_s_wrapper(BinarySource *src, RSAKey *rsa, char **comment,
                         const char *passphrase, const char **errorstr)
 {
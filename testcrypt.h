@@ -88,6 +88,10 @@ FUNC3(void, mp_rshift_fixed_into, val_mpint, val_mpint, uint)
 FUNC2(val_mpint, mp_rshift_fixed, val_mpint, uint)
 FUNC1(val_mpint, mp_random_bits, uint)
 FUNC2(val_mpint, mp_random_in_range, val_mpint, val_mpint)
+FUNC3(uint, mp_mul_benchmark, val_mpint, val_mpint, uint)
+FUNC4(uint, mp_modmul_benchmark, val_mpint, val_mpint, val_mpint, uint)
+FUNC4(uint, monty_mul_benchmark, val_mpint, val_mpint, val_mpint, uint)
+FUNC4(uint, mp_modpow_benchmark, val_mpint, val_mpint, val_mpint, uint)
 
 /*
  * ecc.h functions.
@@ -102,6 +106,8 @@ FUNC2(val_wpoint, ecc_weierstrass_add_general, val_wpoint, val_wpoint)
 FUNC2(val_wpoint, ecc_weierstrass_add, val_wpoint, val_wpoint)
 FUNC1(val_wpoint, ecc_weierstrass_double, val_wpoint)
 FUNC2(val_wpoint, ecc_weierstrass_multiply, val_wpoint, val_mpint)
+FUNC2(val_wcomb, ecc_weierstrass_comb_new, val_wpoint, uint)
+FUNC2(val_wpoint, ecc_weierstrass_comb_multiply, val_wcomb, val_mpint)
 FUNC1(uint, ecc_weierstrass_is_identity, val_wpoint)
 /* The output pointers in get_affine all become extra output values */
 FUNC3(void, ecc_weierstrass_get_affine, val_wpoint, out_val_mpint, out_val_mpint)
@@ -119,6 +125,8 @@ FUNC3(val_epoint, ecc_edwards_point_new_from_y, val_ecurve, val_mpint, uint)
 FUNC1(val_epoint, ecc_edwards_point_copy, val_epoint)
 FUNC2(val_epoint, ecc_edwards_add, val_epoint, val_epoint)
 FUNC2(val_epoint, ecc_edwards_multiply, val_epoint, val_mpint)
+FUNC2(val_ecomb, ecc_edwards_comb_new, val_epoint, uint)
+FUNC2(val_epoint, ecc_edwards_comb_multiply, val_ecomb, val_mpint)
 FUNC2(uint, ecc_edwards_eq, val_epoint, val_epoint)
 FUNC3(void, ecc_edwards_get_affine, val_epoint, out_val_mpint, out_val_mpint)
 
@@ -143,12 +151,15 @@ FUNC1(opt_val_hash, blake2b_new_general, uint)
  * to ssh2_mac_new. Also, again, I've invented an ssh2_mac_update so
  * you can put data into the MAC.
  */
-FUNC2(val_mac, ssh2_mac_new, macalg, opt_val_cipher)
+FUNC2(opt_val_mac, ssh2_mac_new, macalg, opt_val_cipher)
 FUNC2(void, ssh2_mac_setkey, val_mac, val_string_ptrlen)
 FUNC1(void, ssh2_mac_start, val_mac)
 FUNC2(void, ssh2_mac_update, val_mac, val_string_ptrlen)
 FUNC1(val_string, ssh2_mac_genresult, val_mac)
 FUNC1(val_string_asciz_const, ssh2_mac_text_name, val_mac)
+FUNC3(void, aesgcm_set_prefix_lengths, val_mac, uint, uint)
+FUNC2(void, umac_set_nonce, val_mac, val_string_ptrlen)
+FUNC3(uint, ssh2_mac_benchmark, val_mac, val_string_ptrlen, uint)
 
 /*
  * The ssh_key abstraction. All the uses of BinarySink and
@@ -163,12 +174,14 @@ FUNC2(opt_val_key, ssh_key_new_priv_openssh, keyalg, val_string_binarysource)
 FUNC2(opt_val_string_asciz, ssh_key_invalid, val_key, uint)
 FUNC4(void, ssh_key_sign, val_key, val_string_ptrlen, uint, out_val_string_binarysink)
 FUNC3(boolean, ssh_key_verify, val_key, val_string_ptrlen, val_string_ptrlen)
+FUNC2(boolean, ssh_key_verify_batch, keyalg, val_string_ptrlen)
 FUNC2(void, ssh_key_public_blob, val_key, out_val_string_binarysink)
 FUNC2(void, ssh_key_private_blob, val_key, out_val_string_binarysink)
 FUNC2(void, ssh_key_openssh_blob, val_key, out_val_string_binarysink)
 FUNC1(val_string_asciz, ssh_key_cache_str, val_key)
 FUNC1(val_keycomponents, ssh_key_components, val_key)
 FUNC2(uint, ssh_key_public_bits, keyalg, val_string_ptrlen)
+FUNC2(void, rsa_set_crt_threads, val_key, boolean)
 
 /*
  * Accessors to retrieve the innards of a 'key_components'.
@@ -190,6 +203,7 @@ FUNC2(val_string, ssh_cipher_encrypt, val_cipher, val_string_ptrlen)
 FUNC2(val_string, ssh_cipher_decrypt, val_cipher, val_string_ptrlen)
 FUNC3(val_string, ssh_cipher_encrypt_length, val_cipher, val_string_ptrlen, uint)
 FUNC3(val_string, ssh_cipher_decrypt_length, val_cipher, val_string_ptrlen, uint)
+FUNC1(void, ssh_cipher_next_message, val_cipher)
 
 /*
  * Integer Diffie-Hellman.
@@ -246,6 +260,8 @@ FUNC1(void, prng_seed_begin, val_prng)
 FUNC2(void, prng_seed_update, val_prng, val_string_ptrlen)
 FUNC1(void, prng_seed_finish, val_prng)
 FUNC2(val_string, prng_read, val_prng, uint)
+FUNC2(val_string, prng_read_buffered, val_prng, uint)
+FUNC4(uint, prng_read_benchmark, val_prng, uint, boolean, uint)
 FUNC3(void, prng_add_entropy, val_prng, uint, val_string_ptrlen)
 
 /*
@@ -268,6 +284,8 @@ FUNC2(val_string_asciz, ssh2_fingerprint_blob, val_string_ptrlen, fptype)
  */
 FUNC9(val_string, argon2, argon2flavour, uint, uint, uint, uint, val_string_ptrlen, val_string_ptrlen, val_string_ptrlen, val_string_ptrlen)
 FUNC2(val_string, argon2_long_hash, uint, val_string_ptrlen)
+FUNC1(boolean, argon2_force_impl, opt_val_string_asciz)
+FUNC1(void, argon2_force_workers, uint)
 
 /*
  * Key generation functions.
@@ -280,6 +298,7 @@ FUNC3(val_rsa, rsa1_generate, uint, boolean, val_pgc)
 FUNC1(val_pgc, primegen_new_context, primegenpolicy)
 FUNC2(opt_val_mpint, primegen_generate, val_pgc, consumed_val_pcs)
 FUNC2(val_string, primegen_mpu_certificate, val_pgc, val_mpint)
+FUNC1(void, primegen_parallel_force_workers, uint)
 FUNC1(val_pcs, pcs_new, uint)
 FUNC3(val_pcs, pcs_new_with_firstbits, uint, uint, uint)
 FUNC3(void, pcs_require_residue, val_pcs, val_mpint, val_mpint)
@@ -314,7 +333,33 @@ FUNC3(val_string, aes256_decrypt_pubkey, val_string_ptrlen, val_string_ptrlen, v
 FUNC1(uint, crc32_rfc1662, val_string_ptrlen)
 FUNC1(uint, crc32_ssh1, val_string_ptrlen)
 FUNC2(uint, crc32_update, uint, val_string_ptrlen)
+FUNC2(uint, crc32_update_sw, uint, val_string_ptrlen)
+FUNC2(uint, crc32_update_hw, uint, val_string_ptrlen)
+FUNC0(boolean, crc32_hw_available)
 FUNC2(boolean, crcda_detect, val_string_ptrlen, val_string_ptrlen)
+FUNC0(val_crcda, crcda_make_context)
+FUNC3(boolean, detect_attack, val_crcda, val_string_ptrlen, val_string_ptrlen)
+FUNC3(uint, crcda_benchmark, val_string_ptrlen, val_string_ptrlen, uint)
+
+/*
+ * SSH zlib compression. The compress and decompress functions each
+ * take one packet's worth of data and return the result.
+ */
+FUNC1(val_compressor, zlib_compressor_new, uint)
+FUNC2(val_string, ssh_compressor_compress, val_compressor, val_string_ptrlen)
+FUNC0(val_decompressor, zlib_decompressor_new)
+FUNC2(opt_val_string, ssh_decompressor_decompress, val_decompressor, val_string_ptrlen)
+
+/*
+ * Outgoing packets, and the pool of buffers they're allocated from.
+ * pktout_maxlen reports the size of the buffer currently holding the
+ * packet's data, which the pool rounds up to a size class.
+ */
+FUNC0(val_pktout, ssh_new_packet)
+FUNC2(void, pktout_put, val_pktout, val_string_ptrlen)
+FUNC1(val_string, pktout_data, val_pktout)
+FUNC1(uint, pktout_maxlen, val_pktout)
+FUNC3(void, ssh_packet_pool_stats, out_uint, out_uint, out_uint)
 
 /*
  * These functions aren't part of PuTTY's own API, but are additions
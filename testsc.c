@@ -249,7 +249,16 @@ VOLATILE_WRAPPED_DEFN(static, size_t, looplimit, (size_t x))
     X(Y, ssh_aes128_cbc)                        \
     X(Y, ssh_aes128_cbc_hw)                     \
     X(Y, ssh_aes128_cbc_sw)                     \
+    X(Y, ssh_aes256_gcm)                        \
+    X(Y, ssh_aes256_gcm_hw)                     \
+    X(Y, ssh_aes256_gcm_sw)                     \
+    X(Y, ssh_aes128_gcm)                        \
+    X(Y, ssh_aes128_gcm_hw)                     \
+    X(Y, ssh_aes128_gcm_sw)                     \
     X(Y, ssh2_chacha20_poly1305)                \
+    X(Y, ssh2_chacha20_poly1305_sw)             \
+    X(Y, ssh2_chacha20_poly1305_sse2)           \
+    X(Y, ssh2_chacha20_poly1305_avx2)           \
     /* end of list */
 
 #define CIPHER_TESTLIST(X, name) X(cipher_ ## name)
@@ -261,6 +270,11 @@ VOLATILE_WRAPPED_DEFN(static, size_t, looplimit, (size_t x))
     X(Y, ssh_hmac_sha1_96)                      \
     X(Y, ssh_hmac_sha1_96_buggy)                \
     X(Y, ssh_hmac_sha256)                       \
+    X(Y, ssh_umac_64)                           \
+    X(Y, ssh_umac_128)                          \
+    X(Y, ssh2_aesgcm_mac)                       \
+    X(Y, ssh2_aesgcm_mac_hw)                    \
+    X(Y, ssh2_aesgcm_mac_sw)                    \
     /* end of list */
 
 #define MAC_TESTLIST(X, name) X(mac_ ## name)
@@ -315,15 +329,20 @@ VOLATILE_WRAPPED_DEFN(static, size_t, looplimit, (size_t x))
     X(ecc_weierstrass_double)                   \
     X(ecc_weierstrass_add_general)              \
     X(ecc_weierstrass_multiply)                 \
+    X(ecc_weierstrass_comb_multiply)            \
     X(ecc_weierstrass_is_identity)              \
     X(ecc_weierstrass_get_affine)               \
     X(ecc_weierstrass_decompress)               \
     X(ecc_montgomery_diff_add)                  \
     X(ecc_montgomery_double)                    \
     X(ecc_montgomery_multiply)                  \
+    X(ecc_montgomery_multiply_25519)            \
     X(ecc_montgomery_get_affine)                \
     X(ecc_edwards_add)                          \
     X(ecc_edwards_multiply)                     \
+    X(ecc_edwards_comb_multiply)                \
+    X(ecc_edwards_multiply_25519)               \
+    X(ecc_edwards_comb_multiply_25519)          \
     X(ecc_edwards_eq)                           \
     X(ecc_edwards_get_affine)                   \
     X(ecc_edwards_decompress)                   \
@@ -847,6 +866,27 @@ static void test_ecc_weierstrass_multiply(void)
     mp_free(exponent);
 }
 
+static void test_ecc_weierstrass_comb_multiply(void)
+{
+    WeierstrassCurve *wc = wcurve();
+    WeierstrassPoint *B = wpoint(wc, 1);
+    WeierstrassComb *comb = ecc_weierstrass_comb_new(B, 56);
+    mp_int *exponent = mp_new(56);
+    for (size_t i = 0; i < looplimit(8); i++) {
+        mp_random_fill(exponent);
+
+        log_start();
+        WeierstrassPoint *r = ecc_weierstrass_comb_multiply(comb, exponent);
+        log_end();
+
+        ecc_weierstrass_point_free(r);
+    }
+    ecc_weierstrass_comb_free(comb);
+    ecc_weierstrass_point_free(B);
+    ecc_weierstrass_curve_free(wc);
+    mp_free(exponent);
+}
+
 static void test_ecc_weierstrass_is_identity(void)
 {
     WeierstrassCurve *wc = wcurve();
@@ -1046,6 +1086,42 @@ static void test_ecc_montgomery_multiply(void)
     mp_free(exponent);
 }
 
+/* Curve25519 and Ed25519 have their own field arithmetic (see ecc.c),
+ * so they need testing separately from the small example curves */
+static MontgomeryCurve *mcurve25519(void)
+{
+    mp_int *p = MP_LITERAL(0x7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed);
+    mp_int *a = MP_LITERAL(0x76d06);
+    mp_int *b = MP_LITERAL(0x1);
+    MontgomeryCurve *mc = ecc_montgomery_curve(p, a, b);
+    mp_free(p);
+    mp_free(a);
+    mp_free(b);
+    return mc;
+}
+
+static void test_ecc_montgomery_multiply_25519(void)
+{
+    MontgomeryCurve *mc = mcurve25519();
+    mp_int *x = mp_new(254);
+    mp_int *exponent = mp_new(255);
+    for (size_t i = 0; i < looplimit(8); i++) {
+        mp_random_fill(x);
+        MontgomeryPoint *a = ecc_montgomery_point_new(mc, x);
+        mp_random_fill(exponent);
+
+        log_start();
+        MontgomeryPoint *r = ecc_montgomery_multiply(a, exponent);
+        log_end();
+
+        ecc_montgomery_point_free(r);
+        ecc_montgomery_point_free(a);
+    }
+    ecc_montgomery_curve_free(mc);
+    mp_free(x);
+    mp_free(exponent);
+}
+
 static void test_ecc_montgomery_get_affine(void)
 {
     MontgomeryCurve *wc = mcurve();
@@ -1179,6 +1255,89 @@ static void test_ecc_edwards_multiply(void)
     mp_free(exponent);
 }
 
+static void test_ecc_edwards_comb_multiply(void)
+{
+    EdwardsCurve *ec = ecurve();
+    EdwardsPoint *B = epoint(ec, 1);
+    EdwardsComb *comb = ecc_edwards_comb_new(B, 56);
+    mp_int *exponent = mp_new(56);
+    for (size_t i = 0; i < looplimit(8); i++) {
+        mp_random_fill(exponent);
+
+        log_start();
+        EdwardsPoint *r = ecc_edwards_comb_multiply(comb, exponent);
+        log_end();
+
+        ecc_edwards_point_free(r);
+    }
+    ecc_edwards_comb_free(comb);
+    ecc_edwards_point_free(B);
+    ecc_edwards_curve_free(ec);
+    mp_free(exponent);
+}
+
+static EdwardsCurve *ecurve25519(void)
+{
+    mp_int *p = MP_LITERAL(0x7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed);
+    mp_int *d = MP_LITERAL(0x52036cee2b6ffe738cc740797779e89800700a4d4141d8ab75eb4dca135978a3);
+    mp_int *a = MP_LITERAL(0x7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffec);
+    EdwardsCurve *ec = ecc_edwards_curve(p, d, a, NULL);
+    mp_free(p);
+    mp_free(d);
+    mp_free(a);
+    return ec;
+}
+
+static EdwardsPoint *epoint25519(EdwardsCurve *ec)
+{
+    mp_int *x = MP_LITERAL(0x216936d3cd6e53fec0a4e231fdd6dc5c692cc7609525a7b2c9562d608f25d51a);
+    mp_int *y = MP_LITERAL(0x6666666666666666666666666666666666666666666666666666666666666658);
+    EdwardsPoint *ep = ecc_edwards_point_new(ec, x, y);
+    mp_free(x);
+    mp_free(y);
+    return ep;
+}
+
+static void test_ecc_edwards_multiply_25519(void)
+{
+    EdwardsCurve *ec = ecurve25519();
+    EdwardsPoint *B = epoint25519(ec);
+    mp_int *exponent = mp_new(255);
+    for (size_t i = 0; i < looplimit(8); i++) {
+        mp_random_fill(exponent);
+
+        log_start();
+        EdwardsPoint *r = ecc_edwards_multiply(B, exponent);
+        log_end();
+
+        ecc_edwards_point_free(r);
+    }
+    ecc_edwards_point_free(B);
+    ecc_edwards_curve_free(ec);
+    mp_free(exponent);
+}
+
+static void test_ecc_edwards_comb_multiply_25519(void)
+{
+    EdwardsCurve *ec = ecurve25519();
+    EdwardsPoint *B = epoint25519(ec);
+    EdwardsComb *comb = ecc_edwards_comb_new(B, 255);
+    mp_int *exponent = mp_new(255);
+    for (size_t i = 0; i < looplimit(8); i++) {
+        mp_random_fill(exponent);
+
+        log_start();
+        EdwardsPoint *r = ecc_edwards_comb_multiply(comb, exponent);
+        log_end();
+
+        ecc_edwards_point_free(r);
+    }
+    ecc_edwards_comb_free(comb);
+    ecc_edwards_point_free(B);
+    ecc_edwards_curve_free(ec);
+    mp_free(exponent);
+}
+
 static void test_ecc_edwards_eq(void)
 {
     EdwardsCurve *ec = ecurve();
@@ -1323,6 +1482,8 @@ static void test_cipher(const ssh_cipheralg *calg)
         if (calg->flags & SSH_CIPHER_SEPARATE_LENGTH)
             ssh_cipher_decrypt_length(c, data, datalen, seq);
         ssh_cipher_decrypt(c, data, datalen);
+        if (calg->flags & SSH_CIPHER_NEXT_MESSAGE)
+            ssh_cipher_next_message(c);
         log_end();
     }
 
@@ -1342,8 +1503,21 @@ CIPHERS(CIPHER_TESTFN, Y_unused)
 
 static void test_mac(const ssh2_macalg *malg)
 {
-    ssh2_mac *m = ssh2_mac_new(malg, NULL);
+    /* The GHASH half of AES-GCM needs an AES-GCM cipher to key it */
+    ssh_cipher *c = NULL;
+    if (malg == &ssh2_aesgcm_mac || malg == &ssh2_aesgcm_mac_hw ||
+        malg == &ssh2_aesgcm_mac_sw) {
+        c = ssh_cipher_new(&ssh_aes128_gcm);
+        if (!c) {
+            test_skipped = true;
+            return;
+        }
+    }
+
+    ssh2_mac *m = ssh2_mac_new(malg, c);
     if (!m) {
+        if (c)
+            ssh_cipher_free(c);
         test_skipped = true;
         return;
     }
@@ -1352,6 +1526,8 @@ static void test_mac(const ssh2_macalg *malg)
     size_t datalen = 256;
     size_t maclen = malg->len;
     uint8_t *data = snewn(datalen + maclen, uint8_t);
+    uint8_t *ckey = c ? snewn(c->vt->padded_keybytes, uint8_t) : NULL;
+    uint8_t *civ = c ? snewn(c->vt->blksize, uint8_t) : NULL;
 
     for (size_t i = 0; i < looplimit(16); i++) {
         random_read(mkey, malg->keylen);
@@ -1359,8 +1535,16 @@ static void test_mac(const ssh2_macalg *malg)
         uint8_t seqbuf[4];
         random_read(seqbuf, 4);
         uint32_t seq = GET_32BIT_MSB_FIRST(seqbuf);
+        if (c) {
+            random_read(ckey, c->vt->padded_keybytes);
+            random_read(civ, c->vt->blksize);
+        }
 
         log_start();
+        if (c) {
+            ssh_cipher_setkey(c, ckey);
+            ssh_cipher_setiv(c, civ);
+        }
         ssh2_mac_setkey(m, make_ptrlen(mkey, malg->keylen));
         ssh2_mac_generate(m, data, datalen, seq);
         ssh2_mac_verify(m, data, datalen, seq);
@@ -1369,7 +1553,11 @@ static void test_mac(const ssh2_macalg *malg)
 
     sfree(mkey);
     sfree(data);
+    sfree(ckey);
+    sfree(civ);
     ssh2_mac_free(m);
+    if (c)
+        ssh_cipher_free(c);
 }
 
 #define MAC_TESTFN(Y_unused, mac)                                 \
@@ -8,12 +8,25 @@
  *
  * It's also useful as a means for a fuzzer to get reasonably direct
  * access to PuTTY's zlib decompressor.
+ *
+ * With -c, it runs the other way, compressing its input the way
+ * ssh2bpp would, one packet-sized block at a time. Each block is
+ * immediately decompressed again and checked against the original,
+ * and the compressed stream is written to standard output, so that
+ * it can be checked with other zlib implementations too.
+ *
+ * With -b, it benchmarks sshzlib.c instead: each corpus file (or a
+ * built-in synthetic corpus, if none are given) is put through the
+ * compressor and decompressor in chunks of each of a range of packet
+ * sizes, and the compression ratio and throughput in each direction
+ * are reported.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "defs.h"
 #include "ssh.h"
@@ -29,12 +42,291 @@ void dputs(const char *buf)
     fputs(buf, stderr);
 }
 
+#define PACKET_SIZE 16384
+
+static int compress_stream(FILE *fp, int level)
+{
+    static unsigned char buf[PACKET_SIZE];
+    unsigned char *outbuf, *checkbuf;
+    int outlen, checklen;
+    size_t ret;
+    ssh_compressor *comp = ssh_compressor_new(&ssh_zlib, level);
+    ssh_decompressor *decomp = ssh_decompressor_new(&ssh_zlib);
+    int toret = 0;
+
+    while ((ret = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        ssh_compressor_compress(comp, buf, ret, &outbuf, &outlen, 0);
+        fwrite(outbuf, 1, outlen, stdout);
+
+        if (!ssh_decompressor_decompress(decomp, outbuf, outlen,
+                                         &checkbuf, &checklen)) {
+            fprintf(stderr, "round trip failed: decoding error\n");
+            toret = 1;
+        } else {
+            if (checklen != ret || memcmp(checkbuf, buf, ret)) {
+                fprintf(stderr, "round trip failed: data mismatch\n");
+                toret = 1;
+            }
+            sfree(checkbuf);
+        }
+        sfree(outbuf);
+        if (toret)
+            break;
+    }
+
+    ssh_compressor_free(comp);
+    ssh_decompressor_free(decomp);
+    return toret;
+}
+
+/*
+ * Benchmark mode.
+ */
+#define BENCH_MIN_SECONDS 0.5
+
+static const int bench_chunk_sizes[] = { 256, 1024, 4096, 16384, 32768 };
+
+typedef struct BenchCorpus {
+    const char *name;
+    unsigned char *data;
+    size_t len;
+} BenchCorpus;
+
+/*
+ * The built-in corpus is generated from a fixed-seed PRNG, so that
+ * it's the same every time, and results from different builds can be
+ * compared. It has one member that compresses well (log-file-like
+ * text), one that doesn't compress at all (as if it were already
+ * compressed or encrypted), and one that alternates between the two.
+ */
+#define BENCH_CORPUS_SIZE (1024 * 1024)
+
+static uint32_t bench_prng(uint32_t *state)
+{
+    /* xorshift32 */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void bench_make_text(strbuf *sb, size_t len, uint32_t *state)
+{
+    static const char *const users[] = {
+        "root", "admin", "simon", "jacob", "owen", "ben", "build", "git",
+    };
+    static const char *const events[] = {
+        "Accepted publickey for", "Failed password for",
+        "Disconnected from user", "Connection closed by authenticating user",
+        "pam_unix(sshd:session): session opened for user",
+        "pam_unix(sshd:session): session closed for user",
+    };
+
+    while (sb->len < len) {
+        uint32_t r = bench_prng(state);
+        strbuf_catf(sb, "Oct %2u %02u:%02u:%02u tartarus sshd[%u]: %s %s "
+                    "from 10.%u.%u.%u port %u ssh2\n",
+                    1 + r % 31, (r >> 5) % 24, (r >> 10) % 60,
+                    (r >> 16) % 60, 1000 + (bench_prng(state) % 30000),
+                    events[(r >> 22) % lenof(events)],
+                    users[(r >> 26) % lenof(users)],
+                    r & 7, (r >> 3) & 15, bench_prng(state) & 255,
+                    1024 + bench_prng(state) % 64000);
+    }
+    strbuf_shrink_to(sb, len);
+}
+
+static void bench_make_random(strbuf *sb, size_t len, uint32_t *state)
+{
+    while (sb->len < len)
+        put_uint32(sb, bench_prng(state));
+    strbuf_shrink_to(sb, len);
+}
+
+static void bench_builtin_corpus(BenchCorpus *corpus)
+{
+    uint32_t state = 0x12345678;
+    strbuf *sb;
+
+    sb = strbuf_new();
+    bench_make_text(sb, BENCH_CORPUS_SIZE, &state);
+    corpus[0].name = "text";
+    corpus[0].len = sb->len;
+    corpus[0].data = (unsigned char *)strbuf_to_str(sb);
+
+    sb = strbuf_new();
+    bench_make_random(sb, BENCH_CORPUS_SIZE, &state);
+    corpus[1].name = "random";
+    corpus[1].len = sb->len;
+    corpus[1].data = (unsigned char *)strbuf_to_str(sb);
+
+    sb = strbuf_new();
+    while (sb->len < BENCH_CORPUS_SIZE) {
+        bench_make_text(sb, sb->len + 65536, &state);
+        bench_make_random(sb, sb->len + 65536, &state);
+    }
+    corpus[2].name = "mixed";
+    corpus[2].len = sb->len;
+    corpus[2].data = (unsigned char *)strbuf_to_str(sb);
+}
+
+static bool bench_load_file(BenchCorpus *corpus, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    unsigned char buf[4096];
+    size_t ret;
+
+    if (!fp) {
+        fprintf(stderr, "unable to open '%s'\n", filename);
+        return false;
+    }
+
+    strbuf *sb = strbuf_new();
+    while ((ret = fread(buf, 1, sizeof(buf), fp)) > 0)
+        put_data(sb, buf, ret);
+    fclose(fp);
+
+    corpus->name = filename;
+    corpus->len = sb->len;
+    corpus->data = (unsigned char *)strbuf_to_str(sb);
+    return true;
+}
+
+/*
+ * Compress and decompress a whole corpus file, one chunk at a time,
+ * through a single compressor and decompressor as a connection
+ * would. Adds the CPU time spent in each direction to *ctime and
+ * *dtime, and sets *complen to the total compressed size. Returns
+ * false if the data didn't survive the round trip.
+ */
+static bool bench_pass(const BenchCorpus *corpus, int chunk, int level,
+                       size_t *complen, double *ctime, double *dtime)
+{
+    size_t nchunks = (corpus->len + chunk - 1) / chunk;
+    unsigned char **blocks = snewn(nchunks, unsigned char *);
+    int *blocklens = snewn(nchunks, int);
+    size_t i, pos, total = 0;
+    bool ok = true;
+    clock_t start;
+
+    ssh_compressor *comp = ssh_compressor_new(&ssh_zlib, level);
+    start = clock();
+    for (i = 0, pos = 0; i < nchunks; i++, pos += chunk) {
+        int len = corpus->len - pos < chunk ? corpus->len - pos : chunk;
+        ssh_compressor_compress(comp, corpus->data + pos, len,
+                                &blocks[i], &blocklens[i], 0);
+        total += blocklens[i];
+    }
+    *ctime += (double)(clock() - start) / CLOCKS_PER_SEC;
+    ssh_compressor_free(comp);
+
+    ssh_decompressor *decomp = ssh_decompressor_new(&ssh_zlib);
+    start = clock();
+    for (i = 0, pos = 0; i < nchunks; i++, pos += chunk) {
+        int len = corpus->len - pos < chunk ? corpus->len - pos : chunk;
+        unsigned char *out;
+        int outlen;
+
+        if (!ssh_decompressor_decompress(decomp, blocks[i], blocklens[i],
+                                         &out, &outlen)) {
+            ok = false;
+            break;
+        }
+        if (outlen != len || memcmp(out, corpus->data + pos, len))
+            ok = false;
+        sfree(out);
+        if (!ok)
+            break;
+    }
+    *dtime += (double)(clock() - start) / CLOCKS_PER_SEC;
+    ssh_decompressor_free(decomp);
+
+    for (i = 0; i < nchunks; i++)
+        sfree(blocks[i]);
+    sfree(blocks);
+    sfree(blocklens);
+
+    *complen = total;
+    return ok;
+}
+
+static int benchmark(char **filenames, int nfiles, int level, int chunk)
+{
+    BenchCorpus *corpus;
+    int ncorpus, i, j, toret = 0;
+
+    if (nfiles) {
+        corpus = snewn(nfiles, BenchCorpus);
+        for (ncorpus = 0; ncorpus < nfiles; ncorpus++)
+            if (!bench_load_file(&corpus[ncorpus], filenames[ncorpus])) {
+                toret = 1;
+                goto out;
+            }
+    } else {
+        corpus = snewn(3, BenchCorpus);
+        bench_builtin_corpus(corpus);
+        ncorpus = 3;
+    }
+
+    printf("%-16s %6s %5s %7s %14s %14s\n", "corpus", "chunk", "level",
+           "ratio", "compress", "decompress");
+
+    for (i = 0; i < ncorpus; i++) {
+        for (j = 0; j < lenof(bench_chunk_sizes); j++) {
+            int thischunk = chunk ? chunk : bench_chunk_sizes[j];
+            double ctime = 0, dtime = 0;
+            size_t complen;
+            int passes = 0;
+            bool ok;
+
+            /*
+             * Repeat until we've taken long enough to get a
+             * reasonably stable figure. (An empty file never will,
+             * so one pass is all it gets.)
+             */
+            do {
+                ok = bench_pass(&corpus[i], thischunk, level,
+                                &complen, &ctime, &dtime);
+                passes++;
+            } while (ok && corpus[i].len &&
+                     ctime + dtime < BENCH_MIN_SECONDS);
+
+            if (!ok) {
+                fprintf(stderr, "%s: round trip failed at chunk size %d\n",
+                        corpus[i].name, thischunk);
+                toret = 1;
+                goto out;
+            }
+
+            double mb = (double)corpus[i].len * passes / 1000000;
+            printf("%-16s %6d %5d %6.1f%% %9.1f MB/s %9.1f MB/s\n",
+                   corpus[i].name, thischunk, level,
+                   100.0 * complen / (corpus[i].len ? corpus[i].len : 1),
+                   ctime > 0 ? mb / ctime : 0, dtime > 0 ? mb / dtime : 0);
+
+            if (chunk)
+                break;                 /* only one chunk size requested */
+        }
+    }
+
+  out:
+    while (ncorpus-- > 0)
+        sfree(corpus[ncorpus].data);
+    sfree(corpus);
+    return toret;
+}
+
 int main(int argc, char **argv)
 {
     unsigned char buf[16], *outbuf;
     int ret, outlen;
     ssh_decompressor *handle;
-    int noheader = false, opts = true;
+    int noheader = false, opts = true, level = 0;
+    bool bench = false;
+    int chunk = 0;
+    char **filenames = snewn(argc, char *);
+    int nfiles = 0;
     char *filename = NULL;
     FILE *fp;
 
@@ -44,6 +336,21 @@ int main(int argc, char **argv)
         if (p[0] == '-' && opts) {
             if (!strcmp(p, "-d")) {
                 noheader = true;
+            } else if (!strcmp(p, "-c")) {
+                if (--argc == 0 || (level = atoi(*++argv)) < 1 ||
+                    level > 9) {
+                    fprintf(stderr, "-c expects a level from 1 to 9\n");
+                    return 1;
+                }
+            } else if (!strcmp(p, "-b")) {
+                bench = true;
+            } else if (!strcmp(p, "-s")) {
+                if (--argc == 0 || (chunk = atoi(*++argv)) < 1 ||
+                    chunk > 65536) {
+                    fprintf(stderr, "-s expects a chunk size from 1 to "
+                            "65536\n");
+                    return 1;
+                }
             } else if (!strcmp(p, "--")) {
                 opts = false;          /* next thing is filename */
             } else if (!strcmp(p, "--help")) {
@@ -51,20 +358,43 @@ int main(int argc, char **argv)
                        " from standard input\n");
                 printf("       testzlib -d       decode Deflate (RFC1951) data"
                        " from standard input\n");
+                printf("       testzlib -c N     compress standard input"
+                       " at level N (1-9), checking\n"
+                       "                         that it decompresses"
+                       " correctly\n");
+                printf("       testzlib -b [-c N] [-s SIZE] [FILE...]\n"
+                       "                         benchmark compression and"
+                       " decompression of each\n"
+                       "                         FILE (or a built-in corpus)"
+                       " in packet-sized chunks\n"
+                       "                         (all of a range of sizes,"
+                       " or just SIZE) at level N\n");
                 printf("       testzlib --help   display this text\n");
                 return 0;
             } else {
                 fprintf(stderr, "unknown command line option '%s'\n", p);
                 return 1;
             }
-        } else if (!filename) {
-            filename = p;
         } else {
-            fprintf(stderr, "can only handle one filename\n");
-            return 1;
+            filenames[nfiles++] = p;
         }
     }
 
+    if (bench) {
+        ret = benchmark(filenames, nfiles,
+                        level ? level : COMPRESSION_LEVEL_DEFAULT, chunk);
+        sfree(filenames);
+        return ret;
+    }
+
+    if (nfiles > 1) {
+        fprintf(stderr, "can only handle one filename\n");
+        return 1;
+    }
+    if (nfiles)
+        filename = filenames[0];
+    sfree(filenames);
+
     handle = ssh_decompressor_new(&ssh_zlib);
 
     if (noheader) {
@@ -89,6 +419,14 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (level) {
+        ssh_decompressor_free(handle);
+        ret = compress_stream(fp, level);
+        if (filename)
+            fclose(fp);
+        return ret;
+    }
+
     while (1) {
         ret = fread(buf, 1, sizeof(buf), fp);
         if (ret <= 0)
@@ -0,0 +1,157 @@
+/*
+ * Unix implementation of worker thread pools, using POSIX threads.
+ */
+
+#ifndef NO_THREADS
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "putty.h"
+#include "ssh.h"
+
+typedef struct WorkerThread {
+    WorkerPool *pool;
+    size_t index;
+    pthread_t thread;
+} WorkerThread;
+
+struct WorkerPool {
+    worker_fn_t fn;
+    void *ctx;
+
+    /*
+     * Workers 1,...,nthreads have threads of their own. If we were
+     * asked for more than we managed to start, the calling thread
+     * runs the rest of them itself, along with worker 0.
+     */
+    size_t nworkers, nthreads;
+    WorkerThread *threads;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond, done_cond;
+
+    /*
+     * 'generation' is incremented each time the pool is told to run,
+     * so that each thread can tell a new request from a spurious
+     * wakeup. 'pending' counts the threads that haven't finished the
+     * current request yet.
+     */
+    unsigned long generation;
+    size_t pending;
+    bool shutting_down;
+};
+
+static void *worker_thread_main(void *vthread)
+{
+    WorkerThread *wt = (WorkerThread *)vthread;
+    WorkerPool *pool = wt->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (pool->generation == seen && !pool->shutting_down)
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        if (pool->shutting_down)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->fn(pool->ctx, wt->index);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+WorkerPool *worker_pool_new(size_t nworkers, worker_fn_t fn, void *ctx)
+{
+    if (nworkers < 2)
+        return NULL;                   /* no point */
+
+    WorkerPool *pool = snew(WorkerPool);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->nworkers = nworkers;
+    pool->nthreads = 0;
+    pool->threads = snewn(nworkers - 1, WorkerThread);
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->shutting_down = false;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (size_t i = 0; i < nworkers - 1; i++) {
+        WorkerThread *wt = &pool->threads[i];
+        wt->pool = pool;
+        wt->index = i + 1;
+        if (pthread_create(&wt->thread, NULL, worker_thread_main, wt) != 0)
+            break;
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads == 0) {
+        /* Couldn't start any threads at all, so we might as well
+         * tell the caller to fall back to doing the work itself. */
+        worker_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void worker_pool_run(WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->generation++;
+    pool->pending = pool->nthreads;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool->fn(pool->ctx, 0);
+    for (size_t i = pool->nthreads + 1; i < pool->nworkers; i++)
+        pool->fn(pool->ctx, i);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void worker_pool_free(WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i].thread, NULL);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    sfree(pool->threads);
+    sfree(pool);
+}
+
+size_t worker_pool_ncpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 1)
+        return n;
+#endif
+    return 1;
+}
+
+#else /* NO_THREADS */
+
+#include "nothread.c"
+
+#endif /* NO_THREADS */
@@ -0,0 +1,142 @@
+/*
+ * Windows implementation of worker thread pools.
+ */
+
+#ifndef NO_THREADS
+
+#include "putty.h"
+#include "ssh.h"
+
+typedef struct WorkerThread {
+    WorkerPool *pool;
+    size_t index;
+    HANDLE thread;
+
+    /* Auto-reset events: 'start' is set by worker_pool_run to wake
+     * the thread, and 'done' by the thread when it's finished. */
+    HANDLE start, done;
+} WorkerThread;
+
+struct WorkerPool {
+    worker_fn_t fn;
+    void *ctx;
+
+    /*
+     * Workers 1,...,nthreads have threads of their own. If we were
+     * asked for more than we managed to start, the calling thread
+     * runs the rest of them itself, along with worker 0.
+     */
+    size_t nworkers, nthreads;
+    WorkerThread *threads;
+    HANDLE *done_events;
+
+    volatile bool shutting_down;
+};
+
+static DWORD WINAPI worker_thread_main(void *vthread)
+{
+    WorkerThread *wt = (WorkerThread *)vthread;
+    WorkerPool *pool = wt->pool;
+
+    while (true) {
+        WaitForSingleObject(wt->start, INFINITE);
+        if (pool->shutting_down)
+            break;
+        pool->fn(pool->ctx, wt->index);
+        SetEvent(wt->done);
+    }
+
+    return 0;
+}
+
+WorkerPool *worker_pool_new(size_t nworkers, worker_fn_t fn, void *ctx)
+{
+    if (nworkers < 2)
+        return NULL;                   /* no point */
+
+    /* WaitForMultipleObjects can't wait for more than this many
+     * handles, so don't make more threads than that. */
+    size_t maxthreads = MAXIMUM_WAIT_OBJECTS;
+
+    WorkerPool *pool = snew(WorkerPool);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->nworkers = nworkers;
+    pool->nthreads = 0;
+    pool->threads = snewn(nworkers - 1, WorkerThread);
+    pool->done_events = snewn(nworkers - 1, HANDLE);
+    pool->shutting_down = false;
+
+    for (size_t i = 0; i < nworkers - 1 && i < maxthreads; i++) {
+        WorkerThread *wt = &pool->threads[i];
+        wt->pool = pool;
+        wt->index = i + 1;
+        wt->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+        wt->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+        wt->thread = NULL;
+        if (wt->start && wt->done)
+            wt->thread = CreateThread(NULL, 0, worker_thread_main,
+                                      wt, 0, NULL);
+        if (!wt->thread) {
+            if (wt->start)
+                CloseHandle(wt->start);
+            if (wt->done)
+                CloseHandle(wt->done);
+            break;
+        }
+        pool->done_events[i] = wt->done;
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads == 0) {
+        /* Couldn't start any threads at all, so we might as well
+         * tell the caller to fall back to doing the work itself. */
+        worker_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void worker_pool_run(WorkerPool *pool)
+{
+    for (size_t i = 0; i < pool->nthreads; i++)
+        SetEvent(pool->threads[i].start);
+
+    pool->fn(pool->ctx, 0);
+    for (size_t i = pool->nthreads + 1; i < pool->nworkers; i++)
+        pool->fn(pool->ctx, i);
+
+    WaitForMultipleObjects(pool->nthreads, pool->done_events,
+                           TRUE, INFINITE);
+}
+
+void worker_pool_free(WorkerPool *pool)
+{
+    pool->shutting_down = true;
+    for (size_t i = 0; i < pool->nthreads; i++) {
+        WorkerThread *wt = &pool->threads[i];
+        SetEvent(wt->start);
+        WaitForSingleObject(wt->thread, INFINITE);
+        CloseHandle(wt->thread);
+        CloseHandle(wt->start);
+        CloseHandle(wt->done);
+    }
+
+    sfree(pool->done_events);
+    sfree(pool->threads);
+    sfree(pool);
+}
+
+size_t worker_pool_ncpus(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 1 ? si.dwNumberOfProcessors : 1;
+}
+
+#else /* NO_THREADS */
+
+#include "nothread.c"
+
+#endif /* NO_THREADS */